@@ -1,4 +1,5 @@
 #include "ActivationFunctions/ActivationFunction.h"
+#include "ActivationFunctions/ActivationKernels.h"
 #include <cassert>
 #include <cmath>
 #include <stdexcept>
@@ -7,76 +8,148 @@ namespace neural_network {
 
 using Type = ActivationFunction::Type;
 
-ActivationFunction::ActivationFunction(Function f_apply, Function f_derivative)
-    : f_apply_(std::move(f_apply)), f_derivative_(std::move(f_derivative)) {}
+namespace {
 
-Vector ActivationFunction::apply(const Vector &x) const { return f_apply_(x); }
+// Calls f with the kernel matching an element-wise type. Identity and
+// Softmax have dedicated code paths and never reach here.
+template <typename F> void dispatch(Type type, F &&f) {
+  switch (type) {
+  case Type::ReLU:
+    f(ReLUKernel{});
+    break;
+  case Type::Sigmoid:
+    f(SigmoidKernel{});
+    break;
+  case Type::Tanh:
+    f(TanhKernel{});
+    break;
+  default:
+    assert(false && "Not an element-wise ActivationFunction::Type");
+  }
+}
+
+void softmaxColumns(Eigen::Ref<Matrix> x) {
+  for (Index j = 0; j < x.cols(); ++j) {
+    auto col = x.col(j);
+    col = (col.array() - col.maxCoeff()).exp().matrix();
+    col /= col.sum();
+  }
+}
+
+} // namespace
+
+ActivationFunction::ActivationFunction(Type type) : type_(type) {}
+
+Type ActivationFunction::type() const { return type_; }
+
+Vector ActivationFunction::apply(const Vector &x) const {
+  Vector y = x;
+  applyInPlace(y);
+  return y;
+}
 
 Vector ActivationFunction::derivative(const Vector &x) const {
-  return f_derivative_(x);
+  return derivativeBatch(x);
+}
+
+Matrix ActivationFunction::applyBatch(const Matrix &x) const {
+  Matrix y = x;
+  applyInPlace(y);
+  return y;
+}
+
+// The softmax derivative is folded into the cross-entropy gradient, so
+// like the identity it passes gradients through unchanged.
+Matrix ActivationFunction::derivativeBatch(const Matrix &x) const {
+  if (type_ == Type::Identity || type_ == Type::Softmax) {
+    return Matrix::Ones(x.rows(), x.cols());
+  }
+  Matrix d(x.rows(), x.cols());
+  dispatch(type_, [&](auto kernel) {
+    using Kernel = decltype(kernel);
+    d = Kernel::derivative(Kernel::apply(x.array())).matrix();
+  });
+  return d;
+}
+
+void ActivationFunction::applyInPlace(Eigen::Ref<Matrix> x) const {
+  if (type_ == Type::Identity) {
+    return;
+  }
+  if (type_ == Type::Softmax) {
+    softmaxColumns(x);
+    return;
+  }
+  dispatch(type_, [&](auto kernel) {
+    x = decltype(kernel)::apply(x.array()).matrix();
+  });
+}
+
+void ActivationFunction::biasApplyInPlace(Eigen::Ref<Matrix> z,
+                                          const ConstVectorRef &bias) const {
+  assert(z.rows() == bias.size());
+  if (type_ == Type::Identity || type_ == Type::Softmax) {
+    z.colwise() += bias;
+    if (type_ == Type::Softmax) {
+      softmaxColumns(z);
+    }
+    return;
+  }
+  dispatch(type_, [&](auto kernel) {
+    for (Index j = 0; j < z.cols(); ++j) {
+      z.col(j) =
+          decltype(kernel)::apply(z.col(j).array() + bias.array()).matrix();
+    }
+  });
+}
+
+void ActivationFunction::backward(const ConstMatrixRef &grad_output,
+                                  const ConstMatrixRef &output,
+                                  Eigen::Ref<Matrix> grad_z) const {
+  assert(grad_output.rows() == output.rows() &&
+         grad_output.cols() == output.cols());
+  assert(grad_z.rows() == output.rows() && grad_z.cols() == output.cols());
+  if (type_ == Type::Identity || type_ == Type::Softmax) {
+    if (grad_z.data() != grad_output.data()) {
+      grad_z = grad_output;
+    }
+    return;
+  }
+  dispatch(type_, [&](auto kernel) {
+    grad_z = (grad_output.array() *
+              decltype(kernel)::derivative(output.array()))
+                 .matrix();
+  });
 }
 
 ActivationFunction ActivationFunction::ReLU() {
-  return ActivationFunction(
-      [](const Vector &x) { return x.array().max(0.0).matrix(); },
-      [](const Vector &x) {
-        return (x.array() > 0.0).cast<double>().matrix();
-      });
+  return ActivationFunction(Type::ReLU);
 }
 
 ActivationFunction ActivationFunction::Sigmoid() {
-  return ActivationFunction(
-      [](const Vector &x) {
-        return (1.0 / (1.0 + (-x.array()).exp())).matrix();
-      },
-      [](const Vector &x) {
-        return x.unaryExpr([](double v) {
-          const double s = 1.0 / (1.0 + std::exp(-v));
-          return s * (1.0 - s);
-        });
-      });
+  return ActivationFunction(Type::Sigmoid);
 }
 
 ActivationFunction ActivationFunction::Identity() {
-  return ActivationFunction(
-      [](const Vector &x) { return x; },
-      [](const Vector &x) { return Vector::Ones(x.size()); });
+  return ActivationFunction(Type::Identity);
 }
 
 ActivationFunction ActivationFunction::Tanh() {
-  return ActivationFunction(
-      [](const Vector &x) { return x.array().tanh().matrix(); },
-      [](const Vector &x) {
-        return (1.0 - x.array().tanh().square()).matrix();
-      });
+  return ActivationFunction(Type::Tanh);
 }
 
 ActivationFunction ActivationFunction::Softmax() {
-  auto apply = [](const Vector &x) -> Vector {
-    Vector shifted = x.array() - x.maxCoeff();
-    Vector exps = shifted.array().exp();
-    return exps / exps.sum();
-  };
-
-  auto derivative = [](const Vector &x) -> Vector {
-    return Vector::Ones(x.size());
-  };
-
-  return ActivationFunction(apply, derivative);
+  return ActivationFunction(Type::Softmax);
 }
 
 ActivationFunction ActivationFunction::create(Type type) {
   switch (type) {
   case Type::ReLU:
-    return ReLU();
   case Type::Sigmoid:
-    return Sigmoid();
   case Type::Identity:
-    return Identity();
   case Type::Tanh:
-    return Tanh();
   case Type::Softmax:
-    return Softmax();
+    return ActivationFunction(type);
   default:
     assert(false && "Unknown ActivationFunction::Type");
     return ReLU();
@@ -1,21 +1,41 @@
 #pragma once
 #include "Utilities/Utils.h"
 #include <cassert>
-#include <functional>
 
 namespace neural_network {
 
+// Element-wise (and column-wise softmax) activations. The type selects a
+// statically dispatched kernel; the in-place variants write into caller
+// buffers and never allocate.
 class ActivationFunction {
 public:
   enum class Type { ReLU, Sigmoid, Identity, Tanh, Softmax };
+  // Number of Type values, for checking types read from files.
+  static constexpr unsigned kTypeCount = 5;
 
-  using Function = std::function<Vector(const Vector &)>;
+  explicit ActivationFunction(Type type);
 
-  ActivationFunction(Function f_apply, Function f_derivative);
+  Type type() const;
 
   Vector apply(const Vector &x) const;
   Vector derivative(const Vector &x) const;
 
+  // Batched variants: one sample per column.
+  Matrix applyBatch(const Matrix &x) const;
+  Matrix derivativeBatch(const Matrix &x) const;
+
+  // Overwrites x (one sample per column) with its activation.
+  void applyInPlace(Eigen::Ref<Matrix> x) const;
+
+  // Fused forward kernel: z = f(z + bias) in a single pass over z.
+  void biasApplyInPlace(Eigen::Ref<Matrix> z, const ConstVectorRef &bias) const;
+
+  // Fused backward kernel: grad_z = grad_output * f'(z), with the
+  // derivative computed from the cached activation output = f(z). grad_z
+  // may alias grad_output.
+  void backward(const ConstMatrixRef &grad_output, const ConstMatrixRef &output,
+                Eigen::Ref<Matrix> grad_z) const;
+
   static ActivationFunction ReLU();
   static ActivationFunction Sigmoid();
   static ActivationFunction Identity();
@@ -25,8 +45,7 @@ public:
   static ActivationFunction create(Type type);
 
 private:
-  Function f_apply_;
-  Function f_derivative_;
+  Type type_;
 };
 
 } // namespace neural_network
@@ -0,0 +1,36 @@
+#pragma once
+#include "Utilities/Utils.h"
+
+namespace neural_network {
+
+// Element-wise activation kernels on Eigen array expressions, so every pass
+// is vectorized. Shared by ActivationFunction, which picks one at run time,
+// and the compile-time pipelines in Inference/StaticModel.h.
+// derivative() takes the activation output a = f(z), not z itself.
+
+struct ReLUKernel {
+  template <typename A> static auto apply(const A &z) {
+    return z.max(Scalar(0));
+  }
+  template <typename A> static auto derivative(const A &a) {
+    return (a > Scalar(0)).template cast<Scalar>();
+  }
+};
+
+struct SigmoidKernel {
+  template <typename A> static auto apply(const A &z) {
+    return (Scalar(1) + (-z).exp()).inverse();
+  }
+  template <typename A> static auto derivative(const A &a) {
+    return a * (Scalar(1) - a);
+  }
+};
+
+struct TanhKernel {
+  template <typename A> static auto apply(const A &z) { return z.tanh(); }
+  template <typename A> static auto derivative(const A &a) {
+    return Scalar(1) - a.square();
+  }
+};
+
+} // namespace neural_network
@@ -0,0 +1,153 @@
+#include "Benchmarks/Benchmark.h"
+#include "Utilities/Utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <type_traits>
+
+namespace neural_network {
+namespace bench {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double timeIterations(const std::function<void()> &body, long long n) {
+  const auto start = Clock::now();
+  for (long long i = 0; i < n; ++i) {
+    body();
+  }
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Smallest iteration count whose run takes at least min_seconds, found by
+// extrapolating from the previous (too short) run.
+long long calibrate(const std::function<void()> &body, double min_seconds) {
+  long long n = 1;
+  for (;;) {
+    const double seconds = timeIterations(body, n);
+    if (seconds >= min_seconds) {
+      return n;
+    }
+    const double factor =
+        seconds > 0.0 ? std::min(1.4 * min_seconds / seconds, 10.0) : 10.0;
+    n = std::max(n + 1, static_cast<long long>(double(n) * factor));
+  }
+}
+
+std::string escape(const std::string &text) {
+  std::string out;
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+    }
+    out += c;
+  }
+  return out;
+}
+
+} // namespace
+
+void Runner::add(std::string name, std::function<void()> body,
+                 double items_per_iteration, Counters counters) {
+  cases_.push_back(Case{std::move(name), std::move(body), items_per_iteration,
+                        std::move(counters), nullptr});
+}
+
+void Runner::addWithSetup(std::string name, std::function<void()> body,
+                          double items_per_iteration,
+                          std::function<Counters()> setup) {
+  cases_.push_back(Case{std::move(name), std::move(body), items_per_iteration,
+                        {}, std::move(setup)});
+}
+
+std::vector<Result> Runner::run(const Options &options,
+                                std::ostream &log) const {
+  std::vector<Result> results;
+  for (const auto &c : cases_) {
+    if (c.name.find(options.filter) == std::string::npos) {
+      continue;
+    }
+    Counters counters = c.setup ? c.setup() : c.counters;
+    c.body(); // warm-up: first-touch allocations, caches
+    const long long n = calibrate(c.body, options.min_seconds);
+
+    std::vector<double> ns;
+    for (int r = 0; r < std::max(options.repetitions, 1); ++r) {
+      ns.push_back(timeIterations(c.body, n) * 1e9 / double(n));
+    }
+    std::sort(ns.begin(), ns.end());
+
+    Result result;
+    result.name = c.name;
+    result.iterations = n;
+    result.repetitions = int(ns.size());
+    result.ns_per_iteration = ns[ns.size() / 2];
+    result.min_ns_per_iteration = ns.front();
+    result.max_ns_per_iteration = ns.back();
+    if (c.items_per_iteration > 0.0) {
+      result.items_per_second =
+          c.items_per_iteration * 1e9 / result.ns_per_iteration;
+    }
+    result.counters = std::move(counters);
+    log << std::left << std::setw(48) << result.name << std::right
+        << std::setw(14) << std::fixed << std::setprecision(0)
+        << result.ns_per_iteration << " ns";
+    if (result.items_per_second > 0.0) {
+      log << std::setw(16) << result.items_per_second << " items/s";
+    }
+    log << std::endl;
+    results.push_back(std::move(result));
+  }
+  return results;
+}
+
+void writeJson(std::ostream &out, const std::vector<Result> &results) {
+  char date[32];
+  const std::time_t now = std::time(nullptr);
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+  out << std::setprecision(6) << std::defaultfloat;
+  out << "{\n  \"context\": {\n";
+  out << "    \"date\": \"" << date << "\",\n";
+  out << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n";
+#if defined(NDEBUG)
+  out << "    \"library_build_type\": \"release\",\n";
+#else
+  out << "    \"library_build_type\": \"debug\",\n";
+#endif
+  out << "    \"scalar\": \""
+      << (std::is_same_v<Scalar, double> ? "double" : "float") << "\",\n";
+  out << "    \"eigen_version\": \"" << EIGEN_WORLD_VERSION << "."
+      << EIGEN_MAJOR_VERSION << "." << EIGEN_MINOR_VERSION << "\",\n";
+  out << "    \"simd\": \"" << escape(Eigen::SimdInstructionSetsInUse())
+      << "\"\n  },\n";
+
+  out << "  \"benchmarks\": [";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const Result &r = results[i];
+    out << (i == 0 ? "\n" : ",\n") << "    {\n";
+    out << "      \"name\": \"" << escape(r.name) << "\",\n";
+    out << "      \"iterations\": " << r.iterations << ",\n";
+    out << "      \"repetitions\": " << r.repetitions << ",\n";
+    out << "      \"real_time\": " << r.ns_per_iteration << ",\n";
+    out << "      \"min_time\": " << r.min_ns_per_iteration << ",\n";
+    out << "      \"max_time\": " << r.max_ns_per_iteration << ",\n";
+    out << "      \"time_unit\": \"ns\"";
+    if (r.items_per_second > 0.0) {
+      out << ",\n      \"items_per_second\": " << r.items_per_second;
+    }
+    for (const auto &[name, value] : r.counters) {
+      out << ",\n      \"" << escape(name) << "\": " << value;
+    }
+    out << "\n    }";
+  }
+  out << "\n  ]\n}\n";
+}
+
+} // namespace bench
+} // namespace neural_network
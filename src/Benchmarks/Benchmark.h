@@ -0,0 +1,75 @@
+#pragma once
+
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace neural_network {
+namespace bench {
+
+// Timing of one benchmark case. Times are per iteration; the reported
+// value is the median over the repetitions.
+struct Result {
+  std::string name;
+  long long iterations = 0; // per repetition
+  int repetitions = 0;
+  double ns_per_iteration = 0.0;
+  double min_ns_per_iteration = 0.0;
+  double max_ns_per_iteration = 0.0;
+  // Items (samples, elements, bytes...) per second at the median time, or
+  // 0 if the case does not declare an item count.
+  double items_per_second = 0.0;
+  // Extra named values measured once for the case (accuracy, bytes...),
+  // written as fields of its JSON object like Google Benchmark's counters.
+  std::vector<std::pair<std::string, double>> counters;
+};
+
+// Minimal micro-benchmark harness. Every case is a callable that performs
+// one iteration on state it owns. The iteration count is grown until one
+// run lasts at least min_seconds, then that many iterations are timed
+// `repetitions` times.
+class Runner {
+public:
+  struct Options {
+    double min_seconds = 0.25;
+    int repetitions = 3;
+    // Only cases whose name contains this substring run.
+    std::string filter;
+  };
+
+  using Counters = std::vector<std::pair<std::string, double>>;
+
+  void add(std::string name, std::function<void()> body,
+           double items_per_iteration = 0.0, Counters counters = {});
+  // Same with counters that are expensive to measure (e.g. the accuracy of
+  // a model trained for the case): `setup` runs once, only if the case is
+  // selected, before it is timed, and returns the counters.
+  void addWithSetup(std::string name, std::function<void()> body,
+                    double items_per_iteration,
+                    std::function<Counters()> setup);
+
+  // Runs the selected cases in registration order, logging one line per
+  // case to `log`.
+  std::vector<Result> run(const Options &options, std::ostream &log) const;
+
+private:
+  struct Case {
+    std::string name;
+    std::function<void()> body;
+    double items_per_iteration;
+    Counters counters;
+    std::function<Counters()> setup;
+  };
+
+  std::vector<Case> cases_;
+};
+
+// Writes the results as JSON: a "context" object describing the build and
+// machine followed by a "benchmarks" array, one object per result (the
+// layout of Google Benchmark's JSON reporter).
+void writeJson(std::ostream &out, const std::vector<Result> &results);
+
+} // namespace bench
+} // namespace neural_network
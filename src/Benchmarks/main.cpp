@@ -0,0 +1,760 @@
+#include "Benchmarks/Benchmark.h"
+#include "Inference/InferenceModel.h"
+#include "Inference/QuantizedModel.h"
+#include "Inference/StaticModel.h"
+#include "Layers/DenseKernels.h"
+#include "Layers/Layer.h"
+#include "Loader/MNISTLoader.h"
+#include "Loader/StreamingLoader.h"
+#include "LossFunctions/LossFunction.h"
+#include "LossFunctions/SoftmaxCrossEntropy.h"
+#include "Model/Architectures.h"
+#include "Trainer/ParallelTrainer.h"
+#include "Utilities/FileReader.h"
+#include "Utilities/FileWriter.h"
+#include "Utilities/Random.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace neural_network;
+
+namespace {
+
+// Command line: neural_net_bench [--filter=SUBSTRING] [--min-time=SECONDS]
+//   [--repetitions=N] [--out=FILE.json] [--mnist-dir=DIR] [--model=FILE]
+// The JSON report goes to --out, or to stdout; progress goes to stderr.
+// Without --mnist-dir, loadMNIST is measured on generated IDX files of the
+// same shape as the MNIST training set. --model names a trained model file
+// for the inference cases, which otherwise use untrained architectures.
+struct Config {
+  bench::Runner::Options options;
+  std::string out;
+  std::filesystem::path mnist_dir;
+  std::filesystem::path model;
+};
+
+Config parseArguments(int argc, char **argv) {
+  Config config;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const auto eq = arg.find('=');
+    const std::string key = arg.substr(0, eq);
+    const std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+    if (key == "--filter") {
+      config.options.filter = value;
+    } else if (key == "--min-time") {
+      config.options.min_seconds = std::stod(value);
+    } else if (key == "--repetitions") {
+      config.options.repetitions = std::stoi(value);
+    } else if (key == "--out") {
+      config.out = value;
+    } else if (key == "--mnist-dir") {
+      config.mnist_dir = value;
+    } else if (key == "--model") {
+      config.model = value;
+    } else {
+      throw std::runtime_error("Unknown argument: " + arg);
+    }
+  }
+  return config;
+}
+
+const char *activationName(ActivationFunction::Type type) {
+  switch (type) {
+  case ActivationFunction::Type::ReLU:
+    return "relu";
+  case ActivationFunction::Type::Sigmoid:
+    return "sigmoid";
+  case ActivationFunction::Type::Identity:
+    return "identity";
+  case ActivationFunction::Type::Tanh:
+    return "tanh";
+  case ActivationFunction::Type::Softmax:
+    return "softmax";
+  }
+  return "unknown";
+}
+
+void writeUint32BE(std::ofstream &out, std::uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.put(char((value >> shift) & 0xFF));
+  }
+}
+
+// Random 28x28 images and labels in the IDX format, like the MNIST files.
+void writeSyntheticIdx(const std::filesystem::path &images,
+                       const std::filesystem::path &labels,
+                       std::uint32_t count) {
+  Random rng(1);
+  const Matrix pixels = rng.uniformMatrix(784, count, 0.0, 255.0);
+  std::ofstream img(images, std::ios::binary), lbl(labels, std::ios::binary);
+  for (std::uint32_t v : {2051u, count, 28u, 28u})
+    writeUint32BE(img, v);
+  for (Index i = 0; i < pixels.size(); ++i)
+    img.put(char(static_cast<std::uint8_t>(pixels.data()[i])));
+  for (std::uint32_t v : {2049u, count})
+    writeUint32BE(lbl, v);
+  for (std::uint32_t i = 0; i < count; ++i)
+    lbl.put(char(i % 10));
+}
+
+// Inputs in [0, 1] with about 19% nonzeros, the share of nonzero pixels in
+// MNIST, which send a layer down its sparse path.
+Matrix sparseInput(Random &rng, Index rows, Index cols) {
+  const Matrix keep = rng.uniformMatrix(rows, cols, 0.0, 1.0);
+  return (keep.array() < 0.19)
+      .select(rng.uniformMatrix(rows, cols, 0.0, 1.0), 0);
+}
+
+void addLayerBenchmarks(bench::Runner &runner) {
+  for (bool sparse : {false, true}) {
+    for (Index batch : {1, 64, 256}) {
+      struct State {
+        Layer layer{In(784), Out(128), ActivationFunction::ReLU()};
+        Layer::Scratch scratch;
+        Matrix input, grad;
+      };
+      auto state = std::make_shared<State>();
+      Random rng(2);
+      state->input = sparse ? sparseInput(rng, 784, batch)
+                            : rng.uniformMatrix(784, batch, 0.0, 1.0);
+      state->grad = rng.uniformMatrix(128, batch, -1.0, 1.0);
+      state->layer.setSparseInput(sparse);
+      state->layer.forwardBatch(state->input, state->scratch);
+
+      const std::string shape = std::string("784x128/relu/") +
+                                (sparse ? "sparse/" : "") +
+                                "batch:" + std::to_string(batch);
+      runner.add(
+          "layer_forward/" + shape,
+          [state] { state->layer.forwardBatch(state->input, state->scratch); },
+          double(batch));
+      runner.add(
+          "layer_backward/" + shape,
+          [state] { state->layer.backwardBatch(state->grad, state->scratch); },
+          double(batch));
+    }
+  }
+}
+
+// The three products of a 784x128 layer with every kernel the CPU runs and
+// with Eigen as the reference, and the two that take an MNIST-like sparse
+// input; items are the floating-point operations of the dense products.
+void addKernelBenchmarks(bench::Runner &runner) {
+  using kernels::Isa;
+  const Isa best = kernels::activeIsa();
+  for (Index batch : {1, 32, 256}) {
+    struct State {
+      Matrix w, x, sparse_x, dz, out, grad_input, grad_w;
+      kernels::CompressedMatrix compressed;
+    };
+    auto state = std::make_shared<State>();
+    Random rng(7);
+    state->w = rng.uniformMatrix(128, 784, -1.0, 1.0);
+    state->x = rng.uniformMatrix(784, batch, 0.0, 1.0);
+    state->sparse_x = sparseInput(rng, 784, batch);
+    state->compressed.assign(state->sparse_x);
+    state->dz = rng.uniformMatrix(128, batch, -1.0, 1.0);
+    state->out.resize(128, batch);
+    state->grad_input.resize(784, batch);
+    state->grad_w.resize(128, 784);
+
+    const double flops = 2.0 * 128 * 784 * double(batch);
+    const std::string shape = "/784x128/batch:" + std::to_string(batch);
+    runner.add(
+        "dense_kernel/eigen/forward" + shape,
+        [state] { state->out.noalias() = state->w * state->x; }, flops);
+    runner.add(
+        "dense_kernel/eigen/input_gradient" + shape,
+        [state] {
+          state->grad_input.noalias() = state->w.transpose() * state->dz;
+        },
+        flops);
+    runner.add(
+        "dense_kernel/eigen/weight_gradient" + shape,
+        [state] {
+          state->grad_w.noalias() = state->dz * state->x.transpose();
+        },
+        flops);
+    for (Isa isa : {Isa::Scalar, Isa::Avx2, Isa::Avx512}) {
+      if (!kernels::supported(isa))
+        continue;
+      const std::string prefix =
+          std::string("dense_kernel/") + kernels::isaName(isa);
+      // Each case switches to its kernel and back to the default.
+      runner.add(
+          prefix + "/forward" + shape,
+          [state, isa, best] {
+            kernels::setIsa(isa);
+            kernels::multiply(state->w, state->x, state->out);
+            kernels::setIsa(best);
+          },
+          flops);
+      runner.add(
+          prefix + "/input_gradient" + shape,
+          [state, isa, best] {
+            kernels::setIsa(isa);
+            kernels::multiplyTransposedA(state->w, state->dz,
+                                         state->grad_input);
+            kernels::setIsa(best);
+          },
+          flops);
+      runner.add(
+          prefix + "/weight_gradient" + shape,
+          [state, isa, best] {
+            kernels::setIsa(isa);
+            kernels::multiplyTransposedB(state->dz, state->x, state->grad_w);
+            kernels::setIsa(best);
+          },
+          flops);
+      runner.add(
+          prefix + "/sparse_forward" + shape,
+          [state, isa, best] {
+            kernels::setIsa(isa);
+            kernels::multiplySparse(state->w, state->compressed, state->out);
+            kernels::setIsa(best);
+          },
+          flops);
+      runner.add(
+          prefix + "/sparse_weight_gradient" + shape,
+          [state, isa, best] {
+            kernels::setIsa(isa);
+            kernels::multiplyTransposedBSparse(state->dz, state->compressed,
+                                               state->grad_w);
+            kernels::setIsa(best);
+          },
+          flops);
+    }
+  }
+}
+
+void addActivationBenchmarks(bench::Runner &runner) {
+  using Type = ActivationFunction::Type;
+  for (Type type : {Type::ReLU, Type::Sigmoid, Type::Identity, Type::Tanh,
+                    Type::Softmax}) {
+    struct State {
+      ActivationFunction activation;
+      Matrix z, output, grad, grad_z;
+      Vector bias;
+    };
+    Random rng(3);
+    auto state = std::make_shared<State>(State{
+        ActivationFunction::create(type),
+        rng.uniformMatrix(128, 256, -1.0, 1.0), Matrix(),
+        rng.uniformMatrix(128, 256, -1.0, 1.0), Matrix(128, 256),
+        rng.uniformMatrix(128, 1, -0.1, 0.1)});
+    state->output = state->z;
+    state->activation.biasApplyInPlace(state->output, state->bias);
+
+    const std::string suffix =
+        std::string(activationName(type)) + "/128x256";
+    runner.add(
+        "activation_forward/" + suffix,
+        [state] { state->activation.biasApplyInPlace(state->z, state->bias); },
+        128.0 * 256.0);
+    runner.add(
+        "activation_backward/" + suffix,
+        [state] {
+          state->activation.backward(state->grad, state->output,
+                                     state->grad_z);
+        },
+        128.0 * 256.0);
+  }
+}
+
+void addOptimizerBenchmarks(bench::Runner &runner) {
+  const std::pair<const char *, Optimizer> optimizers[] = {
+      {"sgd", Optimizer::SGD(0.01)},
+      {"momentum", Optimizer::Momentum(0.01)},
+      {"nesterov", Optimizer::Nesterov(0.01)},
+      {"rmsprop", Optimizer::RMSProp(0.001)},
+      {"adam", Optimizer::Adam(0.001)},
+      {"adamw", Optimizer::AdamW(0.001)},
+      {"lamb", Optimizer::LAMB(0.001)}};
+  for (const auto &[name, optimizer] : optimizers) {
+    struct State {
+      Optimizer optimizer;
+      Matrix weights, grad;
+      std::any cache;
+    };
+    Random rng(4);
+    auto state = std::make_shared<State>(
+        State{optimizer, rng.uniformMatrix(784, 128, -0.1, 0.1),
+              rng.uniformMatrix(784, 128, -1e-3, 1e-3),
+              optimizer.init_cache(784, 128)});
+    runner.add(
+        std::string("optimizer_update/") + name + "/784x128",
+        [state] {
+          state->optimizer.update(state->weights, state->cache, state->grad);
+        },
+        784.0 * 128.0);
+  }
+}
+
+void addLoaderBenchmarks(bench::Runner &runner,
+                         const std::filesystem::path &images,
+                         const std::filesystem::path &labels,
+                         double samples) {
+  runner.add(
+      "load_mnist",
+      [images, labels] {
+        Dataset dataset;
+        if (!loadMNIST(images.string(), labels.string(), dataset)) {
+          throw std::runtime_error("loadMNIST failed");
+        }
+      },
+      samples);
+}
+
+void addModelFileBenchmarks(bench::Runner &runner,
+                            const std::filesystem::path &dir) {
+  for (int choice : {1, 2, 3}) {
+    const auto path =
+        dir / ("neural_net_bench_model" + std::to_string(choice) + ".bin");
+    auto model = std::make_shared<Model>(makeArchitecture(choice));
+    {
+      FileWriter out(path);
+      out << *model;
+    }
+    const double bytes = double(std::filesystem::file_size(path));
+    runner.add(
+        "model_file_round_trip/arch:" + std::to_string(choice),
+        [model, path] {
+          {
+            FileWriter out(path);
+            out << *model;
+          }
+          FileReader in(path);
+          in >> *model;
+        },
+        bytes);
+  }
+}
+
+// Trainer thread counts to sweep: powers of two up to 16, plus the
+// machine's own count if it is not one of them.
+std::vector<std::size_t> threadCounts() {
+  std::vector<std::size_t> counts = {1, 2, 4, 8, 16};
+  const std::size_t cores = std::thread::hardware_concurrency();
+  if (cores > 0 && std::find(counts.begin(), counts.end(), cores) ==
+                       counts.end()) {
+    counts.push_back(cores);
+  }
+  return counts;
+}
+
+// One iteration is one optimizer step on the next mini-batch of a random
+// MNIST-shaped dataset, so items/s is training samples per second.
+void addTrainingBenchmarks(bench::Runner &runner) {
+  auto data = std::make_shared<const Dataset>([] {
+    Random rng(5);
+    std::vector<int> labels(8192);
+    for (std::size_t i = 0; i < labels.size(); ++i)
+      labels[i] = int(i % 10);
+    return Dataset(rng.uniformMatrix(784, 8192, 0.0, 1.0), std::move(labels));
+  }());
+  auto targets = std::make_shared<const Matrix>(data->oneHot(10));
+
+  struct State {
+    State(int choice, std::size_t threads)
+        : model(makeArchitecture(choice)),
+          optimizer(Optimizer::Adam(0.001)), trainer(model, threads) {
+      model.initOptimizerState(optimizer);
+    }
+    Model model;
+    Optimizer optimizer;
+    ParallelTrainer trainer;
+    Index next = 0;
+  };
+
+  for (int choice : {1, 2, 3}) {
+    for (Index batch : {32, 128, 512}) {
+      for (std::size_t threads : threadCounts()) {
+        const std::string name = "train_step/arch:" + std::to_string(choice) +
+                                 "/batch:" + std::to_string(batch) +
+                                 "/threads:" + std::to_string(threads);
+        // Built on first use so that filtered-out cases cost nothing.
+        std::shared_ptr<State> state;
+        runner.add(
+            name,
+            [=]() mutable {
+              if (!state) {
+                state = std::make_shared<State>(choice, threads);
+              }
+              if (state->next + batch > data->size()) {
+                state->next = 0;
+              }
+              const Index start = state->next;
+              state->next += batch;
+              if (isClassifier(choice)) {
+                state->trainer.trainBatch(
+                    data->batch(start, batch), data->labelBatch(start, batch),
+                    SoftmaxCrossEntropy::lossGradBatch, state->optimizer);
+              } else {
+                state->trainer.trainBatch(
+                    data->batch(start, batch),
+                    targets->middleCols(start, batch),
+                    LossFunction::mseGradBatch, state->optimizer);
+              }
+            },
+            double(batch));
+      }
+    }
+  }
+}
+
+// One iteration trains a new architecture 1 model for one epoch streamed
+// from the IDX files through a shuffle window far smaller than the file,
+// so items/s is training samples per second including the reads. The
+// counters come from an extra epoch run first: the seconds and share of it
+// the trainer spent waiting for a batch, and how many of its batches were
+// not ready.
+void addStreamingBenchmarks(bench::Runner &runner,
+                            const std::filesystem::path &images,
+                            const std::filesystem::path &labels,
+                            double samples) {
+  struct State {
+    explicit State(std::size_t threads)
+        : model(makeArchitecture(1)), optimizer(Optimizer::Adam(0.001)),
+          trainer(model, threads) {
+      model.initOptimizerState(optimizer);
+    }
+    Model model;
+    Optimizer optimizer;
+    ParallelTrainer trainer;
+  };
+  for (std::size_t threads : {std::size_t(1), std::size_t(4)}) {
+    // Every epoch starts from a fresh model: on these random labels the
+    // gradients soon become tiny and later epochs would time subnormal
+    // arithmetic instead of the stream.
+    const auto epoch = [=] {
+      State state(threads);
+      StreamingOptions options;
+      options.batch_size = 128;
+      options.shuffle_window = 4096;
+      StreamingLoader loader(images.string(), labels.string(), options);
+      while (const StreamingLoader::Batch *batch = loader.next()) {
+        state.trainer.trainBatch(
+            batch->view(),
+            Eigen::Map<const Labels>(batch->labels.data(), batch->size),
+            SoftmaxCrossEntropy::lossGradBatch, state.optimizer);
+      }
+      return loader.stats();
+    };
+    runner.addWithSetup(
+        "streaming_train_epoch/arch:1/batch:128/threads:" +
+            std::to_string(threads),
+        [epoch] { epoch(); }, samples,
+        [epoch] {
+          const auto start = std::chrono::steady_clock::now();
+          const StreamingLoader::Stats stats = epoch();
+          const double seconds = std::chrono::duration<double>(
+                                     std::chrono::steady_clock::now() - start)
+                                     .count();
+          return bench::Runner::Counters{
+              {"stall_seconds", stats.stall_seconds},
+              {"stall_share", stats.stall_seconds / seconds},
+              {"stalled_batches", double(stats.stalls)},
+              {"batches", double(stats.batches)}};
+        });
+  }
+}
+
+// Fraction of `data` classified correctly, and the predicted classes.
+template <typename Inference>
+double accuracy(const Inference &model, const Dataset &data,
+                std::vector<Index> &predictions) {
+  const Index batch = 256;
+  auto workspace = model.makeWorkspace(batch);
+  predictions.resize(std::size_t(data.size()));
+  Index correct = 0;
+  for (Index start = 0; start < data.size(); start += batch) {
+    const Index count = std::min(batch, data.size() - start);
+    const ConstMatrixRef out =
+        model.predict(data.batch(start, count), workspace);
+    for (Index j = 0; j < count; ++j) {
+      out.col(j).maxCoeff(&predictions[std::size_t(start + j)]);
+      correct += predictions[std::size_t(start + j)] == data.label(start + j);
+    }
+  }
+  return double(correct) / double(data.size());
+}
+
+// Float and int8 inference on the same model at a serving (1) and a bulk
+// (256) batch size; items are samples. The int8 model is calibrated on the
+// first 1000 samples of `calibration`. Every case reports its accuracy on
+// `test` and its parameter bytes; the int8 cases add the accuracy change
+// against float and the share of samples where both predict the same
+// class.
+void addQuantizationBenchmarks(bench::Runner &runner, const std::string &name,
+                               const InferenceModel &model,
+                               const Dataset &calibration,
+                               const Dataset &test) {
+  auto float_model = std::make_shared<const InferenceModel>(model);
+  auto int8_model =
+      std::make_shared<const QuantizedModel>(QuantizedModel::quantize(
+          model, calibration.batch(0, std::min<Index>(calibration.size(),
+                                                      1000))));
+  std::vector<Index> float_predictions, int8_predictions;
+  const double float_accuracy = accuracy(*float_model, test, float_predictions);
+  const double int8_accuracy = accuracy(*int8_model, test, int8_predictions);
+  Index agree = 0;
+  for (std::size_t i = 0; i < float_predictions.size(); ++i)
+    agree += float_predictions[i] == int8_predictions[i];
+
+  auto data = std::make_shared<const Dataset>(test);
+  for (Index batch : {1, 256}) {
+    const std::string suffix = name + "/batch:" + std::to_string(batch);
+    auto float_workspace = std::make_shared<InferenceModel::Workspace>(
+        float_model->makeWorkspace(batch));
+    auto int8_workspace = std::make_shared<QuantizedModel::Workspace>(
+        int8_model->makeWorkspace(batch));
+    // Cycles through the test set so that the inputs are not all cached.
+    auto next = std::make_shared<Index>(0);
+    const auto input = [data, next, batch] {
+      if (*next + batch > data->size())
+        *next = 0;
+      const Index start = *next;
+      *next += batch;
+      return data->batch(start, batch);
+    };
+    runner.add(
+        "inference_predict/float/" + suffix,
+        [float_model, float_workspace, input] {
+          float_model->predict(input(), *float_workspace);
+        },
+        double(batch),
+        {{"accuracy", float_accuracy},
+         {"parameter_bytes", double(float_model->parameterBytes())}});
+    runner.add(
+        "inference_predict/int8/" + suffix,
+        [int8_model, int8_workspace, input] {
+          int8_model->predict(input(), *int8_workspace);
+        },
+        double(batch),
+        {{"accuracy", int8_accuracy},
+         {"accuracy_delta", int8_accuracy - float_accuracy},
+         {"agreement", double(agree) / double(test.size())},
+         {"parameter_bytes", double(int8_model->parameterBytes())}});
+  }
+}
+
+// Single-sample latency of one architecture through Model::forward, the
+// runtime-shaped InferenceModel and the compile-time StaticModel; items are
+// samples.
+template <typename Static>
+void addStaticModelBenchmarks(bench::Runner &runner, int choice,
+                              const Dataset &test) {
+  auto model = std::make_shared<Model>(makeArchitecture(choice));
+  auto frozen = std::make_shared<const InferenceModel>(model->freeze());
+  auto workspace =
+      std::make_shared<InferenceModel::Workspace>(frozen->makeWorkspace(1));
+  auto fixed = std::make_shared<const Static>(*model);
+
+  auto data = std::make_shared<const Dataset>(test);
+  auto next = std::make_shared<Index>(0);
+  const auto input = [data, next] {
+    *next = (*next + 1) % data->size();
+    return data->batch(*next, 1);
+  };
+  // The outputs are stored so the inlined static pipeline is not elided.
+  auto out = std::make_shared<Vector>();
+  auto fixed_out = std::make_shared<typename Static::Output>();
+  const std::string suffix = "/arch:" + std::to_string(choice);
+  runner.add("single_inference/model_forward" + suffix,
+             [model, out, input] { *out = model->forward(input()); });
+  runner.add("single_inference/inference_model" + suffix,
+             [frozen, workspace, out, input] {
+               *out = frozen->predict(input(), *workspace);
+             });
+  runner.add("single_inference/static_model" + suffix,
+             [fixed, fixed_out, input] {
+               *fixed_out = fixed->predict(input());
+             });
+}
+
+// The MLPs of the training driver against a LeNet-style convolutional
+// network (with and without batch normalization), all trained the same way:
+// a few epochs of Adam on the softmax cross-entropy of `train`. Every case
+// reports the network's accuracy on `test` and its parameter count and
+// bytes, and times inference (Model::forwardBatch without training) at a
+// serving (1) and a bulk (256) batch size; items are samples. A network is
+// trained on first use, so filtered-out cases cost nothing.
+void addArchitectureComparison(bench::Runner &runner, const Dataset &train,
+                               const Dataset &test) {
+  static constexpr int kEpochs = 3;
+  static constexpr Index kTrainBatch = 64;
+  struct Network {
+    Model model;
+    bool trained = false;
+    double accuracy = 0.0;
+  };
+  auto train_data = std::make_shared<const Dataset>(train);
+  auto test_data = std::make_shared<const Dataset>(test);
+
+  const auto trainOnce = [train_data, test_data](Network &network) {
+    if (!network.trained) {
+      Model &model = network.model;
+      Optimizer optimizer = Optimizer::Adam(0.001);
+      model.initOptimizerState(optimizer);
+      ParallelTrainer trainer(model, 4);
+      for (int epoch = 0; epoch < kEpochs; ++epoch) {
+        for (Index start = 0; start < train_data->size();
+             start += kTrainBatch) {
+          const Index count = std::min(kTrainBatch, train_data->size() - start);
+          trainer.trainBatch(train_data->batch(start, count),
+                             train_data->labelBatch(start, count),
+                             SoftmaxCrossEntropy::lossGradBatch, optimizer);
+        }
+      }
+      auto scratch = model.makeScratch(256);
+      Index correct = 0;
+      for (Index start = 0; start < test_data->size(); start += 256) {
+        const Index count = std::min<Index>(256, test_data->size() - start);
+        const ConstMatrixRef out =
+            model.forwardBatch(test_data->batch(start, count), scratch, false);
+        for (Index j = 0; j < count; ++j) {
+          Index predicted;
+          out.col(j).maxCoeff(&predicted);
+          correct += predicted == test_data->label(start + j);
+        }
+      }
+      network.accuracy = double(correct) / double(test_data->size());
+      network.trained = true;
+    }
+    const double parameters = double(network.model.parameters().size());
+    return bench::Runner::Counters{
+        {"accuracy", network.accuracy},
+        {"parameters", parameters},
+        {"parameter_bytes", parameters * sizeof(Scalar)}};
+  };
+
+  const std::vector<std::pair<std::string, std::function<Model()>>> networks{
+      {"arch:1", [] { return makeArchitecture(1); }},
+      {"arch:2", [] { return makeArchitecture(2); }},
+      {"arch:3", [] { return makeArchitecture(3); }},
+      {"lenet", [] { return makeLeNet(false); }},
+      {"lenet_bn", [] { return makeLeNet(true); }}};
+  for (const auto &[name, make] : networks) {
+    auto network = std::make_shared<Network>(Network{make()});
+    for (Index batch : {1, 256}) {
+      auto scratch = std::make_shared<Model::Scratch>();
+      // Cycles through the test set so that the inputs are not all cached.
+      auto next = std::make_shared<Index>(0);
+      runner.addWithSetup(
+          "architecture/" + name + "/batch:" + std::to_string(batch),
+          [network, scratch, next, test_data, batch] {
+            if (scratch->layers.empty())
+              *scratch = network->model.makeScratch(batch);
+            if (*next + batch > test_data->size())
+              *next = 0;
+            const Index start = *next;
+            *next += batch;
+            network->model.forwardBatch(test_data->batch(start, batch),
+                                        *scratch, false);
+          },
+          double(batch), [network, trainOnce] { return trainOnce(*network); });
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  try {
+    const Config config = parseArguments(argc, argv);
+    const auto tmp = std::filesystem::temp_directory_path();
+
+    std::filesystem::path images, labels;
+    double samples = 60000;
+    bool synthetic = config.mnist_dir.empty();
+    // Calibration and evaluation sets of the inference cases.
+    Dataset train, test;
+    if (synthetic) {
+      images = tmp / "neural_net_bench_images.idx3";
+      labels = tmp / "neural_net_bench_labels.idx1";
+      writeSyntheticIdx(images, labels, 60000);
+      Random rng(6);
+      std::vector<int> test_labels(2000);
+      for (std::size_t i = 0; i < test_labels.size(); ++i)
+        test_labels[i] = int(i % 10);
+      test = Dataset(rng.uniformMatrix(784, 2000, 0.0, 1.0),
+                     std::move(test_labels));
+      train = test;
+    } else {
+      images = config.mnist_dir / "train-images.idx3-ubyte";
+      labels = config.mnist_dir / "train-labels.idx1-ubyte";
+      if (!loadMNIST(images.string(), labels.string(), train)) {
+        throw std::runtime_error("Could not load MNIST from " +
+                                 config.mnist_dir.string());
+      }
+      samples = double(train.size());
+      if (!loadMNIST((config.mnist_dir / "t10k-images.idx3-ubyte").string(),
+                     (config.mnist_dir / "t10k-labels.idx1-ubyte").string(),
+                     test)) {
+        test = train;
+      }
+    }
+
+    bench::Runner runner;
+    addLayerBenchmarks(runner);
+    addKernelBenchmarks(runner);
+    addActivationBenchmarks(runner);
+    addOptimizerBenchmarks(runner);
+    addLoaderBenchmarks(runner, images, labels, samples);
+    addModelFileBenchmarks(runner, tmp);
+    addTrainingBenchmarks(runner);
+    addStreamingBenchmarks(runner, images, labels, samples);
+    addStaticModelBenchmarks<static_architectures::Architecture1>(runner, 1,
+                                                                  test);
+    addStaticModelBenchmarks<static_architectures::Architecture2>(runner, 2,
+                                                                  test);
+    addStaticModelBenchmarks<static_architectures::Architecture3>(runner, 3,
+                                                                  test);
+    addArchitectureComparison(runner, train, test);
+    if (config.model.empty()) {
+      for (int choice : {1, 2, 3}) {
+        addQuantizationBenchmarks(runner, "arch:" + std::to_string(choice),
+                                  makeArchitecture(choice).freeze(), train,
+                                  test);
+      }
+    } else {
+      addQuantizationBenchmarks(runner, "model",
+                                InferenceModel::load(config.model), train,
+                                test);
+    }
+
+    const auto results = runner.run(config.options, std::cerr);
+
+    if (synthetic) {
+      std::filesystem::remove(images);
+      std::filesystem::remove(labels);
+    }
+    for (int choice : {1, 2, 3}) {
+      std::filesystem::remove(tmp / ("neural_net_bench_model" +
+                                     std::to_string(choice) + ".bin"));
+    }
+
+    if (config.out.empty()) {
+      bench::writeJson(std::cout, results);
+    } else {
+      std::ofstream out(config.out);
+      bench::writeJson(out, results);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "neural_net_bench: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,182 @@
+#include "Inference/InferenceModel.h"
+#include "Layers/DenseKernels.h"
+#include "Model/Model.h"
+#include "Utilities/MappedFile.h"
+#include "Utilities/ModelFormat.h"
+
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+namespace neural_network {
+
+namespace {
+
+// Owned copy of the tensors of a Model.
+struct OwnedTensors {
+  std::vector<Matrix> weights;
+  std::vector<Vector> biases;
+};
+
+} // namespace
+
+Index InferenceModel::Workspace::capacity() const { return capacity_; }
+
+InferenceModel::ConstMatrixMap InferenceModel::DenseLayer::weightsMap() const {
+  return ConstMatrixMap(weights, rows, cols);
+}
+
+InferenceModel::ConstVectorMap InferenceModel::DenseLayer::biasesMap() const {
+  return ConstVectorMap(biases, rows);
+}
+
+InferenceModel::InferenceModel(const Model &model) {
+  auto tensors = std::make_shared<OwnedTensors>();
+  for (const auto &layer : model.layers()) {
+    if (layer.kind() != AnyLayer::Kind::Dense) {
+      throw std::runtime_error("Inference models hold dense layers only.");
+    }
+    tensors->weights.push_back(layer.weights());
+    tensors->biases.push_back(layer.biases());
+  }
+  for (size_t i = 0; i < model.layers().size(); ++i) {
+    const auto &weights = tensors->weights[i];
+    layers_.push_back(DenseLayer{
+        weights.data(), tensors->biases[i].data(), weights.rows(),
+        weights.cols(),
+        ActivationFunction::create(model.layers()[i].activationType())});
+  }
+  storage_ = std::move(tensors);
+}
+
+InferenceModel InferenceModel::load(const std::filesystem::path &file) {
+  namespace format = model_format;
+
+  auto mapped = std::make_shared<MappedFile>(file);
+  if (mapped->size() < sizeof(format::Header)) {
+    throw std::runtime_error("Not a model file.");
+  }
+  format::Header header;
+  std::memcpy(&header, mapped->data(), sizeof(header));
+  format::checkHeader(header, mapped->size());
+  const auto stored = static_cast<format::ScalarType>(header.scalar_type);
+
+  InferenceModel model;
+  auto tensors = std::make_shared<OwnedTensors>();
+  tensors->weights.reserve(header.layer_count);
+  tensors->biases.reserve(header.layer_count);
+  for (std::uint64_t i = 0; i < header.layer_count; ++i) {
+    const std::uint64_t record_size = format::recordSize(header.version);
+    format::LayerRecord record{};
+    std::memcpy(&record,
+                mapped->data() + sizeof(format::Header) + i * record_size,
+                record_size);
+    format::checkLayerRecord(header, record);
+    if (record.kind != std::uint32_t(AnyLayer::Kind::Dense)) {
+      throw std::runtime_error("Inference models hold dense layers only.");
+    }
+
+    // Each layer must consume the previous one's output, or predict()
+    // would multiply mismatched shapes.
+    const Index rows = Index(record.rows), cols = Index(record.cols);
+    if (rows == 0 || cols == 0 ||
+        (i > 0 && cols != model.layers_.back().rows)) {
+      throw std::runtime_error("Corrupt layer record in model file.");
+    }
+    const std::byte *weights = mapped->data() + record.weights_offset;
+    const std::byte *biases = mapped->data() + record.biases_offset;
+    auto activation = ActivationFunction::create(
+        static_cast<ActivationFunction::Type>(record.activation));
+
+    if (stored == format::scalarTypeOf<Scalar>()) {
+      model.layers_.push_back(
+          DenseLayer{reinterpret_cast<const Scalar *>(weights),
+                     reinterpret_cast<const Scalar *>(biases), rows, cols,
+                     std::move(activation)});
+      continue;
+    }
+
+    // Written with the other precision: convert into owned tensors.
+    using Other =
+        std::conditional_t<std::is_same_v<Scalar, float>, double, float>;
+    using OtherMatrix = Eigen::Matrix<Other, Eigen::Dynamic, Eigen::Dynamic>;
+    using OtherVector = Eigen::Matrix<Other, Eigen::Dynamic, 1>;
+    tensors->weights.push_back(
+        Eigen::Map<const OtherMatrix>(
+            reinterpret_cast<const Other *>(weights), rows, cols)
+            .cast<Scalar>());
+    tensors->biases.push_back(
+        Eigen::Map<const OtherVector>(reinterpret_cast<const Other *>(biases),
+                                      rows)
+            .cast<Scalar>());
+    model.layers_.push_back(DenseLayer{tensors->weights.back().data(),
+                                       tensors->biases.back().data(), rows,
+                                       cols, std::move(activation)});
+  }
+
+  if (tensors->weights.empty()) {
+    model.storage_ = std::move(mapped);
+  } else {
+    model.storage_ = std::move(tensors);
+  }
+  return model;
+}
+
+InferenceModel::Workspace
+InferenceModel::makeWorkspace(Index max_batch_size) const {
+  assert(max_batch_size > 0);
+  Workspace workspace;
+  workspace.capacity_ = max_batch_size;
+  workspace.activations_.reserve(layers_.size());
+  for (const auto &layer : layers_) {
+    workspace.activations_.emplace_back(layer.rows, max_batch_size);
+  }
+  return workspace;
+}
+
+ConstMatrixRef
+InferenceModel::predict(const ConstMatrixRef &input,
+                        Workspace &workspace) const {
+  if (layers_.empty()) {
+    throw std::runtime_error("Model has no layers.");
+  }
+  if (input.cols() > workspace.capacity_ ||
+      workspace.activations_.size() != layers_.size()) {
+    throw std::runtime_error("Batch does not fit the inference workspace.");
+  }
+  if (input.rows() != inputSize()) {
+    throw std::runtime_error("Input size does not match the model.");
+  }
+
+  const Index batch = input.cols();
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    const auto &layer = layers_[i];
+    auto out = workspace.activations_[i].leftCols(batch);
+    if (i == 0) {
+      kernels::multiply(layer.weightsMap(), input, out);
+    } else {
+      kernels::multiply(layer.weightsMap(),
+                        workspace.activations_[i - 1].leftCols(batch), out);
+    }
+    layer.activation.biasApplyInPlace(out, layer.biasesMap());
+  }
+  return workspace.activations_.back().leftCols(batch);
+}
+
+Index InferenceModel::inputSize() const {
+  return layers_.empty() ? 0 : layers_.front().cols;
+}
+
+Index InferenceModel::outputSize() const {
+  return layers_.empty() ? 0 : layers_.back().rows;
+}
+
+std::size_t InferenceModel::parameterBytes() const {
+  std::size_t bytes = 0;
+  for (const auto &layer : layers_) {
+    bytes += sizeof(Scalar) * std::size_t(layer.rows * (layer.cols + 1));
+  }
+  return bytes;
+}
+
+} // namespace neural_network
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "ActivationFunctions/ActivationFunction.h"
+#include "Utilities/Utils.h"
+
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+namespace neural_network {
+
+class Model;
+
+// Read-only dense network for serving. Unlike Model::forward, predict()
+// never touches the model: all per-call state lives in a Workspace owned by
+// the caller, so any number of threads can share one InferenceModel
+// without locks as long as each uses its own Workspace. A Workspace is
+// sized once for a maximum batch and predict() does no heap allocation.
+//
+// The weights are immutable and shared between copies. load() memory-maps
+// a FileWriter model file and uses the tensors in place, without parsing or
+// copying them.
+class InferenceModel {
+public:
+  // Activation buffers of one caller, one Matrix (outputs x max batch) per
+  // layer. Create with makeWorkspace() and reuse across calls.
+  class Workspace {
+  public:
+    Index capacity() const;
+
+  private:
+    friend class InferenceModel;
+    friend class QuantizedModel;
+    std::vector<Matrix> activations_;
+    Index capacity_ = 0;
+  };
+
+  InferenceModel() = default;
+  // Both throw std::runtime_error if the model has layers other than dense
+  // ones.
+  explicit InferenceModel(const Model &model);
+
+  static InferenceModel load(const std::filesystem::path &file);
+
+  Workspace makeWorkspace(Index max_batch_size) const;
+
+  // Runs a batch (one sample per column). The returned view points into the
+  // workspace and stays valid until the workspace is used again.
+  ConstMatrixRef predict(const ConstMatrixRef &input,
+                         Workspace &workspace) const;
+
+  Index inputSize() const;
+  Index outputSize() const;
+  // Bytes of weights and biases.
+  std::size_t parameterBytes() const;
+
+private:
+  // Calibrates on the layer outputs and quantizes the tensors.
+  friend class QuantizedModel;
+
+  using ConstMatrixMap = Eigen::Map<const Matrix>;
+  using ConstVectorMap = Eigen::Map<const Vector>;
+
+  // Views into storage_, which is either owned tensors or a mapped file.
+  struct DenseLayer {
+    const Scalar *weights;
+    const Scalar *biases;
+    Index rows;
+    Index cols;
+    ActivationFunction activation;
+
+    ConstMatrixMap weightsMap() const;
+    ConstVectorMap biasesMap() const;
+  };
+
+  std::shared_ptr<const void> storage_;
+  std::vector<DenseLayer> layers_;
+};
+
+} // namespace neural_network
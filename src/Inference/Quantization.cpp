@@ -0,0 +1,121 @@
+#include "Inference/Quantization.h"
+#include "Inference/InferenceModel.h"
+#include "Inference/QuantizedModel.h"
+#include "Trainer/TrainingRun.h"
+#include "Utilities/Settings.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace neural_network {
+
+namespace {
+
+// Accuracy in percent over `data` and the mean seconds per sample when it
+// is fed in batches of `batch`.
+template <typename Inference>
+std::pair<double, double> evaluate(const Inference &model, const Dataset &data,
+                                   Index batch) {
+  auto workspace = model.makeWorkspace(batch);
+  Index correct = 0;
+  const auto start_time = std::chrono::steady_clock::now();
+  for (Index start = 0; start < data.size(); start += batch) {
+    const Index count = std::min(batch, data.size() - start);
+    const ConstMatrixRef out =
+        model.predict(data.batch(start, count), workspace);
+    for (Index j = 0; j < count; ++j) {
+      Index predicted;
+      out.col(j).maxCoeff(&predicted);
+      correct += predicted == data.label(start + j);
+    }
+  }
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start_time)
+                             .count();
+  return {100.0 * double(correct) / double(data.size()),
+          seconds / double(data.size())};
+}
+
+// One row of the comparison table; returns the accuracy.
+template <typename Inference>
+double report(const char *name, const Inference &model, const Dataset &data,
+              std::ostream &log) {
+  const auto [accuracy, single] = evaluate(model, data, 1);
+  const double bulk = evaluate(model, data, 256).second;
+  log << std::left << std::setw(6) << name << std::right << std::fixed
+      << std::setprecision(2) << std::setw(9) << accuracy << "%"
+      << std::setw(11) << double(model.parameterBytes()) / 1024.0 << " KiB"
+      << std::setw(13) << single * 1e6 << std::setw(13) << bulk * 1e6
+      << "\n"
+      << std::defaultfloat;
+  return accuracy;
+}
+
+} // namespace
+
+void QuantizationJob::set(const std::string &key, const std::string &value) {
+  if (key == "quantize") {
+    model = value;
+  } else if (key == "out") {
+    out = value;
+  } else if (key == "calibration_samples") {
+    calibration_samples = Index(parseInteger(key, value, 1));
+  } else if (key == "train_images") {
+    train_images = value;
+  } else if (key == "train_labels") {
+    train_labels = value;
+  } else if (key == "test_images") {
+    test_images = value;
+  } else if (key == "test_labels") {
+    test_labels = value;
+  } else {
+    throw std::runtime_error("Unknown option: " + key);
+  }
+}
+
+QuantizationJob QuantizationJob::fromArguments(int argc,
+                                               const char *const *argv) {
+  QuantizationJob job;
+  for (auto [key, value] : parseFlags(argc, argv)) {
+    std::replace(key.begin(), key.end(), '-', '_');
+    job.set(key, value);
+  }
+  if (job.model.empty()) {
+    throw std::runtime_error("--quantize needs a model file");
+  }
+  if (job.out.empty()) {
+    job.out = job.model;
+    job.out.replace_extension(".q8");
+  }
+  return job;
+}
+
+void runQuantization(const QuantizationJob &job, std::ostream &log) {
+  const InferenceModel model = InferenceModel::load(job.model);
+  const Dataset train = loadDataset(job.train_images, job.train_labels);
+  const Dataset test = loadDataset(job.test_images, job.test_labels);
+
+  const Index samples = std::min(job.calibration_samples, train.size());
+  const QuantizedModel quantized =
+      QuantizedModel::quantize(model, train.batch(0, samples));
+  quantized.save(job.out);
+  log << "Quantized " << job.model.string() << " to int8 on " << samples
+      << " calibration samples: " << job.out.string() << " ("
+      << QuantizedModel::kernelName() << " kernel)\n";
+
+  // Latency is microseconds per sample at batch sizes 1 and 256.
+  log << "model  accuracy     parameters   us/sample@1 us/sample@256\n";
+  const double float_accuracy = report("float", model, test, log);
+  const double int8_accuracy = report("int8", quantized, test, log);
+  log << "Accuracy change: " << std::showpos << std::fixed
+      << std::setprecision(2) << int8_accuracy - float_accuracy
+      << std::noshowpos << " points\n"
+      << std::defaultfloat;
+}
+
+} // namespace neural_network
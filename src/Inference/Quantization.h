@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Utilities/Utils.h"
+
+#include <filesystem>
+#include <iosfwd>
+#include <string>
+
+namespace neural_network {
+
+// Settings of `neural_net --quantize=MODEL`, which turns a model file
+// written by FileWriter into a QuantizedModel file.
+struct QuantizationJob {
+  std::filesystem::path model;
+  // Defaults to the model path with the extension .q8.
+  std::filesystem::path out;
+  // Leading training samples used to calibrate the activation scales.
+  Index calibration_samples = 1000;
+  std::filesystem::path train_images = "../data/train-images.idx3-ubyte";
+  std::filesystem::path train_labels = "../data/train-labels.idx1-ubyte";
+  std::filesystem::path test_images = "../data/t10k-images.idx3-ubyte";
+  std::filesystem::path test_labels = "../data/t10k-labels.idx1-ubyte";
+
+  // Keys: quantize (the model), out, calibration_samples and the four data
+  // paths. Throws std::runtime_error on unknown keys or bad values.
+  void set(const std::string &key, const std::string &value);
+  static QuantizationJob fromArguments(int argc, const char *const *argv);
+};
+
+// Calibrates, writes the quantized model and reports the test accuracy,
+// parameter bytes and per-sample latency at batch sizes 1 and 256 of the
+// float and the int8 model.
+void runQuantization(const QuantizationJob &job, std::ostream &log);
+
+} // namespace neural_network
@@ -0,0 +1,502 @@
+#include "Inference/QuantizedModel.h"
+#include "Inference/InferenceModel.h"
+#include "Utilities/CpuFeatures.h"
+#include "Utilities/FileWriter.h"
+#include "Utilities/MappedFile.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#if defined(NEURAL_NETWORK_X86_KERNELS)
+#include <immintrin.h>
+#endif
+
+namespace neural_network {
+
+namespace {
+
+// Quantized file layout (version 1, native little-endian):
+//
+//   Header                        24 bytes
+//   LayerRecord[layer_count]      56 bytes each
+//   padding to kAlignment
+//   per layer: int8 weights (rows x stride, row-major), padding,
+//              float32 weight scales (rows), padding,
+//              float32 biases (rows), padding
+namespace format {
+
+constexpr char kMagic[8] = {'N', 'N', 'Q', 'U', 'A', 'N', 'T', '\0'};
+constexpr std::uint32_t kVersion = 1;
+constexpr std::uint64_t kAlignment = 64;
+
+struct Header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t layer_count;
+  std::uint64_t file_size;
+};
+
+struct LayerRecord {
+  std::uint64_t rows;
+  std::uint64_t cols;
+  std::uint64_t stride;
+  std::uint32_t activation;
+  float input_scale;
+  std::uint64_t weights_offset;
+  std::uint64_t scales_offset;
+  std::uint64_t biases_offset;
+};
+
+static_assert(sizeof(Header) == 24 && std::is_trivially_copyable_v<Header>);
+static_assert(sizeof(LayerRecord) == 56 &&
+              std::is_trivially_copyable_v<LayerRecord>);
+
+std::uint64_t alignUp(std::uint64_t offset) {
+  return (offset + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+// Whether `count` items of `size` bytes at `offset` lie inside a file of
+// `file_size` bytes, without overflowing on corrupt values.
+bool fits(std::uint64_t offset, std::uint64_t count, std::uint64_t size,
+          std::uint64_t file_size) {
+  return offset % kAlignment == 0 && offset <= file_size &&
+         (count == 0 || size <= (file_size - offset) / count);
+}
+
+} // namespace format
+
+// Rows are padded to a whole number of SIMD loads; the padding is zero.
+constexpr Index kColumnAlignment = 32;
+
+Index paddedColumns(Index cols) {
+  return (cols + kColumnAlignment - 1) / kColumnAlignment * kColumnAlignment;
+}
+
+// Symmetric int8 range; -128 is left out so that negation is exact.
+constexpr Scalar kQuantMax = 127;
+
+// Scales and biases are float32 in the file and rounded to float from the
+// start, so a saved model predicts exactly like the one in memory.
+Scalar scaleFor(Scalar max_abs) {
+  return Scalar(float(max_abs > Scalar(0) ? max_abs / kQuantMax : 1));
+}
+
+#if defined(NEURAL_NETWORK_X86_KERNELS) && !defined(NEURAL_NET_USE_DOUBLE)
+// Rounds and narrows 16 floats at a time (Eigen converts element by
+// element); returns how many of the `n` values were quantized.
+Index quantizeBlocks(const float *in, Index n, float inverse,
+                     std::int8_t *q) {
+  const __m128 factor = _mm_set1_ps(inverse);
+  const __m128 high = _mm_set1_ps(kQuantMax);
+  const __m128 low = _mm_set1_ps(-kQuantMax);
+  const auto convert = [&](const float *p) {
+    const __m128 v = _mm_mul_ps(_mm_loadu_ps(p), factor);
+    return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v, low), high));
+  };
+  Index i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i lo = _mm_packs_epi32(convert(in + i), convert(in + i + 4));
+    const __m128i hi =
+        _mm_packs_epi32(convert(in + i + 8), convert(in + i + 12));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(q + i),
+                     _mm_packs_epi16(lo, hi));
+  }
+  return i;
+}
+#else
+Index quantizeBlocks(const Scalar *, Index, Scalar, std::int8_t *) {
+  return 0;
+}
+#endif
+
+// Quantizes the columns of `values` with multiplier 1 / scale into a
+// column-major int8 buffer with `stride` bytes per column, rounding to
+// nearest.
+void quantizeColumns(const ConstMatrixRef &values, Scalar scale,
+                     std::int8_t *out, Index stride) {
+  const Scalar inverse = Scalar(1) / scale;
+  const Index rows = values.rows();
+  for (Index j = 0; j < values.cols(); ++j) {
+    const Scalar *in = values.col(j).data();
+    std::int8_t *q = out + j * stride;
+    for (Index i = quantizeBlocks(in, rows, inverse, q); i < rows; ++i) {
+      q[i] = static_cast<std::int8_t>(
+          std::lrint(std::clamp(in[i] * inverse, -kQuantMax, kQuantMax)));
+    }
+  }
+}
+
+// Dot products of R consecutive weight rows with one input column, both
+// `n` int8 values long (a multiple of kColumnAlignment), into sums[0..R).
+// The SIMD versions widen the input to int16 once per load and share it
+// between the R rows; pairs of products are summed into int32 lanes with
+// madd, which cannot overflow for int8 operands.
+using DotKernel = void (*)(const std::int8_t *w, Index stride,
+                           const std::int8_t *x, Index n, std::int32_t *sums);
+
+template <int R>
+void dotRowsScalar(const std::int8_t *w, Index stride, const std::int8_t *x,
+                   Index n, std::int32_t *sums) {
+  for (int r = 0; r < R; ++r) {
+    std::int32_t sum = 0;
+    for (Index k = 0; k < n; ++k)
+      sum += std::int32_t(w[r * stride + k]) * std::int32_t(x[k]);
+    sums[r] = sum;
+  }
+}
+
+#if defined(NEURAL_NETWORK_X86_KERNELS)
+inline std::int32_t horizontalSum(__m128i s) {
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(s);
+}
+
+// Baseline x86-64. SSE2 has no sign-extending load: each byte is
+// duplicated into both halves of a 16-bit lane and shifted down.
+template <int R>
+void dotRowsSse2(const std::int8_t *w, Index stride, const std::int8_t *x,
+                 Index n, std::int32_t *sums) {
+  const auto widen = [](const std::int8_t *p, __m128i &lo, __m128i &hi) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    lo = _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+    hi = _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+  };
+  __m128i acc[R];
+  for (int r = 0; r < R; ++r)
+    acc[r] = _mm_setzero_si128();
+  for (Index k = 0; k < n; k += 16) {
+    __m128i x_lo, x_hi;
+    widen(x + k, x_lo, x_hi);
+    for (int r = 0; r < R; ++r) {
+      __m128i w_lo, w_hi;
+      widen(w + r * stride + k, w_lo, w_hi);
+      acc[r] = _mm_add_epi32(acc[r], _mm_add_epi32(_mm_madd_epi16(w_lo, x_lo),
+                                                   _mm_madd_epi16(w_hi, x_hi)));
+    }
+  }
+  for (int r = 0; r < R; ++r)
+    sums[r] = horizontalSum(acc[r]);
+}
+
+template <int R>
+__attribute__((target("avx2"))) void
+dotRowsAvx2(const std::int8_t *w, Index stride, const std::int8_t *x,
+            Index n, std::int32_t *sums) {
+  __m256i acc[R];
+  for (int r = 0; r < R; ++r)
+    acc[r] = _mm256_setzero_si256();
+  for (Index k = 0; k < n; k += 16) {
+    const __m256i xv = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + k)));
+    for (int r = 0; r < R; ++r) {
+      const __m256i wv = _mm256_cvtepi8_epi16(_mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(w + r * stride + k)));
+      acc[r] = _mm256_add_epi32(acc[r], _mm256_madd_epi16(wv, xv));
+    }
+  }
+  for (int r = 0; r < R; ++r) {
+    sums[r] = horizontalSum(_mm_add_epi32(
+        _mm256_castsi256_si128(acc[r]), _mm256_extracti128_si256(acc[r], 1)));
+  }
+}
+#endif
+
+// out(r, j) = scales[r] * sum_k w(r, k) * x(k, j) for a rows x batch
+// column-major output. Blocks of four rows stay in L1 while the batch
+// streams past them; a batch of one is the GEMV case.
+template <DotKernel Dot4, DotKernel Dot1>
+void int8Gemm(const std::int8_t *w, Index rows, Index stride,
+              const std::int8_t *x, Index batch, const Scalar *scales,
+              Scalar *out) {
+  std::int32_t sums[4];
+  Index r = 0;
+  for (; r + 4 <= rows; r += 4) {
+    const std::int8_t *block = w + r * stride;
+    for (Index j = 0; j < batch; ++j) {
+      Dot4(block, stride, x + j * stride, stride, sums);
+      for (int i = 0; i < 4; ++i)
+        out[j * rows + r + i] = Scalar(sums[i]) * scales[r + i];
+    }
+  }
+  for (; r < rows; ++r) {
+    for (Index j = 0; j < batch; ++j) {
+      Dot1(w + r * stride, stride, x + j * stride, stride, sums);
+      out[j * rows + r] = Scalar(sums[0]) * scales[r];
+    }
+  }
+}
+
+struct GemmKernel {
+  const char *name;
+  void (*gemm)(const std::int8_t *, Index, Index, const std::int8_t *, Index,
+               const Scalar *, Scalar *);
+};
+
+// The widest kernel this CPU runs, chosen on first use.
+const GemmKernel &gemmKernel() {
+  static const GemmKernel kernel = [] {
+#if defined(NEURAL_NETWORK_X86_KERNELS)
+    if (cpuFeatures().avx2) {
+      return GemmKernel{"avx2",
+                        int8Gemm<dotRowsAvx2<4>, dotRowsAvx2<1>>};
+    }
+    return GemmKernel{"sse2", int8Gemm<dotRowsSse2<4>, dotRowsSse2<1>>};
+#else
+    return GemmKernel{"scalar",
+                      int8Gemm<dotRowsScalar<4>, dotRowsScalar<1>>};
+#endif
+  }();
+  return kernel;
+}
+
+// Quantized weights of models built by quantize().
+struct OwnedWeights {
+  std::vector<std::vector<std::int8_t>> layers;
+};
+
+} // namespace
+
+Index QuantizedModel::Workspace::capacity() const { return capacity_; }
+
+const char *QuantizedModel::kernelName() { return gemmKernel().name; }
+
+QuantizedModel QuantizedModel::quantize(const InferenceModel &model,
+                                        const ConstMatrixRef &calibration) {
+  if (model.layers_.empty()) {
+    throw std::runtime_error("Model has no layers.");
+  }
+  if (calibration.cols() == 0 || calibration.rows() != model.inputSize()) {
+    throw std::runtime_error("Calibration data does not fit the model.");
+  }
+
+  // Largest magnitude seen at the input of every layer.
+  std::vector<Scalar> max_abs(model.layers_.size(), Scalar(0));
+  const Index chunk = 256;
+  InferenceModel::Workspace workspace = model.makeWorkspace(chunk);
+  for (Index start = 0; start < calibration.cols(); start += chunk) {
+    const Index count = std::min(chunk, calibration.cols() - start);
+    const auto batch = calibration.middleCols(start, count);
+    model.predict(batch, workspace);
+    max_abs[0] = std::max(max_abs[0], batch.cwiseAbs().maxCoeff());
+    for (size_t i = 1; i < model.layers_.size(); ++i) {
+      max_abs[i] = std::max(
+          max_abs[i],
+          workspace.activations_[i - 1].leftCols(count).cwiseAbs().maxCoeff());
+    }
+  }
+
+  QuantizedModel quantized;
+  auto weights = std::make_shared<OwnedWeights>();
+  for (size_t i = 0; i < model.layers_.size(); ++i) {
+    const auto &dense = model.layers_[i];
+    const auto w = dense.weightsMap();
+    const Index stride = paddedColumns(dense.cols);
+    auto &q = weights->layers.emplace_back(dense.rows * stride, 0);
+
+    QuantizedLayer layer{q.data(),
+                         dense.rows,
+                         dense.cols,
+                         stride,
+                         scaleFor(max_abs[i]),
+                         Vector(dense.rows),
+                         Vector(dense.rows),
+                         dense.biasesMap().cast<float>().cast<Scalar>(),
+                         dense.activation};
+    for (Index r = 0; r < dense.rows; ++r) {
+      const Scalar scale = scaleFor(w.row(r).cwiseAbs().maxCoeff());
+      layer.weight_scales[r] = scale;
+      for (Index c = 0; c < dense.cols; ++c) {
+        q[r * stride + c] = static_cast<std::int8_t>(
+            std::clamp(std::round(w(r, c) / scale), -kQuantMax, kQuantMax));
+      }
+    }
+    layer.output_scales = layer.weight_scales * layer.input_scale;
+    quantized.layers_.push_back(std::move(layer));
+  }
+  quantized.storage_ = std::move(weights);
+  return quantized;
+}
+
+void QuantizedModel::save(const std::filesystem::path &file) const {
+  std::vector<format::LayerRecord> records;
+  std::uint64_t offset = format::alignUp(
+      sizeof(format::Header) + sizeof(format::LayerRecord) * layers_.size());
+  for (const auto &layer : layers_) {
+    format::LayerRecord record{};
+    record.rows = layer.rows;
+    record.cols = layer.cols;
+    record.stride = layer.stride;
+    record.activation = static_cast<std::uint32_t>(layer.activation.type());
+    record.input_scale = float(layer.input_scale);
+    record.weights_offset = offset;
+    offset = format::alignUp(offset + layer.rows * layer.stride);
+    record.scales_offset = offset;
+    offset = format::alignUp(offset + sizeof(float) * layer.rows);
+    record.biases_offset = offset;
+    offset = format::alignUp(offset + sizeof(float) * layer.rows);
+    records.push_back(record);
+  }
+
+  format::Header header{};
+  std::memcpy(header.magic, format::kMagic, sizeof(format::kMagic));
+  header.version = format::kVersion;
+  header.layer_count = std::uint32_t(records.size());
+  header.file_size = offset;
+
+  FileWriter out(file);
+  out << header;
+  for (const auto &record : records) {
+    out << record;
+  }
+  for (const auto &layer : layers_) {
+    const Eigen::VectorXf scales = layer.weight_scales.cast<float>();
+    const Eigen::VectorXf biases = layer.biases.cast<float>();
+    out.pad(format::kAlignment);
+    out.write(layer.weights, layer.rows * layer.stride);
+    out.pad(format::kAlignment);
+    out.write(scales.data(), sizeof(float) * layer.rows);
+    out.pad(format::kAlignment);
+    out.write(biases.data(), sizeof(float) * layer.rows);
+  }
+  out.pad(format::kAlignment);
+  out.close();
+}
+
+QuantizedModel QuantizedModel::load(const std::filesystem::path &file) {
+  auto mapped = std::make_shared<MappedFile>(file);
+  format::Header header;
+  if (mapped->size() < sizeof(header)) {
+    throw std::runtime_error("Not a quantized model file.");
+  }
+  std::memcpy(&header, mapped->data(), sizeof(header));
+  if (std::memcmp(header.magic, format::kMagic, sizeof(format::kMagic)) != 0) {
+    throw std::runtime_error("Not a quantized model file.");
+  }
+  if (header.version != format::kVersion) {
+    throw std::runtime_error("Unsupported quantized model file version.");
+  }
+  if (header.file_size > mapped->size()) {
+    throw std::runtime_error("Truncated quantized model file.");
+  }
+  if (header.file_size < sizeof(header) ||
+      header.layer_count > (header.file_size - sizeof(header)) /
+                               sizeof(format::LayerRecord)) {
+    throw std::runtime_error("Corrupt quantized model file.");
+  }
+
+  QuantizedModel model;
+  for (std::uint64_t i = 0; i < header.layer_count; ++i) {
+    format::LayerRecord record;
+    std::memcpy(&record,
+                mapped->data() + sizeof(header) +
+                    i * sizeof(format::LayerRecord),
+                sizeof(record));
+    // Each layer must consume the previous one's output: predict()
+    // quantizes that many rows into a buffer sized for this layer.
+    const std::uint64_t inputs =
+        i == 0 ? record.cols : std::uint64_t(model.layers_.back().rows);
+    if (record.rows == 0 || record.cols == 0 || record.cols != inputs ||
+        record.stride < record.cols ||
+        record.stride % kColumnAlignment != 0 ||
+        record.activation >= ActivationFunction::kTypeCount ||
+        !format::fits(record.weights_offset, record.rows, record.stride,
+                      header.file_size) ||
+        !format::fits(record.scales_offset, record.rows, sizeof(float),
+                      header.file_size) ||
+        !format::fits(record.biases_offset, record.rows, sizeof(float),
+                      header.file_size)) {
+      throw std::runtime_error("Corrupt layer record in quantized model.");
+    }
+    const Index rows = Index(record.rows);
+    const auto floats = [&](std::uint64_t offset) {
+      Eigen::VectorXf values(rows);
+      std::memcpy(values.data(), mapped->data() + offset,
+                  sizeof(float) * rows);
+      return Vector(values.cast<Scalar>());
+    };
+    QuantizedLayer layer{
+        reinterpret_cast<const std::int8_t *>(mapped->data() +
+                                              record.weights_offset),
+        rows,
+        Index(record.cols),
+        Index(record.stride),
+        Scalar(record.input_scale),
+        Vector(),
+        floats(record.scales_offset),
+        floats(record.biases_offset),
+        ActivationFunction::create(
+            static_cast<ActivationFunction::Type>(record.activation))};
+    layer.output_scales = layer.weight_scales * layer.input_scale;
+    model.layers_.push_back(std::move(layer));
+  }
+  model.storage_ = std::move(mapped);
+  return model;
+}
+
+QuantizedModel::Workspace
+QuantizedModel::makeWorkspace(Index max_batch_size) const {
+  assert(max_batch_size > 0);
+  Workspace workspace;
+  workspace.capacity_ = max_batch_size;
+  for (const auto &layer : layers_) {
+    workspace.inputs_.emplace_back(layer.stride * max_batch_size, 0);
+    workspace.outputs_.emplace_back(layer.rows, max_batch_size);
+  }
+  return workspace;
+}
+
+ConstMatrixRef QuantizedModel::predict(const ConstMatrixRef &input,
+                                       Workspace &workspace) const {
+  if (layers_.empty()) {
+    throw std::runtime_error("Model has no layers.");
+  }
+  if (input.cols() > workspace.capacity_ ||
+      workspace.outputs_.size() != layers_.size()) {
+    throw std::runtime_error("Batch does not fit the inference workspace.");
+  }
+  if (input.rows() != inputSize()) {
+    throw std::runtime_error("Input size does not match the model.");
+  }
+
+  const auto kernel = gemmKernel().gemm;
+  const Index batch = input.cols();
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    const auto &layer = layers_[i];
+    std::int8_t *x = workspace.inputs_[i].data();
+    if (i == 0) {
+      quantizeColumns(input, layer.input_scale, x, layer.stride);
+    } else {
+      quantizeColumns(workspace.outputs_[i - 1].leftCols(batch),
+                      layer.input_scale, x, layer.stride);
+    }
+    auto out = workspace.outputs_[i].leftCols(batch);
+    kernel(layer.weights, layer.rows, layer.stride, x, batch,
+           layer.output_scales.data(), out.data());
+    layer.activation.biasApplyInPlace(out, layer.biases);
+  }
+  return workspace.outputs_.back().leftCols(batch);
+}
+
+Index QuantizedModel::inputSize() const {
+  return layers_.empty() ? 0 : layers_.front().cols;
+}
+
+Index QuantizedModel::outputSize() const {
+  return layers_.empty() ? 0 : layers_.back().rows;
+}
+
+std::size_t QuantizedModel::parameterBytes() const {
+  std::size_t bytes = 0;
+  for (const auto &layer : layers_) {
+    bytes += std::size_t(layer.rows * layer.stride) +
+             2 * sizeof(float) * std::size_t(layer.rows);
+  }
+  return bytes;
+}
+
+} // namespace neural_network
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "ActivationFunctions/ActivationFunction.h"
+#include "Utilities/Utils.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+namespace neural_network {
+
+class InferenceModel;
+
+// Post-training int8 version of an InferenceModel for serving. Weights are
+// stored as int8 with one symmetric scale per output channel (row); the
+// input of every layer is quantized to int8 with a per-layer scale
+// calibrated on sample data. Each layer multiplies int8 by int8 into int32
+// accumulators, rescales them to floating point, adds the bias and applies
+// the activation there, so only the matrix products run in integers. The
+// product kernel is picked at run time from the CPU's instruction sets.
+//
+// Like InferenceModel, predict() is const and keeps all per-call state in
+// a caller-owned Workspace, and load() uses a mapped file's weights in
+// place. Files use their own format (see QuantizedModel.cpp), not the
+// FileWriter model format.
+class QuantizedModel {
+public:
+  class Workspace {
+  public:
+    Index capacity() const;
+
+  private:
+    friend class QuantizedModel;
+    // Quantized layer inputs (padded columns x max batch) and float
+    // outputs (rows x max batch), one of each per layer.
+    std::vector<std::vector<std::int8_t>> inputs_;
+    std::vector<Matrix> outputs_;
+    Index capacity_ = 0;
+  };
+
+  QuantizedModel() = default;
+
+  // Calibrates the activation scales on `calibration` (one sample per
+  // column, e.g. a few hundred training images) and quantizes the weights.
+  static QuantizedModel quantize(const InferenceModel &model,
+                                 const ConstMatrixRef &calibration);
+
+  void save(const std::filesystem::path &file) const;
+  static QuantizedModel load(const std::filesystem::path &file);
+
+  Workspace makeWorkspace(Index max_batch_size) const;
+
+  // Runs a batch (one sample per column). The returned view points into the
+  // workspace and stays valid until the workspace is used again.
+  ConstMatrixRef predict(const ConstMatrixRef &input,
+                         Workspace &workspace) const;
+
+  Index inputSize() const;
+  Index outputSize() const;
+  // Bytes of weights, scales and biases.
+  std::size_t parameterBytes() const;
+  // The int8 kernel selected for this CPU: "avx2", "sse2" or "scalar".
+  static const char *kernelName();
+
+private:
+  struct QuantizedLayer {
+    // Row-major, rows x stride; columns past `cols` are zero.
+    const std::int8_t *weights;
+    Index rows;
+    Index cols;
+    Index stride;
+    // Multiplier from the layer's int8 input to real values.
+    Scalar input_scale;
+    // Per row: weight scale times input_scale, the multiplier from the
+    // int32 accumulator to the real product.
+    Vector output_scales;
+    Vector weight_scales;
+    Vector biases;
+    ActivationFunction activation;
+  };
+
+  std::shared_ptr<const void> storage_;
+  std::vector<QuantizedLayer> layers_;
+};
+
+} // namespace neural_network
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "ActivationFunctions/ActivationFunction.h"
+#include "ActivationFunctions/ActivationKernels.h"
+#include "Model/Model.h"
+#include "Utilities/Utils.h"
+
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+namespace neural_network {
+
+// Compile-time description of one dense layer.
+template <int In, int Out, ActivationFunction::Type Act> struct Dense {
+  static_assert(In > 0 && Out > 0);
+  static constexpr int inputs = In;
+  static constexpr int outputs = Out;
+  static constexpr ActivationFunction::Type activation = Act;
+};
+
+// Single-sample inference pipeline for an architecture fixed at build time,
+// e.g. StaticModel<Dense<784, 128, ReLU>, Dense<128, 10, Identity>>. Every
+// shape is a template argument: weights are fixed-size Eigen matrices, the
+// layers are chained by template recursion, the activation is chosen at
+// compile time and applied in the GEMV epilogue while the outputs are still
+// in registers, and intermediates live on the stack. There is no virtual
+// call, std::function or heap allocation per prediction.
+//
+// The weights are copied from a trained Model of the same shape and are
+// immutable and shared between copies, so threads may share one instance.
+template <typename... Layers> class StaticModel {
+  static_assert(sizeof...(Layers) > 0);
+
+  using Specs = std::tuple<Layers...>;
+  template <std::size_t I> using Spec = std::tuple_element_t<I, Specs>;
+  static constexpr std::size_t kLayers = sizeof...(Layers);
+
+public:
+  static constexpr int inputs = Spec<0>::inputs;
+  static constexpr int outputs = Spec<kLayers - 1>::outputs;
+  using Input = Eigen::Matrix<Scalar, inputs, 1>;
+  using Output = Eigen::Matrix<Scalar, outputs, 1>;
+
+  // Throws std::runtime_error if the model's shape or activations differ
+  // from the template arguments.
+  explicit StaticModel(const Model &model) {
+    if (model.layers().size() != kLayers) {
+      throw std::runtime_error("Model does not match the static layer spec.");
+    }
+    auto tensors = std::make_shared<Tensors>();
+    load(model, *tensors, std::make_index_sequence<kLayers>());
+    layers_ = std::move(tensors);
+  }
+
+  // Throws std::runtime_error if a dynamic-size input is not an `inputs`
+  // column; fixed sizes are checked at compile time.
+  template <typename Derived>
+  Output predict(const Eigen::MatrixBase<Derived> &input) const {
+    static_assert(Derived::RowsAtCompileTime == inputs ||
+                  Derived::RowsAtCompileTime == Eigen::Dynamic);
+    static_assert(Derived::ColsAtCompileTime == 1 ||
+                  Derived::ColsAtCompileTime == Eigen::Dynamic);
+    if constexpr (Derived::RowsAtCompileTime == Eigen::Dynamic ||
+                  Derived::ColsAtCompileTime == Eigen::Dynamic) {
+      if (input.rows() != inputs || input.cols() != 1) {
+        throw std::runtime_error("Input size does not match the model.");
+      }
+    }
+    const Input x = input;
+    return forward<0>(x);
+  }
+
+private:
+  // Rows computed per pass of the GEMV: a block of accumulators small
+  // enough to stay in registers across the whole input.
+  static constexpr int rowBlock(int rows) {
+    return rows % 32 == 0 ? 32 : rows % 16 == 0 ? 16 : rows % 8 == 0 ? 8 : rows;
+  }
+
+  // The weights are packed in panels of rowBlock() rows: panel p holds rows
+  // [p * B, p * B + B) of every column in turn, so each pass of the GEMV
+  // streams through contiguous memory.
+  template <typename S> struct Tensor {
+    static constexpr int kBlock = rowBlock(S::outputs);
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    Eigen::Matrix<Scalar, kBlock, S::outputs / kBlock * S::inputs> panels;
+    Eigen::Matrix<Scalar, S::outputs, 1> biases;
+  };
+  using Tensors = std::tuple<Tensor<Layers>...>;
+
+  template <std::size_t... I>
+  static void load(const Model &model, Tensors &tensors,
+                   std::index_sequence<I...>) {
+    (loadLayer<I>(model.layers()[I], std::get<I>(tensors)), ...);
+  }
+
+  template <std::size_t I>
+  static void loadLayer(const AnyLayer &layer, Tensor<Spec<I>> &tensor) {
+    using S = Spec<I>;
+    if (layer.kind() != AnyLayer::Kind::Dense ||
+        layer.weights().rows() != S::outputs ||
+        layer.weights().cols() != S::inputs ||
+        layer.activationType() != S::activation) {
+      throw std::runtime_error("Model does not match the static layer spec.");
+    }
+    constexpr int kBlock = Tensor<S>::kBlock;
+    const auto weights = layer.weights();
+    for (int p = 0; p < S::outputs / kBlock; ++p) {
+      tensor.panels.template middleCols<S::inputs>(p * S::inputs) =
+          weights.template middleRows<kBlock>(p * kBlock);
+    }
+    tensor.biases = layer.biases();
+  }
+
+  template <std::size_t I>
+  Output forward(const Eigen::Matrix<Scalar, Spec<I>::inputs, 1> &x) const {
+    using S = Spec<I>;
+    constexpr int kBlock = Tensor<S>::kBlock;
+    using Block = Eigen::Matrix<Scalar, kBlock, 1>;
+    const auto &tensor = std::get<I>(*layers_);
+
+    Eigen::Matrix<Scalar, S::outputs, 1> y;
+    for (int p = 0; p < S::outputs / kBlock; ++p) {
+      // y[rows] = f(W[rows] x + b[rows]) for the panel's rows, one column
+      // of W at a time.
+      const Scalar *panel = tensor.panels.data() + p * kBlock * S::inputs;
+      Block acc = tensor.biases.template segment<kBlock>(p * kBlock);
+      for (int k = 0; k < S::inputs; ++k) {
+        acc.noalias() += Eigen::Map<const Block>(panel + k * kBlock) * x[k];
+      }
+      y.template segment<kBlock>(p * kBlock) = activate<S::activation>(acc);
+    }
+    if constexpr (S::activation == ActivationFunction::Type::Softmax) {
+      y = (y.array() - y.maxCoeff()).exp().matrix();
+      y /= y.sum();
+    }
+
+    if constexpr (I + 1 == kLayers) {
+      return y;
+    } else {
+      static_assert(Spec<I + 1>::inputs == S::outputs,
+                    "Consecutive layers must have matching sizes");
+      return forward<I + 1>(y);
+    }
+  }
+
+  // Softmax needs the whole layer output and is applied after the blocks.
+  template <ActivationFunction::Type Act, typename V>
+  static V activate(const V &z) {
+    using Type = ActivationFunction::Type;
+    if constexpr (Act == Type::ReLU) {
+      return ReLUKernel::apply(z.array()).matrix();
+    } else if constexpr (Act == Type::Sigmoid) {
+      return SigmoidKernel::apply(z.array()).matrix();
+    } else if constexpr (Act == Type::Tanh) {
+      return TanhKernel::apply(z.array()).matrix();
+    } else {
+      return z;
+    }
+  }
+
+  std::shared_ptr<const Tensors> layers_;
+};
+
+// The training driver's architectures (see Model/Architectures.h).
+namespace static_architectures {
+
+using Type = ActivationFunction::Type;
+using Architecture1 =
+    StaticModel<Dense<784, 128, Type::ReLU>, Dense<128, 10, Type::Identity>>;
+using Architecture2 =
+    StaticModel<Dense<784, 128, Type::ReLU>, Dense<128, 64, Type::Sigmoid>,
+                Dense<64, 10, Type::Identity>>;
+using Architecture3 =
+    StaticModel<Dense<784, 128, Type::ReLU>, Dense<128, 64, Type::ReLU>,
+                Dense<64, 32, Type::ReLU>, Dense<32, 10, Type::Identity>>;
+
+} // namespace static_architectures
+
+} // namespace neural_network
@@ -0,0 +1,181 @@
+#include "Layers/AnyLayer.h"
+
+#include <type_traits>
+
+namespace neural_network {
+
+namespace {
+
+// Whether layers of type L have weights and biases.
+template <typename L>
+constexpr bool kLearns = std::is_same_v<L, Layer> ||
+                         std::is_same_v<L, BatchNorm> ||
+                         std::is_same_v<L, Conv2D>;
+
+// Whether layers of type L run differently while training.
+template <typename L>
+constexpr bool kTrains = std::is_same_v<L, Dropout> ||
+                         std::is_same_v<L, BatchNorm> ||
+                         std::is_same_v<L, Conv2D>;
+
+template <typename T> using Plain = std::remove_cvref_t<T>;
+
+} // namespace
+
+AnyLayer::AnyLayer(Layer layer) : layer_(std::move(layer)) {}
+
+AnyLayer::AnyLayer(Dropout layer) : layer_(std::move(layer)) {}
+
+AnyLayer::AnyLayer(BatchNorm layer) : layer_(std::move(layer)) {}
+
+AnyLayer::AnyLayer(Conv2D layer) : layer_(std::move(layer)) {}
+
+AnyLayer::AnyLayer(MaxPool layer) : layer_(std::move(layer)) {}
+
+AnyLayer::Kind AnyLayer::kind() const {
+  return static_cast<Kind>(layer_.index());
+}
+
+Index AnyLayer::inputSize() const {
+  return std::visit([](const auto &layer) { return layer.inputSize(); },
+                    layer_);
+}
+
+Index AnyLayer::outputSize() const {
+  return std::visit([](const auto &layer) { return layer.outputSize(); },
+                    layer_);
+}
+
+Index AnyLayer::parameterCount() const {
+  return std::visit(
+      [](const auto &layer) -> Index {
+        if constexpr (kLearns<Plain<decltype(layer)>>) {
+          return layer.parameterCount();
+        }
+        return 0;
+      },
+      layer_);
+}
+
+Eigen::Map<const Matrix> AnyLayer::weights() const {
+  return std::visit(
+      [](const auto &layer) {
+        if constexpr (kLearns<Plain<decltype(layer)>>) {
+          return layer.weights();
+        }
+        return Eigen::Map<const Matrix>(nullptr, 0, 0);
+      },
+      layer_);
+}
+
+Eigen::Map<const Vector> AnyLayer::biases() const {
+  return std::visit(
+      [](const auto &layer) {
+        if constexpr (kLearns<Plain<decltype(layer)>>) {
+          return layer.biases();
+        }
+        return Eigen::Map<const Vector>(nullptr, 0);
+      },
+      layer_);
+}
+
+ActivationFunction::Type AnyLayer::activationType() const {
+  if (const auto *dense = get<Layer>()) {
+    return dense->activationType();
+  }
+  if (const auto *conv = get<Conv2D>()) {
+    return conv->activationType();
+  }
+  return ActivationFunction::Type::Identity;
+}
+
+Index AnyLayer::statisticsCount() const {
+  const auto *norm = get<BatchNorm>();
+  return norm ? 2 * norm->channels() : 0;
+}
+
+AnyLayer::Scratch AnyLayer::makeScratch(std::uint64_t stream) const {
+  return std::visit(
+      [stream](const auto &layer) -> Scratch {
+        typename Plain<decltype(layer)>::Scratch scratch;
+        if constexpr (std::is_same_v<Plain<decltype(layer)>, Dropout>) {
+          scratch.stream = stream;
+        }
+        return scratch;
+      },
+      layer_);
+}
+
+void AnyLayer::reserve(Scratch &scratch, Index batch_size) const {
+  std::visit(
+      [&](const auto &layer) {
+        using L = Plain<decltype(layer)>;
+        layer.reserve(std::get<typename L::Scratch>(scratch), batch_size);
+      },
+      layer_);
+}
+
+ConstMatrixRef AnyLayer::forwardBatch(const ConstMatrixRef &input,
+                                      Scratch &scratch, bool training) const {
+  return std::visit(
+      [&](const auto &layer) -> ConstMatrixRef {
+        using L = Plain<decltype(layer)>;
+        auto &own = std::get<typename L::Scratch>(scratch);
+        if constexpr (kTrains<L>) {
+          return layer.forwardBatch(input, own, training);
+        } else {
+          return layer.forwardBatch(input, own);
+        }
+      },
+      layer_);
+}
+
+ConstMatrixRef AnyLayer::backwardBatch(const ConstMatrixRef &grad_output,
+                                       Scratch &scratch, Scalar *grads,
+                                       Scalar *statistics, bool accumulate,
+                                       bool input_gradient) const {
+  return std::visit(
+      [&](const auto &layer) -> ConstMatrixRef {
+        using L = Plain<decltype(layer)>;
+        auto &own = std::get<typename L::Scratch>(scratch);
+        if constexpr (kLearns<L>) {
+          const auto weights = layer.weights();
+          const ConstMatrixRef grad_input = layer.backwardBatch(
+              grad_output, own,
+              Eigen::Map<Matrix>(grads, weights.rows(), weights.cols()),
+              Eigen::Map<Vector>(grads + weights.size(), weights.rows()),
+              accumulate, input_gradient);
+          if constexpr (std::is_same_v<L, BatchNorm>) {
+            layer.sumStatistics(
+                own, Eigen::Map<Vector>(statistics, statisticsCount()),
+                accumulate);
+          }
+          return grad_input;
+        } else {
+          return layer.backwardBatch(grad_output, own);
+        }
+      },
+      layer_);
+}
+
+void AnyLayer::moveParametersTo(Scalar *data) {
+  std::visit(
+      [data](auto &layer) {
+        using L = Plain<decltype(layer)>;
+        if constexpr (std::is_same_v<L, Conv2D>) {
+          layer.dense_.moveParametersTo(data);
+        } else if constexpr (kLearns<L>) {
+          layer.moveParametersTo(data);
+        }
+      },
+      layer_);
+}
+
+void AnyLayer::updateStatistics(const Scalar *statistics, Index samples) {
+  if (auto *norm = std::get_if<BatchNorm>(&layer_)) {
+    norm->updateStatistics(
+        Eigen::Map<const Vector>(statistics, statisticsCount()), samples);
+  }
+}
+
+} // namespace neural_network
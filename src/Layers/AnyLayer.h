@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Layers/BatchNorm.h"
+#include "Layers/Conv2D.h"
+#include "Layers/Dropout.h"
+#include "Layers/Layer.h"
+#include "Layers/MaxPool.h"
+
+#include <cstdint>
+#include <variant>
+
+namespace neural_network {
+
+class Model;
+
+// One layer of a Model: a dense Layer, Dropout, BatchNorm, Conv2D or
+// MaxPool. The types share an interface by convention instead of a base
+// class (a Scratch, reserve(), forwardBatch() and backwardBatch(), plus
+// weights() and biases() for those that learn) and AnyLayer dispatches to
+// them through a std::variant, so layers keep their value semantics and
+// every call inside a layer is static.
+//
+// Samples are columns; image-shaped samples are channels-last (see
+// ImageShape), so convolutions, pooling and dense layers chain without
+// reshaping.
+class AnyLayer {
+public:
+  // The index of the layer type, as stored in model files.
+  enum class Kind : std::uint32_t {
+    Dense,
+    Dropout,
+    BatchNorm,
+    Conv2D,
+    MaxPool
+  };
+
+  using Scratch = std::variant<Layer::Scratch, Dropout::Scratch,
+                               BatchNorm::Scratch, Conv2D::Scratch,
+                               MaxPool::Scratch>;
+
+  // Implicit, so that a Model can be written as a list of layers.
+  AnyLayer(Layer layer);
+  AnyLayer(Dropout layer);
+  AnyLayer(BatchNorm layer);
+  AnyLayer(Conv2D layer);
+  AnyLayer(MaxPool layer);
+
+  Kind kind() const;
+  // The layer if it has type L, else nullptr.
+  template <typename L> const L *get() const {
+    return std::get_if<L>(&layer_);
+  }
+  template <typename L> L *get() { return std::get_if<L>(&layer_); }
+
+  Index inputSize() const;
+  Index outputSize() const;
+  // Scalars of the weights followed by the biases; both are empty for the
+  // layers that do not learn.
+  Index parameterCount() const;
+  Eigen::Map<const Matrix> weights() const;
+  Eigen::Map<const Vector> biases() const;
+  // Identity for the layers without an activation.
+  ActivationFunction::Type activationType() const;
+  // Scalars of batch statistics that backwardBatch() writes next to the
+  // gradients (see BatchNorm::sumStatistics()).
+  Index statisticsCount() const;
+
+  // `stream` seeds the dropout masks drawn with the scratch.
+  Scratch makeScratch(std::uint64_t stream = 0) const;
+  void reserve(Scratch &scratch, Index batch_size) const;
+  // Without `training`, dropout passes its input through and batch
+  // normalization uses its running statistics.
+  ConstMatrixRef forwardBatch(const ConstMatrixRef &input, Scratch &scratch,
+                              bool training) const;
+  // Follows a training forward pass. Writes the gradients of the weights
+  // and biases to `grads`, laid out like the parameters, and the batch
+  // statistics to `statistics` (adding to both when accumulate is set).
+  ConstMatrixRef backwardBatch(const ConstMatrixRef &grad_output,
+                               Scratch &scratch, Scalar *grads,
+                               Scalar *statistics, bool accumulate,
+                               bool input_gradient) const;
+
+private:
+  friend class Model;
+
+  // Moves the parameters to `data`, a slice of the model's arena.
+  void moveParametersTo(Scalar *data);
+  // Folds the statistics summed over `samples` samples into the running
+  // averages.
+  void updateStatistics(const Scalar *statistics, Index samples);
+
+  std::variant<Layer, Dropout, BatchNorm, Conv2D, MaxPool> layer_;
+};
+
+} // namespace neural_network
@@ -0,0 +1,258 @@
+#include "Layers/BatchNorm.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace neural_network {
+
+namespace {
+
+// One sample of a channels-last input as channels x positions.
+Eigen::Map<const Matrix> sampleOf(const ConstMatrixRef &batch, Index j,
+                                  Index channels) {
+  return Eigen::Map<const Matrix>(batch.col(j).data(), channels,
+                                  batch.rows() / channels);
+}
+
+} // namespace
+
+BatchNorm::BatchNorm(Index size) : BatchNorm(size, size) {}
+
+BatchNorm::BatchNorm(ImageShape shape)
+    : BatchNorm(shape.size(), shape.channels) {}
+
+BatchNorm::BatchNorm(Index size, Index channels)
+    : size_(size), channels_(channels), parameters_(2 * channels),
+      running_mean_(Vector::Zero(channels)),
+      running_variance_(Vector::Ones(channels)) {
+  assert(channels > 0 && size % channels == 0);
+  parameters_.head(channels).setOnes();
+  parameters_.tail(channels).setZero();
+  bind(parameters_.data());
+}
+
+BatchNorm::BatchNorm(const BatchNorm &other)
+    : size_(other.size_), channels_(other.channels_),
+      parameters_(Eigen::Map<const Vector>(other.data_, 2 * other.channels_)),
+      running_mean_(other.running_mean_),
+      running_variance_(other.running_variance_) {
+  bind(parameters_.data());
+}
+
+// Eigen moves steal the heap buffer, so a view of the own storage stays
+// valid; a view of a model arena is carried over as it is.
+BatchNorm::BatchNorm(BatchNorm &&other) noexcept
+    : size_(other.size_), channels_(other.channels_),
+      parameters_(std::move(other.parameters_)), data_(other.data_),
+      running_mean_(std::move(other.running_mean_)),
+      running_variance_(std::move(other.running_variance_)) {
+  other.data_ = nullptr;
+}
+
+BatchNorm &BatchNorm::operator=(const BatchNorm &other) {
+  if (this != &other) {
+    *this = BatchNorm(other);
+  }
+  return *this;
+}
+
+BatchNorm &BatchNorm::operator=(BatchNorm &&other) noexcept {
+  if (this != &other) {
+    size_ = other.size_;
+    channels_ = other.channels_;
+    parameters_ = std::move(other.parameters_);
+    data_ = other.data_;
+    running_mean_ = std::move(other.running_mean_);
+    running_variance_ = std::move(other.running_variance_);
+    other.data_ = nullptr;
+  }
+  return *this;
+}
+
+void BatchNorm::bind(Scalar *data) { data_ = data; }
+
+void BatchNorm::moveParametersTo(Scalar *data) {
+  if (data != data_) {
+    Eigen::Map<Vector>(data, parameterCount()) =
+        Eigen::Map<const Vector>(data_, parameterCount());
+  }
+  bind(data);
+  parameters_.resize(0);
+}
+
+Index BatchNorm::inputSize() const { return size_; }
+
+Index BatchNorm::outputSize() const { return size_; }
+
+Index BatchNorm::channels() const { return channels_; }
+
+Index BatchNorm::positions() const { return size_ / channels_; }
+
+Index BatchNorm::parameterCount() const { return 2 * channels_; }
+
+Eigen::Map<const Matrix> BatchNorm::weights() const {
+  return Eigen::Map<const Matrix>(data_, channels_, 1);
+}
+
+Eigen::Map<const Vector> BatchNorm::biases() const {
+  return Eigen::Map<const Vector>(data_ + channels_, channels_);
+}
+
+const Vector &BatchNorm::runningMean() const { return running_mean_; }
+
+const Vector &BatchNorm::runningVariance() const { return running_variance_; }
+
+void BatchNorm::reserve(Scratch &scratch, Index batch_size) const {
+  if (batch_size <= scratch.capacity && scratch.output.rows() == size_ &&
+      scratch.mean.size() == channels_) {
+    return;
+  }
+  const Index capacity = std::max(batch_size, scratch.capacity);
+  scratch.normalized.resize(size_, capacity);
+  scratch.output.resize(size_, capacity);
+  scratch.grad_input.resize(size_, capacity);
+  for (Vector *v : {&scratch.mean, &scratch.variance, &scratch.inv_std,
+                    &scratch.grad_gamma, &scratch.grad_beta,
+                    &scratch.grad_scale}) {
+    v->resize(channels_);
+  }
+  scratch.capacity = capacity;
+}
+
+ConstMatrixRef BatchNorm::forwardBatch(const ConstMatrixRef &input,
+                                       Scratch &scratch,
+                                       bool training) const {
+  assert(input.rows() == size_);
+  const Index batch = input.cols();
+  reserve(scratch, batch);
+  scratch.batch = batch;
+  const auto gamma = weights().col(0).array();
+  const auto beta = biases().array();
+  auto output = scratch.output.leftCols(batch);
+
+  if (!training) {
+    // y = (x - mean) * gamma / sqrt(variance + eps) + beta, with the
+    // per-channel factor kept in inv_std.
+    scratch.inv_std = gamma * (running_variance_.array() +
+                               static_cast<Scalar>(kEpsilon))
+                                  .rsqrt();
+    for (Index j = 0; j < batch; ++j) {
+      Eigen::Map<Matrix>(output.col(j).data(), channels_, positions()) =
+          ((sampleOf(input, j, channels_).colwise() - running_mean_)
+               .array()
+               .colwise() *
+           scratch.inv_std.array())
+              .colwise() +
+          beta;
+    }
+    return output;
+  }
+
+  // Two passes over the batch, for the mean and then the variance.
+  const auto count = static_cast<Scalar>(positions() * batch);
+  scratch.mean.setZero();
+  for (Index j = 0; j < batch; ++j) {
+    scratch.mean += sampleOf(input, j, channels_).rowwise().sum();
+  }
+  scratch.mean /= count;
+  scratch.variance.setZero();
+  for (Index j = 0; j < batch; ++j) {
+    scratch.variance += (sampleOf(input, j, channels_).colwise() - scratch.mean)
+                            .array()
+                            .square()
+                            .matrix()
+                            .rowwise()
+                            .sum();
+  }
+  scratch.variance /= count;
+  scratch.inv_std =
+      (scratch.variance.array() + static_cast<Scalar>(kEpsilon)).rsqrt();
+
+  for (Index j = 0; j < batch; ++j) {
+    auto normalized = Eigen::Map<Matrix>(scratch.normalized.col(j).data(),
+                                         channels_, positions());
+    normalized = (sampleOf(input, j, channels_).colwise() - scratch.mean)
+                     .array()
+                     .colwise() *
+                 scratch.inv_std.array();
+    Eigen::Map<Matrix>(output.col(j).data(), channels_, positions()) =
+        (normalized.array().colwise() * gamma).colwise() + beta;
+  }
+  return output;
+}
+
+ConstMatrixRef BatchNorm::backwardBatch(const ConstMatrixRef &grad_output,
+                                        Scratch &scratch,
+                                        Eigen::Ref<Matrix> grad_w,
+                                        Eigen::Ref<Vector> grad_b,
+                                        bool accumulate,
+                                        bool input_gradient) const {
+  const Index batch = scratch.batch;
+  assert(grad_output.rows() == size_ && grad_output.cols() == batch);
+  assert(grad_w.rows() == channels_ && grad_w.cols() == 1);
+  assert(grad_b.size() == channels_);
+  const ConstMatrixRef normalized = scratch.normalized.leftCols(batch);
+
+  scratch.grad_gamma.setZero();
+  scratch.grad_beta.setZero();
+  for (Index j = 0; j < batch; ++j) {
+    const auto dy = sampleOf(grad_output, j, channels_);
+    scratch.grad_beta += dy.rowwise().sum();
+    scratch.grad_gamma +=
+        dy.cwiseProduct(sampleOf(normalized, j, channels_)).rowwise().sum();
+  }
+  if (accumulate) {
+    grad_w.col(0) += scratch.grad_gamma;
+    grad_b += scratch.grad_beta;
+  } else {
+    grad_w.col(0) = scratch.grad_gamma;
+    grad_b = scratch.grad_beta;
+  }
+
+  if (!input_gradient) {
+    return scratch.grad_input.leftCols(0);
+  }
+  // dx = gamma / (N * std) * (N * dy - sum(dy) - x_hat * sum(dy * x_hat))
+  // over the N values of each channel in the batch.
+  const auto count = static_cast<Scalar>(positions() * batch);
+  scratch.grad_scale =
+      weights().col(0).cwiseProduct(scratch.inv_std) / count;
+  auto grad_input = scratch.grad_input.leftCols(batch);
+  for (Index j = 0; j < batch; ++j) {
+    Eigen::Map<Matrix>(grad_input.col(j).data(), channels_, positions()) =
+        (((count * sampleOf(grad_output, j, channels_).array()).colwise() -
+          scratch.grad_beta.array()) -
+         sampleOf(normalized, j, channels_).array().colwise() *
+             scratch.grad_gamma.array())
+            .colwise() *
+        scratch.grad_scale.array();
+  }
+  return grad_input;
+}
+
+void BatchNorm::sumStatistics(const Scratch &scratch, Eigen::Ref<Vector> sums,
+                              bool accumulate) const {
+  assert(sums.size() == 2 * channels_);
+  const auto batch = static_cast<Scalar>(scratch.batch);
+  if (!accumulate) {
+    sums.setZero();
+  }
+  sums.head(channels_) += batch * scratch.mean;
+  sums.tail(channels_).array() +=
+      batch * (scratch.variance.array() + scratch.mean.array().square());
+}
+
+void BatchNorm::updateStatistics(const ConstVectorRef &sums, Index samples) {
+  assert(sums.size() == 2 * channels_ && samples > 0);
+  const auto n = static_cast<Scalar>(samples);
+  const auto m = static_cast<Scalar>(kMomentum);
+  for (Index c = 0; c < channels_; ++c) {
+    const Scalar mean = sums[c] / n;
+    const Scalar variance =
+        std::max(sums[channels_ + c] / n - mean * mean, Scalar(0));
+    running_mean_[c] += m * (mean - running_mean_[c]);
+    running_variance_[c] += m * (variance - running_variance_[c]);
+  }
+}
+
+} // namespace neural_network
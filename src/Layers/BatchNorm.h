@@ -0,0 +1,107 @@
+#pragma once
+
+#include "Utilities/Utils.h"
+
+namespace neural_network {
+
+class FileReader;
+class Model;
+
+// Batch normalization: each channel is shifted and scaled to zero mean and
+// unit variance, then multiplied by a learned gamma and offset by a
+// learned beta. On a flat input every entry is its own channel; on an
+// image (channels-last) a channel's statistics run over all its positions.
+//
+// Training normalizes with the statistics of the batch. Inference uses
+// running averages of them: backwardBatch() is followed by
+// sumStatistics(), and the sums, reduced and accumulated like gradients,
+// go to updateStatistics() once per optimizer step.
+class BatchNorm {
+public:
+  // Normalized inputs, output and input gradient (one column per sample),
+  // and per channel the batch mean and variance of the last training pass,
+  // the 1 / standard deviation it used, the gradients of gamma and beta and
+  // gamma / (N * standard deviation) for the input gradient.
+  struct Scratch {
+    Matrix normalized;
+    Matrix output;
+    Matrix grad_input;
+    Vector mean;
+    Vector variance;
+    Vector inv_std;
+    Vector grad_gamma;
+    Vector grad_beta;
+    Vector grad_scale;
+    Index capacity = 0;
+    Index batch = 0;
+  };
+
+  // Weight of the latest batch in the running averages.
+  static constexpr double kMomentum = 0.1;
+  static constexpr double kEpsilon = 1e-5;
+
+  explicit BatchNorm(Index size);
+  explicit BatchNorm(ImageShape shape);
+
+  // Copies own their parameters, even if the source views a model arena.
+  BatchNorm(const BatchNorm &other);
+  BatchNorm(BatchNorm &&other) noexcept;
+  BatchNorm &operator=(const BatchNorm &other);
+  BatchNorm &operator=(BatchNorm &&other) noexcept;
+
+  Index inputSize() const;
+  Index outputSize() const;
+  Index channels() const;
+
+  void reserve(Scratch &scratch, Index batch_size) const;
+  ConstMatrixRef forwardBatch(const ConstMatrixRef &input, Scratch &scratch,
+                              bool training) const;
+  // Follows a training forward pass. grad_w and grad_b receive the
+  // gradients of gamma and beta, summed over the batch (added to them when
+  // accumulate is set).
+  ConstMatrixRef backwardBatch(const ConstMatrixRef &grad_output,
+                               Scratch &scratch, Eigen::Ref<Matrix> grad_w,
+                               Eigen::Ref<Vector> grad_b,
+                               bool accumulate = false,
+                               bool input_gradient = true) const;
+
+  // 2 * channels() sums over the samples of the last training batch: of
+  // each sample's mean of every channel, then of its mean square. Written
+  // to `sums`, or added to them when accumulate is set.
+  void sumStatistics(const Scratch &scratch, Eigen::Ref<Vector> sums,
+                     bool accumulate = false) const;
+  // Moves the running averages towards the statistics of `samples` samples
+  // whose sums are `sums`.
+  void updateStatistics(const ConstVectorRef &sums, Index samples);
+
+  // gamma (channels x 1) and beta.
+  Eigen::Map<const Matrix> weights() const;
+  Eigen::Map<const Vector> biases() const;
+  const Vector &runningMean() const;
+  const Vector &runningVariance() const;
+  Index parameterCount() const;
+
+private:
+  BatchNorm(Index size, Index channels);
+
+  // Points the parameters at `data`: gamma followed by beta.
+  void bind(Scalar *data);
+  // Moves the parameters to `data` (a slice of the model's arena) and
+  // releases the layer's own storage.
+  void moveParametersTo(Scalar *data);
+  // Positions of a channel in one sample.
+  Index positions() const;
+
+  Index size_;
+  Index channels_;
+  // Own parameter storage; empty while the layer views a model arena.
+  Vector parameters_;
+  Scalar *data_ = nullptr;
+  Vector running_mean_;
+  Vector running_variance_;
+
+  friend class AnyLayer;
+  friend FileReader &operator>>(FileReader &, Model &);
+};
+
+} // namespace neural_network
@@ -0,0 +1,198 @@
+#include "Layers/Conv2D.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+namespace neural_network {
+
+Conv2D::Conv2D(ImageShape input, Index filters, Index kernel,
+               ActivationFunction activation, Index stride, Index padding)
+    : Conv2D(input, kernel, stride, padding,
+             Layer(In(std::max<Index>(kernel * kernel * input.channels, 0)),
+                   Out(std::max<Index>(filters, 0)), std::move(activation))) {
+}
+
+Conv2D::Conv2D(ImageShape input, Index kernel, Index stride, Index padding,
+               Layer dense)
+    : input_(input), kernel_(kernel), stride_(stride), padding_(padding),
+      dense_(std::move(dense)) {
+  const Index filters = dense_.weights().rows();
+  if (kernel <= 0 || stride <= 0 || padding < 0 || filters <= 0 ||
+      input.size() <= 0 || input.height + 2 * padding < kernel ||
+      input.width + 2 * padding < kernel ||
+      dense_.weights().cols() != kernel * kernel * input.channels) {
+    throw std::runtime_error("Convolution does not fit its input.");
+  }
+  output_ = ImageShape{(input.height + 2 * padding - kernel) / stride + 1,
+                       (input.width + 2 * padding - kernel) / stride + 1,
+                       filters};
+  dense_.setSparseInput(true);
+}
+
+ImageShape Conv2D::inputShape() const { return input_; }
+
+ImageShape Conv2D::outputShape() const { return output_; }
+
+Index Conv2D::inputSize() const { return input_.size(); }
+
+Index Conv2D::outputSize() const { return output_.size(); }
+
+Index Conv2D::kernel() const { return kernel_; }
+
+Index Conv2D::stride() const { return stride_; }
+
+Index Conv2D::padding() const { return padding_; }
+
+Eigen::Map<const Matrix> Conv2D::weights() const { return dense_.weights(); }
+
+Eigen::Map<const Vector> Conv2D::biases() const { return dense_.biases(); }
+
+ActivationFunction::Type Conv2D::activationType() const {
+  return dense_.activationType();
+}
+
+Index Conv2D::parameterCount() const { return dense_.parameterCount(); }
+
+Index Conv2D::tileSamples() const {
+  // Unrolling the whole batch before the product would stream the patches
+  // (25 times the image for a 5 x 5 kernel) through memory twice; tiles of
+  // about kTileBytes are multiplied straight after im2col writes them.
+  constexpr Index kTileBytes = Index(1) << 18;
+  const Index positions = output_.height * output_.width;
+  return std::max<Index>(
+      1, kTileBytes / Index(sizeof(Scalar) * dense_.inputSize() * positions));
+}
+
+void Conv2D::reserve(Scratch &scratch, Index batch_size) const {
+  if (batch_size <= scratch.capacity &&
+      scratch.patches.rows() == dense_.inputSize()) {
+    return;
+  }
+  const Index capacity = std::max(batch_size, scratch.capacity);
+  const Index positions = output_.height * output_.width;
+  const Index tile = std::min(tileSamples(), capacity) * positions;
+  if (scratch.patches.rows() != dense_.inputSize() ||
+      scratch.patches.cols() < tile) {
+    scratch.patches.resize(dense_.inputSize(), tile);
+  }
+  dense_.reserveOutput(scratch.dense, capacity * positions, tile);
+  scratch.capacity = capacity;
+}
+
+void Conv2D::im2col(const ConstMatrixRef &input,
+                    Eigen::Ref<Matrix> columns) const {
+  const Index channels = input_.channels;
+  const Index row = kernel_ * channels;
+  Index q = 0;
+  for (Index j = 0; j < input.cols(); ++j) {
+    const Scalar *image = input.col(j).data();
+    for (Index oy = 0; oy < output_.height; ++oy) {
+      for (Index ox = 0; ox < output_.width; ++ox, ++q) {
+        // Kernel columns [left, right) fall inside the image; each kernel
+        // row of them is one contiguous run of the input.
+        const Index x0 = ox * stride_ - padding_;
+        const Index left = std::clamp<Index>(-x0, 0, kernel_);
+        const Index right = std::clamp<Index>(input_.width - x0, left, kernel_);
+        Scalar *column = columns.col(q).data();
+        for (Index ky = 0; ky < kernel_; ++ky, column += row) {
+          const Index y = oy * stride_ - padding_ + ky;
+          if (y < 0 || y >= input_.height) {
+            std::fill(column, column + row, Scalar(0));
+            continue;
+          }
+          std::fill(column, column + left * channels, Scalar(0));
+          std::copy_n(image + (y * input_.width + x0 + left) * channels,
+                      (right - left) * channels, column + left * channels);
+          std::fill(column + right * channels, column + row, Scalar(0));
+        }
+      }
+    }
+  }
+}
+
+void Conv2D::col2im(const ConstMatrixRef &columns,
+                    Eigen::Ref<Matrix> output) const {
+  const Index channels = input_.channels;
+  const Index row = kernel_ * channels;
+  output.setZero();
+  Index q = 0;
+  for (Index j = 0; j < output.cols(); ++j) {
+    Scalar *image = output.col(j).data();
+    for (Index oy = 0; oy < output_.height; ++oy) {
+      for (Index ox = 0; ox < output_.width; ++ox, ++q) {
+        const Index x0 = ox * stride_ - padding_;
+        const Index left = std::clamp<Index>(-x0, 0, kernel_);
+        const Index right = std::clamp<Index>(input_.width - x0, left, kernel_);
+        const Scalar *column = columns.col(q).data();
+        for (Index ky = 0; ky < kernel_; ++ky, column += row) {
+          const Index y = oy * stride_ - padding_ + ky;
+          if (y < 0 || y >= input_.height) {
+            continue;
+          }
+          Eigen::Map<Vector>(image + (y * input_.width + x0 + left) * channels,
+                             (right - left) * channels) +=
+              Eigen::Map<const Vector>(column + left * channels,
+                                       (right - left) * channels);
+        }
+      }
+    }
+  }
+}
+
+ConstMatrixRef Conv2D::forwardBatch(const ConstMatrixRef &input,
+                                    Scratch &scratch, bool training) const {
+  assert(input.rows() == inputSize());
+  const Index batch = input.cols();
+  reserve(scratch, batch);
+  scratch.batch = batch;
+  const Index positions = output_.height * output_.width;
+  // Training keeps every patch for backwardBatch(); those buffers are only
+  // sized once a scratch is trained with.
+  if (training) {
+    dense_.reserve(scratch.dense, batch * positions);
+    if (scratch.grad_input.rows() != inputSize() ||
+        scratch.grad_input.cols() < batch) {
+      scratch.grad_input.resize(inputSize(), batch);
+    }
+  }
+
+  const Index tile = tileSamples();
+  for (Index first = 0; first < batch; first += tile) {
+    const Index samples = std::min(tile, batch - first);
+    auto columns =
+        training ? scratch.dense.input.middleCols(first * positions,
+                                                  samples * positions)
+                 : scratch.patches.leftCols(samples * positions);
+    im2col(input.middleCols(first, samples), columns);
+    dense_.forwardTile(columns, scratch.dense, first * positions,
+                       batch * positions, training);
+  }
+  return Eigen::Map<const Matrix>(scratch.dense.output.data(), outputSize(),
+                                  batch);
+}
+
+ConstMatrixRef Conv2D::backwardBatch(const ConstMatrixRef &grad_output,
+                                     Scratch &scratch,
+                                     Eigen::Ref<Matrix> grad_w,
+                                     Eigen::Ref<Vector> grad_b,
+                                     bool accumulate,
+                                     bool input_gradient) const {
+  const Index batch = scratch.batch;
+  assert(grad_output.rows() == outputSize() && grad_output.cols() == batch);
+  assert(grad_output.outerStride() == grad_output.rows() || batch == 1);
+
+  const Index positions = output_.height * output_.width;
+  const ConstMatrixRef grad_columns = dense_.backwardBatch(
+      Eigen::Map<const Matrix>(grad_output.data(), output_.channels,
+                               batch * positions),
+      scratch.dense, grad_w, grad_b, accumulate, input_gradient);
+  if (!input_gradient) {
+    return scratch.grad_input.leftCols(0);
+  }
+  auto grad_input = scratch.grad_input.leftCols(batch);
+  col2im(grad_columns, grad_input);
+  return grad_input;
+}
+
+} // namespace neural_network
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "Layers/Layer.h"
+#include "Utilities/Utils.h"
+
+namespace neural_network {
+
+class FileReader;
+class Model;
+
+// 2-D convolution of channels-last images: `filters` kernels of kernel x
+// kernel x input channels slide over the zero-padded input with the given
+// stride, each followed by a bias and the activation. The patches under
+// the kernel are unrolled into columns (im2col) and multiplied through a
+// dense Layer with a kernel's worth of inputs and one output per filter:
+// its output, a column of filters per position, is the channels-last
+// output image. A batch is unrolled and multiplied a few samples at a
+// time, so that the patches are still in cache for the product.
+// Mostly-zero patches (the first layer on MNIST) take the dense layer's
+// sparse path.
+class Conv2D {
+public:
+  // The dense layer's scratch, whose input holds the patches of a training
+  // batch (one column per output position of each sample), the patches of
+  // one tile for inference, and the input gradient. reserve() sizes what
+  // inference needs; the training buffers are sized by the first training
+  // forward pass.
+  struct Scratch {
+    Layer::Scratch dense;
+    Matrix patches;
+    Matrix grad_input;
+    Index capacity = 0;
+    Index batch = 0;
+  };
+
+  Conv2D(ImageShape input, Index filters, Index kernel,
+         ActivationFunction activation, Index stride = 1, Index padding = 0);
+
+  ImageShape inputShape() const;
+  ImageShape outputShape() const;
+  Index inputSize() const;
+  Index outputSize() const;
+  Index kernel() const;
+  Index stride() const;
+  Index padding() const;
+
+  void reserve(Scratch &scratch, Index batch_size) const;
+  // Without `training` the patches are not kept for backwardBatch().
+  ConstMatrixRef forwardBatch(const ConstMatrixRef &input, Scratch &scratch,
+                              bool training = true) const;
+  // As Layer::backwardBatch(); grad_output must be contiguous, as the views
+  // of a scratch are.
+  ConstMatrixRef backwardBatch(const ConstMatrixRef &grad_output,
+                               Scratch &scratch, Eigen::Ref<Matrix> grad_w,
+                               Eigen::Ref<Vector> grad_b,
+                               bool accumulate = false,
+                               bool input_gradient = true) const;
+
+  // filters x (kernel * kernel * input channels), a row per filter in the
+  // input's (y, x, channel) order.
+  Eigen::Map<const Matrix> weights() const;
+  Eigen::Map<const Vector> biases() const;
+  ActivationFunction::Type activationType() const;
+  Index parameterCount() const;
+
+private:
+  // Around a dense layer of one row per filter (as read from a file).
+  Conv2D(ImageShape input, Index kernel, Index stride, Index padding,
+         Layer dense);
+
+  // Copies the patches of every sample into `columns`, and adds them back
+  // onto the image positions they came from.
+  void im2col(const ConstMatrixRef &input, Eigen::Ref<Matrix> columns) const;
+  void col2im(const ConstMatrixRef &columns, Eigen::Ref<Matrix> output) const;
+  // Samples unrolled and multiplied at a time.
+  Index tileSamples() const;
+
+  ImageShape input_;
+  ImageShape output_;
+  Index kernel_ = 0;
+  Index stride_ = 1;
+  Index padding_ = 0;
+  Layer dense_;
+
+  friend class AnyLayer;
+  friend FileReader &operator>>(FileReader &, Model &);
+};
+
+} // namespace neural_network
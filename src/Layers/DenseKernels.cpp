@@ -0,0 +1,993 @@
+#include "Layers/DenseKernels.h"
+#include "Utilities/CpuFeatures.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#if defined(NEURAL_NETWORK_X86_KERNELS) && !defined(NEURAL_NET_USE_DOUBLE)
+#define NEURAL_NETWORK_SIMD_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace neural_network {
+namespace kernels {
+
+namespace {
+
+// Block sizes of the GEMM: a kc-deep slice of op(B), nc columns wide, is
+// packed once and stays in L2 while mc-row panels of op(A) (L1-sized per
+// micro-panel) stream past it. kMc and kNc are multiples of every
+// micro-tile's rows and columns.
+constexpr Index kKc = 1024 / sizeof(Scalar);
+constexpr Index kMc = 128;
+constexpr Index kNc = 240;
+
+// Computes a rows x cols tile of C from a kc-deep micro-panel of op(A)
+// (row i of step p at a[p * a_step + i]) and one of op(B) (column j of
+// step p at b[p * b_step + j]). Only the first `rows` rows are stored;
+// they are added to C when `add` is set.
+using MicroKernel = void (*)(Index kc, const Scalar *a, Index a_step,
+                             const Scalar *b, Index b_step, Scalar *c,
+                             Index ldc, Index rows, bool add);
+
+// C(i, j) for rows i in [0, R) of op(A) and one column j of op(B), as dot
+// products of k-long contiguous vectors: row i of op(A) at a + i * lda and
+// the column of op(B) at b. Used when op(A) is a transposed matrix and
+// op(B) has few columns, where packing A would cost as much as the
+// product.
+using DotKernel = void (*)(Index k, const Scalar *a, Index lda,
+                           const Scalar *b, Scalar *c, bool add);
+
+// kColumnRows rows of a single-column C from an untransposed A read in
+// place (column p at a + p * lda) and the column of op(B) (step p at
+// b[p * b_step]). Wider than a micro-tile, so that A streams through
+// whole cache lines. The gathering variant only takes the k steps
+// p = index[q], the nonzeros of a sparse op(B), whose values are then
+// b[q * b_step].
+constexpr Index kColumnRows = 64;
+using ColumnKernel = void (*)(Index k, const int *index, const Scalar *a,
+                              Index lda, const Scalar *b, Index b_step,
+                              Scalar *c, bool add);
+
+// The transpose of a gather: adds kColumnRows rows of the column a, times
+// values[q], to column index[q] of C (at c + index[q] * ldc) for q < k.
+using ScatterKernel = void (*)(Index k, const int *index,
+                               const Scalar *values, const Scalar *a,
+                               Scalar *c, Index ldc);
+
+template <bool kGather> inline Index step(const int *index, Index q) {
+  return kGather ? index[q] : q;
+}
+
+// Copies the nonzeros of x[0, count), count <= 64, to `values` and their
+// positions plus `first` to `indices`, and returns how many there are. The
+// nonzeros of an image are scattered, so this avoids a branch per entry;
+// up to `count` entries of the outputs may be written.
+using CompressKernel = Index (*)(const Scalar *x, Index count, int first,
+                                 int *indices, Scalar *values);
+
+// Stores the first `rows` rows of an accumulator tile.
+template <int MR, int NR>
+void storeTile(const Scalar (&tile)[NR][MR], Scalar *c, Index ldc,
+               Index rows, bool add) {
+  for (int j = 0; j < NR; ++j) {
+    Scalar *column = c + j * ldc;
+    if (rows == MR && add) {
+      for (int i = 0; i < MR; ++i)
+        column[i] += tile[j][i];
+    } else if (rows == MR) {
+      for (int i = 0; i < MR; ++i)
+        column[i] = tile[j][i];
+    } else {
+      for (Index i = 0; i < rows; ++i)
+        column[i] = add ? column[i] + tile[j][i] : tile[j][i];
+    }
+  }
+}
+
+template <int R>
+void storeDots(const Scalar (&sums)[R], Scalar *c, bool add) {
+  if (add) {
+    for (int r = 0; r < R; ++r)
+      c[r] += sums[r];
+  } else {
+    std::copy(sums, sums + R, c);
+  }
+}
+
+// Portable kernels: plain loops over fixed-size arrays that the compiler
+// vectorizes for the baseline instruction set.
+constexpr int kScalarMr = 8;
+constexpr int kScalarNr = 4;
+
+template <int NR>
+void microScalar(Index kc, const Scalar *a, Index a_step, const Scalar *b,
+                 Index b_step, Scalar *c, Index ldc, Index rows, bool add) {
+  Scalar tile[NR][kScalarMr] = {};
+  for (Index p = 0; p < kc; ++p, a += a_step, b += b_step) {
+#pragma GCC unroll 4
+    for (int j = 0; j < NR; ++j) {
+#pragma GCC unroll 8
+      for (int i = 0; i < kScalarMr; ++i)
+        tile[j][i] += a[i] * b[j];
+    }
+  }
+  storeTile<kScalarMr, NR>(tile, c, ldc, rows, add);
+}
+
+template <int R>
+void dotScalar(Index k, const Scalar *a, Index lda, const Scalar *b,
+               Scalar *c, bool add) {
+  constexpr int kLanes = 8;
+  Scalar lanes[R][kLanes] = {};
+  Index p = 0;
+  for (; p + kLanes <= k; p += kLanes) {
+    for (int r = 0; r < R; ++r) {
+      for (int l = 0; l < kLanes; ++l)
+        lanes[r][l] += a[r * lda + p + l] * b[p + l];
+    }
+  }
+  Scalar sums[R];
+  for (int r = 0; r < R; ++r) {
+    sums[r] = 0;
+    for (int l = 0; l < kLanes; ++l)
+      sums[r] += lanes[r][l];
+    for (Index q = p; q < k; ++q)
+      sums[r] += a[r * lda + q] * b[q];
+  }
+  storeDots<R>(sums, c, add);
+}
+
+template <bool kGather>
+void columnScalar(Index k, const int *index, const Scalar *a, Index lda,
+                  const Scalar *b, Index b_step, Scalar *c, bool add) {
+  Scalar sums[kColumnRows] = {};
+  for (Index q = 0; q < k; ++q) {
+    const Scalar *column = a + step<kGather>(index, q) * lda;
+    const Scalar bp = b[q * b_step];
+    for (int i = 0; i < kColumnRows; ++i)
+      sums[i] += column[i] * bp;
+  }
+  storeDots<kColumnRows>(sums, c, add);
+}
+
+void scatterScalar(Index k, const int *index, const Scalar *values,
+                   const Scalar *a, Scalar *c, Index ldc) {
+  Scalar column[kColumnRows];
+  std::copy(a, a + kColumnRows, column);
+  for (Index q = 0; q < k; ++q) {
+    Scalar *target = c + index[q] * ldc;
+    for (int i = 0; i < kColumnRows; ++i)
+      target[i] += column[i] * values[q];
+  }
+}
+
+Index compressScalar(const Scalar *x, Index count, int first, int *indices,
+                     Scalar *values) {
+  Index n = 0;
+  for (Index i = 0; i < count; ++i) {
+    indices[n] = first + static_cast<int>(i);
+    values[n] = x[i];
+    n += x[i] != Scalar(0);
+  }
+  return n;
+}
+
+#if defined(NEURAL_NETWORK_SIMD_KERNELS)
+
+// Tiles narrower than four columns interleave this many steps over
+// separate accumulators, so that enough independent FMAs are in flight to
+// hide their latency.
+constexpr int interleave(int nr) { return nr < 4 ? 4 / nr : 1; }
+
+// The loops over a tile's columns are unrolled with a pragma: register
+// arrays indexed by loop counters would otherwise be kept on the stack.
+
+// 16 x 6 tile in twelve 8-wide registers.
+constexpr int kAvx2Mr = 16;
+constexpr int kAvx2Nr = 6;
+
+template <int NR>
+__attribute__((target("avx2,fma"), always_inline)) inline void
+stepAvx2(const float *a, const float *b, __m256 (&lo)[NR],
+         __m256 (&hi)[NR]) {
+  const __m256 a0 = _mm256_loadu_ps(a);
+  const __m256 a1 = _mm256_loadu_ps(a + 8);
+#pragma GCC unroll 16
+  for (int j = 0; j < NR; ++j) {
+    const __m256 bj = _mm256_broadcast_ss(b + j);
+    lo[j] = _mm256_fmadd_ps(a0, bj, lo[j]);
+    hi[j] = _mm256_fmadd_ps(a1, bj, hi[j]);
+  }
+}
+
+template <int NR>
+__attribute__((target("avx2,fma"))) void
+microAvx2(Index kc, const float *a, Index a_step, const float *b,
+          Index b_step, float *c, Index ldc, Index rows, bool add) {
+  constexpr int U = interleave(NR);
+  __m256 lo[U][NR], hi[U][NR];
+#pragma GCC unroll 4
+  for (int u = 0; u < U; ++u) {
+#pragma GCC unroll 16
+    for (int j = 0; j < NR; ++j)
+      lo[u][j] = hi[u][j] = _mm256_setzero_ps();
+  }
+  Index p = 0;
+  for (; p + U <= kc; p += U) {
+#pragma GCC unroll 4
+    for (int u = 0; u < U; ++u, a += a_step, b += b_step)
+      stepAvx2<NR>(a, b, lo[u], hi[u]);
+  }
+  for (; p < kc; ++p, a += a_step, b += b_step)
+    stepAvx2<NR>(a, b, lo[0], hi[0]);
+
+  alignas(32) float tile[NR][kAvx2Mr];
+#pragma GCC unroll 16
+  for (int j = 0; j < NR; ++j) {
+#pragma GCC unroll 4
+    for (int u = 1; u < U; ++u) {
+      lo[0][j] = _mm256_add_ps(lo[0][j], lo[u][j]);
+      hi[0][j] = _mm256_add_ps(hi[0][j], hi[u][j]);
+    }
+    _mm256_store_ps(tile[j], lo[0][j]);
+    _mm256_store_ps(tile[j] + 8, hi[0][j]);
+  }
+  storeTile<kAvx2Mr, NR>(tile, c, ldc, rows, add);
+}
+
+// Sum of the eight lanes of v.
+__attribute__((target("avx2"), always_inline)) inline float sumAvx2(__m256 v) {
+  __m128 x = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+  x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 1));
+  return _mm_cvtss_f32(x);
+}
+
+template <int R>
+__attribute__((target("avx2,fma"))) void
+dotAvx2(Index k, const float *a, Index lda, const float *b, float *c,
+        bool add) {
+  __m256 acc[2][R];
+#pragma GCC unroll 4
+  for (int r = 0; r < R; ++r)
+    acc[0][r] = acc[1][r] = _mm256_setzero_ps();
+  Index p = 0;
+  for (; p + 16 <= k; p += 16) {
+    const __m256 b0 = _mm256_loadu_ps(b + p);
+    const __m256 b1 = _mm256_loadu_ps(b + p + 8);
+#pragma GCC unroll 4
+    for (int r = 0; r < R; ++r) {
+      acc[0][r] = _mm256_fmadd_ps(_mm256_loadu_ps(a + r * lda + p), b0,
+                                  acc[0][r]);
+      acc[1][r] = _mm256_fmadd_ps(_mm256_loadu_ps(a + r * lda + p + 8), b1,
+                                  acc[1][r]);
+    }
+  }
+  float sums[R];
+#pragma GCC unroll 4
+  for (int r = 0; r < R; ++r) {
+    sums[r] = sumAvx2(_mm256_add_ps(acc[0][r], acc[1][r]));
+    for (Index q = p; q < k; ++q)
+      sums[r] += a[r * lda + q] * b[q];
+  }
+  storeDots<R>(sums, c, add);
+}
+
+// Eight 8-wide accumulators.
+template <bool kGather>
+__attribute__((target("avx2,fma"))) void
+columnAvx2(Index k, const int *index, const float *a, Index lda,
+           const float *b, Index b_step, float *c, bool add) {
+  constexpr int kVectors = kColumnRows / 8;
+  __m256 acc[kVectors];
+#pragma GCC unroll 8
+  for (int v = 0; v < kVectors; ++v)
+    acc[v] = _mm256_setzero_ps();
+  for (Index q = 0; q < k; ++q) {
+    const float *column = a + step<kGather>(index, q) * lda;
+    const __m256 bp = _mm256_broadcast_ss(b + q * b_step);
+#pragma GCC unroll 8
+    for (int v = 0; v < kVectors; ++v)
+      acc[v] = _mm256_fmadd_ps(_mm256_loadu_ps(column + 8 * v), bp, acc[v]);
+  }
+#pragma GCC unroll 8
+  for (int v = 0; v < kVectors; ++v) {
+    if (add)
+      acc[v] = _mm256_add_ps(acc[v], _mm256_loadu_ps(c + 8 * v));
+    _mm256_storeu_ps(c + 8 * v, acc[v]);
+  }
+}
+
+__attribute__((target("avx2,fma"))) void
+scatterAvx2(Index k, const int *index, const float *values, const float *a,
+            float *c, Index ldc) {
+  constexpr int kVectors = kColumnRows / 8;
+  __m256 column[kVectors];
+#pragma GCC unroll 8
+  for (int v = 0; v < kVectors; ++v)
+    column[v] = _mm256_loadu_ps(a + 8 * v);
+  for (Index q = 0; q < k; ++q) {
+    float *target = c + index[q] * ldc;
+    const __m256 value = _mm256_broadcast_ss(values + q);
+#pragma GCC unroll 8
+    for (int v = 0; v < kVectors; ++v) {
+      const __m256 sum = _mm256_fmadd_ps(column[v], value,
+                                         _mm256_loadu_ps(target + 8 * v));
+      _mm256_storeu_ps(target + 8 * v, sum);
+    }
+  }
+}
+
+// The positions are read off a bit mask of the nonzeros.
+__attribute__((target("avx2"))) Index compressAvx2(const float *x,
+                                                   Index count, int first,
+                                                   int *indices,
+                                                   float *values) {
+  const __m256 zero = _mm256_setzero_ps();
+  std::uint64_t mask = 0;
+  Index i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 v = _mm256_loadu_ps(x + i);
+    const int bits = _mm256_movemask_ps(_mm256_cmp_ps(v, zero, _CMP_NEQ_UQ));
+    mask |= std::uint64_t(bits) << i;
+  }
+  for (; i < count; ++i)
+    mask |= std::uint64_t(x[i] != 0.0f) << i;
+  Index n = 0;
+  for (; mask != 0; mask &= mask - 1, ++n) {
+    const int at = std::countr_zero(mask);
+    indices[n] = first + at;
+    values[n] = x[at];
+  }
+  return n;
+}
+
+// 32 x 12 tile in twenty-four 16-wide registers.
+constexpr int kAvx512Mr = 32;
+constexpr int kAvx512Nr = 12;
+
+template <int NR>
+__attribute__((target("avx512f"), always_inline)) inline void
+stepAvx512(const float *a, const float *b, __m512 (&lo)[NR],
+           __m512 (&hi)[NR]) {
+  const __m512 a0 = _mm512_loadu_ps(a);
+  const __m512 a1 = _mm512_loadu_ps(a + 16);
+#pragma GCC unroll 16
+  for (int j = 0; j < NR; ++j) {
+    const __m512 bj = _mm512_set1_ps(b[j]);
+    lo[j] = _mm512_fmadd_ps(a0, bj, lo[j]);
+    hi[j] = _mm512_fmadd_ps(a1, bj, hi[j]);
+  }
+}
+
+template <int NR>
+__attribute__((target("avx512f"))) void
+microAvx512(Index kc, const float *a, Index a_step, const float *b,
+            Index b_step, float *c, Index ldc, Index rows, bool add) {
+  constexpr int U = interleave(NR);
+  __m512 lo[U][NR], hi[U][NR];
+#pragma GCC unroll 4
+  for (int u = 0; u < U; ++u) {
+#pragma GCC unroll 16
+    for (int j = 0; j < NR; ++j)
+      lo[u][j] = hi[u][j] = _mm512_setzero_ps();
+  }
+  Index p = 0;
+  for (; p + U <= kc; p += U) {
+#pragma GCC unroll 4
+    for (int u = 0; u < U; ++u, a += a_step, b += b_step)
+      stepAvx512<NR>(a, b, lo[u], hi[u]);
+  }
+  for (; p < kc; ++p, a += a_step, b += b_step)
+    stepAvx512<NR>(a, b, lo[0], hi[0]);
+
+  alignas(64) float tile[NR][kAvx512Mr];
+#pragma GCC unroll 16
+  for (int j = 0; j < NR; ++j) {
+#pragma GCC unroll 4
+    for (int u = 1; u < U; ++u) {
+      lo[0][j] = _mm512_add_ps(lo[0][j], lo[u][j]);
+      hi[0][j] = _mm512_add_ps(hi[0][j], hi[u][j]);
+    }
+    _mm512_store_ps(tile[j], lo[0][j]);
+    _mm512_store_ps(tile[j] + 16, hi[0][j]);
+  }
+  storeTile<kAvx512Mr, NR>(tile, c, ldc, rows, add);
+}
+
+template <int R>
+__attribute__((target("avx512f"))) void
+dotAvx512(Index k, const float *a, Index lda, const float *b, float *c,
+          bool add) {
+  __m512 acc[2][R];
+#pragma GCC unroll 4
+  for (int r = 0; r < R; ++r)
+    acc[0][r] = acc[1][r] = _mm512_setzero_ps();
+  Index p = 0;
+  for (; p + 32 <= k; p += 32) {
+    const __m512 b0 = _mm512_loadu_ps(b + p);
+    const __m512 b1 = _mm512_loadu_ps(b + p + 16);
+#pragma GCC unroll 4
+    for (int r = 0; r < R; ++r) {
+      acc[0][r] = _mm512_fmadd_ps(_mm512_loadu_ps(a + r * lda + p), b0,
+                                  acc[0][r]);
+      acc[1][r] = _mm512_fmadd_ps(_mm512_loadu_ps(a + r * lda + p + 16), b1,
+                                  acc[1][r]);
+    }
+  }
+  // The halves are summed through memory: GCC 12's 512-bit reduce and
+  // extract intrinsics trip -Wuninitialized on their masked passthrough.
+  float sums[R];
+  alignas(64) float lanes[16];
+#pragma GCC unroll 4
+  for (int r = 0; r < R; ++r) {
+    _mm512_store_ps(lanes, _mm512_add_ps(acc[0][r], acc[1][r]));
+    sums[r] = sumAvx2(
+        _mm256_add_ps(_mm256_load_ps(lanes), _mm256_load_ps(lanes + 8)));
+    for (Index q = p; q < k; ++q)
+      sums[r] += a[r * lda + q] * b[q];
+  }
+  storeDots<R>(sums, c, add);
+}
+
+// Four 16-wide accumulators, each split over two interleaved steps.
+template <bool kGather>
+__attribute__((target("avx512f"))) void
+columnAvx512(Index k, const int *index, const float *a, Index lda,
+             const float *b, Index b_step, float *c, bool add) {
+  constexpr int kVectors = kColumnRows / 16;
+  __m512 acc[2][kVectors];
+#pragma GCC unroll 4
+  for (int v = 0; v < kVectors; ++v)
+    acc[0][v] = acc[1][v] = _mm512_setzero_ps();
+  Index q = 0;
+  for (; q + 2 <= k; q += 2) {
+    const float *a0 = a + step<kGather>(index, q) * lda;
+    const float *a1 = a + step<kGather>(index, q + 1) * lda;
+    const __m512 b0 = _mm512_set1_ps(b[q * b_step]);
+    const __m512 b1 = _mm512_set1_ps(b[(q + 1) * b_step]);
+#pragma GCC unroll 4
+    for (int v = 0; v < kVectors; ++v) {
+      acc[0][v] = _mm512_fmadd_ps(_mm512_loadu_ps(a0 + 16 * v), b0, acc[0][v]);
+      acc[1][v] = _mm512_fmadd_ps(_mm512_loadu_ps(a1 + 16 * v), b1, acc[1][v]);
+    }
+  }
+  if (q < k) {
+    const float *a0 = a + step<kGather>(index, q) * lda;
+    const __m512 b0 = _mm512_set1_ps(b[q * b_step]);
+#pragma GCC unroll 4
+    for (int v = 0; v < kVectors; ++v)
+      acc[0][v] = _mm512_fmadd_ps(_mm512_loadu_ps(a0 + 16 * v), b0, acc[0][v]);
+  }
+#pragma GCC unroll 4
+  for (int v = 0; v < kVectors; ++v) {
+    __m512 sum = _mm512_add_ps(acc[0][v], acc[1][v]);
+    if (add)
+      sum = _mm512_add_ps(sum, _mm512_loadu_ps(c + 16 * v));
+    _mm512_storeu_ps(c + 16 * v, sum);
+  }
+}
+
+__attribute__((target("avx512f"))) void
+scatterAvx512(Index k, const int *index, const float *values, const float *a,
+              float *c, Index ldc) {
+  constexpr int kVectors = kColumnRows / 16;
+  __m512 column[kVectors];
+#pragma GCC unroll 4
+  for (int v = 0; v < kVectors; ++v)
+    column[v] = _mm512_loadu_ps(a + 16 * v);
+  for (Index q = 0; q < k; ++q) {
+    float *target = c + index[q] * ldc;
+    const __m512 value = _mm512_set1_ps(values[q]);
+#pragma GCC unroll 4
+    for (int v = 0; v < kVectors; ++v) {
+      const __m512 sum = _mm512_fmadd_ps(column[v], value,
+                                         _mm512_loadu_ps(target + 16 * v));
+      _mm512_storeu_ps(target + 16 * v, sum);
+    }
+  }
+}
+
+// Sixteen entries at a time with the compressing stores.
+__attribute__((target("avx512f"))) Index compressAvx512(const float *x,
+                                                       Index count, int first,
+                                                       int *indices,
+                                                       float *values) {
+  const __m512 zero = _mm512_setzero_ps();
+  const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                         11, 12, 13, 14, 15);
+  Index n = 0;
+  for (Index i = 0; i < count; i += 16) {
+    const __mmask16 lanes = count - i >= 16
+                                ? __mmask16(0xFFFF)
+                                : __mmask16((1u << (count - i)) - 1);
+    const __m512 v = _mm512_maskz_loadu_ps(lanes, x + i);
+    const __mmask16 nonzero = _mm512_cmp_ps_mask(v, zero, _CMP_NEQ_UQ);
+    const __m512i at =
+        _mm512_add_epi32(lane, _mm512_set1_epi32(first + static_cast<int>(i)));
+    _mm512_mask_compressstoreu_ps(values + n, nonzero, v);
+    _mm512_mask_compressstoreu_epi32(indices + n, nonzero, at);
+    n += std::popcount(static_cast<unsigned>(nonzero));
+  }
+  return n;
+}
+
+#endif // NEURAL_NETWORK_SIMD_KERNELS
+
+// A micro-kernel for every width from 1 to NR columns, so that narrow
+// edges (and single-sample batches) do no wasted work.
+template <int NR> using Micro = std::array<MicroKernel, NR>;
+
+template <template <int> class Tag, std::size_t... J>
+constexpr auto microTable(std::index_sequence<J...>) {
+  return Micro<sizeof...(J)>{Tag<int(J) + 1>::kernel...};
+}
+
+template <int N> struct ScalarTag {
+  static constexpr MicroKernel kernel = microScalar<N>;
+};
+#if defined(NEURAL_NETWORK_SIMD_KERNELS)
+template <int N> struct Avx2Tag {
+  static constexpr MicroKernel kernel = microAvx2<N>;
+};
+template <int N> struct Avx512Tag {
+  static constexpr MicroKernel kernel = microAvx512<N>;
+};
+#endif
+
+// Dot kernels take this many rows at a time, plus one for the rest.
+constexpr Index kDotRows = 4;
+
+struct Kernel {
+  Isa isa;
+  Index mr;
+  Index nr;
+  // micro[j - 1] computes j columns.
+  const MicroKernel *micro;
+  DotKernel dot;
+  DotKernel dot1;
+  ColumnKernel column;
+  ColumnKernel gather;
+  ScatterKernel scatter;
+  CompressKernel compress;
+};
+
+constexpr auto kScalarMicro =
+    microTable<ScalarTag>(std::make_index_sequence<kScalarNr>());
+constexpr Kernel kScalarKernel{Isa::Scalar,         kScalarMr,
+                               kScalarNr,           kScalarMicro.data(),
+                               dotScalar<kDotRows>, dotScalar<1>,
+                               columnScalar<false>, columnScalar<true>,
+                               scatterScalar,       compressScalar};
+#if defined(NEURAL_NETWORK_SIMD_KERNELS)
+constexpr auto kAvx2Micro =
+    microTable<Avx2Tag>(std::make_index_sequence<kAvx2Nr>());
+constexpr Kernel kAvx2Kernel{Isa::Avx2,         kAvx2Mr,
+                             kAvx2Nr,           kAvx2Micro.data(),
+                             dotAvx2<kDotRows>, dotAvx2<1>,
+                             columnAvx2<false>, columnAvx2<true>,
+                             scatterAvx2,       compressAvx2};
+constexpr auto kAvx512Micro =
+    microTable<Avx512Tag>(std::make_index_sequence<kAvx512Nr>());
+constexpr Kernel kAvx512Kernel{Isa::Avx512,         kAvx512Mr,
+                               kAvx512Nr,           kAvx512Micro.data(),
+                               dotAvx512<kDotRows>, dotAvx512<1>,
+                               columnAvx512<false>, columnAvx512<true>,
+                               scatterAvx512,       compressAvx512};
+#endif
+
+static_assert(kMc % kScalarMr == 0 && kNc % kScalarNr == 0 &&
+              kColumnRows % kScalarMr == 0);
+#if defined(NEURAL_NETWORK_SIMD_KERNELS)
+static_assert(kMc % kAvx2Mr == 0 && kNc % kAvx2Nr == 0 &&
+              kColumnRows % kAvx2Mr == 0);
+static_assert(kMc % kAvx512Mr == 0 && kNc % kAvx512Nr == 0 &&
+              kColumnRows % kAvx512Mr == 0);
+#endif
+
+const Kernel *kernelFor(Isa isa) {
+  switch (isa) {
+  case Isa::Scalar:
+    return &kScalarKernel;
+#if defined(NEURAL_NETWORK_SIMD_KERNELS)
+  case Isa::Avx2:
+    return cpuFeatures().avx2 && cpuFeatures().fma ? &kAvx2Kernel : nullptr;
+  case Isa::Avx512:
+    return cpuFeatures().avx512f ? &kAvx512Kernel : nullptr;
+#endif
+  default:
+    return nullptr;
+  }
+}
+
+std::atomic<const Kernel *> &activeKernel() {
+  static std::atomic<const Kernel *> kernel{[] {
+    for (Isa isa : {Isa::Avx512, Isa::Avx2}) {
+      if (const Kernel *widest = kernelFor(isa))
+        return widest;
+    }
+    return &kScalarKernel;
+  }()};
+  return kernel;
+}
+
+// A column-major matrix with the given outer stride, used as op(X) = X
+// or, when transposed, op(X) = X^T.
+struct Operand {
+  const Scalar *data;
+  Index stride;
+  bool transposed;
+};
+
+// Rows [row, row + rows) x steps [step, step + kc) of op(A) as mr-row
+// micro-panels, step-major within a panel, zero-padded to whole panels.
+void packA(const Operand &a, Index row, Index rows, Index step, Index kc,
+           Index mr, Scalar *out) {
+  for (Index ir = 0; ir < rows; ir += mr, out += mr * kc) {
+    const Index height = std::min(mr, rows - ir);
+    if (a.transposed) {
+      // Row i of op(A) is contiguous.
+      for (Index i = 0; i < height; ++i) {
+        const Scalar *src = a.data + (row + ir + i) * a.stride + step;
+        for (Index p = 0; p < kc; ++p)
+          out[p * mr + i] = src[p];
+      }
+    } else {
+      for (Index p = 0; p < kc; ++p) {
+        const Scalar *src = a.data + (step + p) * a.stride + row + ir;
+        std::copy(src, src + height, out + p * mr);
+      }
+    }
+    if (height < mr) {
+      for (Index p = 0; p < kc; ++p)
+        std::fill(out + p * mr + height, out + (p + 1) * mr, Scalar(0));
+    }
+  }
+}
+
+// Steps [step, step + kc) x columns [col, col + cols) of op(B) as
+// nr-column micro-panels, step-major within a panel. Columns past the
+// edge are never read and are left unset.
+void packB(const Operand &b, Index step, Index kc, Index col, Index cols,
+           Index nr, Scalar *out) {
+  for (Index jr = 0; jr < cols; jr += nr, out += nr * kc) {
+    const Index width = std::min(nr, cols - jr);
+    if (b.transposed) {
+      // Step p of op(B) is contiguous.
+      for (Index p = 0; p < kc; ++p) {
+        const Scalar *src = b.data + (step + p) * b.stride + col + jr;
+        std::copy(src, src + width, out + p * nr);
+      }
+    } else {
+      for (Index j = 0; j < width; ++j) {
+        const Scalar *src = b.data + (col + jr + j) * b.stride + step;
+        for (Index p = 0; p < kc; ++p)
+          out[p * nr + j] = src[p];
+      }
+    }
+  }
+}
+
+// C = op(A) * op(B) as dot products; see DotKernel.
+void dotProducts(const Kernel &kernel, const Operand &a, const Operand &b,
+                 Index m, Index n, Index k, Scalar *c, Index ldc,
+                 bool accumulate) {
+  for (Index j = 0; j < n; ++j) {
+    const Scalar *column = b.data + j * b.stride;
+    Index i = 0;
+    for (; i + kDotRows <= m; i += kDotRows)
+      kernel.dot(k, a.data + i * a.stride, a.stride, column, c + j * ldc + i,
+                 accumulate);
+    for (; i < m; ++i)
+      kernel.dot1(k, a.data + i * a.stride, a.stride, column,
+                  c + j * ldc + i, accumulate);
+  }
+}
+
+// C (m x n) = op(A) (m x k) * op(B) (k x n), or C += ... when accumulating.
+void gemm(const Kernel &kernel, const Operand &a, const Operand &b, Index m,
+          Index n, Index k, Scalar *c, Index ldc, bool accumulate) {
+  if (m == 0 || n == 0) {
+    return;
+  }
+  if (k == 0) {
+    if (!accumulate) {
+      for (Index j = 0; j < n; ++j)
+        std::fill(c + j * ldc, c + j * ldc + m, Scalar(0));
+    }
+    return;
+  }
+  const Index mr = kernel.mr, nr = kernel.nr;
+  // With a single micro-panel of B there is nothing to reuse a packed
+  // panel of A for: an untransposed A is read in place, a transposed one
+  // (whose rows are contiguous) through dot products.
+  if (a.transposed && !b.transposed && n <= nr) {
+    dotProducts(kernel, a, b, m, n, k, c, ldc, accumulate);
+    return;
+  }
+  const bool direct_a = !a.transposed && n <= nr;
+
+  alignas(64) Scalar packed_a[kMc * kKc];
+  alignas(64) Scalar packed_b[kKc * kNc];
+  for (Index jc = 0; jc < n; jc += kNc) {
+    const Index nc = std::min(kNc, n - jc);
+    for (Index pc = 0; pc < k; pc += kKc) {
+      const Index kc = std::min(kKc, k - pc);
+      const bool add = accumulate || pc > 0;
+      packB(b, pc, kc, jc, nc, nr, packed_b);
+      for (Index ic = 0; ic < m; ic += kMc) {
+        const Index mc = std::min(kMc, m - ic);
+        if (!direct_a) {
+          packA(a, ic, mc, pc, kc, mr, packed_a);
+        }
+        for (Index jr = 0; jr < nc; jr += nr) {
+          const MicroKernel micro = kernel.micro[std::min(nr, nc - jr) - 1];
+          for (Index ir = 0; ir < mc; ir += mr) {
+            if (direct_a && nc == 1 && mc - ir >= kColumnRows) {
+              kernel.column(kc, nullptr, a.data + pc * a.stride + ic + ir,
+                            a.stride, packed_b, nr, c + jc * ldc + ic + ir,
+                            add);
+              ir += kColumnRows - mr;
+              continue;
+            }
+            const Index rows = std::min(mr, mc - ir);
+            const Scalar *panel = packed_a + ir * kc;
+            Index panel_step = mr;
+            if (direct_a && rows == mr) {
+              panel = a.data + pc * a.stride + ic + ir;
+              panel_step = a.stride;
+            } else if (direct_a) {
+              packA(a, ic + ir, rows, pc, kc, mr, packed_a);
+              panel = packed_a;
+            }
+            micro(kc, panel, panel_step, packed_b + jr * kc, nr,
+                  c + (jc + jr) * ldc + ic + ir, ldc, rows, add);
+          }
+        }
+      }
+    }
+  }
+}
+
+void gemm(const ConstMatrixRef &a, bool transpose_a, const ConstMatrixRef &b,
+          bool transpose_b, Eigen::Ref<Matrix> out, bool accumulate) {
+  const Index m = transpose_a ? a.cols() : a.rows();
+  const Index k = transpose_a ? a.rows() : a.cols();
+  const Index n = transpose_b ? b.rows() : b.cols();
+  assert((transpose_b ? b.cols() : b.rows()) == k);
+  assert(out.rows() == m && out.cols() == n);
+  gemm(*activeKernel().load(std::memory_order_relaxed),
+       Operand{a.data(), a.outerStride(), transpose_a},
+       Operand{b.data(), b.outerStride(), transpose_b}, m, n, k, out.data(),
+       out.outerStride(), accumulate);
+}
+
+// c (+)= sum over q < k of column index[q] of A (`rows` rows, at most
+// kColumnRows, with stride lda) times values[q].
+void gatherRows(const Kernel &kernel, Index rows, Index k, const int *index,
+                const Scalar *values, const Scalar *a, Index lda, Scalar *c,
+                bool add) {
+  if (k == 0) {
+    if (!add) {
+      std::fill(c, c + rows, Scalar(0));
+    }
+  } else if (rows == kColumnRows) {
+    kernel.gather(k, index, a, lda, values, 1, c, add);
+  } else {
+    if (!add) {
+      std::fill(c, c + rows, Scalar(0));
+    }
+    for (Index q = 0; q < k; ++q) {
+      const Scalar *column = a + index[q] * lda;
+      for (Index i = 0; i < rows; ++i)
+        c[i] += column[i] * values[q];
+    }
+  }
+}
+
+// Column index[q] of C (`rows` rows, at most kColumnRows, with stride ldc)
+// += a * values[q] for q < k.
+void scatterRows(const Kernel &kernel, Index rows, Index k, const int *index,
+                 const Scalar *values, const Scalar *a, Scalar *c,
+                 Index ldc) {
+  if (rows == kColumnRows) {
+    kernel.scatter(k, index, values, a, c, ldc);
+    return;
+  }
+  for (Index q = 0; q < k; ++q) {
+    Scalar *target = c + index[q] * ldc;
+    for (Index i = 0; i < rows; ++i)
+      target[i] += a[i] * values[q];
+  }
+}
+
+} // namespace
+
+void CompressedMatrix::reserve(Index rows, Index cols) {
+  const auto limit =
+      static_cast<std::size_t>(kMaxDensity * double(rows) * double(cols));
+  indices_.reserve(limit + kBlock);
+  values_.reserve(limit + kBlock);
+  segments_.reserve(cols * ((rows + kBlock - 1) / kBlock) + 1);
+}
+
+bool CompressedMatrix::assign(const ConstMatrixRef &x) {
+  clear();
+  rows_ = x.rows();
+  blocks_ = (x.rows() + kBlock - 1) / kBlock;
+  return append(x);
+}
+
+bool CompressedMatrix::append(const ConstMatrixRef &x) {
+  static_assert(kBlock <= 64, "A block must fit in one compress call");
+  assert(x.rows() == rows_ && (cols_ == 0 || !empty()));
+  const Index start = cols_;
+  const auto limit = static_cast<Index>(kMaxDensity * double(x.rows()) *
+                                        double(start + x.cols()));
+  const Kernel &kernel = *activeKernel().load(std::memory_order_relaxed);
+  Index n = nonZeros();
+  segments_.resize((start + x.cols()) * blocks_ + 1);
+  // A block past the limit may still be written before it is caught.
+  indices_.resize(limit + kBlock);
+  values_.resize(limit + kBlock);
+  // One pass, which gives up as soon as there are too many nonzeros.
+  for (Index j = 0; j < x.cols(); ++j) {
+    const Scalar *column = x.data() + j * x.outerStride();
+    for (Index block = 0; block < blocks_; ++block) {
+      segments_[(start + j) * blocks_ + block] = n;
+      const Index first = block * kBlock;
+      n += kernel.compress(column + first, std::min(kBlock, x.rows() - first),
+                           static_cast<int>(first), indices_.data() + n,
+                           values_.data() + n);
+      if (n > limit) {
+        clear();
+        return false;
+      }
+    }
+  }
+  segments_.back() = n;
+  indices_.resize(n);
+  values_.resize(n);
+  cols_ = start + x.cols();
+  return true;
+}
+
+void CompressedMatrix::clear() {
+  rows_ = cols_ = blocks_ = 0;
+  indices_.clear();
+  values_.clear();
+  segments_.clear();
+}
+
+const char *isaName(Isa isa) {
+  switch (isa) {
+  case Isa::Scalar:
+    return "scalar";
+  case Isa::Avx2:
+    return "avx2";
+  case Isa::Avx512:
+    return "avx512";
+  }
+  return "unknown";
+}
+
+bool supported(Isa isa) { return kernelFor(isa) != nullptr; }
+
+Isa activeIsa() { return activeKernel().load()->isa; }
+
+void setIsa(Isa isa) {
+  const Kernel *kernel = kernelFor(isa);
+  if (!kernel) {
+    throw std::runtime_error(std::string("Kernel not supported: ") +
+                             isaName(isa));
+  }
+  activeKernel().store(kernel);
+}
+
+void multiply(const ConstMatrixRef &a, const ConstMatrixRef &b,
+              Eigen::Ref<Matrix> out, bool accumulate) {
+  const Kernel &kernel = *activeKernel().load(std::memory_order_relaxed);
+  const Index m = a.rows(), n = b.cols(), k = a.cols();
+  // With fewer rows than a micro-tile (a convolution's few filters against
+  // thousands of patches) most of the tile would be padding, so the product
+  // runs as b^T * a^T into a block of the transpose, whose rows fill it.
+  // Every mr divides kColumnRows, so m rows fit a block of it.
+  constexpr Index kTransposedCols = kMc;
+  if (m >= kernel.mr || n < kernel.mr || k == 0) {
+    gemm(a, false, b, false, out, accumulate);
+    return;
+  }
+  assert(b.rows() == k && out.rows() == m && out.cols() == n);
+  alignas(64) Scalar block[kTransposedCols * kColumnRows];
+  for (Index j = 0; j < n; j += kTransposedCols) {
+    const Index cols = std::min(kTransposedCols, n - j);
+    gemm(kernel, Operand{b.data() + j * b.outerStride(), b.outerStride(), true},
+         Operand{a.data(), a.outerStride(), true}, cols, m, k, block, cols,
+         false);
+    const Eigen::Map<const Matrix> transposed(block, cols, m);
+    if (accumulate) {
+      out.middleCols(j, cols) += transposed.transpose();
+    } else {
+      out.middleCols(j, cols) = transposed.transpose();
+    }
+  }
+}
+
+void multiplyTransposedA(const ConstMatrixRef &a, const ConstMatrixRef &b,
+                         Eigen::Ref<Matrix> out, bool accumulate) {
+  gemm(a, true, b, false, out, accumulate);
+}
+
+void multiplyTransposedB(const ConstMatrixRef &a, const ConstMatrixRef &b,
+                         Eigen::Ref<Matrix> out, bool accumulate) {
+  gemm(a, false, b, true, out, accumulate);
+}
+
+// Both products run over tiles of kColumnRows rows of a (or out) and, for
+// each, over the blocks of rows of b, so that the tiles of a and out that
+// one block reads and writes stay in L1.
+void multiplySparse(const ConstMatrixRef &a, const CompressedMatrix &b,
+                    Eigen::Ref<Matrix> out, Index first) {
+  assert(!b.empty() && a.cols() == b.rows());
+  assert(out.rows() == a.rows() && first + out.cols() <= b.cols());
+  // Column j of out sums the columns of a at the nonzeros of column j of b,
+  // for kSparseCols columns at a time.
+  constexpr Index kSparseCols = 32;
+  const Kernel &kernel = *activeKernel().load(std::memory_order_relaxed);
+  for (Index r = 0; r < a.rows(); r += kColumnRows) {
+    const Index rows = std::min(kColumnRows, a.rows() - r);
+    for (Index jc = 0; jc < out.cols(); jc += kSparseCols) {
+      const Index end = std::min(out.cols(), jc + kSparseCols);
+      for (Index block = 0; block < b.blocks_; ++block) {
+        for (Index j = jc; j < end; ++j) {
+          const Index *segment =
+              b.segments_.data() + (first + j) * b.blocks_ + block;
+          gatherRows(kernel, rows, segment[1] - segment[0],
+                     b.indices_.data() + segment[0],
+                     b.values_.data() + segment[0], a.data() + r,
+                     a.outerStride(), out.data() + j * out.outerStride() + r,
+                     block > 0);
+        }
+      }
+    }
+  }
+}
+
+void multiplyTransposedBSparse(const ConstMatrixRef &a,
+                               const CompressedMatrix &b,
+                               Eigen::Ref<Matrix> out, bool accumulate) {
+  assert(!b.empty() && a.cols() == b.cols());
+  assert(out.rows() == a.rows() && out.cols() == b.rows());
+  // Column j of a, times the nonzeros of column j of b, is added to the
+  // columns of out at their rows.
+  const Kernel &kernel = *activeKernel().load(std::memory_order_relaxed);
+  for (Index r = 0; r < a.rows(); r += kColumnRows) {
+    const Index rows = std::min(kColumnRows, a.rows() - r);
+    for (Index block = 0; block < b.blocks_; ++block) {
+      if (!accumulate) {
+        const Index first = block * b.kBlock;
+        out.block(r, first, rows, std::min(b.kBlock, b.rows() - first))
+            .setZero();
+      }
+      for (Index j = 0; j < b.cols(); ++j) {
+        const Index *segment = b.segments_.data() + j * b.blocks_ + block;
+        scatterRows(kernel, rows, segment[1] - segment[0],
+                    b.indices_.data() + segment[0],
+                    b.values_.data() + segment[0],
+                    a.data() + j * a.outerStride() + r, out.data() + r,
+                    out.outerStride());
+      }
+    }
+  }
+}
+
+} // namespace kernels
+} // namespace neural_network
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "Utilities/Utils.h"
+
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace neural_network {
+namespace kernels {
+
+// Matrix products of the dense layers: W * X on the forward pass, W^T * dZ
+// and dZ * X^T on the backward pass. They share one cache-blocked GEMM
+// that packs panels of both operands into stack buffers sized for the L1
+// and L2 caches and runs a register-tiled micro-kernel on them. The
+// micro-kernel is written for several instruction sets and the widest one
+// the CPU supports is picked at run time, so a binary built for the
+// baseline still uses AVX2 or AVX-512 where they exist. Inputs that are a
+// single column (one sample) are read in place without packing.
+//
+// The output must not overlap the inputs. Nothing is allocated on the
+// heap.
+enum class Isa { Scalar, Avx2, Avx512 };
+
+const char *isaName(Isa isa);
+// Whether this build and CPU can run `isa`. The SIMD kernels are single
+// precision only, so double builds support Scalar alone.
+bool supported(Isa isa);
+// The instruction set in use: the widest supported one, unless setIsa()
+// chose another.
+Isa activeIsa();
+// Switches every thread to `isa` (e.g. to compare kernels). Throws
+// std::runtime_error if it is not supported.
+void setIsa(Isa isa);
+
+// out = a * b, or out += a * b when `accumulate` is set.
+void multiply(const ConstMatrixRef &a, const ConstMatrixRef &b,
+              Eigen::Ref<Matrix> out, bool accumulate = false);
+// out = a^T * b, or out += a^T * b.
+void multiplyTransposedA(const ConstMatrixRef &a, const ConstMatrixRef &b,
+                         Eigen::Ref<Matrix> out, bool accumulate = false);
+// out = a * b^T, or out += a * b^T.
+void multiplyTransposedB(const ConstMatrixRef &a, const ConstMatrixRef &b,
+                         Eigen::Ref<Matrix> out, bool accumulate = false);
+
+// A copy of the nonzeros of a matrix, column by column (its compressed
+// sparse column form). For mostly-zero inputs such as MNIST images, where
+// about 80% of the pixels are 0, the sparse products below only touch the
+// columns of W, and of its gradient, that meet a nonzero.
+class CompressedMatrix {
+public:
+  // Matrices with at most this share of nonzeros are worth compressing;
+  // denser ones are faster through the blocked GEMM.
+  static constexpr double kMaxDensity = 0.3;
+
+  // Sizes the buffers for up to `cols` columns of `rows` rows, so that
+  // assign() and append() do not allocate.
+  void reserve(Index rows, Index cols);
+  // Compresses `x` if it is sparse enough and returns whether it is;
+  // otherwise the matrix is left empty.
+  bool assign(const ConstMatrixRef &x);
+  // Same for `x` appended as further columns of a non-empty matrix with
+  // the same rows; the density limit applies to all columns together.
+  bool append(const ConstMatrixRef &x);
+  void clear();
+  bool empty() const { return segments_.empty(); }
+  Index rows() const { return rows_; }
+  Index cols() const { return cols_; }
+  Index nonZeros() const { return empty() ? 0 : segments_.back(); }
+
+private:
+  friend void multiplySparse(const ConstMatrixRef &, const CompressedMatrix &,
+                             Eigen::Ref<Matrix>, Index);
+  friend void multiplyTransposedBSparse(const ConstMatrixRef &,
+                                        const CompressedMatrix &,
+                                        Eigen::Ref<Matrix>, bool);
+
+  // Each column is cut into segments of kBlock rows, so that the products
+  // can keep the matching tile of their dense operands in L1: segment b of
+  // column j holds the entries segments_[s] up to segments_[s + 1] of
+  // indices_ (the rows) and values_, with s = j * blocks_ + b.
+  static constexpr Index kBlock = 64;
+
+  // Leaves new elements uninitialized, so that sizing the buffers for a
+  // batch does not write them all before they are filled.
+  template <typename T> struct UninitializedAllocator : std::allocator<T> {
+    template <typename U> struct rebind {
+      using other = UninitializedAllocator<U>;
+    };
+    UninitializedAllocator() = default;
+    template <typename U>
+    UninitializedAllocator(const UninitializedAllocator<U> &) noexcept {}
+    template <typename U> void construct(U *p) noexcept {
+      ::new (static_cast<void *>(p)) U;
+    }
+    template <typename U, typename... Args>
+    void construct(U *p, Args &&...args) {
+      ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+  };
+  template <typename T>
+  using Buffer = std::vector<T, UninitializedAllocator<T>>;
+
+  Index rows_ = 0;
+  Index cols_ = 0;
+  Index blocks_ = 0;
+  Buffer<int> indices_;
+  Buffer<Scalar> values_;
+  Buffer<Index> segments_;
+};
+
+// out = a * b, or columns [first, first + out.cols()) of it.
+void multiplySparse(const ConstMatrixRef &a, const CompressedMatrix &b,
+                    Eigen::Ref<Matrix> out, Index first = 0);
+// out = a * b^T, or out += a * b^T.
+void multiplyTransposedBSparse(const ConstMatrixRef &a,
+                               const CompressedMatrix &b,
+                               Eigen::Ref<Matrix> out,
+                               bool accumulate = false);
+
+} // namespace kernels
+} // namespace neural_network
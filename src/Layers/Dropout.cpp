@@ -0,0 +1,78 @@
+#include "Layers/Dropout.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+namespace neural_network {
+
+namespace {
+
+// The splitmix64 finalizer: every input bit affects every output bit.
+std::uint64_t mix(std::uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+} // namespace
+
+Dropout::Dropout(Index size, double rate) : size_(size), rate_(rate) {
+  if (!(rate >= 0.0 && rate < 1.0)) {
+    throw std::runtime_error("Dropout rate must be in [0, 1).");
+  }
+}
+
+Index Dropout::inputSize() const { return size_; }
+
+Index Dropout::outputSize() const { return size_; }
+
+double Dropout::rate() const { return rate_; }
+
+void Dropout::reserve(Scratch &scratch, Index batch_size) const {
+  if (batch_size <= scratch.capacity && scratch.mask.rows() == size_) {
+    return;
+  }
+  const Index capacity = std::max(batch_size, scratch.capacity);
+  scratch.mask.resize(size_, capacity);
+  scratch.output.resize(size_, capacity);
+  scratch.grad_input.resize(size_, capacity);
+  scratch.capacity = capacity;
+}
+
+ConstMatrixRef Dropout::forwardBatch(const ConstMatrixRef &input,
+                                     Scratch &scratch, bool training) const {
+  assert(input.rows() == size_);
+  if (!training) {
+    return input;
+  }
+  const Index batch = input.cols();
+  reserve(scratch, batch);
+  scratch.batch = batch;
+
+  // An input survives if the top 32 bits of its hash reach the threshold.
+  const auto threshold = static_cast<std::uint64_t>(rate_ * 4294967296.0);
+  const auto scale = static_cast<Scalar>(1.0 / (1.0 - rate_));
+  const std::uint64_t key = mix(mix(scratch.stream) + scratch.passes++);
+  auto mask = scratch.mask.leftCols(batch);
+  Scalar *m = mask.data();
+  for (Index i = 0; i < mask.size(); ++i) {
+    m[i] = (mix(key + std::uint64_t(i)) >> 32) >= threshold ? scale
+                                                             : Scalar(0);
+  }
+  auto output = scratch.output.leftCols(batch);
+  output.noalias() = input.cwiseProduct(mask);
+  return output;
+}
+
+ConstMatrixRef Dropout::backwardBatch(const ConstMatrixRef &grad_output,
+                                      Scratch &scratch) const {
+  const Index batch = scratch.batch;
+  assert(grad_output.rows() == size_ && grad_output.cols() == batch);
+  auto grad_input = scratch.grad_input.leftCols(batch);
+  grad_input.noalias() =
+      grad_output.cwiseProduct(scratch.mask.leftCols(batch));
+  return grad_input;
+}
+
+} // namespace neural_network
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Utilities/Utils.h"
+
+#include <cstdint>
+
+namespace neural_network {
+
+// Inverted dropout: while training, every input is zeroed with probability
+// `rate` and the others are scaled by 1 / (1 - rate), so inference passes
+// the input through unchanged. The masks are a counter-based hash of the
+// scratch's stream and forward count rather than draws from a generator,
+// so they are reproducible and threads share no state.
+class Dropout {
+public:
+  // The mask of the last training pass (0 or 1 / (1 - rate) per input), the
+  // output and the input gradient, one column per sample. Give scratches
+  // used at the same time different streams.
+  struct Scratch {
+    Matrix mask;
+    Matrix output;
+    Matrix grad_input;
+    Index capacity = 0;
+    Index batch = 0;
+    std::uint64_t stream = 0;
+    std::uint64_t passes = 0;
+  };
+
+  // Throws std::runtime_error unless 0 <= rate < 1.
+  Dropout(Index size, double rate);
+
+  Index inputSize() const;
+  Index outputSize() const;
+  double rate() const;
+
+  void reserve(Scratch &scratch, Index batch_size) const;
+  // Without `training` this returns the input itself.
+  ConstMatrixRef forwardBatch(const ConstMatrixRef &input, Scratch &scratch,
+                              bool training) const;
+  // Follows a training forward pass.
+  ConstMatrixRef backwardBatch(const ConstMatrixRef &grad_output,
+                               Scratch &scratch) const;
+
+private:
+  Index size_;
+  double rate_;
+};
+
+} // namespace neural_network
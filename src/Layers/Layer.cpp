@@ -1,8 +1,11 @@
 #include "Layers/Layer.h"
+#include "Layers/DenseKernels.h"
 #include "Utilities/FileReader.h"
 #include "Utilities/FileWriter.h"
+#include "Utilities/Profiler.h"
 #include "Utilities/Random.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <fstream>
@@ -10,56 +13,297 @@
 namespace neural_network {
 
 Layer::Layer(In in, Out out, ActivationFunction activation)
-    : weights_(initWeights(out, in)), biases_(initBiases(out)),
-      last_input_(Vector::Zero(in)), last_z_(Vector::Zero(out)),
-      activation_(std::move(activation)) {}
+    : activation_type_(activation.type()), activation_(std::move(activation)),
+      weights_(nullptr, 0, 0), biases_(nullptr, 0), scratch_() {
+  resize(out, in);
+  weights_ = initWeights(out, in);
+  biases_.setZero();
+}
 
 Layer::Layer()
-    : weights_(), biases_(), last_input_(), last_z_(), cache_(),
+    : activation_type_(ActivationFunction::Type::Identity),
       activation_(
-          ActivationFunction::create(ActivationFunction::Type::Identity)) {}
+          ActivationFunction::create(ActivationFunction::Type::Identity)),
+      weights_(nullptr, 0, 0), biases_(nullptr, 0), optimizer_state_(),
+      scratch_() {}
 
-Matrix Layer::initWeights(Out out, In in) {
-  double stddev = std::sqrt(2.0 / (in + out));
-  return Random::global().normalMatrix(out, in, 0.0, stddev);
+Layer::Layer(const Layer &other)
+    : activation_type_(other.activation_type_),
+      activation_(other.activation_), sparse_input_(other.sparse_input_),
+      weights_(nullptr, 0, 0), biases_(nullptr, 0),
+      optimizer_state_(other.optimizer_state_),
+      scratch_(other.scratch_) {
+  resize(other.weights_.rows(), other.weights_.cols());
+  weights_ = other.weights_;
+  biases_ = other.biases_;
 }
 
-Vector Layer::initBiases(Out out) { return Vector::Zero(out); }
+// Eigen moves steal the heap buffer, so views of the own storage stay
+// valid; views of a model arena are carried over as they are.
+Layer::Layer(Layer &&other) noexcept
+    : activation_type_(other.activation_type_),
+      activation_(other.activation_), sparse_input_(other.sparse_input_),
+      parameters_(std::move(other.parameters_)), weights_(other.weights_),
+      biases_(other.biases_),
+      optimizer_state_(std::move(other.optimizer_state_)),
+      scratch_(std::move(other.scratch_)) {
+  other.bind(nullptr, 0, 0);
+}
 
-Vector Layer::forward(const Vector &input) {
-  assert(input.size() == weights_.cols());
-  last_input_ = input;
-  last_z_ = weights_ * input + biases_;
-  return activation_.apply(last_z_);
+Layer &Layer::operator=(const Layer &other) {
+  if (this != &other) {
+    *this = Layer(other);
+  }
+  return *this;
+}
+
+Layer &Layer::operator=(Layer &&other) noexcept {
+  if (this != &other) {
+    activation_type_ = other.activation_type_;
+    activation_ = other.activation_;
+    sparse_input_ = other.sparse_input_;
+    parameters_ = std::move(other.parameters_);
+    bind(other.weights_.data(), other.weights_.rows(), other.weights_.cols());
+    optimizer_state_ = std::move(other.optimizer_state_);
+    scratch_ = std::move(other.scratch_);
+    other.bind(nullptr, 0, 0);
+  }
+  return *this;
 }
 
+void Layer::bind(Scalar *data, Index rows, Index cols) {
+  // Eigen::Map cannot be reseated by assignment (that copies the data).
+  new (&weights_) Eigen::Map<Matrix>(data, rows, cols);
+  new (&biases_) Eigen::Map<Vector>(data ? data + rows * cols : nullptr, rows);
+}
+
+void Layer::resize(Index rows, Index cols) {
+  parameters_.resize(rows * cols + rows);
+  bind(parameters_.data(), rows, cols);
+}
+
+void Layer::moveParametersTo(Scalar *data) {
+  if (data != weights_.data()) {
+    Eigen::Map<Vector>(data, parameterCount()) =
+        Eigen::Map<const Vector>(weights_.data(), parameterCount());
+  }
+  bind(data, weights_.rows(), weights_.cols());
+  parameters_.resize(0);
+}
+
+Matrix Layer::initWeights(Out out, In in) {
+  Scalar stddev = std::sqrt(Scalar(2) / Scalar(in + out));
+  return Random::global().normalMatrix(out, in, Scalar(0), stddev);
+}
+
+Vector Layer::forward(const Vector &input) { return forwardBatch(input); }
+
 Vector Layer::predict(const Vector &input) const {
   assert(input.size() == weights_.cols());
-  Vector z = weights_ * input + biases_;
-  return activation_.apply(z);
+  Vector out(weights_.rows());
+  kernels::multiply(weights_, input, out);
+  activation_.biasApplyInPlace(out, biases_);
+  return out;
 }
 
 Vector Layer::backward(const Vector &grad_output, const Optimizer &optimizer) {
-  if (!cache_.has_value()) {
-    throw std::runtime_error("Optimizer cache not initialized");
+  return backwardBatch(grad_output, optimizer);
+}
+
+Matrix Layer::forwardBatch(const ConstMatrixRef &input) {
+  return forwardBatch(input, scratch_);
+}
+
+Matrix Layer::predictBatch(const ConstMatrixRef &input) const {
+  assert(input.rows() == weights_.cols());
+  Matrix out(weights_.rows(), input.cols());
+  kernels::multiply(weights_, input, out);
+  activation_.biasApplyInPlace(out, biases_);
+  return out;
+}
+
+Matrix Layer::backwardBatch(const Matrix &grad_output,
+                            const Optimizer &optimizer) {
+  Matrix grad_input = backwardBatch(grad_output, scratch_);
+
+  const Scalar scale = Scalar(1) / static_cast<Scalar>(scratch_.batch);
+  scratch_.grad_w *= scale;
+  scratch_.grad_b *= scale;
+  applyGradients(scratch_.grad_w, scratch_.grad_b, optimizer);
+
+  return grad_input;
+}
+
+void Layer::reserve(Scratch &scratch, Index batch_size) const {
+  if (batch_size <= scratch.capacity &&
+      scratch.input.rows() == weights_.cols() &&
+      scratch.output.rows() == weights_.rows()) {
+    return;
+  }
+  const Index capacity = std::max(batch_size, scratch.capacity);
+  scratch.input.resize(weights_.cols(), capacity);
+  // reserveOutput() may already have grown the output past the capacity.
+  if (scratch.output.rows() != weights_.rows() ||
+      scratch.output.cols() < capacity) {
+    scratch.output.resize(weights_.rows(), capacity);
+  }
+  scratch.grad_z.resize(weights_.rows(), capacity);
+  scratch.grad_input.resize(weights_.cols(), capacity);
+  scratch.sparse_input.reserve(weights_.cols(), capacity);
+  scratch.capacity = capacity;
+}
+
+void Layer::reserveOutput(Scratch &scratch, Index batch_size,
+                          Index tile_size) const {
+  if (scratch.output.rows() != weights_.rows() ||
+      scratch.output.cols() < batch_size) {
+    scratch.output.resize(weights_.rows(),
+                          std::max(batch_size, scratch.capacity));
   }
+  scratch.sparse_input.reserve(weights_.cols(), tile_size);
+}
 
-  Vector deriv = activation_.derivative(last_z_);
-  Vector dz = grad_output.array() * deriv.array();
+ConstMatrixRef Layer::forwardBatch(const ConstMatrixRef &input,
+                                   Scratch &scratch) const {
+  return forwardTile(input, scratch, 0, input.cols(), true);
+}
 
-  Matrix grad_w = dz * last_input_.transpose();
-  Vector grad_b = dz;
+ConstMatrixRef Layer::forwardTile(const ConstMatrixRef &input,
+                                  Scratch &scratch, Index first, Index batch,
+                                  bool keep) const {
+  assert(input.rows() == weights_.cols() && first + input.cols() <= batch);
+  if (first == 0) {
+    if (keep) {
+      reserve(scratch, batch);
+    } else {
+      reserveOutput(scratch, batch, input.cols());
+    }
+    scratch.batch = batch;
+  }
+  assert(scratch.batch == batch);
 
-  optimizer.update(weights_, cache_, grad_w);
-  optimizer.update(biases_, cache_, grad_b);
+  const Index rows = weights_.rows(), cols = weights_.cols();
+  const Index n = input.cols();
+  auto output = scratch.output.middleCols(first, n);
+  {
+    NN_PROFILE_SCOPE(Forward, 2.0 * rows * cols * n,
+                     sizeof(Scalar) * (rows * cols + 2 * cols * n + rows * n));
+    // Conv2D unrolls its patches straight into scratch.input.
+    if (keep && input.data() != scratch.input.col(first).data()) {
+      scratch.input.middleCols(first, n) = input;
+    }
+    // Mostly-zero inputs (the images fed to a first layer) only need the
+    // columns of W at their nonzeros; the compressed copy is kept for the
+    // weight gradient. A tile after a dense one is taken as dense too.
+    bool sparse = false;
+    if (first == 0) {
+      sparse = sparse_input_ && scratch.sparse_input.assign(input);
+    } else if (!scratch.sparse_input.empty()) {
+      sparse = keep ? scratch.sparse_input.append(input)
+                    : scratch.sparse_input.assign(input);
+    }
+    if (sparse) {
+      kernels::multiplySparse(weights_, scratch.sparse_input, output,
+                              keep ? first : 0);
+    } else {
+      scratch.sparse_input.clear();
+      kernels::multiply(weights_, input, output);
+    }
+  }
+  NN_PROFILE_SCOPE(Activation, rows * n,
+                   sizeof(Scalar) * (2 * rows * n + rows));
+  activation_.biasApplyInPlace(output, biases_);
+  return output;
+}
 
-  return weights_.transpose() * dz;
+ConstMatrixRef Layer::backwardBatch(const ConstMatrixRef &grad_output,
+                                    Scratch &scratch) const {
+  scratch.grad_w.resize(weights_.rows(), weights_.cols());
+  scratch.grad_b.resize(biases_.size());
+  return backwardBatch(grad_output, scratch, scratch.grad_w, scratch.grad_b);
 }
 
-void Layer::setCache(const Optimizer &opt) {
-  cache_ = opt.init_cache(weights_.rows(), weights_.cols());
+ConstMatrixRef Layer::backwardBatch(const ConstMatrixRef &grad_output,
+                                    Scratch &scratch, Eigen::Ref<Matrix> grad_w,
+                                    Eigen::Ref<Vector> grad_b, bool accumulate,
+                                    bool input_gradient) const {
+  const Index batch = scratch.batch;
+  assert(grad_output.cols() == batch);
+  assert(grad_w.rows() == weights_.rows() && grad_w.cols() == weights_.cols());
+  assert(grad_b.size() == biases_.size());
+
+  const Index rows = weights_.rows(), cols = weights_.cols();
+  auto grad_z = scratch.grad_z.leftCols(batch);
+  const auto input = scratch.input.leftCols(batch);
+  {
+    NN_PROFILE_SCOPE(Activation, rows * batch,
+                     sizeof(Scalar) * 3 * rows * batch);
+    activation_.backward(grad_output, scratch.output.leftCols(batch), grad_z);
+  }
+
+  // One GEMM for the weight gradient, a second for the input gradient.
+  const int gemms = input_gradient ? 2 : 1;
+  NN_PROFILE_SCOPE(Backward, 2.0 * gemms * rows * cols * batch,
+                   sizeof(Scalar) * gemms *
+                       (rows * cols + rows * batch + cols * batch));
+  if (!scratch.sparse_input.empty()) {
+    kernels::multiplyTransposedBSparse(grad_z, scratch.sparse_input, grad_w,
+                                       accumulate);
+  } else {
+    kernels::multiplyTransposedB(grad_z, input, grad_w, accumulate);
+  }
+  if (accumulate) {
+    grad_b.noalias() += grad_z.rowwise().sum();
+  } else {
+    grad_b.noalias() = grad_z.rowwise().sum();
+  }
+
+  if (!input_gradient) {
+    return scratch.grad_input.leftCols(0);
+  }
+  auto grad_input = scratch.grad_input.leftCols(batch);
+  kernels::multiplyTransposedA(weights_, grad_z, grad_input);
+  return grad_input;
 }
 
-void Layer::freeCache() { cache_.reset(); }
+void Layer::applyGradients(const Matrix &grad_w, const Vector &grad_b,
+                           const Optimizer &optimizer) {
+  if (!optimizer_state_) {
+    throw std::runtime_error("Optimizer state not initialized");
+  }
+  optimizer.update(weights_, optimizer_state_->weights, grad_w);
+  optimizer.update(biases_, optimizer_state_->biases, grad_b);
+}
+
+void Layer::initOptimizerState(const Optimizer &opt) {
+  optimizer_state_ = opt.init_state(weights_.rows(), weights_.cols());
+}
+
+void Layer::resetOptimizerState() { optimizer_state_.reset(); }
+
+Index Layer::inputSize() const { return weights_.cols(); }
+
+Index Layer::outputSize() const { return weights_.rows(); }
+
+Eigen::Map<const Matrix> Layer::weights() const {
+  return Eigen::Map<const Matrix>(weights_.data(), weights_.rows(),
+                                  weights_.cols());
+}
+
+Eigen::Map<const Vector> Layer::biases() const {
+  return Eigen::Map<const Vector>(biases_.data(), biases_.size());
+}
+
+Index Layer::parameterCount() const {
+  return weights_.size() + biases_.size();
+}
+
+ActivationFunction::Type Layer::activationType() const {
+  return activation_type_;
+}
+
+bool Layer::sparseInput() const { return sparse_input_; }
+
+void Layer::setSparseInput(bool sparse) { sparse_input_ = sparse; }
 
 } // namespace neural_network
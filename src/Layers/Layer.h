@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ActivationFunctions/ActivationFunction.h"
+#include "Layers/DenseKernels.h"
 #include "Optimizer/Optimizer.h"
 #include "Utilities/Utils.h"
 
@@ -12,40 +13,139 @@
 namespace neural_network {
 
 class FileReader;
-class FileWriter;
+class Model;
 
 class Layer {
 public:
+  // Forward/backward scratch of one batch: the cached input and activation
+  // output (one column per sample), the gradients with respect to the
+  // pre-activation and to the input and, for a standalone layer, the
+  // weight/bias gradients summed over the batch. The per-sample buffers are
+  // allocated for `capacity` samples and only grow, so once sized for the
+  // largest batch (see reserve()) a training step does no heap allocation;
+  // the current batch occupies their first `batch` columns. The
+  // data-parallel trainer keeps one per thread. sparse_input is a
+  // compressed copy of a mostly-zero input and is empty for a dense one
+  // or when the layer does not take sparse input.
+  struct Scratch {
+    Matrix input;
+    kernels::CompressedMatrix sparse_input;
+    Matrix output;
+    Matrix grad_z;
+    Matrix grad_input;
+    Matrix grad_w;
+    Vector grad_b;
+    Index capacity = 0;
+    Index batch = 0;
+  };
+
   EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
   Layer();
   Layer(In in, Out out, ActivationFunction activation);
 
+  // Copies own their parameters, even if the source views a model arena.
+  Layer(const Layer &other);
+  Layer(Layer &&other) noexcept;
+  Layer &operator=(const Layer &other);
+  Layer &operator=(Layer &&other) noexcept;
+
   Vector forward(const Vector &input);
   Vector predict(const Vector &input) const;
 
   Vector backward(const Vector &grad_output, const Optimizer &optimizer);
 
-  void setCache(const Optimizer &opt);
-  void freeCache();
+  // Batched path: one sample per column. The weight and bias gradients are
+  // averaged over the batch before the optimizer update.
+  Matrix forwardBatch(const ConstMatrixRef &input);
+  Matrix predictBatch(const ConstMatrixRef &input) const;
+
+  Matrix backwardBatch(const Matrix &grad_output, const Optimizer &optimizer);
+
+  // Read-only variants writing all per-batch state into an external scratch,
+  // which grows to the batch size if needed. forwardBatch() returns a view
+  // of scratch.output. backwardBatch() writes the summed gradients to
+  // grad_w/grad_b (by default scratch.grad_w/grad_b), or adds them to it
+  // when accumulate is set, and returns a view of the gradient with respect
+  // to the input; with input_gradient unset that product is skipped and the
+  // view is empty. Views stay valid until the scratch is used again.
+  void reserve(Scratch &scratch, Index batch_size) const;
+  // Sizes only what forwardTile() without `keep` writes: the output of a
+  // batch of batch_size columns and the compressed copy of a tile of
+  // tile_size columns.
+  void reserveOutput(Scratch &scratch, Index batch_size,
+                     Index tile_size) const;
+  ConstMatrixRef forwardBatch(const ConstMatrixRef &input,
+                              Scratch &scratch) const;
+  // forwardBatch() of columns [first, first + input.cols()) of a batch of
+  // `batch` columns, for callers producing the input a tile at a time
+  // (Conv2D); tiles come in order, starting at column 0, and return views
+  // of their own columns of scratch.output. With `keep` the tiles are
+  // stored for backwardBatch(), in place if the input is already at its
+  // columns of scratch.input; without it they are not, and the scratch only
+  // serves inference. Once a tile is not sparse, the later ones are not
+  // scanned.
+  ConstMatrixRef forwardTile(const ConstMatrixRef &input, Scratch &scratch,
+                             Index first, Index batch, bool keep) const;
+  ConstMatrixRef backwardBatch(const ConstMatrixRef &grad_output,
+                               Scratch &scratch) const;
+  ConstMatrixRef backwardBatch(const ConstMatrixRef &grad_output,
+                               Scratch &scratch, Eigen::Ref<Matrix> grad_w,
+                               Eigen::Ref<Vector> grad_b,
+                               bool accumulate = false,
+                               bool input_gradient = true) const;
+
+  void applyGradients(const Matrix &grad_w, const Vector &grad_b,
+                      const Optimizer &optimizer);
+
+  // Optimizer state lives for the whole training session: create it once
+  // before the first step and reset it when training is done.
+  void initOptimizerState(const Optimizer &opt);
+  void resetOptimizerState();
+
+  Index inputSize() const;
+  Index outputSize() const;
+  Eigen::Map<const Matrix> weights() const;
+  Eigen::Map<const Vector> biases() const;
+  ActivationFunction::Type activationType() const;
+
+  // Number of scalars of the weights followed by the biases.
+  Index parameterCount() const;
+
+  // Whether inputs may be mostly zero (the images fed to a first layer,
+  // convolution patches). Only such layers look for nonzeros to take the
+  // sparse products; the others always run the dense ones. Off by default;
+  // Model turns it on for its first layer and Conv2D for its patches.
+  bool sparseInput() const;
+  void setSparseInput(bool sparse);
 
 private:
   static Matrix initWeights(Out out, In in);
-  static Vector initBiases(Out out);
+
+  // Points weights_/biases_ at `data`, which holds the weights (column
+  // major) followed by the biases.
+  void bind(Scalar *data, Index rows, Index cols);
+  // Reallocates the layer's own (uninitialized) parameters.
+  void resize(Index rows, Index cols);
+  // Moves the parameters to `data` (a slice of the model's arena) and
+  // releases the layer's own storage.
+  void moveParametersTo(Scalar *data);
 
   ActivationFunction::Type activation_type_;
   ActivationFunction activation_;
+  bool sparse_input_ = false;
 
-  Matrix weights_;
-  Vector biases_;
+  // Own parameter storage; empty while the layer views a model arena.
+  Vector parameters_;
+  Eigen::Map<Matrix> weights_;
+  Eigen::Map<Vector> biases_;
 
-  std::any cache_; // cache from Optimizer
+  std::optional<OptimizerState> optimizer_state_;
 
-  // Caches for backprop
-  Vector last_input_;
-  Vector last_z_;
+  // Caches for backprop of the last forward pass
+  Scratch scratch_;
 
-  friend FileReader &operator>>(FileReader &, Layer &l);
-  friend FileWriter &operator<<(FileWriter &, const Layer &l);
+  friend class AnyLayer;
+  friend FileReader &operator>>(FileReader &, Model &);
 };
 
 } // namespace neural_network
@@ -0,0 +1,100 @@
+#include "Layers/MaxPool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+namespace neural_network {
+
+MaxPool::MaxPool(ImageShape input, Index window, Index stride)
+    : input_(input), window_(window), stride_(stride == 0 ? window : stride) {
+  if (window <= 0 || stride_ <= 0 || input.size() <= 0 ||
+      input.height < window || input.width < window) {
+    throw std::runtime_error("Pooling window does not fit its input.");
+  }
+  output_ = ImageShape{(input.height - window) / stride_ + 1,
+                       (input.width - window) / stride_ + 1, input.channels};
+}
+
+ImageShape MaxPool::inputShape() const { return input_; }
+
+ImageShape MaxPool::outputShape() const { return output_; }
+
+Index MaxPool::inputSize() const { return input_.size(); }
+
+Index MaxPool::outputSize() const { return output_.size(); }
+
+Index MaxPool::window() const { return window_; }
+
+Index MaxPool::stride() const { return stride_; }
+
+void MaxPool::reserve(Scratch &scratch, Index batch_size) const {
+  if (batch_size <= scratch.capacity &&
+      scratch.output.rows() == outputSize() &&
+      scratch.grad_input.rows() == inputSize()) {
+    return;
+  }
+  const Index capacity = std::max(batch_size, scratch.capacity);
+  scratch.output.resize(outputSize(), capacity);
+  scratch.argmax.resize(outputSize(), capacity);
+  scratch.grad_input.resize(inputSize(), capacity);
+  scratch.capacity = capacity;
+}
+
+ConstMatrixRef MaxPool::forwardBatch(const ConstMatrixRef &input,
+                                     Scratch &scratch) const {
+  assert(input.rows() == inputSize());
+  const Index batch = input.cols();
+  reserve(scratch, batch);
+  scratch.batch = batch;
+
+  const Index channels = input_.channels;
+  for (Index j = 0; j < batch; ++j) {
+    const Scalar *image = input.col(j).data();
+    Scalar *out = scratch.output.col(j).data();
+    int *argmax = scratch.argmax.col(j).data();
+    for (Index oy = 0; oy < output_.height; ++oy) {
+      for (Index ox = 0; ox < output_.width; ++ox) {
+        // The channels of a pixel are contiguous, so every channel's
+        // running maximum is updated at once, a pixel of the window at a
+        // time.
+        const Index first = (oy * stride_ * input_.width + ox * stride_) *
+                            channels;
+        std::copy_n(image + first, channels, out);
+        for (Index c = 0; c < channels; ++c) {
+          argmax[c] = int(first + c);
+        }
+        for (Index ky = 0; ky < window_; ++ky) {
+          for (Index kx = ky == 0 ? 1 : 0; kx < window_; ++kx) {
+            const Index at = first + (ky * input_.width + kx) * channels;
+            for (Index c = 0; c < channels; ++c) {
+              if (image[at + c] > out[c]) {
+                out[c] = image[at + c];
+                argmax[c] = int(at + c);
+              }
+            }
+          }
+        }
+        out += channels;
+        argmax += channels;
+      }
+    }
+  }
+  return scratch.output.leftCols(batch);
+}
+
+ConstMatrixRef MaxPool::backwardBatch(const ConstMatrixRef &grad_output,
+                                      Scratch &scratch) const {
+  const Index batch = scratch.batch;
+  assert(grad_output.rows() == outputSize() && grad_output.cols() == batch);
+  auto grad_input = scratch.grad_input.leftCols(batch);
+  grad_input.setZero();
+  for (Index j = 0; j < batch; ++j) {
+    for (Index i = 0; i < outputSize(); ++i) {
+      grad_input(scratch.argmax(i, j), j) += grad_output(i, j);
+    }
+  }
+  return grad_input;
+}
+
+} // namespace neural_network
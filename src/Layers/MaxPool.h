@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Utilities/Utils.h"
+
+namespace neural_network {
+
+// Max pooling of channels-last images: every channel keeps the largest
+// value of each window x window region, the regions `stride` apart (by
+// default the window, so they tile the image). Rows and columns left over
+// at the border are dropped.
+class MaxPool {
+public:
+  // Output and input gradient, one column per sample, and for every output
+  // the row of the input it was taken from.
+  struct Scratch {
+    Matrix output;
+    Eigen::Matrix<int, Eigen::Dynamic, Eigen::Dynamic> argmax;
+    Matrix grad_input;
+    Index capacity = 0;
+    Index batch = 0;
+  };
+
+  // stride 0 means the window.
+  MaxPool(ImageShape input, Index window, Index stride = 0);
+
+  ImageShape inputShape() const;
+  ImageShape outputShape() const;
+  Index inputSize() const;
+  Index outputSize() const;
+  Index window() const;
+  Index stride() const;
+
+  void reserve(Scratch &scratch, Index batch_size) const;
+  ConstMatrixRef forwardBatch(const ConstMatrixRef &input,
+                              Scratch &scratch) const;
+  ConstMatrixRef backwardBatch(const ConstMatrixRef &grad_output,
+                               Scratch &scratch) const;
+
+private:
+  ImageShape input_;
+  ImageShape output_;
+  Index window_;
+  Index stride_;
+};
+
+} // namespace neural_network
@@ -0,0 +1,59 @@
+#include "Loader/Dataset.h"
+
+#include <cassert>
+
+namespace neural_network {
+
+Dataset::Dataset(Matrix samples, std::vector<int> labels)
+    : samples_(std::move(samples)), labels_(std::move(labels)) {
+  assert(samples_.cols() == neural_network::size(labels_));
+}
+
+Index Dataset::size() const { return samples_.cols(); }
+
+Index Dataset::featureSize() const { return samples_.rows(); }
+
+Dataset::ConstColumn Dataset::sample(Index i) const { return samples_.col(i); }
+
+int Dataset::label(Index i) const { return labels_[i]; }
+
+Dataset::ConstColumns Dataset::batch(Index start, Index count) const {
+  return samples_.middleCols(start, count);
+}
+
+Eigen::Map<const Labels> Dataset::labelBatch(Index start, Index count) const {
+  assert(start + count <= size());
+  return Eigen::Map<const Labels>(labels_.data() + start, count);
+}
+
+void Dataset::gather(const std::vector<int> &indices, Index start, Index count,
+                     Matrix &out) const {
+  assert(start + count <= neural_network::size(indices));
+  out.resize(samples_.rows(), count);
+  for (Index j = 0; j < count; ++j) {
+    out.col(j) = samples_.col(indices[start + j]);
+  }
+}
+
+void Dataset::gather(const std::vector<int> &indices, Index start, Index count,
+                     Matrix &out, Labels &out_labels) const {
+  gather(indices, start, count, out);
+  out_labels.resize(count);
+  for (Index j = 0; j < count; ++j) {
+    out_labels[j] = labels_[indices[start + j]];
+  }
+}
+
+Matrix Dataset::oneHot(Index num_classes) const {
+  Matrix targets = Matrix::Zero(num_classes, size());
+  for (Index j = 0; j < size(); ++j) {
+    targets(labels_[j], j) = Scalar(1);
+  }
+  return targets;
+}
+
+const Matrix &Dataset::samples() const { return samples_; }
+
+const std::vector<int> &Dataset::labels() const { return labels_; }
+
+} // namespace neural_network
@@ -0,0 +1,49 @@
+#pragma once
+#include "Utilities/Utils.h"
+
+#include <vector>
+
+namespace neural_network {
+
+// Labelled samples stored one per column in a single contiguous,
+// column-major matrix. Samples and contiguous mini-batches are handed out
+// as zero-copy views; shuffled mini-batches are gathered into a caller
+// buffer that can be reused across steps.
+class Dataset {
+public:
+  using ConstColumn = Matrix::ConstColXpr;
+  using ConstColumns = Eigen::Block<const Matrix, Eigen::Dynamic,
+                                    Eigen::Dynamic, true>;
+
+  Dataset() = default;
+  Dataset(Matrix samples, std::vector<int> labels);
+
+  Index size() const;
+  Index featureSize() const;
+
+  ConstColumn sample(Index i) const;
+  int label(Index i) const;
+
+  // Samples [start, start + count) and their labels.
+  ConstColumns batch(Index start, Index count) const;
+  Eigen::Map<const Labels> labelBatch(Index start, Index count) const;
+
+  // Copies the samples indices[start, start + count) into out.
+  void gather(const std::vector<int> &indices, Index start, Index count,
+              Matrix &out) const;
+  // Same, also copying the matching labels into out_labels.
+  void gather(const std::vector<int> &indices, Index start, Index count,
+              Matrix &out, Labels &out_labels) const;
+
+  // One-hot encoding of the labels, one column per sample.
+  Matrix oneHot(Index num_classes) const;
+
+  const Matrix &samples() const;
+  const std::vector<int> &labels() const;
+
+private:
+  Matrix samples_;
+  std::vector<int> labels_;
+};
+
+} // namespace neural_network
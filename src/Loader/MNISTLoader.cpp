@@ -1,43 +1,56 @@
 #include "Loader/MNISTLoader.h"
+#include "Utilities/MappedFile.h"
+
 #include <cstdint>
-#include <fstream>
+#include <exception>
+#include <memory>
 
 namespace neural_network {
 
-static uint32_t readUint32BE(std::ifstream &in) {
-  unsigned char bytes[4];
-  in.read(reinterpret_cast<char *>(bytes), 4);
+static uint32_t readUint32BE(const std::byte *bytes) {
   return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) |
          (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
 }
 
 bool loadMNIST(const std::string &image_file, const std::string &label_file,
-               std::vector<Vector> &images, std::vector<int> &labels) {
-  std::ifstream img_f(image_file, std::ios::binary),
-      lbl_f(label_file, std::ios::binary);
-  if (!img_f.is_open() || !lbl_f.is_open())
+               Dataset &dataset) {
+  // Both files are mapped and converted in one pass straight into the
+  // dataset matrix, without an intermediate copy of the raw bytes.
+  std::unique_ptr<MappedFile> img_f, lbl_f;
+  try {
+    img_f = std::make_unique<MappedFile>(image_file);
+    lbl_f = std::make_unique<MappedFile>(label_file);
+  } catch (const std::exception &) {
+    return false;
+  }
+  if (img_f->size() < 16 || lbl_f->size() < 8)
     return false;
-  uint32_t magic_images = readUint32BE(img_f), num_images = readUint32BE(img_f);
-  uint32_t rows = readUint32BE(img_f), cols = readUint32BE(img_f);
-  uint32_t magic_labels = readUint32BE(lbl_f), num_labels = readUint32BE(lbl_f);
+
+  const std::byte *img = img_f->data(), *lbl = lbl_f->data();
+  uint32_t magic_images = readUint32BE(img), num_images = readUint32BE(img + 4);
+  uint32_t rows = readUint32BE(img + 8), cols = readUint32BE(img + 12);
+  uint32_t magic_labels = readUint32BE(lbl), num_labels = readUint32BE(lbl + 4);
   if (magic_images != 2051 || magic_labels != 2049 || num_images != num_labels)
     return false;
-  images.clear();
-  labels.clear();
-  images.reserve(num_images);
-  labels.reserve(num_images);
-  size_t img_size = rows * cols;
-  std::vector<unsigned char> buffer(img_size);
-  for (uint32_t i = 0; i < num_images; ++i) {
-    img_f.read(reinterpret_cast<char *>(buffer.data()), img_size);
-    unsigned char label = 0;
-    lbl_f.read(reinterpret_cast<char *>(&label), 1);
-    Vector vec(img_size);
-    for (size_t j = 0; j < img_size; ++j)
-      vec[j] = buffer[j] / 255.0;
-    images.push_back(vec);
-    labels.push_back(int(label));
-  }
+
+  // Bounded by division: a crafted header must not wrap the product.
+  const size_t img_size = size_t(rows) * cols;
+  if (img_size == 0 || num_images > (img_f->size() - 16) / img_size ||
+      lbl_f->size() - 8 < size_t(num_labels))
+    return false;
+
+  using ByteMatrix =
+      Eigen::Matrix<std::uint8_t, Eigen::Dynamic, Eigen::Dynamic>;
+  Eigen::Map<const ByteMatrix> pixels(
+      reinterpret_cast<const std::uint8_t *>(img + 16), Index(img_size),
+      Index(num_images));
+  Matrix samples = pixels.cast<Scalar>() / Scalar(255);
+
+  std::vector<int> labels(num_labels);
+  for (uint32_t i = 0; i < num_labels; ++i)
+    labels[i] = int(lbl[8 + i]);
+
+  dataset = Dataset(std::move(samples), std::move(labels));
   return true;
 }
 
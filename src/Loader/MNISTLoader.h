@@ -1,11 +1,14 @@
 #pragma once
+#include "Loader/Dataset.h"
 #include "Utilities/Utils.h"
 #include <string>
 #include <vector>
 
 namespace neural_network {
 
+// Loads an IDX image/label file pair. Images are normalized to [0, 1] and
+// stored one per column.
 bool loadMNIST(const std::string &image_file, const std::string &label_file,
-               std::vector<Vector> &images, std::vector<int> &labels);
+               Dataset &dataset);
 
 } // namespace neural_network
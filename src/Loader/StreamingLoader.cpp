@@ -0,0 +1,209 @@
+#include "Loader/StreamingLoader.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+namespace neural_network {
+
+namespace {
+
+uint32_t readUint32BE(std::ifstream &in) {
+  unsigned char bytes[4];
+  in.read(reinterpret_cast<char *>(bytes), 4);
+  return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) |
+         (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+}
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+} // namespace
+
+Dataset::ConstColumns StreamingLoader::Batch::view() const {
+  return samples.leftCols(size);
+}
+
+StreamingLoader::StreamingLoader(const std::string &image_file,
+                                 const std::string &label_file,
+                                 StreamingOptions options)
+    : options_(options), images_(image_file, std::ios::binary),
+      labels_(label_file, std::ios::binary), rng_(options.seed) {
+  if (!images_.is_open() || !labels_.is_open()) {
+    throw std::runtime_error("Could not open IDX files for streaming.");
+  }
+  uint32_t magic_images = readUint32BE(images_),
+           num_images = readUint32BE(images_);
+  uint32_t rows = readUint32BE(images_), cols = readUint32BE(images_);
+  uint32_t magic_labels = readUint32BE(labels_),
+           num_labels = readUint32BE(labels_);
+  // The counts are bounded by the file sizes, by division, before any
+  // buffer is sized from them.
+  const std::uint64_t feature_size = std::uint64_t(rows) * cols;
+  if (!images_ || !labels_ || magic_images != 2051 || magic_labels != 2049 ||
+      num_images != num_labels || feature_size == 0 ||
+      num_images > (std::filesystem::file_size(image_file) - 16) /
+                       feature_size ||
+      num_labels > std::filesystem::file_size(label_file) - 8) {
+    throw std::runtime_error("Invalid IDX files for streaming.");
+  }
+  assert(options_.batch_size > 0 && options_.ring_size > 0);
+  options_.shuffle_window = std::max<Index>(options_.shuffle_window, 1);
+  options_.read_chunk = std::max<Index>(options_.read_chunk, 1);
+
+  num_samples_ = Index(num_images);
+  feature_size_ = Index(feature_size);
+
+  window_pixels_.resize(size_t(options_.shuffle_window * feature_size_));
+  window_labels_.resize(size_t(options_.shuffle_window));
+
+  ring_.resize(options_.ring_size);
+  for (auto &batch : ring_) {
+    batch.samples.resize(feature_size_, options_.batch_size);
+    batch.labels.resize(size_t(options_.batch_size));
+  }
+
+  reader_ = std::thread([this] { readerLoop(); });
+}
+
+StreamingLoader::~StreamingLoader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  slot_free_.notify_all();
+  reader_.join();
+}
+
+Index StreamingLoader::size() const { return num_samples_; }
+
+Index StreamingLoader::featureSize() const { return feature_size_; }
+
+StreamingLoader::Stats StreamingLoader::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+const StreamingLoader::Batch *StreamingLoader::next() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (taken_ > released_) {
+    ++released_;
+    slot_free_.notify_one();
+  }
+  if (taken_ == produced_ && !finished_) {
+    const auto start = Clock::now();
+    ++stats_.stalls;
+    batch_ready_.wait(lock, [this] { return taken_ < produced_ || finished_; });
+    stats_.stall_seconds += secondsSince(start);
+  }
+  if (taken_ < produced_) {
+    ++stats_.batches;
+    return &ring_[taken_++ % ring_.size()];
+  }
+  if (error_) {
+    std::rethrow_exception(error_);
+  }
+  return nullptr;
+}
+
+void StreamingLoader::readerLoop() {
+  try {
+    for (Index emitted = 0; emitted < num_samples_;) {
+      std::size_t slot;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (produced_ - released_ == ring_.size() && !stop_) {
+          const auto start = Clock::now();
+          slot_free_.wait(lock, [this] {
+            return produced_ - released_ < ring_.size() || stop_;
+          });
+          stats_.reader_idle_seconds += secondsSince(start);
+        }
+        if (stop_) {
+          return;
+        }
+        slot = produced_ % ring_.size();
+      }
+
+      // The slot is not visible to the trainer until produced_ advances.
+      Batch &batch = ring_[slot];
+      fillBatch(batch);
+      emitted += batch.size;
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++produced_;
+      }
+      batch_ready_.notify_one();
+    }
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    error_ = std::current_exception();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+  }
+  batch_ready_.notify_all();
+}
+
+// Tops the shuffle window up with the next chunk of the file.
+void StreamingLoader::refillWindow() {
+  const Index count = std::min({options_.read_chunk,
+                                options_.shuffle_window - window_count_,
+                                num_samples_ - samples_read_});
+  if (count <= 0) {
+    return;
+  }
+  images_.read(reinterpret_cast<char *>(window_pixels_.data() +
+                                        window_count_ * feature_size_),
+               std::streamsize(count * feature_size_));
+  labels_.read(reinterpret_cast<char *>(window_labels_.data() + window_count_),
+               std::streamsize(count));
+  if (!images_ || !labels_) {
+    throw std::runtime_error("Unexpected end of IDX file while streaming.");
+  }
+  window_count_ += count;
+  samples_read_ += count;
+}
+
+void StreamingLoader::fillBatch(Batch &batch) {
+  using ByteVector = Eigen::Matrix<std::uint8_t, Eigen::Dynamic, 1>;
+
+  batch.size = 0;
+  while (batch.size < options_.batch_size) {
+    if (window_count_ + options_.read_chunk <= options_.shuffle_window ||
+        window_count_ == 0) {
+      refillWindow();
+    }
+    if (window_count_ == 0) {
+      break;
+    }
+
+    // Emit a random window entry and move the last entry into its place.
+    std::uniform_int_distribution<Index> pick(0, window_count_ - 1);
+    const Index i = pick(rng_);
+    std::uint8_t *pixels = window_pixels_.data() + i * feature_size_;
+
+    batch.samples.col(batch.size) =
+        Eigen::Map<const ByteVector>(pixels, feature_size_).cast<Scalar>() /
+        Scalar(255);
+    batch.labels[size_t(batch.size)] = int(window_labels_[size_t(i)]);
+    ++batch.size;
+
+    const Index last = window_count_ - 1;
+    if (i != last) {
+      std::memcpy(pixels, window_pixels_.data() + last * feature_size_,
+                  size_t(feature_size_));
+      window_labels_[size_t(i)] = window_labels_[size_t(last)];
+    }
+    --window_count_;
+  }
+}
+
+} // namespace neural_network
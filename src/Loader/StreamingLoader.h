@@ -0,0 +1,99 @@
+#pragma once
+#include "Loader/Dataset.h"
+#include "Utilities/Utils.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace neural_network {
+
+struct StreamingOptions {
+  Index batch_size = 64;
+  // Number of mini-batches prepared ahead of the trainer.
+  std::size_t ring_size = 4;
+  // Samples held for shuffling; 1 streams the file in order.
+  Index shuffle_window = 8192;
+  // Samples fetched from the file per read.
+  Index read_chunk = 1024;
+  std::uint64_t seed = 42;
+};
+
+// Streams one pass over an IDX image/label file pair in mini-batches.
+// A background thread reads the files in chunks into a bounded shuffle
+// window and fills a ring of preallocated batch buffers, so reading
+// overlaps training and memory use does not depend on the file size.
+// Samples are shuffled within the window.
+class StreamingLoader {
+public:
+  struct Batch {
+    Matrix samples; // features x batch_size, first `size` columns valid
+    std::vector<int> labels;
+    Index size = 0;
+
+    Dataset::ConstColumns view() const;
+  };
+
+  struct Stats {
+    std::size_t batches = 0;
+    // Times next() found no batch ready and the trainer had to wait.
+    std::size_t stalls = 0;
+    double stall_seconds = 0.0;
+    // Time the reader spent waiting for the trainer to free a buffer.
+    double reader_idle_seconds = 0.0;
+  };
+
+  StreamingLoader(const std::string &image_file, const std::string &label_file,
+                  StreamingOptions options = {});
+  ~StreamingLoader();
+
+  StreamingLoader(const StreamingLoader &) = delete;
+  StreamingLoader &operator=(const StreamingLoader &) = delete;
+
+  // Returns the next mini-batch, or nullptr once the pass is complete.
+  // The batch stays valid until the following call. Rethrows errors from
+  // the reader thread.
+  const Batch *next();
+
+  Index size() const;
+  Index featureSize() const;
+  Stats stats() const;
+
+private:
+  void readerLoop();
+  void refillWindow();
+  void fillBatch(Batch &batch);
+
+  StreamingOptions options_;
+  std::ifstream images_, labels_;
+  Index num_samples_ = 0;
+  Index feature_size_ = 0;
+
+  // Reader-thread state: raw shuffle window and read position.
+  std::vector<std::uint8_t> window_pixels_;
+  std::vector<std::uint8_t> window_labels_;
+  Index window_count_ = 0;
+  Index samples_read_ = 0;
+  std::mt19937_64 rng_;
+
+  std::vector<Batch> ring_;
+  std::size_t produced_ = 0, taken_ = 0, released_ = 0;
+  bool finished_ = false;
+  bool stop_ = false;
+  std::exception_ptr error_;
+  Stats stats_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable batch_ready_;
+  std::condition_variable slot_free_;
+  std::thread reader_;
+};
+
+} // namespace neural_network
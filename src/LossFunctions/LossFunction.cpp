@@ -11,12 +11,12 @@ double LossFunction::mse(const Vector &y_pred, const Vector &y_true) {
 
 Vector LossFunction::mseGrad(const Vector &y_pred, const Vector &y_true) {
   assert(y_pred.size() == y_true.size());
-  return (2.0 / y_pred.size()) * (y_pred - y_true);
+  return Scalar(2.0 / y_pred.size()) * (y_pred - y_true);
 }
 
 double LossFunction::crossEntropy(const Vector &y_pred, const Vector &y_true) {
   assert(y_pred.size() == y_true.size());
-  const double epsilon = 1e-12;
+  const Scalar epsilon = Scalar(1e-12);
   return -(y_true.array() * (y_pred.array() + epsilon).log()).sum();
 }
 
@@ -26,4 +26,34 @@ Vector LossFunction::crossEntropyGrad(const Vector &y_pred,
   return y_pred - y_true;
 }
 
+double LossFunction::mseBatch(const ConstMatrixRef &y_pred,
+                              const ConstMatrixRef &y_true) {
+  assert(y_pred.rows() == y_true.rows() && y_pred.cols() == y_true.cols());
+  return (y_pred - y_true).squaredNorm() / y_pred.size();
+}
+
+void LossFunction::mseGradBatch(const ConstMatrixRef &y_pred,
+                                const ConstMatrixRef &y_true,
+                                Eigen::Ref<Matrix> grad) {
+  assert(y_pred.rows() == y_true.rows() && y_pred.cols() == y_true.cols());
+  assert(grad.rows() == y_pred.rows() && grad.cols() == y_pred.cols());
+  grad.noalias() = Scalar(2.0 / y_pred.rows()) * (y_pred - y_true);
+}
+
+double LossFunction::crossEntropyBatch(const ConstMatrixRef &y_pred,
+                                       const ConstMatrixRef &y_true) {
+  assert(y_pred.rows() == y_true.rows() && y_pred.cols() == y_true.cols());
+  const Scalar epsilon = Scalar(1e-12);
+  return -(y_true.array() * (y_pred.array() + epsilon).log()).sum() /
+         y_pred.cols();
+}
+
+void LossFunction::crossEntropyGradBatch(const ConstMatrixRef &y_pred,
+                                         const ConstMatrixRef &y_true,
+                                         Eigen::Ref<Matrix> grad) {
+  assert(y_pred.rows() == y_true.rows() && y_pred.cols() == y_true.cols());
+  assert(grad.rows() == y_pred.rows() && grad.cols() == y_pred.cols());
+  grad.noalias() = y_pred - y_true;
+}
+
 } // namespace neural_network
@@ -10,6 +10,21 @@ public:
 
   static double crossEntropy(const Vector &y_pred, const Vector &y_true);
   static Vector crossEntropyGrad(const Vector &y_pred, const Vector &y_true);
+
+  // Batched variants: one sample per column. Losses are averaged over the
+  // batch, gradients are per sample (the layers average them) and written
+  // into `grad`, which is sized like y_pred.
+  static double mseBatch(const ConstMatrixRef &y_pred,
+                         const ConstMatrixRef &y_true);
+  static void mseGradBatch(const ConstMatrixRef &y_pred,
+                           const ConstMatrixRef &y_true,
+                           Eigen::Ref<Matrix> grad);
+
+  static double crossEntropyBatch(const ConstMatrixRef &y_pred,
+                                  const ConstMatrixRef &y_true);
+  static void crossEntropyGradBatch(const ConstMatrixRef &y_pred,
+                                    const ConstMatrixRef &y_true,
+                                    Eigen::Ref<Matrix> grad);
 };
 
 } // namespace neural_network
@@ -0,0 +1,64 @@
+#include "LossFunctions/SoftmaxCrossEntropy.h"
+#include <cassert>
+#include <cmath>
+
+namespace neural_network {
+
+namespace {
+
+// -log softmax(z)[label] = log(sum(exp(z - max))) + max - z[label]
+template <typename Column>
+double columnLoss(const Column &z, int label) {
+  assert(label >= 0 && label < z.size());
+  const Scalar max = z.maxCoeff();
+  const Scalar sum = (z.array() - max).exp().sum();
+  return double(std::log(sum) + max - z[label]);
+}
+
+// Same loss; additionally overwrites grad with softmax(z) - one_hot(label).
+template <typename Column, typename GradColumn>
+double columnLossGrad(const Column &z, int label, GradColumn &&grad) {
+  assert(label >= 0 && label < z.size());
+  const Scalar max = z.maxCoeff();
+  grad = (z.array() - max).exp().matrix();
+  const Scalar sum = grad.sum();
+  grad /= sum;
+  grad[label] -= Scalar(1);
+  return double(std::log(sum) + max - z[label]);
+}
+
+} // namespace
+
+double SoftmaxCrossEntropy::loss(const Vector &logits, int label) {
+  return columnLoss(logits, label);
+}
+
+double SoftmaxCrossEntropy::lossGrad(const Vector &logits, int label,
+                                     Vector &grad) {
+  grad.resize(logits.size());
+  return columnLossGrad(logits, label, grad);
+}
+
+double SoftmaxCrossEntropy::lossBatch(const ConstMatrixRef &logits,
+                                      const ConstLabelsRef &labels) {
+  assert(labels.size() == logits.cols());
+  double total = 0.0;
+  for (Index j = 0; j < logits.cols(); ++j) {
+    total += columnLoss(logits.col(j), labels[j]);
+  }
+  return logits.cols() > 0 ? total / logits.cols() : 0.0;
+}
+
+double SoftmaxCrossEntropy::lossGradBatch(const ConstMatrixRef &logits,
+                                          const ConstLabelsRef &labels,
+                                          Eigen::Ref<Matrix> grad) {
+  assert(labels.size() == logits.cols());
+  assert(grad.rows() == logits.rows() && grad.cols() == logits.cols());
+  double total = 0.0;
+  for (Index j = 0; j < logits.cols(); ++j) {
+    total += columnLossGrad(logits.col(j), labels[j], grad.col(j));
+  }
+  return logits.cols() > 0 ? total / logits.cols() : 0.0;
+}
+
+} // namespace neural_network
@@ -0,0 +1,26 @@
+#pragma once
+#include "Utilities/Utils.h"
+
+namespace neural_network {
+
+// Softmax followed by cross-entropy, fused into one numerically stable
+// pass over the raw logits of the output layer (which should use the
+// Identity activation). Targets are integer class labels. The gradient
+// with respect to the logits is softmax(logits) - one_hot(label).
+class SoftmaxCrossEntropy {
+public:
+  static double loss(const Vector &logits, int label);
+  static double lossGrad(const Vector &logits, int label, Vector &grad);
+
+  // Batched variants: one sample per column. Losses are averaged over the
+  // batch, gradients are per sample (the layers average them). grad must
+  // already have the shape of logits; it is typically a view of a reused
+  // workspace.
+  static double lossBatch(const ConstMatrixRef &logits,
+                          const ConstLabelsRef &labels);
+  static double lossGradBatch(const ConstMatrixRef &logits,
+                              const ConstLabelsRef &labels,
+                              Eigen::Ref<Matrix> grad);
+};
+
+} // namespace neural_network
@@ -0,0 +1,49 @@
+#include "Model/Architectures.h"
+
+#include <stdexcept>
+
+namespace neural_network {
+
+Architecture architecture(int choice) {
+  using Type = ActivationFunction::Type;
+  switch (choice) {
+  case 1:
+    return {{784, 128, 10}, {Type::ReLU, Type::Identity}};
+  case 2:
+    return {{784, 128, 64, 10}, {Type::ReLU, Type::Sigmoid, Type::Identity}};
+  case 3:
+    return {{784, 128, 64, 32, 10},
+            {Type::ReLU, Type::ReLU, Type::ReLU, Type::Identity}};
+  }
+  throw std::runtime_error("Unknown architecture");
+}
+
+Model makeArchitecture(int choice) {
+  const Architecture a = architecture(choice);
+  return Model(a.layer_sizes, a.activations);
+}
+
+bool isClassifier(int choice) { return choice == 3; }
+
+Model makeLeNet(bool batch_norm, double dropout) {
+  using Type = ActivationFunction::Type;
+  const auto relu = [] { return ActivationFunction::create(Type::ReLU); };
+  const Conv2D conv1(ImageShape{28, 28, 1}, 6, 5, relu());
+  const MaxPool pool1(conv1.outputShape(), 2);
+  const Conv2D conv2(pool1.outputShape(), 16, 5, relu());
+  const MaxPool pool2(conv2.outputShape(), 2);
+
+  std::vector<AnyLayer> layers{conv1, pool1, conv2};
+  if (batch_norm) {
+    layers.emplace_back(BatchNorm(conv2.outputShape()));
+  }
+  layers.emplace_back(pool2);
+  layers.emplace_back(Layer(In(pool2.outputSize()), Out(120), relu()));
+  layers.emplace_back(Dropout(120, dropout));
+  layers.emplace_back(Layer(In(120), Out(84), relu()));
+  layers.emplace_back(
+      Layer(In(84), Out(10), ActivationFunction::create(Type::Identity)));
+  return Model(std::move(layers));
+}
+
+} // namespace neural_network
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Model/Model.h"
+
+#include <vector>
+
+namespace neural_network {
+
+// Layer widths (input first) and one activation per layer.
+struct Architecture {
+  std::vector<size_t> layer_sizes;
+  std::vector<ActivationFunction::Type> activations;
+};
+
+// The MNIST networks offered by the training driver, numbered as in its
+// menu (1-3). Architecture 3 ends in raw logits for the fused softmax
+// cross-entropy on integer labels; the others regress one-hot targets.
+Architecture architecture(int choice);
+Model makeArchitecture(int choice);
+bool isClassifier(int choice);
+
+// A LeNet-5 style network for MNIST digits: two 5x5 convolutions (6 and 16
+// filters, ReLU), each followed by 2x2 max pooling, then dense layers of
+// 120 and 84 ReLU units, the first followed by dropout, and raw logits for
+// the softmax cross-entropy. With batch_norm the second convolution's
+// output is batch-normalized before pooling.
+Model makeLeNet(bool batch_norm = false, double dropout = 0.25);
+
+} // namespace neural_network
@@ -1,83 +1,288 @@
 #include "Model/Model.h"
+#include "Inference/InferenceModel.h"
+#include "Utilities/Profiler.h"
 #include <Eigen/Core>
+#include <algorithm>
 #include <cassert>
+#include <optional>
+#include <string>
 
 namespace neural_network {
 
 Model::Model(std::initializer_list<size_t> layer_sizes,
-             std::initializer_list<ActivationFunction::Type> activations) {
-  assert(layer_sizes.size() == activations.size() + 1);
+             std::initializer_list<ActivationFunction::Type> activations)
+    : Model(std::vector<size_t>(layer_sizes),
+            std::vector<ActivationFunction::Type>(activations)) {}
 
-  auto it = activations.begin();
-  for (auto i = layer_sizes.begin(); i + 1 != layer_sizes.end(); ++i, ++it) {
-    layers_.emplace_back(In(*i), Out(*(i + 1)),
-                         ActivationFunction::create(*it));
+Model::Model(const std::vector<size_t> &layer_sizes,
+             const std::vector<ActivationFunction::Type> &activations) {
+  if (layer_sizes.size() < 2 ||
+      layer_sizes.size() != activations.size() + 1) {
+    throw std::runtime_error("Model needs one activation per layer.");
   }
+  layers_.reserve(activations.size());
+  for (size_t i = 0; i < activations.size(); ++i) {
+    layers_.emplace_back(Layer(In(Index(layer_sizes[i])),
+                               Out(Index(layer_sizes[i + 1])),
+                               ActivationFunction::create(activations[i])));
+  }
+  bindLayers();
 }
 
-Vector Model::forward(const Vector &input) {
+Model::Model(std::vector<AnyLayer> layers) : layers_(std::move(layers)) {
   if (layers_.empty()) {
     throw std::runtime_error("Model has no layers.");
   }
-  Vector x = input;
-  for (auto &layer : layers_) {
-    x = layer.forward(x);
+  for (size_t i = 1; i < layers_.size(); ++i) {
+    if (layers_[i].inputSize() != layers_[i - 1].outputSize()) {
+      throw std::runtime_error("Layer " + std::to_string(i) +
+                               " does not take the previous layer's output.");
+    }
+  }
+  bindLayers();
+}
+
+Model::Model(const Model &other)
+    : layers_(other.layers_), optimizer_state_(other.optimizer_state_),
+      scratch_(other.scratch_),
+      accumulated_samples_(other.accumulated_samples_) {
+  bindLayers();
+}
+
+Model &Model::operator=(const Model &other) {
+  if (this != &other) {
+    *this = Model(other);
+  }
+  return *this;
+}
+
+void Model::bindLayers() {
+  // Only the first layer sees the raw inputs, which may be mostly zero.
+  if (!layers_.empty()) {
+    if (auto *dense = layers_.front().get<Layer>()) {
+      dense->setSparseInput(true);
+    }
+  }
+  constexpr Index kAlignment = Index(64 / sizeof(Scalar));
+  offsets_.resize(layers_.size());
+  segments_.clear();
+  Index total = 0;
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    offsets_[i] = total;
+    // Layers without parameters (dropout, pooling) take no arena space.
+    const Index weights = layers_[i].weights().size();
+    const Index biases = layers_[i].biases().size();
+    if (weights > 0) {
+      segments_.emplace_back(total, weights);
+    }
+    if (biases > 0) {
+      segments_.emplace_back(total + weights, biases);
+    }
+    total += (layers_[i].parameterCount() + kAlignment - 1) / kAlignment *
+             kAlignment;
+  }
+  Vector arena = Vector::Zero(total);
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    layers_[i].moveParametersTo(arena.data() + offsets_[i]);
+  }
+  parameters_ = std::move(arena);
+
+  statistics_offsets_.resize(layers_.size());
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    statistics_offsets_[i] = total;
+    total += layers_[i].statisticsCount();
   }
-  return x;
+  gradient_size_ = total;
 }
 
-std::vector<Vector> Model::forwardTrain(const Vector &x) {
-  std::vector<Vector> activations;
-  activations.reserve(layers_.size() + 1);
+Vector Model::forward(const Vector &input) { return forwardBatch(input); }
+
+Matrix Model::forwardBatch(const ConstMatrixRef &input) {
+  if (scratch_.layers.size() != layers_.size()) {
+    scratch_ = makeScratch();
+  }
+  return forwardBatch(input, scratch_, false);
+}
+
+InferenceModel Model::freeze() const { return InferenceModel(*this); }
+
+Model::Scratch Model::makeScratch(Index batch_size,
+                                  std::uint64_t stream) const {
+  Scratch scratch{{}, Matrix(), Vector::Zero(gradient_size_)};
+  scratch.layers.reserve(layers_.size());
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    // Every layer of every stream draws its own dropout masks.
+    scratch.layers.push_back(
+        layers_[i].makeScratch(stream * layers_.size() + i));
+    if (batch_size > 0) {
+      layers_[i].reserve(scratch.layers[i], batch_size);
+    }
+  }
+  if (batch_size > 0 && !layers_.empty()) {
+    scratch.loss_grad.resize(layers_.back().outputSize(), batch_size);
+  }
+  return scratch;
+}
 
-  Vector current = x;
-  activations.push_back(current);
+Eigen::Ref<Matrix> Model::Scratch::lossGrad(Index rows, Index batch) {
+  if (loss_grad.cols() < batch || loss_grad.rows() != rows) {
+    loss_grad.resize(rows, batch);
+  }
+  return loss_grad.leftCols(batch);
+}
 
-  for (auto &layer : layers_) {
-    current = layer.forward(current);
-    activations.push_back(current);
+// Each layer returns a view of its output (or, for dropout in inference,
+// of its input), which the next layer reads.
+ConstMatrixRef Model::forwardBatch(const ConstMatrixRef &input,
+                                   Scratch &scratch, bool training) const {
+  if (layers_.empty()) {
+    throw std::runtime_error("Model has no layers.");
   }
-  return activations;
+  assert(scratch.layers.size() == layers_.size());
+  std::optional<ConstMatrixRef> x(input);
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    NN_PROFILE_LAYER(i);
+    const ConstMatrixRef output =
+        layers_[i].forwardBatch(*x, scratch.layers[i], training);
+    x.emplace(output);
+  }
+  return *x;
 }
 
-void Model::backward(const Vector &grad, const Optimizer &opt) {
-  Vector g = grad;
+// Likewise each layer returns a view of the gradient of its input. The
+// first layer's input gradient is never needed.
+void Model::backwardBatch(const ConstMatrixRef &grad, Scratch &scratch,
+                          bool accumulate) const {
+  assert(scratch.layers.size() == layers_.size());
+  assert(scratch.grads.size() == gradient_size_);
+  std::optional<ConstMatrixRef> grad_output(grad);
   for (int i = int(layers_.size()) - 1; i >= 0; --i) {
-    g = layers_[i].backward(g, opt);
+    NN_PROFILE_LAYER(i);
+    const ConstMatrixRef grad_input = layers_[i].backwardBatch(
+        *grad_output, scratch.layers[i], scratch.grads.data() + offsets_[i],
+        scratch.grads.data() + statistics_offsets_[i], accumulate, i > 0);
+    grad_output.emplace(grad_input);
   }
 }
 
-void Model::trainStep(
-    const Vector &x, const Vector &y,
-    const std::function<Vector(const Vector &, const Vector &)> &lossGrad,
-    Optimizer &optimizer) {
-  for (auto &layer : layers_) {
-    layer.setCache(optimizer);
+void Model::applyGradients(Scratch &scratch, Index batch_size,
+                           const Optimizer &optimizer) {
+  assert(scratch.grads.size() == gradient_size_);
+  assert(batch_size > 0);
+  if (!optimizer_state_.has_value()) {
+    throw std::runtime_error("Optimizer state not initialized");
+  }
+  optimizer.updateArena(parameters_, optimizer_state_,
+                        scratch.grads.head(parameters_.size()),
+                        Scalar(1) / static_cast<Scalar>(batch_size),
+                        segments_);
+  for (size_t i = 0; i < layers_.size(); ++i) {
+    if (layers_[i].statisticsCount() > 0) {
+      layers_[i].updateStatistics(
+          scratch.grads.data() + statistics_offsets_[i], batch_size);
+    }
+  }
+}
+
+void Model::initOptimizerState(const Optimizer &optimizer) {
+  optimizer_state_ = optimizer.init_cache(int(parameters_.size()), 1);
+}
+
+void Model::trainStep(const Vector &x, const Vector &y,
+                      const LossGrad &lossGrad, Optimizer &optimizer) {
+  trainBatch(
+      x, y,
+      [&](const ConstMatrixRef &output, const ConstMatrixRef &target,
+          Eigen::Ref<Matrix> grad) { grad = lossGrad(output, target); },
+      optimizer);
+}
+
+void Model::trainBatch(const ConstMatrixRef &X, const ConstMatrixRef &Y,
+                       const BatchLossGrad &lossGrad, Optimizer &optimizer) {
+  accumulateBatch(X, Y, lossGrad);
+  applyAccumulated(optimizer);
+}
+
+double Model::trainBatch(const ConstMatrixRef &X, const ConstLabelsRef &labels,
+                         const LabelLossGrad &lossGrad, Optimizer &optimizer) {
+  const double loss = accumulateBatch(X, labels, lossGrad);
+  applyAccumulated(optimizer);
+  return loss;
+}
+
+void Model::accumulateBatch(const ConstMatrixRef &X, const ConstMatrixRef &Y,
+                            const BatchLossGrad &lossGrad) {
+  assert(X.cols() == Y.cols());
+  if (scratch_.layers.size() != layers_.size()) {
+    scratch_ = makeScratch();
   }
+  const ConstMatrixRef output = forwardBatch(X, scratch_);
+  auto grad = scratch_.lossGrad(output.rows(), X.cols());
+  lossGrad(output, Y, grad);
 
-  auto activations = forwardTrain(x);
-  Vector grad = lossGrad(activations.back(), y);
+  backwardBatch(grad, scratch_, accumulated_samples_ > 0);
+  accumulated_samples_ += X.cols();
+}
 
-  backward(grad, optimizer);
+double Model::accumulateBatch(const ConstMatrixRef &X,
+                              const ConstLabelsRef &labels,
+                              const LabelLossGrad &lossGrad) {
+  assert(X.cols() == labels.size());
+  if (scratch_.layers.size() != layers_.size()) {
+    scratch_ = makeScratch();
+  }
+  const ConstMatrixRef output = forwardBatch(X, scratch_);
+  auto grad = scratch_.lossGrad(output.rows(), X.cols());
+  const double loss = lossGrad(output, labels, grad);
 
-  for (auto &layer : layers_) {
-    layer.freeCache();
+  backwardBatch(grad, scratch_, accumulated_samples_ > 0);
+  accumulated_samples_ += X.cols();
+  return loss;
+}
+
+void Model::applyAccumulated(const Optimizer &optimizer) {
+  if (accumulated_samples_ == 0) {
+    return;
   }
+  applyGradients(scratch_, accumulated_samples_, optimizer);
+  accumulated_samples_ = 0;
 }
 
-void Model::train(const std::vector<Vector> &xs, const std::vector<Vector> &ys,
-                  int epochs, LossFunction loss, Optimizer &optimizer) {
-  assert(xs.size() == ys.size());
+void Model::train(const Matrix &xs, const Matrix &ys, int epochs,
+                  const BatchLossGrad &lossGrad, Optimizer &optimizer,
+                  Index batch_size, Index accumulation_steps) {
+  assert(xs.cols() == ys.cols());
+  assert(batch_size > 0 && accumulation_steps > 0);
+  const Index n = xs.cols();
+  initOptimizerState(optimizer);
   for (int e = 0; e < epochs; ++e) {
-    for (size_t i = 0; i < xs.size(); ++i) {
-      trainStep(xs[i], ys[i], LossFunction::mseGrad, optimizer);
+    Index micro_batches = 0;
+    for (Index start = 0; start < n; start += batch_size) {
+      const Index count = std::min(batch_size, n - start);
+      accumulateBatch(xs.middleCols(start, count), ys.middleCols(start, count),
+                      lossGrad);
+      if (++micro_batches % accumulation_steps == 0) {
+        applyAccumulated(optimizer);
+      }
     }
+    applyAccumulated(optimizer);
   }
 }
 
-const std::vector<Layer, Eigen::aligned_allocator<Layer>> &
-Model::layers() const {
-  return layers_;
+const std::vector<AnyLayer> &Model::layers() const { return layers_; }
+
+const Vector &Model::parameters() const { return parameters_; }
+
+const std::any &Model::optimizerState() const { return optimizer_state_; }
+
+void Model::restore(const ConstVectorRef &parameters,
+                    std::any optimizer_state) {
+  if (parameters.size() != parameters_.size()) {
+    throw std::runtime_error("Saved parameters do not match the model.");
+  }
+  parameters_ = parameters;
+  optimizer_state_ = std::move(optimizer_state);
+  accumulated_samples_ = 0;
 }
 
 } // namespace neural_network
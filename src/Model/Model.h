@@ -1,43 +1,162 @@
 #pragma once
 
-#include "Layers/Layer.h"
+#include "Layers/AnyLayer.h"
 #include "LossFunctions/LossFunction.h"
 
+#include <any>
+#include <cstdint>
 #include <functional>
 #include <initializer_list>
 #include <vector>
 
 namespace neural_network {
 
-class FileReader;
-class FileWriter;
+class InferenceModel;
 
 class Model {
 public:
+  using LossGrad = std::function<Vector(const Vector &, const Vector &)>;
+  // Loss head over targets: writes the gradient with respect to the output
+  // (first argument) into the last argument, which is sized like it.
+  using BatchLossGrad = std::function<void(
+      const ConstMatrixRef &, const ConstMatrixRef &, Eigen::Ref<Matrix>)>;
+  // Mean loss of a batch given the output and the targets.
+  using BatchLoss =
+      std::function<double(const ConstMatrixRef &, const ConstMatrixRef &)>;
+  // Loss head over integer labels: writes the gradient with respect to the
+  // output into the last argument (already sized like the output) and
+  // returns the mean loss of the batch.
+  using LabelLossGrad = std::function<double(
+      const ConstMatrixRef &, const ConstLabelsRef &, Eigen::Ref<Matrix>)>;
+  // Training workspace: per-layer forward/backward scratch, the loss
+  // gradient buffer of the label heads and the gradients of all layers
+  // summed over a batch, laid out exactly like the parameter arena and
+  // followed by the batch statistics of the batch-norm layers (summed the
+  // same way). Buffers are sized for the largest batch seen (or the one
+  // given to makeScratch()), so steady-state training steps do no heap
+  // allocation.
+  struct Scratch {
+    std::vector<AnyLayer::Scratch> layers;
+    Matrix loss_grad;
+    Vector grads;
+
+    // The first `batch` columns of loss_grad, grown to fit if needed.
+    Eigen::Ref<Matrix> lossGrad(Index rows, Index batch);
+  };
+
   Model(std::initializer_list<size_t> layer_sizes,
         std::initializer_list<ActivationFunction::Type> activations);
+  // Same from runtime lists (e.g. a config file); throws if there is not
+  // exactly one activation per layer.
+  Model(const std::vector<size_t> &layer_sizes,
+        const std::vector<ActivationFunction::Type> &activations);
+  // Any stack of layers, e.g. convolutions and pooling ahead of dense
+  // layers; throws unless each layer takes the previous one's output.
+  explicit Model(std::vector<AnyLayer> layers);
+
+  Model(const Model &other);
+  Model(Model &&other) noexcept = default;
+  Model &operator=(const Model &other);
+  Model &operator=(Model &&other) noexcept = default;
 
+  // Inference: dropout is off and batch normalization uses its running
+  // statistics.
   Vector forward(const Vector &input);
+  Matrix forwardBatch(const ConstMatrixRef &input);
+
+  // Read-only snapshot of the current weights for (concurrent) inference.
+  InferenceModel freeze() const;
+
+  // Creates the optimizer state of the parameter arena used by
+  // trainStep/trainBatch. Must be called once before training; train() does
+  // it itself.
+  void initOptimizerState(const Optimizer &optimizer);
+
+  void trainStep(const Vector &x, const Vector &y, const LossGrad &lossGrad,
+                 Optimizer &optimizer);
+
+  // One optimizer step on a mini-batch stored one sample per column.
+  void trainBatch(const ConstMatrixRef &X, const ConstMatrixRef &Y,
+                  const BatchLossGrad &lossGrad, Optimizer &optimizer);
+  // Same with integer class labels; returns the mean loss of the batch.
+  double trainBatch(const ConstMatrixRef &X, const ConstLabelsRef &labels,
+                    const LabelLossGrad &lossGrad, Optimizer &optimizer);
+
+  // Gradient accumulation: accumulateBatch() runs forward/backward on one
+  // micro-batch and adds its gradients to those gathered since the last
+  // applyAccumulated(), which averages them over every accumulated sample
+  // and takes a single optimizer step. K micro-batches followed by one
+  // applyAccumulated() update the model like one batch of all their samples,
+  // while the activations only ever hold one micro-batch.
+  void accumulateBatch(const ConstMatrixRef &X, const ConstMatrixRef &Y,
+                       const BatchLossGrad &lossGrad);
+  // Same with integer class labels; returns the mean loss of the
+  // micro-batch.
+  double accumulateBatch(const ConstMatrixRef &X, const ConstLabelsRef &labels,
+                         const LabelLossGrad &lossGrad);
+  void applyAccumulated(const Optimizer &optimizer);
+
+  // Read-only forward/backward over an external per-layer scratch, for
+  // callers that run several batches (or shards of one batch) at once.
+  // forwardBatch() returns a view of the scratch.
+  // backwardBatch() leaves the summed gradients in the scratch (adding them
+  // to the ones already there when accumulate is set) and applyGradients()
+  // averages them over batch_size and updates the whole parameter arena in
+  // one fused optimizer pass (and updates the running statistics of the
+  // batch-norm layers). Scratches used at the same time need different
+  // streams so that their dropout masks differ. Without `training`,
+  // forwardBatch() runs in inference mode and must not be followed by
+  // backwardBatch().
+  Scratch makeScratch(Index batch_size = 0, std::uint64_t stream = 0) const;
+  ConstMatrixRef forwardBatch(const ConstMatrixRef &input, Scratch &scratch,
+                              bool training = true) const;
+  void backwardBatch(const ConstMatrixRef &grad, Scratch &scratch,
+                     bool accumulate = false) const;
+  void applyGradients(Scratch &scratch, Index batch_size,
+                      const Optimizer &optimizer);
 
-  void trainStep(
-      const Vector &x, const Vector &y,
-      const std::function<Vector(const Vector &, const Vector &)> &lossGrad,
-      Optimizer &optimizer);
+  // Trains on samples stored one per column, in order, in mini-batches of
+  // batch_size, with the gradients of lossGrad. With accumulation_steps > 1
+  // every optimizer step covers that many consecutive mini-batches.
+  void train(const Matrix &xs, const Matrix &ys, int epochs,
+             const BatchLossGrad &lossGrad, Optimizer &optimizer,
+             Index batch_size = 1, Index accumulation_steps = 1);
 
-  void train(const std::vector<Vector> &xs, const std::vector<Vector> &ys,
-             int epochs, LossFunction loss, Optimizer &optimizer);
+  const std::vector<AnyLayer> &layers() const;
 
-  const std::vector<Layer, Eigen::aligned_allocator<Layer>> &layers() const;
+  // Every layer's weights and biases, stored back to back in one buffer.
+  const Vector &parameters() const;
+  // Optimizer state of the arena: an OptimizerCache once
+  // initOptimizerState() has run, empty before.
+  const std::any &optimizerState() const;
+  // Continues from saved training state: copies `parameters` (laid out like
+  // parameters()) into the arena, replaces the optimizer state and drops any
+  // accumulated gradients. Throws if the size does not match.
+  void restore(const ConstVectorRef &parameters, std::any optimizer_state);
 
 private:
-  std::vector<Layer, Eigen::aligned_allocator<Layer>> layers_;
+  // Moves the layers' parameters into a freshly laid out arena.
+  void bindLayers();
 
-  std::vector<Vector> forwardTrain(const Vector &x);
+  std::vector<AnyLayer> layers_;
 
-  void backward(const Vector &grad, const Optimizer &opt);
+  // Layer i owns parameters_[offsets_[i], offsets_[i] +
+  // layers_[i].parameterCount()); blocks start on 64-byte boundaries and
+  // the padding stays zero.
+  Vector parameters_;
+  std::vector<Index> offsets_;
+  // Every weight and bias tensor in the arena, for layer-wise optimizers.
+  Optimizer::Segments segments_;
+  // Layer i writes its batch statistics to Scratch::grads at
+  // statistics_offsets_[i], past the arena.
+  std::vector<Index> statistics_offsets_;
+  Index gradient_size_ = 0;
+  std::any optimizer_state_;
 
-  friend FileReader &operator>>(FileReader &, Model &);
-  friend FileWriter &operator<<(FileWriter &, const Model &);
+  // Scratch of trainStep/trainBatch/accumulateBatch and the number of
+  // samples whose gradients scratch_.grads holds.
+  Scratch scratch_;
+  Index accumulated_samples_ = 0;
 };
 
 } // namespace neural_network
@@ -0,0 +1,94 @@
+#include "Optimizer/LearningRateSchedule.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace neural_network {
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+
+// Cosine interpolation from `from` (progress 0) to `to` (progress 1).
+double cosineBetween(double from, double to, double progress) {
+  progress = std::clamp(progress, 0.0, 1.0);
+  return to + (from - to) * 0.5 * (1.0 + std::cos(kPi * progress));
+}
+
+} // namespace
+
+LearningRateSchedule::LearningRateSchedule(Type type) : type_(type) {}
+
+LearningRateSchedule LearningRateSchedule::Constant() {
+  return LearningRateSchedule(Type::Constant);
+}
+
+LearningRateSchedule LearningRateSchedule::Step(Index step_size,
+                                                double gamma) {
+  assert(step_size > 0);
+  LearningRateSchedule schedule(Type::Step);
+  schedule.total_steps_ = step_size;
+  schedule.gamma_ = gamma;
+  return schedule;
+}
+
+LearningRateSchedule LearningRateSchedule::Cosine(Index total_steps,
+                                                  double min_factor) {
+  assert(total_steps > 0);
+  LearningRateSchedule schedule(Type::Cosine);
+  schedule.total_steps_ = total_steps;
+  schedule.min_factor_ = min_factor;
+  return schedule;
+}
+
+LearningRateSchedule LearningRateSchedule::OneCycle(Index total_steps,
+                                                    double pct_start,
+                                                    double div_factor,
+                                                    double final_div_factor) {
+  assert(total_steps > 0 && pct_start > 0.0 && pct_start < 1.0);
+  LearningRateSchedule schedule(Type::OneCycle);
+  schedule.total_steps_ = total_steps;
+  schedule.pct_start_ = pct_start;
+  schedule.div_factor_ = div_factor;
+  schedule.final_div_factor_ = final_div_factor;
+  return schedule;
+}
+
+LearningRateSchedule
+LearningRateSchedule::withWarmup(Index warmup_steps) const {
+  LearningRateSchedule schedule = *this;
+  schedule.warmup_steps_ = std::max<Index>(warmup_steps, 0);
+  return schedule;
+}
+
+LearningRateSchedule::Type LearningRateSchedule::type() const { return type_; }
+
+double LearningRateSchedule::factor(Index step) const {
+  if (step < warmup_steps_) {
+    return double(step + 1) / double(warmup_steps_);
+  }
+  step -= warmup_steps_;
+
+  switch (type_) {
+  case Type::Step:
+    return std::pow(gamma_, double(step / total_steps_));
+  case Type::Cosine:
+    return cosineBetween(1.0, min_factor_, double(step) / total_steps_);
+  case Type::OneCycle: {
+    const double initial = 1.0 / div_factor_;
+    const double final = initial / final_div_factor_;
+    const double peak = pct_start_ * double(total_steps_);
+    if (double(step) < peak) {
+      return cosineBetween(initial, 1.0, double(step) / peak);
+    }
+    return cosineBetween(1.0, final,
+                         (double(step) - peak) / (total_steps_ - peak));
+  }
+  case Type::Constant:
+  default:
+    return 1.0;
+  }
+}
+
+} // namespace neural_network
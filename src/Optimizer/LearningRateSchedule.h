@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Utilities/Utils.h"
+
+namespace neural_network {
+
+// Learning-rate schedule: a factor applied to the optimizer's base rate as
+// a function of the number of steps taken so far. The optimizer evaluates
+// it on every update, so the schedule advances once per training step.
+class LearningRateSchedule {
+public:
+  enum class Type { Constant, Step, Cosine, OneCycle };
+
+  static LearningRateSchedule Constant();
+  // Multiplies the rate by gamma every step_size steps.
+  static LearningRateSchedule Step(Index step_size, double gamma = 0.1);
+  // Cosine decay from the base rate to min_factor * base over total_steps.
+  static LearningRateSchedule Cosine(Index total_steps,
+                                     double min_factor = 0.0);
+  // One-cycle policy: cosine ramp from base / div_factor up to the base
+  // rate over the first pct_start of total_steps, then cosine annealing
+  // down to base / (div_factor * final_div_factor).
+  static LearningRateSchedule OneCycle(Index total_steps,
+                                       double pct_start = 0.3,
+                                       double div_factor = 25.0,
+                                       double final_div_factor = 1e4);
+
+  // Linear warmup over the first warmup_steps, after which this schedule
+  // starts from its own step 0.
+  LearningRateSchedule withWarmup(Index warmup_steps) const;
+
+  Type type() const;
+  double factor(Index step) const;
+
+private:
+  explicit LearningRateSchedule(Type type);
+
+  Type type_;
+  Index warmup_steps_ = 0;
+  Index total_steps_ = 1; // Cosine, OneCycle; step size for Step
+  double gamma_ = 1.0;    // Step
+  double min_factor_ = 0.0;
+  double pct_start_ = 0.3;
+  double div_factor_ = 25.0;
+  double final_div_factor_ = 1e4;
+};
+
+} // namespace neural_network
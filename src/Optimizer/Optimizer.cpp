@@ -1,89 +1,222 @@
 #include "Optimizer/Optimizer.h"
+#include "Utilities/Profiler.h"
+#include <algorithm>
+#include <cassert>
 #include <cmath>
+#include <stdexcept>
 
 namespace neural_network {
 
 namespace {
 
-struct SGDCache {};
+OptimizerCache &cacheOf(std::any &cache) {
+  auto *typed = std::any_cast<OptimizerCache>(&cache);
+  if (!typed)
+    throw std::bad_any_cast();
+  return *typed;
+}
 
-struct AdamCache {
-  Matrix m_w, v_w;
-  Vector m_b, v_b;
-  Index t = 0;
-};
+bool usesFirstMoment(Optimizer::Type type) {
+  return type != Optimizer::Type::SGD && type != Optimizer::Type::RMSProp;
+}
 
-} // namespace
+bool usesSecondMoment(Optimizer::Type type) {
+  return type == Optimizer::Type::RMSProp || type == Optimizer::Type::Adam ||
+         type == Optimizer::Type::AdamW || type == Optimizer::Type::LAMB;
+}
 
-Optimizer::Optimizer(MatrixUpdate mu, VectorUpdate vu, CacheInit ci)
-    : update_matrix_(std::move(mu)), update_vector_(std::move(vu)),
-      init_cache_(std::move(ci)) {}
+using ArrayMap = Eigen::Map<Eigen::Array<Scalar, Eigen::Dynamic, 1>>;
+using ConstArrayMap =
+    Eigen::Map<const Eigen::Array<Scalar, Eigen::Dynamic, 1>>;
 
-Optimizer Optimizer::SGD(double lr) {
-  return Optimizer([lr](Matrix &param, std::any & /*cache_unused*/,
-                        const Matrix &grad) { param -= lr * grad; },
-                   [lr](Vector &param, std::any & /*cache_unused*/,
-                        const Vector &grad) { param -= lr * grad; },
-                   [](int, int) { return std::make_any<SGDCache>(); });
+// Kernels run block by block: each block of parameters, gradients and
+// moments stays in L1 across the few vectorized statements of an update,
+// so memory is streamed once per step.
+constexpr Index kBlockSize = 1024;
+
+template <typename Kernel>
+void forEachBlock(Index begin, Index end, Kernel kernel) {
+  for (Index i = begin; i < end; i += kBlockSize) {
+    kernel(i, std::min(kBlockSize, end - i));
+  }
 }
 
-Optimizer Optimizer::Adam(double lr, double beta1, double beta2, double eps) {
-  return Optimizer(
-      [=](Matrix &param, std::any &cache_any, const Matrix &grad) {
-        auto *cache = std::any_cast<AdamCache>(&cache_any);
-        if (!cache)
-          throw std::bad_any_cast();
+} // namespace
 
-        auto &m = cache->m_w, &v = cache->v_w;
-        ++cache->t;
+Optimizer::Optimizer(Type type, double lr, double beta1, double beta2,
+                     double eps, double weight_decay)
+    : type_(type), base_lr_(lr), beta1_(static_cast<Scalar>(beta1)),
+      beta2_(static_cast<Scalar>(beta2)), eps_(static_cast<Scalar>(eps)),
+      weight_decay_(static_cast<Scalar>(weight_decay)) {}
 
-        m = beta1 * m + (1.0 - beta1) * grad;
+Optimizer Optimizer::SGD(double lr) {
+  return Optimizer(Type::SGD, lr, 0.0, 0.0, 0.0);
+}
 
-        v = beta2 * v + (1.0 - beta2) * grad.array().square().matrix();
+Optimizer Optimizer::Momentum(double lr, double momentum) {
+  return Optimizer(Type::Momentum, lr, momentum, 0.0, 0.0);
+}
 
-        Matrix m_hat = m;
+Optimizer Optimizer::Nesterov(double lr, double momentum) {
+  return Optimizer(Type::Nesterov, lr, momentum, 0.0, 0.0);
+}
 
-        Matrix v_hat = v / (1.0 - std::pow(beta2, cache->t));
+Optimizer Optimizer::RMSProp(double lr, double rho, double eps) {
+  return Optimizer(Type::RMSProp, lr, 0.0, rho, eps);
+}
 
-        param -= lr * (m_hat.array() / (v_hat.array().sqrt() + eps)).matrix();
-      },
-      [=](Vector &param, std::any &cache_any, const Vector &grad) {
-        auto *cache = std::any_cast<AdamCache>(&cache_any);
-        if (!cache)
-          throw std::bad_any_cast();
+Optimizer Optimizer::Adam(double lr, double beta1, double beta2, double eps) {
+  return Optimizer(Type::Adam, lr, beta1, beta2, eps);
+}
 
-        auto &m = cache->m_b, &v = cache->v_b;
-        ++cache->t;
+Optimizer Optimizer::AdamW(double lr, double weight_decay, double beta1,
+                           double beta2, double eps) {
+  return Optimizer(Type::AdamW, lr, beta1, beta2, eps, weight_decay);
+}
 
-        m = beta1 * m + (1.0 - beta1) * grad;
+Optimizer Optimizer::LAMB(double lr, double weight_decay, double beta1,
+                          double beta2, double eps) {
+  return Optimizer(Type::LAMB, lr, beta1, beta2, eps, weight_decay);
+}
 
-        v = beta2 * v + (1.0 - beta2) * grad.array().square().matrix();
+Optimizer Optimizer::withSchedule(LearningRateSchedule schedule) const {
+  Optimizer optimizer = *this;
+  optimizer.schedule_ = schedule;
+  return optimizer;
+}
 
-        Vector m_hat = m;
+Optimizer::Type Optimizer::type() const { return type_; }
 
-        Vector v_hat = v / (1.0 - std::pow(beta2, cache->t));
+double Optimizer::learningRate(Index step) const {
+  return base_lr_ * schedule_.factor(step);
+}
 
-        param -= lr * (m_hat.array() / (v_hat.array().sqrt() + eps)).matrix();
-      },
-      [](int rows, int cols) {
-        return std::make_any<AdamCache>(
-            AdamCache{Matrix::Zero(rows, cols), Matrix::Zero(rows, cols),
-                      Vector::Zero(rows), Vector::Zero(rows), 0});
-      });
+void Optimizer::update(Eigen::Ref<Matrix> param, std::any &cache,
+                       const ConstMatrixRef &grad) const {
+  assert(param.rows() == grad.rows() && param.cols() == grad.cols());
+  assert(param.outerStride() == param.rows() &&
+         grad.outerStride() == grad.rows());
+  step(param.data(), cache, grad.data(), param.size(), Scalar(1), {});
 }
 
-void Optimizer::update(Matrix &param, std::any &cache,
-                       const Matrix &grad) const {
-  update_matrix_(param, cache, grad);
+void Optimizer::updateArena(Eigen::Ref<Vector> params, std::any &cache,
+                            const ConstVectorRef &grads, Scalar grad_scale,
+                            const Segments &segments) const {
+  assert(params.size() == grads.size());
+  step(params.data(), cache, grads.data(), params.size(), grad_scale,
+       segments);
 }
 
-void Optimizer::update(Vector &param, std::any &cache,
-                       const Vector &grad) const {
-  update_vector_(param, cache, grad);
+void Optimizer::step(Scalar *param, std::any &cache, const Scalar *grad,
+                     Index size, Scalar grad_scale,
+                     const Segments &segments) const {
+  // Nominal cost: a few FLOPs per moment kept, and every parameter, gradient
+  // and moment element read once and parameters and moments written back.
+  const int moments = int(usesFirstMoment(type_)) + usesSecondMoment(type_);
+  NN_PROFILE_SCOPE(Optimizer, (2.0 + 4.0 * moments) * size,
+                   sizeof(Scalar) * (3.0 + 2.0 * moments) * size);
+  auto &state = cacheOf(cache);
+  if ((usesFirstMoment(type_) && state.m.size() != size) ||
+      (usesSecondMoment(type_) && state.v.size() != size)) {
+    throw std::runtime_error("Optimizer cache does not match the parameters");
+  }
+  const auto lr = static_cast<Scalar>(learningRate(state.t));
+  ++state.t;
+  state.beta2_power *= double(beta2_);
+  const auto v_correction =
+      static_cast<Scalar>(1.0 / (1.0 - state.beta2_power));
+  Scalar *m = state.m.data();
+  Scalar *v = state.v.data();
+
+  switch (type_) {
+  case Type::SGD:
+    forEachBlock(0, size, [&](Index i, Index n) {
+      ArrayMap(param + i, n) -= (lr * grad_scale) * ConstArrayMap(grad + i, n);
+    });
+    break;
+
+  case Type::Momentum:
+  case Type::Nesterov:
+    forEachBlock(0, size, [&](Index i, Index n) {
+      ArrayMap u(m + i, n);
+      const auto g = grad_scale * ConstArrayMap(grad + i, n);
+      u = beta1_ * u + g;
+      if (type_ == Type::Nesterov)
+        ArrayMap(param + i, n) -= lr * (g + beta1_ * u);
+      else
+        ArrayMap(param + i, n) -= lr * u;
+    });
+    break;
+
+  case Type::RMSProp:
+    forEachBlock(0, size, [&](Index i, Index n) {
+      ArrayMap v_block(v + i, n);
+      const auto g = grad_scale * ConstArrayMap(grad + i, n);
+      v_block = beta2_ * v_block + (Scalar(1) - beta2_) * g.square();
+      ArrayMap(param + i, n) -= lr * g / (v_block.sqrt() + eps_);
+    });
+    break;
+
+  case Type::Adam:
+  case Type::AdamW:
+    forEachBlock(0, size, [&](Index i, Index n) {
+      ArrayMap p_block(param + i, n), m_block(m + i, n), v_block(v + i, n);
+      const auto g = grad_scale * ConstArrayMap(grad + i, n);
+      m_block = beta1_ * m_block + (Scalar(1) - beta1_) * g;
+      v_block = beta2_ * v_block + (Scalar(1) - beta2_) * g.square();
+      if (weight_decay_ != Scalar(0))
+        p_block *= Scalar(1) - lr * weight_decay_;
+      p_block -= lr * m_block / ((v_block * v_correction).sqrt() + eps_);
+    });
+    break;
+
+  case Type::LAMB: {
+    const Segments whole{{0, size}};
+    for (const auto &[offset, length] : segments.empty() ? whole : segments) {
+      const Index end = offset + length;
+      assert(offset >= 0 && end <= size);
+      auto direction = [&](Index i, Index n) {
+        return ArrayMap(m + i, n) /
+                   ((ArrayMap(v + i, n) * v_correction).sqrt() + eps_) +
+               weight_decay_ * ArrayMap(param + i, n);
+      };
+      // First pass: moments and the norms of the tensor and its update.
+      double param_norm = 0.0, update_norm = 0.0;
+      forEachBlock(offset, end, [&](Index i, Index n) {
+        const auto g = grad_scale * ConstArrayMap(grad + i, n);
+        ArrayMap m_block(m + i, n), v_block(v + i, n);
+        m_block = beta1_ * m_block + (Scalar(1) - beta1_) * g;
+        v_block = beta2_ * v_block + (Scalar(1) - beta2_) * g.square();
+        param_norm += double(ArrayMap(param + i, n).square().sum());
+        update_norm += double(direction(i, n).square().sum());
+      });
+      const auto trust =
+          param_norm > 0.0 && update_norm > 0.0
+              ? static_cast<Scalar>(std::sqrt(param_norm / update_norm))
+              : Scalar(1);
+      // Second pass: the scaled update. The direction reads each
+      // parameter only at the index being written, so no copy is needed.
+      forEachBlock(offset, end, [&](Index i, Index n) {
+        ArrayMap(param + i, n) -= (lr * trust) * direction(i, n);
+      });
+    }
+    break;
+  }
+  }
 }
 
 std::any Optimizer::init_cache(int rows, int cols) const {
-  return init_cache_(rows, cols);
+  OptimizerCache cache;
+  if (usesFirstMoment(type_))
+    cache.m = Matrix::Zero(rows, cols);
+  if (usesSecondMoment(type_))
+    cache.v = Matrix::Zero(rows, cols);
+  return std::make_any<OptimizerCache>(std::move(cache));
+}
+
+OptimizerState Optimizer::init_state(Index rows, Index cols) const {
+  return OptimizerState{init_cache(int(rows), int(cols)),
+                        init_cache(int(rows), 1)};
 }
 
 } // namespace neural_network
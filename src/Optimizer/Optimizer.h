@@ -1,33 +1,96 @@
 #pragma once
 
+#include "Optimizer/LearningRateSchedule.h"
 #include "Utilities/Utils.h"
 #include <any>
-#include <functional>
+#include <utility>
+#include <vector>
 
 namespace neural_network {
 
+// What init_cache() returns for every rule: the moments it uses (others
+// stay empty) and the number of steps taken. Public so that checkpoints can
+// save and restore it.
+struct OptimizerCache {
+  Matrix m, v;
+  Index t = 0;
+  // beta2^t, kept as a running product instead of calling pow every step.
+  double beta2_power = 1.0;
+};
+
+// Optimizer state of one layer (e.g. Adam moments and step counter). It is
+// created once per training session and kept separately for the weights and
+// the biases, so that neither update advances the other's state.
+struct OptimizerState {
+  std::any weights;
+  std::any biases;
+};
+
+// Gradient-descent update rules. Every rule is a fused kernel over a flat,
+// contiguous run of parameters: parameters, gradients and moments are
+// streamed once per step, in cache-sized blocks, without temporaries.
+// Each cache counts its steps; the learning rate of a step is the base
+// rate times the schedule's factor at that count.
 class Optimizer {
 public:
-  using MatrixUpdate =
-      std::function<void(Matrix &, std::any &, const Matrix &)>;
-  using VectorUpdate =
-      std::function<void(Vector &, std::any &, const Vector &)>;
-  using CacheInit = std::function<std::any(int rows, int cols)>;
+  enum class Type { SGD, Momentum, Nesterov, RMSProp, Adam, AdamW, LAMB };
+
+  // Tensor boundaries (offset, size) inside a parameter arena.
+  using Segments = std::vector<std::pair<Index, Index>>;
 
   static Optimizer SGD(double lr);
+  static Optimizer Momentum(double lr, double momentum = 0.9);
+  static Optimizer Nesterov(double lr, double momentum = 0.9);
+  static Optimizer RMSProp(double lr, double rho = 0.9, double eps = 1e-8);
+  // Adam, AdamW and LAMB share the moment updates; like Adam, the others
+  // bias-correct only the second moment.
   static Optimizer Adam(double lr, double beta1 = 0.9, double beta2 = 0.999,
                         double eps = 1e-8);
+  // Adam with weight decay decoupled from the gradient.
+  static Optimizer AdamW(double lr, double weight_decay = 0.01,
+                         double beta1 = 0.9, double beta2 = 0.999,
+                         double eps = 1e-8);
+  // AdamW scaled per tensor by the trust ratio |w| / |update|, for large
+  // batches.
+  static Optimizer LAMB(double lr, double weight_decay = 0.01,
+                        double beta1 = 0.9, double beta2 = 0.999,
+                        double eps = 1e-6);
+
+  Optimizer withSchedule(LearningRateSchedule schedule) const;
+
+  Type type() const;
+  // Learning rate used by the update after `step` completed steps.
+  double learningRate(Index step) const;
+
+  // Updates one tensor; `cache` comes from init_cache() with its shape.
+  void update(Eigen::Ref<Matrix> param, std::any &cache,
+              const ConstMatrixRef &grad) const;
+
+  // Updates a whole parameter arena in one pass. The gradients are scaled
+  // by grad_scale on the fly (e.g. 1 / batch size); `cache` comes from
+  // init_cache(params.size(), 1). Layer-wise rules (LAMB) treat every
+  // segment as one tensor and leave parameters outside them untouched; no
+  // segments means a single tensor.
+  void updateArena(Eigen::Ref<Vector> params, std::any &cache,
+                   const ConstVectorRef &grads, Scalar grad_scale,
+                   const Segments &segments = {}) const;
 
-  void update(Matrix &param, std::any &cache, const Matrix &grad) const;
-  void update(Vector &param, std::any &cache, const Vector &grad) const;
   std::any init_cache(int rows, int cols) const;
+  OptimizerState init_state(Index rows, Index cols) const;
 
 private:
-  MatrixUpdate update_matrix_;
-  VectorUpdate update_vector_;
-  CacheInit init_cache_;
+  Optimizer(Type type, double lr, double beta1, double beta2, double eps,
+            double weight_decay = 0.0);
+
+  void step(Scalar *param, std::any &cache, const Scalar *grad, Index size,
+            Scalar grad_scale, const Segments &segments) const;
 
-  Optimizer(MatrixUpdate mu, VectorUpdate vu, CacheInit ci);
+  Type type_;
+  double base_lr_;
+  // Hyperparameters in the network's scalar type. beta1 doubles as the
+  // momentum coefficient and beta2 as RMSProp's decay rate.
+  Scalar beta1_, beta2_, eps_, weight_decay_;
+  LearningRateSchedule schedule_ = LearningRateSchedule::Constant();
 };
 
 } // namespace neural_network
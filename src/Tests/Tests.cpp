@@ -1,22 +1,58 @@
 #include "Tests/Tests.h"
 #include "ActivationFunctions/ActivationFunction.h"
+#include "Inference/InferenceModel.h"
+#include "Inference/QuantizedModel.h"
+#include "Inference/StaticModel.h"
+#include "Layers/AnyLayer.h"
+#include "Layers/DenseKernels.h"
 #include "Layers/Layer.h"
+#include "Loader/MNISTLoader.h"
+#include "Loader/StreamingLoader.h"
+#include "LossFunctions/SoftmaxCrossEntropy.h"
+#include "Model/Architectures.h"
+#include "Model/Model.h"
 #include "Optimizer/Optimizer.h"
+#include "Trainer/Checkpoint.h"
+#include "Trainer/Metrics.h"
+#include "Trainer/ParallelTrainer.h"
+#include "Trainer/TrainingConfig.h"
+#include "Trainer/TrainingSweep.h"
+#include "Utilities/AllocationCounter.h"
+#include "Utilities/FileReader.h"
+#include "Utilities/FileWriter.h"
+#include "Utilities/ModelFormat.h"
+#include "Utilities/Profiler.h"
+#include "Utilities/Random.h"
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <type_traits>
 
 namespace {
 
 using namespace neural_network;
 using namespace neural_network::test;
 
+// Comparison tolerance matching the precision the network is built with.
+const double kPrecision = Eigen::NumTraits<Scalar>::dummy_precision();
+
 TestStatus testActivationFunction() {
   using AF = ActivationFunction;
   Vector x(3);
   x << -1, 0, 2;
 
   Vector y_relu = AF::create(AF::Type::ReLU).apply(x);
-  Eigen::ArrayXd expected(3);
+  Eigen::Array<Scalar, Eigen::Dynamic, 1> expected(3);
   expected << 0, 0, 2;
   if (!(y_relu.array() == expected).all()) {
     std::cout << "[FAIL] ActivationFunction::ReLU output mismatch\n";
@@ -30,7 +66,7 @@ TestStatus testActivationFunction() {
   }
 
   Vector y_tanh = AF::create(AF::Type::Tanh).apply(x);
-  if (std::abs(y_tanh[2] - std::tanh(2)) > 1e-8) {
+  if (std::abs(y_tanh[2] - std::tanh(2)) > std::max(1e-8, kPrecision)) {
     std::cout << "[FAIL] ActivationFunction::Tanh value incorrect\n";
     return TestStatus::Error;
   }
@@ -38,6 +74,78 @@ TestStatus testActivationFunction() {
   return TestStatus::OK;
 }
 
+TestStatus testFusedActivationKernels() {
+  using AF = ActivationFunction;
+  Matrix z(3, 2);
+  z << -1, 0.5, 0, -2, 2, 1;
+  Vector bias(3);
+  bias << 0.25, -0.5, 1;
+  Matrix grad(3, 2);
+  grad << 1, -2, 3, 0.5, -1, 2;
+
+  for (AF::Type type : {AF::Type::ReLU, AF::Type::Sigmoid, AF::Type::Tanh,
+                        AF::Type::Identity, AF::Type::Softmax}) {
+    const AF activation = AF::create(type);
+    Matrix shifted = z;
+    shifted.colwise() += bias;
+    const Matrix expected_out = activation.applyBatch(shifted);
+    Matrix expected_grad = grad;
+    if (type != AF::Type::Softmax)
+      expected_grad.array() *= activation.derivativeBatch(shifted).array();
+
+    Matrix out = z, grad_z(3, 2);
+    AllocationCounter allocations;
+    activation.biasApplyInPlace(out, bias);
+    activation.backward(grad, out, grad_z);
+    const std::size_t allocated = allocations.count();
+
+    if (!out.isApprox(expected_out, kPrecision) ||
+        !grad_z.isApprox(expected_grad, kPrecision) || allocated != 0) {
+      std::cout << "[FAIL] Fused activation kernel mismatch for type "
+                << int(type) << "\n";
+      return TestStatus::Error;
+    }
+  }
+  return TestStatus::OK;
+}
+
+TestStatus testSoftmaxCrossEntropy() {
+  Matrix logits(3, 2);
+  logits << 1, 1000, 2, 1001, -1, 999;
+  Labels labels(2);
+  labels << 1, 0;
+
+  // Reference: separate softmax and cross-entropy on the first column,
+  // whose logits are small enough not to overflow.
+  const Vector probs = ActivationFunction::Softmax().apply(logits.col(0));
+  Vector one_hot = Vector::Zero(3);
+  one_hot[1] = 1;
+  const double expected_loss = LossFunction::crossEntropy(probs, one_hot);
+
+  Matrix grad(3, 2);
+  const double loss =
+      SoftmaxCrossEntropy::lossGradBatch(logits, labels, grad);
+  Vector single_grad;
+  const double single_loss =
+      SoftmaxCrossEntropy::lossGrad(logits.col(0), 1, single_grad);
+
+  // The second column is the first shifted by 999 with label 0, i.e.
+  // -log softmax([1, 2, 0])[0].
+  const double shifted_loss =
+      std::log(std::exp(1.0) + std::exp(2.0) + 1.0) - 1.0;
+  if (std::abs(single_loss - expected_loss) > 1e-4 ||
+      !single_grad.isApprox(probs - one_hot, kPrecision) ||
+      !grad.col(0).isApprox(single_grad, kPrecision) ||
+      !std::isfinite(loss) ||
+      std::abs(loss - (expected_loss + shifted_loss) / 2) > 1e-4 ||
+      std::abs(SoftmaxCrossEntropy::lossBatch(logits, labels) - loss) >
+          1e-6) {
+    std::cout << "[FAIL] SoftmaxCrossEntropy loss or gradient incorrect\n";
+    return TestStatus::Error;
+  }
+  return TestStatus::OK;
+}
+
 TestStatus testOptimizerSGD() {
   Optimizer opt = Optimizer::SGD(0.1);
   Matrix w = Matrix::Ones(2, 2);
@@ -46,7 +154,7 @@ TestStatus testOptimizerSGD() {
 
   opt.update(w, cache, grad);
 
-  return !(std::abs(w(0, 0) - 0.9) > 1e-9)
+  return !(std::abs(w(0, 0) - 0.9) > std::max(1e-9, kPrecision))
              ? TestStatus::OK
              : (std::cout << "[FAIL] Optimizer::SGD weight update incorrect\n",
                 TestStatus::Error);
@@ -75,11 +183,77 @@ TestStatus testOptimizerAdam() {
   return TestStatus::OK;
 }
 
+TestStatus testOptimizerRulesAndSchedules() {
+  using LRS = LearningRateSchedule;
+  const double tol = std::max(1e-9, kPrecision);
+
+  // One step of each rule on w = 1 with gradient 1.
+  auto firstStep = [](const Optimizer &opt) {
+    Matrix w = Matrix::Ones(4, 1), grad = Matrix::Ones(4, 1);
+    std::any cache = opt.init_cache(4, 1);
+    opt.update(w, cache, grad);
+    return double(w(0, 0));
+  };
+  if (std::abs(firstStep(Optimizer::Nesterov(0.1, 0.9)) - (1 - 0.1 * 1.9)) >
+          tol ||
+      std::abs(firstStep(Optimizer::RMSProp(0.01, 0.9)) -
+               (1 - 0.01 / std::sqrt(0.1))) > 1e-5 ||
+      // LAMB: the trust ratio scales every step to lr * |w|.
+      std::abs(firstStep(Optimizer::LAMB(0.1, 0.0)) - 0.9) > 1e-5) {
+    std::cout << "[FAIL] Optimizer rule produced a wrong first step\n";
+    return TestStatus::Error;
+  }
+
+  // AdamW without weight decay is Adam; with decay it shrinks the weights.
+  Random rng(3);
+  const Matrix grad = rng.uniformMatrix(5, 2, -1.0, 1.0);
+  auto train = [&](const Optimizer &opt) {
+    Matrix w = Matrix::Ones(5, 2);
+    std::any cache = opt.init_cache(5, 2);
+    for (int step = 0; step < 5; ++step)
+      opt.update(w, cache, grad);
+    return w;
+  };
+  const Matrix adam = train(Optimizer::Adam(0.01));
+  if (train(Optimizer::AdamW(0.01, 0.0)) != adam ||
+      !(train(Optimizer::AdamW(0.01, 0.5)).array() < adam.array()).all()) {
+    std::cout << "[FAIL] Optimizer::AdamW weight decay incorrect\n";
+    return TestStatus::Error;
+  }
+
+  const LRS warm_cosine = LRS::Cosine(10).withWarmup(4);
+  const LRS one_cycle = LRS::OneCycle(100, 0.3, 25.0, 1e4);
+  if (std::abs(LRS::Step(3, 0.5).factor(2) - 1.0) > tol ||
+      std::abs(LRS::Step(3, 0.5).factor(7) - 0.25) > tol ||
+      std::abs(warm_cosine.factor(0) - 0.25) > tol ||
+      std::abs(warm_cosine.factor(4) - 1.0) > tol ||
+      std::abs(warm_cosine.factor(9) - 0.5) > tol ||
+      std::abs(warm_cosine.factor(14) - 0.0) > tol ||
+      std::abs(one_cycle.factor(0) - 1.0 / 25) > tol ||
+      std::abs(one_cycle.factor(30) - 1.0) > tol ||
+      std::abs(one_cycle.factor(100) - 1.0 / 25e4) > tol) {
+    std::cout << "[FAIL] LearningRateSchedule factor incorrect\n";
+    return TestStatus::Error;
+  }
+
+  // The schedule advances with every update of a cache.
+  const Optimizer scheduled = Optimizer::SGD(0.1).withSchedule(LRS::Step(1));
+  Matrix w = Matrix::Ones(1, 1), g = Matrix::Ones(1, 1);
+  std::any cache = scheduled.init_cache(1, 1);
+  scheduled.update(w, cache, g);
+  scheduled.update(w, cache, g);
+  if (std::abs(w(0, 0) - (1 - 0.1 - 0.01)) > tol) {
+    std::cout << "[FAIL] Optimizer does not follow its schedule\n";
+    return TestStatus::Error;
+  }
+  return TestStatus::OK;
+}
+
 TestStatus testLayerForwardBackward() {
   Optimizer opt = Optimizer::Adam(0.01, 0.9, 0.999, 1e-8);
   Layer l(In(2), Out(1),
           ActivationFunction::create(ActivationFunction::Type::Identity));
-  l.setCache(opt);
+  l.initOptimizerState(opt);
 
   Vector input(2);
   input << 1.0, -1.0;
@@ -96,6 +270,1595 @@ TestStatus testLayerForwardBackward() {
   return TestStatus::OK;
 }
 
+TestStatus testLayerForwardBatch() {
+  Layer l(In(3), Out(2),
+          ActivationFunction::create(ActivationFunction::Type::Softmax));
+
+  Matrix input(3, 2);
+  input << 1.0, -2.0, 0.5, 0.0, -1.0, 3.0;
+
+  Matrix batch_out = l.forwardBatch(input);
+  for (Index j = 0; j < input.cols(); ++j) {
+    Vector single_out = l.predict(input.col(j));
+    if ((batch_out.col(j) - single_out).cwiseAbs().maxCoeff() > kPrecision) {
+      std::cout << "[FAIL] Layer::forwardBatch differs from Layer::predict\n";
+      return TestStatus::Error;
+    }
+  }
+  return TestStatus::OK;
+}
+
+TestStatus testOptimizerStateNoAllocations() {
+  Optimizer opt = Optimizer::Adam(0.01, 0.9, 0.999, 1e-8);
+  Matrix w = Matrix::Ones(16, 8);
+  Vector b = Vector::Zero(16);
+  Matrix grad_w = Matrix::Constant(16, 8, 0.5);
+  Vector grad_b = Vector::Constant(16, 0.5);
+  OptimizerState state = opt.init_state(w.rows(), w.cols());
+
+  AllocationCounter allocations;
+  for (int step = 0; step < 10; ++step) {
+    opt.update(w, state.weights, grad_w);
+    opt.update(b, state.biases, grad_b);
+  }
+  if (AllocationCounter::supported() && allocations.count() != 0) {
+    std::cout << "[FAIL] Optimizer::update allocated " << allocations.count()
+              << " times in steady state\n";
+    return TestStatus::Error;
+  }
+
+  // Weights and biases keep separate step counters: after 10 steps both
+  // must have moved by the same amount.
+  if (std::abs((1.0 - w(0, 0)) - (0.0 - b[0])) > kPrecision) {
+    std::cout << "[FAIL] Optimizer state shared between weights and biases\n";
+    return TestStatus::Error;
+  }
+  return TestStatus::OK;
+}
+
+TestStatus testParameterArena() {
+  using AF = ActivationFunction;
+  Model model({4, 5, 3}, {AF::Type::ReLU, AF::Type::Identity});
+  Model copy = model;
+
+  auto viewsArena = [](const Model &m) {
+    const Scalar *begin = m.parameters().data();
+    const Scalar *end = begin + m.parameters().size();
+    for (const auto &layer : m.layers()) {
+      const Scalar *weights = layer.weights().data();
+      if (weights < begin || weights + layer.parameterCount() > end ||
+          layer.biases().data() != weights + layer.weights().size())
+        return false;
+    }
+    return true;
+  };
+  if (!viewsArena(model) || !viewsArena(copy) ||
+      copy.parameters().data() == model.parameters().data() ||
+      copy.parameters() != model.parameters()) {
+    std::cout << "[FAIL] Layers do not view their model's parameter arena\n";
+    return TestStatus::Error;
+  }
+
+  // One fused pass over two concatenated tensors must match updating each
+  // tensor on its own with pre-scaled gradients.
+  Random rng(5);
+  const Matrix a = rng.uniformMatrix(6, 3, -1.0, 1.0);
+  const Matrix b = rng.uniformMatrix(1500, 1, -1.0, 1.0);
+  const Matrix grad_a = rng.uniformMatrix(6, 3, -1.0, 1.0);
+  const Matrix grad_b = rng.uniformMatrix(1500, 1, -1.0, 1.0);
+  const Index n = a.size() + b.size();
+
+  for (const Optimizer &opt :
+       {Optimizer::SGD(0.1), Optimizer::Momentum(0.1, 0.9),
+        Optimizer::Adam(0.01, 0.9, 0.999, 1e-8)}) {
+    Vector params(n), grads(n);
+    params << a.reshaped(), b.reshaped();
+    grads << grad_a.reshaped(), grad_b.reshaped();
+    grads *= Scalar(2);
+    std::any arena_cache = opt.init_cache(int(n), 1);
+
+    Matrix a_ref = a, b_ref = b;
+    std::any cache_a = opt.init_cache(6, 3), cache_b = opt.init_cache(1500, 1);
+
+    AllocationCounter allocations;
+    for (int step = 0; step < 3; ++step) {
+      opt.updateArena(params, arena_cache, grads, Scalar(0.5));
+      opt.update(a_ref, cache_a, grad_a);
+      opt.update(b_ref, cache_b, grad_b);
+    }
+    const std::size_t allocated = allocations.count();
+
+    if (params.head(a.size()) != a_ref.reshaped() ||
+        params.tail(b.size()) != b_ref.reshaped() || allocated != 0) {
+      std::cout << "[FAIL] Optimizer::updateArena differs from update\n";
+      return TestStatus::Error;
+    }
+  }
+  return TestStatus::OK;
+}
+
+double maxWeightDifference(const Model &a, const Model &b) {
+  double diff = 0.0;
+  for (size_t i = 0; i < a.layers().size(); ++i) {
+    diff = std::max<double>(
+        diff, (a.layers()[i].weights() - b.layers()[i].weights())
+                  .cwiseAbs()
+                  .maxCoeff());
+    diff = std::max<double>(
+        diff, (a.layers()[i].biases() - b.layers()[i].biases())
+                  .cwiseAbs()
+                  .maxCoeff());
+  }
+  return diff;
+}
+
+TestStatus testParallelTrainer() {
+  using AF = ActivationFunction;
+  Optimizer opt = Optimizer::Adam(0.01, 0.9, 0.999, 1e-8);
+  Model initial({6, 8, 3}, {AF::Type::ReLU, AF::Type::Identity});
+  initial.initOptimizerState(opt);
+
+  Random rng(7);
+  Matrix X = rng.uniformMatrix(6, 37, -1.0, 1.0);
+  Matrix Y = rng.uniformMatrix(3, 37, 0.0, 1.0);
+
+  Model serial = initial;
+  for (int step = 0; step < 3; ++step)
+    serial.trainBatch(X, Y, LossFunction::mseGradBatch, opt);
+
+  auto trainParallel = [&](std::size_t threads) {
+    Model model = initial;
+    ParallelTrainer trainer(model, threads);
+    for (int step = 0; step < 3; ++step)
+      trainer.trainBatch(X, Y, LossFunction::mseGradBatch, opt);
+    return model;
+  };
+
+  if (maxWeightDifference(serial, trainParallel(1)) != 0.0) {
+    std::cout << "[FAIL] ParallelTrainer with 1 thread differs from serial\n";
+    return TestStatus::Error;
+  }
+  Model four_a = trainParallel(4), four_b = trainParallel(4);
+  if (maxWeightDifference(four_a, four_b) != 0.0) {
+    std::cout << "[FAIL] ParallelTrainer is not deterministic\n";
+    return TestStatus::Error;
+  }
+  if (maxWeightDifference(serial, four_a) > std::max(1e-9, kPrecision)) {
+    std::cout << "[FAIL] ParallelTrainer gradients differ from serial\n";
+    return TestStatus::Error;
+  }
+  return TestStatus::OK;
+}
+
+TestStatus testGradientAccumulation() {
+  using AF = ActivationFunction;
+  Optimizer opt = Optimizer::Adam(0.01, 0.9, 0.999, 1e-8);
+  Model initial({6, 8, 3}, {AF::Type::ReLU, AF::Type::Identity});
+  initial.initOptimizerState(opt);
+
+  Random rng(11);
+  Matrix X = rng.uniformMatrix(6, 37, -1.0, 1.0);
+  Matrix Y = rng.uniformMatrix(3, 37, 0.0, 1.0);
+
+  Model full = initial;
+  for (int step = 0; step < 3; ++step)
+    full.trainBatch(X, Y, LossFunction::mseGradBatch, opt);
+
+  // Uneven micro-batches; with 4 threads the first one only uses two
+  // shards, so the others must start over instead of adding stale sums.
+  const std::vector<Index> sizes = {2, 10, 25};
+  Model serial = initial;
+  Model parallel = initial;
+  ParallelTrainer trainer(parallel, 4);
+  for (int step = 0; step < 3; ++step) {
+    Index start = 0;
+    for (Index count : sizes) {
+      serial.accumulateBatch(X.middleCols(start, count),
+                             Y.middleCols(start, count),
+                             LossFunction::mseGradBatch);
+      trainer.accumulateBatch(X.middleCols(start, count),
+                              Y.middleCols(start, count),
+                              LossFunction::mseGradBatch);
+      start += count;
+    }
+    serial.applyAccumulated(opt);
+    trainer.applyAccumulated(opt);
+  }
+
+  if (maxWeightDifference(full, serial) > std::max(1e-9, kPrecision) ||
+      maxWeightDifference(full, parallel) > std::max(1e-9, kPrecision)) {
+    std::cout << "[FAIL] Accumulated micro-batches differ from one batch\n";
+    return TestStatus::Error;
+  }
+  return TestStatus::OK;
+}
+
+// Once a first epoch has sized the training workspaces, a whole epoch,
+// partial last batch included, must not touch the heap.
+TestStatus testTrainingWorkspaceNoAllocations() {
+  using AF = ActivationFunction;
+  Random rng(13);
+  std::vector<int> labels(100);
+  for (size_t i = 0; i < labels.size(); ++i)
+    labels[i] = int(i % 4);
+  const Dataset data(rng.uniformMatrix(784, 100, -1.0, 1.0), labels);
+
+  Optimizer opt = Optimizer::Adam(0.01, 0.9, 0.999, 1e-8);
+  Model serial({784, 128, 16, 4},
+               {AF::Type::ReLU, AF::Type::Tanh, AF::Type::Identity});
+  serial.initOptimizerState(opt);
+  Model parallel = serial;
+  ParallelTrainer trainer(parallel, 2);
+
+  // Both heads: labels, and one-hot targets through the MSE gradient.
+  const Matrix targets = data.oneHot(4);
+  const Index batch_size = 32;
+  auto epoch = [&] {
+    for (Index start = 0; start < data.size(); start += batch_size) {
+      const Index count = std::min(batch_size, data.size() - start);
+      serial.trainBatch(data.batch(start, count),
+                        data.labelBatch(start, count),
+                        SoftmaxCrossEntropy::lossGradBatch, opt);
+      trainer.trainBatch(data.batch(start, count),
+                         data.labelBatch(start, count),
+                         SoftmaxCrossEntropy::lossGradBatch, opt);
+      serial.trainBatch(data.batch(start, count),
+                        targets.middleCols(start, count),
+                        LossFunction::mseGradBatch, opt);
+      trainer.trainBatch(data.batch(start, count),
+                         targets.middleCols(start, count),
+                         LossFunction::mseGradBatch, opt);
+    }
+  };
+  epoch();
+
+  AllocationCounter allocations;
+  epoch();
+  if (AllocationCounter::supported() && allocations.count() != 0) {
+    std::cout << "[FAIL] Training epoch allocated " << allocations.count()
+              << " times after warm-up\n";
+    return TestStatus::Error;
+  }
+
+  // Model::train() sets up the optimizer state once per call; the epochs
+  // after that must not add allocations.
+  const Matrix inputs = data.batch(0, data.size());
+  serial.train(inputs, targets, 1, LossFunction::mseGradBatch, opt,
+               batch_size);
+  AllocationCounter one_epoch;
+  serial.train(inputs, targets, 1, LossFunction::mseGradBatch, opt,
+               batch_size);
+  const std::size_t setup = one_epoch.count();
+  AllocationCounter three_epochs;
+  serial.train(inputs, targets, 3, LossFunction::mseGradBatch, opt,
+               batch_size);
+  if (AllocationCounter::supported() && three_epochs.count() != setup) {
+    std::cout << "[FAIL] Model::train allocated "
+              << three_epochs.count() - setup << " times per epoch\n";
+    return TestStatus::Error;
+  }
+  return TestStatus::OK;
+}
+
+// Every kernel this CPU runs against Eigen's products, on shapes that
+// leave partial micro-tiles and cache blocks in every dimension.
+TestStatus testDenseKernels() {
+  using kernels::Isa;
+  const Isa initial = kernels::activeIsa();
+  Random rng(25);
+  // {rows, cols, batch}: the product is (rows x cols) * (cols x batch).
+  // Fewer rows than a micro-tile against many columns (a convolution's
+  // filters against its patches) take the transposed product.
+  const Index shapes[][3] = {{37, 300, 1}, {130, 513, 250}, {3, 7, 1},
+                             {64, 784, 32}, {10, 1, 5}, {6, 25, 300}};
+  double error = 0.0;
+  for (Isa isa : {Isa::Scalar, Isa::Avx2, Isa::Avx512}) {
+    if (!kernels::supported(isa))
+      continue;
+    kernels::setIsa(isa);
+    for (const auto &shape : shapes) {
+      const Matrix w = rng.uniformMatrix(shape[0], shape[1], -1.0, 1.0);
+      const Matrix x = rng.uniformMatrix(shape[1], shape[2], -1.0, 1.0);
+      const Matrix dz = rng.uniformMatrix(shape[0], shape[2], -1.0, 1.0);
+      const Matrix gw = rng.uniformMatrix(shape[0], shape[1], -1.0, 1.0);
+      Matrix out(shape[0], shape[2]), back(shape[1], shape[2]);
+      const Matrix dx = rng.uniformMatrix(shape[0], shape[2], -1.0, 1.0);
+      Matrix grad = gw, sum = dx;
+      kernels::multiply(w, x, out);
+      kernels::multiply(w, x, sum, true);
+      kernels::multiplyTransposedA(w, dz, back);
+      kernels::multiplyTransposedB(dz, x, grad, true);
+      const Matrix expected_out = w * x;
+      const Matrix expected_back = w.transpose() * dz;
+      const Matrix expected_grad = gw + dz * x.transpose();
+      // Relative to the number of summed products.
+      const double scale = double(std::max(shape[1], shape[2]));
+      error = std::max<double>(
+          {error, (out - expected_out).cwiseAbs().maxCoeff() / scale,
+           (back - expected_back).cwiseAbs().maxCoeff() / scale,
+           (grad - expected_grad).cwiseAbs().maxCoeff() / scale,
+           (sum - dx - expected_out).cwiseAbs().maxCoeff() / scale});
+    }
+    if (error > kPrecision) {
+      std::cout << "[FAIL] " << kernels::isaName(isa)
+                << " dense kernels differ from Eigen by " << error << "\n";
+      kernels::setIsa(initial);
+      return TestStatus::Error;
+    }
+  }
+  kernels::setIsa(initial);
+  return TestStatus::OK;
+}
+
+TestStatus testSparseInput() {
+  using AF = ActivationFunction;
+  using kernels::Isa;
+  const Isa initial = kernels::activeIsa();
+  Random rng(26);
+  // Keeps about a fifth of the entries, like the pixels of an MNIST image.
+  auto sparse = [&](Index rows, Index cols) {
+    const Matrix keep = rng.uniformMatrix(rows, cols, 0.0, 1.0);
+    return Matrix((keep.array() < 0.2)
+                      .select(rng.uniformMatrix(rows, cols, -1.0, 1.0), 0));
+  };
+
+  kernels::CompressedMatrix compressed;
+  if (compressed.assign(rng.uniformMatrix(20, 4, 0.5, 1.0)) ||
+      !compressed.empty()) {
+    std::cout << "[FAIL] A dense input was taken as sparse\n";
+    return TestStatus::Error;
+  }
+
+  // {rows, cols, batch}: W is rows x cols and X is cols x batch.
+  const Index shapes[][3] = {{37, 300, 150}, {128, 784, 64}, {130, 50, 1}};
+  double error = 0.0;
+  for (Isa isa : {Isa::Scalar, Isa::Avx2, Isa::Avx512}) {
+    if (!kernels::supported(isa))
+      continue;
+    kernels::setIsa(isa);
+    for (const auto &shape : shapes) {
+      const Matrix w = rng.uniformMatrix(shape[0], shape[1], -1.0, 1.0);
+      const Matrix x = sparse(shape[1], shape[2]);
+      const Matrix dz = rng.uniformMatrix(shape[0], shape[2], -1.0, 1.0);
+      const Matrix gw = rng.uniformMatrix(shape[0], shape[1], -1.0, 1.0);
+      if (!compressed.assign(x) ||
+          compressed.nonZeros() != (x.array() != 0).count()) {
+        std::cout << "[FAIL] A sparse input was not compressed\n";
+        kernels::setIsa(initial);
+        return TestStatus::Error;
+      }
+      Matrix out(shape[0], shape[2]), grad(shape[0], shape[1]);
+      Matrix sum = gw;
+      kernels::multiplySparse(w, compressed, out);
+      kernels::multiplyTransposedBSparse(dz, compressed, grad);
+      kernels::multiplyTransposedBSparse(dz, compressed, sum, true);
+      const double scale = double(std::max(shape[1], shape[2]));
+      error = std::max<double>(
+          {error, (out - w * x).cwiseAbs().maxCoeff() / scale,
+           (grad - dz * x.transpose()).cwiseAbs().maxCoeff() / scale,
+           (sum - gw - dz * x.transpose()).cwiseAbs().maxCoeff() / scale});
+    }
+    if (error > kPrecision) {
+      std::cout << "[FAIL] " << kernels::isaName(isa)
+                << " sparse kernels differ from Eigen by " << error << "\n";
+      kernels::setIsa(initial);
+      return TestStatus::Error;
+    }
+  }
+  kernels::setIsa(initial);
+
+  // A layer flagged for sparse input takes the sparse path on its own and
+  // does not allocate for it; an unflagged one stays on the dense path.
+  Layer layer(In(784), Out(32), AF::create(AF::Type::Identity));
+  Layer::Scratch scratch;
+  layer.reserve(scratch, 16);
+  const Matrix x = sparse(784, 16);
+  layer.forwardBatch(x, scratch);
+  if (!scratch.sparse_input.empty()) {
+    std::cout << "[FAIL] A layer without sparse input compressed it\n";
+    return TestStatus::Error;
+  }
+  layer.setSparseInput(true);
+  const Matrix dz = rng.uniformMatrix(32, 16, -1.0, 1.0);
+  Matrix grad_w(32, 784);
+  Vector grad_b(32);
+  AllocationCounter allocations;
+  const ConstMatrixRef out = layer.forwardBatch(x, scratch);
+  layer.backwardBatch(dz, scratch, grad_w, grad_b, false, false);
+  const size_t allocated = allocations.count();
+  const Matrix expected =
+      (layer.weights() * x).colwise() + Vector(layer.biases());
+  if (scratch.sparse_input.empty() ||
+      (out - expected).cwiseAbs().maxCoeff() > 784 * kPrecision ||
+      (grad_w - dz * x.transpose()).cwiseAbs().maxCoeff() > 16 * kPrecision) {
+    std::cout << "[FAIL] Layer on a sparse input differs from Eigen\n";
+    return TestStatus::Error;
+  }
+  if (AllocationCounter::supported() && allocated != 0) {
+    std::cout << "[FAIL] Sparse layer pass allocated\n";
+    return TestStatus::Error;
+  }
+  return TestStatus::OK;
+}
+
+TestStatus testInferenceModel() {
+  using AF = ActivationFunction;
+  Model model({5, 7, 4}, {AF::Type::Tanh, AF::Type::Softmax});
+  InferenceModel frozen = model.freeze();
+
+  Random rng(11);
+  Matrix X = rng.uniformMatrix(5, 16, -1.0, 1.0);
+  Matrix expected = model.forwardBatch(X);
+
+  // Every thread shares the model and owns a workspace.
+  std::vector<double> errors(4, 0.0);
+  std::vector<size_t> allocations(4, 0);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < errors.size(); ++t) {
+    threads.emplace_back([&, t] {
+      InferenceModel::Workspace workspace = frozen.makeWorkspace(X.cols());
+      AllocationCounter counter;
+      for (int repeat = 0; repeat < 50; ++repeat) {
+        auto out = frozen.predict(X.leftCols(1 + (repeat + t) % 16),
+                                  workspace);
+        errors[t] = std::max<double>(errors[t],
+                             (out - expected.leftCols(out.cols()))
+                                 .cwiseAbs()
+                                 .maxCoeff());
+      }
+      allocations[t] = counter.count();
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+
+  if (*std::max_element(errors.begin(), errors.end()) > kPrecision) {
+    std::cout << "[FAIL] InferenceModel::predict differs from Model\n";
+    return TestStatus::Error;
+  }
+  if (AllocationCounter::supported() &&
+      *std::max_element(allocations.begin(), allocations.end()) != 0) {
+    std::cout << "[FAIL] InferenceModel::predict allocated\n";
+    return TestStatus::Error;
+  }
+  try {
+    InferenceModel::Workspace workspace = frozen.makeWorkspace(X.cols());
+    frozen.predict(X.topRows(4), workspace);
+    std::cout << "[FAIL] InferenceModel accepted a wrong input size\n";
+    return TestStatus::Error;
+  } catch (const std::runtime_error &) {
+  }
+  return TestStatus::OK;
+}
+
+// Finite-difference check of the backward pass through two layers. Only
+// meaningful in double precision, so it is skipped in float builds.
+TestStatus testGradientCheck() {
+  if constexpr (!std::is_same_v<Scalar, double>) {
+    return TestStatus::OK;
+  }
+  using AF = ActivationFunction;
+  Layer hidden(In(4), Out(5), AF::create(AF::Type::Tanh));
+  Layer output(In(5), Out(3), AF::create(AF::Type::Sigmoid));
+  Layer::Scratch hidden_scratch, output_scratch;
+
+  Random rng(3);
+  Matrix x = rng.uniformMatrix(4, 1, -1.0, 1.0);
+  Matrix y = rng.uniformMatrix(3, 1, 0.0, 1.0);
+
+  auto loss = [&](const Matrix &input) {
+    return LossFunction::mseBatch(
+        output.predictBatch(hidden.predictBatch(input)), y);
+  };
+
+  Matrix out = output.forwardBatch(
+      hidden.forwardBatch(x, hidden_scratch), output_scratch);
+  Matrix loss_grad(out.rows(), out.cols());
+  LossFunction::mseGradBatch(out, y, loss_grad);
+  Matrix analytic = hidden.backwardBatch(
+      output.backwardBatch(loss_grad, output_scratch), hidden_scratch);
+
+  const double h = 1e-6;
+  for (Index i = 0; i < x.rows(); ++i) {
+    Matrix plus = x, minus = x;
+    plus(i, 0) += h;
+    minus(i, 0) -= h;
+    const double numeric = (loss(plus) - loss(minus)) / (2 * h);
+    if (std::abs(numeric - analytic(i, 0)) > 1e-7) {
+      std::cout << "[FAIL] Backward pass disagrees with finite differences\n";
+      return TestStatus::Error;
+    }
+  }
+  return TestStatus::OK;
+}
+
+// Byte offset of `member` of layer record `layer` in a model file.
+std::streamoff recordField(std::streamoff layer, std::size_t member) {
+  return std::streamoff(sizeof(model_format::Header)) +
+         layer * std::streamoff(sizeof(model_format::LayerRecord)) +
+         std::streamoff(member);
+}
+
+// Writes `value` at byte `at` of `file`, runs load() on it and puts the old
+// bytes back; returns whether load() succeeded.
+template <typename T, typename Load>
+bool loadsPatched(const std::filesystem::path &file, std::streamoff at,
+                  T value, Load load) {
+  std::fstream patch(file, std::ios::in | std::ios::out | std::ios::binary);
+  T saved{};
+  patch.seekg(at);
+  patch.read(reinterpret_cast<char *>(&saved), sizeof(saved));
+  patch.seekp(at);
+  patch.write(reinterpret_cast<const char *>(&value), sizeof(value));
+  patch.flush();
+  bool loads = true;
+  try {
+    load();
+  } catch (const std::runtime_error &) {
+    loads = false;
+  }
+  patch.seekp(at);
+  patch.write(reinterpret_cast<const char *>(&saved), sizeof(saved));
+  return loads;
+}
+
+TestStatus testModelFileRoundTrip() {
+  using AF = ActivationFunction;
+  Model model({6, 5, 3}, {AF::Type::ReLU, AF::Type::Softmax});
+  const auto path =
+      std::filesystem::temp_directory_path() / "neural_net_test_model.bin";
+  {
+    FileWriter out(path);
+    out << model;
+  }
+
+  Model loaded({1, 1}, {AF::Type::Identity});
+  {
+    FileReader in(path);
+    in >> loaded;
+  }
+  if (loaded.layers().size() != model.layers().size() ||
+      maxWeightDifference(model, loaded) != 0.0 ||
+      loaded.layers()[1].activationType() != AF::Type::Softmax) {
+    std::cout << "[FAIL] Model file round trip is not exact\n";
+    return TestStatus::Error;
+  }
+
+  Random rng(5);
+  Matrix X = rng.uniformMatrix(6, 4, -1.0, 1.0);
+  InferenceModel frozen = model.freeze();
+  InferenceModel mapped = InferenceModel::load(path);
+  auto frozen_ws = frozen.makeWorkspace(4), mapped_ws = mapped.makeWorkspace(4);
+  if ((frozen.predict(X, frozen_ws) - mapped.predict(X, mapped_ws))
+          .cwiseAbs()
+          .maxCoeff() != 0) {
+    std::cout << "[FAIL] Memory-mapped model differs from the original\n";
+    return TestStatus::Error;
+  }
+
+  // Records whose layers do not chain, whose activation is unknown or whose
+  // weights would end past the file (or wrap around) are rejected, as are
+  // headers claiming more bytes or layers than the file holds.
+  using Header = model_format::Header;
+  using Record = model_format::LayerRecord;
+  const auto read = [&path] {
+    Model patched({1, 1}, {AF::Type::Identity});
+    FileReader in(path);
+    in >> patched;
+  };
+  const auto map = [&path] { InferenceModel::load(path); };
+  for (const auto &load : std::vector<std::function<void()>>{read, map}) {
+    if (loadsPatched(path, recordField(1, offsetof(Record, cols)),
+                     std::uint64_t(6), load) ||
+        loadsPatched(path, recordField(1, offsetof(Record, activation)),
+                     std::uint32_t(AF::kTypeCount), load) ||
+        loadsPatched(path, recordField(1, offsetof(Record, rows)),
+                     std::uint64_t(1) << 62, load) ||
+        loadsPatched(path, offsetof(Header, layer_count),
+                     std::uint64_t(1) << 61, load) ||
+        loadsPatched(path, offsetof(Header, file_size),
+                     std::uint64_t(1) << 40, load)) {
+      std::cout << "[FAIL] A corrupt model file record was accepted\n";
+      return TestStatus::Error;
+    }
+  }
+  std::filesystem::remove(path);
+
+  // A write that only fails when the buffer is flushed is caught by close().
+  if (std::filesystem::exists("/dev/full")) {
+    try {
+      FileWriter full("/dev/full");
+      full << std::int32_t(1);
+      full.close();
+      std::cout << "[FAIL] FileWriter::close missed a failed flush\n";
+      return TestStatus::Error;
+    } catch (const std::runtime_error &) {
+    }
+  }
+  return TestStatus::OK;
+}
+
+void writeUint32BE(std::ofstream &out, std::uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out.put(static_cast<char>((value >> shift) & 0xFF));
+}
+
+TestStatus testTrainingConfig() {
+  const auto file =
+      std::filesystem::temp_directory_path() / "neural_net_test_config.cfg";
+  {
+    std::ofstream out(file);
+    out << "# comment\n"
+        << "layers = 6, 5, 3   # trailing comment\n"
+        << "activations = tanh, identity\n"
+        << "loss = softmax_cross_entropy\n"
+        << "optimizer = lamb\n"
+        << "batch_size = 16\n";
+  }
+  const std::string config_flag = "--config=" + file.string();
+  const char *argv[] = {"neural_net", "--batch-size=32", config_flag.c_str(),
+                        "--seed=9"};
+  const TrainingConfig config = TrainingConfig::fromArguments(4, argv);
+  std::filesystem::remove(file);
+
+  const Model model = config.makeModel();
+  if (config.batch_size != 32 || config.seed != 9 ||
+      config.optimizer != Optimizer::Type::LAMB ||
+      config.loss != TrainingConfig::Loss::SoftmaxCrossEntropy ||
+      model.layers().size() != 2 || model.layers()[0].weights().cols() != 6 ||
+      model.layers()[0].activationType() != ActivationFunction::Type::Tanh ||
+      config.makeOptimizer(10).type() != Optimizer::Type::LAMB) {
+    std::cout << "[FAIL] TrainingConfig parsed the file and flags wrongly\n";
+    return TestStatus::Error;
+  }
+
+  for (const char *bad : {"--layers=6,3", "--optimizer=adagrad", "--epochs=x",
+                          "--unknown=1", "batch_size=4",
+                          "--loss=cross_entropy"}) {
+    const char *bad_argv[] = {"neural_net", bad};
+    try {
+      TrainingConfig::fromArguments(2, bad_argv);
+      std::cout << "[FAIL] TrainingConfig accepted " << bad << "\n";
+      return TestStatus::Error;
+    } catch (const std::runtime_error &) {
+    }
+  }
+  const char *softmax_argv[] = {"neural_net", "--activations=relu,softmax",
+                                "--loss=cross_entropy"};
+  TrainingConfig::fromArguments(3, softmax_argv);
+  return TestStatus::OK;
+}
+
+TestStatus testTrainingSweep() {
+  const char *argv[] = {"neural_net", "--layers=6,4,3 | 6,8,3",
+                        "--activations=relu,identity",
+                        "--learning-rate=0.1|0.01|0.001", "--jobs=3"};
+  const TrainingSweep sweep = TrainingSweep::fromArguments(5, argv);
+  const std::vector<TrainingConfig> configs = sweep.expand();
+  if (sweep.jobs != 3 || configs.size() != 6 ||
+      configs[4].layers[1] != 8 || configs[4].learning_rate != 0.01 ||
+      configs[4].name != "job4" || configs[4].progress ||
+      sweep.describe(4) != "layers=6,8,3;learning_rate=0.01") {
+    std::cout << "[FAIL] TrainingSweep expanded the grid wrongly\n";
+    return TestStatus::Error;
+  }
+
+  for (const char *bad : {"--train-images=a|b", "--optimizer=adam|adagrad",
+                          "--jobs=0", "--checkpoint=run.ckpt",
+                          "--metrics-csv=metrics.csv", "--name=run",
+                          "--stream=true|false", "--shuffle-window=64"}) {
+    const char *bad_argv[] = {"neural_net", bad};
+    try {
+      TrainingSweep::fromArguments(2, bad_argv);
+      std::cout << "[FAIL] TrainingSweep accepted " << bad << "\n";
+      return TestStatus::Error;
+    } catch (const std::runtime_error &) {
+    }
+  }
+  return TestStatus::OK;
+}
+
+TestStatus testCheckpointResume() {
+  Random rng(11);
+  std::vector<int> train_labels(50), test_labels(20);
+  for (size_t i = 0; i < train_labels.size(); ++i)
+    train_labels[i] = int(i % 3);
+  for (size_t i = 0; i < test_labels.size(); ++i)
+    test_labels[i] = int(i % 3);
+  const Dataset train(rng.uniformMatrix(6, 50, 0.0, 1.0), train_labels);
+  const Dataset test(rng.uniformMatrix(6, 20, 0.0, 1.0), test_labels);
+
+  const auto dir =
+      std::filesystem::temp_directory_path() / "neural_net_test_checkpoint";
+  std::filesystem::remove_all(dir);
+  TrainingConfig config;
+  config.set("layers", "6,5,3");
+  config.set("activations", "tanh,identity");
+  config.set("loss", "softmax_cross_entropy");
+  config.set("schedule", "cosine");
+  config.epochs = 3;
+  config.batch_size = 4;
+  config.accumulation_steps = 2;
+  config.output_dir = dir;
+  config.progress = false;
+  // 7 optimizer steps per epoch: the last checkpoint is taken after step
+  // 20, in the middle of the third epoch.
+  config.checkpoint = dir / "run.ckpt";
+  config.checkpoint_epochs = 0;
+  config.checkpoint_steps = 4;
+
+  std::ostream quiet(nullptr);
+  config.name = "full";
+  const TrainingResult full = runTraining(config, train, test, quiet);
+  const TrainingCheckpoint saved = readCheckpoint(config.checkpoint);
+
+  config.name = "resumed";
+  config.resume = config.checkpoint;
+  config.checkpoint.clear();
+  const TrainingResult resumed = runTraining(config, train, test, quiet);
+
+  // Settings that change what the saved position means are rejected.
+  bool accepts_other_settings = false;
+  const std::pair<const char *, const char *> other_settings[] = {
+      {"batch_size", "5"},
+      {"accumulation_steps", "1"},
+      {"seed", "7"},
+      {"threads", "2"}};
+  for (const auto &[key, value] : other_settings) {
+    TrainingConfig changed = config;
+    changed.name = "changed";
+    changed.set(key, value);
+    try {
+      runTraining(changed, train, test, quiet);
+      accepts_other_settings = true;
+    } catch (const std::runtime_error &) {
+    }
+  }
+
+  // A history count whose extra bytes wrap around to the real file size
+  // is still rejected (byte 144 is history_count in the version 3 header).
+  const bool accepts_corrupt = loadsPatched(
+      config.resume, 144,
+      std::uint64_t(saved.history.size()) + (std::uint64_t(1) << 59),
+      [&] { readCheckpoint(config.resume); });
+
+  const auto bytes = [&](const std::string &file) {
+    std::ifstream in(dir / file, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), {});
+  };
+  const bool same_logs =
+      bytes("loss_full_train.csv") == bytes("loss_resumed_train.csv") &&
+      bytes("accuracy_full.csv") == bytes("accuracy_resumed.csv");
+  const bool same_model =
+      bytes("model_full.bin") == bytes("model_resumed.bin");
+  std::filesystem::remove_all(dir);
+
+  if (saved.epoch != 2 || saved.position != 48 || saved.history.size() != 2 ||
+      saved.optimizer_state.t != 20) {
+    std::cout << "[FAIL] Checkpoint was not taken after step 20\n";
+    return TestStatus::Error;
+  }
+  if (accepts_other_settings) {
+    std::cout << "[FAIL] Checkpoint resumed with another batch size, "
+                 "accumulation, seed or thread count\n";
+    return TestStatus::Error;
+  }
+  if (accepts_corrupt) {
+    std::cout << "[FAIL] Checkpoint with a wrapping history count was read\n";
+    return TestStatus::Error;
+  }
+  if (!same_model || !same_logs || full.history.size() != 3 ||
+      resumed.history.size() != 3 ||
+      full.history[2].train_loss != resumed.history[2].train_loss ||
+      full.history[2].val_loss != resumed.history[2].val_loss) {
+    std::cout << "[FAIL] Resumed run differs from the uninterrupted one\n";
+    return TestStatus::Error;
+  }
+  return TestStatus::OK;
+}
+
+TestStatus testMetricsReporter() {
+  // By-products of a training step: the loss and the correct predictions
+  // of its forward pass.
+  Model model({4, 6, 3}, {ActivationFunction::Type::Tanh,
+                          ActivationFunction::Type::Identity});
+  Random rng(12);
+  const Matrix X = rng.uniformMatrix(4, 9, -1.0, 1.0);
+  Labels labels(9);
+  labels << 0, 1, 2, 0, 1, 2, 0, 1, 2;
+  const Matrix out = model.forwardBatch(X);
+  Index expected = 0;
+  for (Index j = 0; j < X.cols(); ++j) {
+    Index predicted;
+    out.col(j).maxCoeff(&predicted);
+    expected += predicted == labels[j];
+  }
+  ParallelTrainer trainer(model, 2);
+  trainer.accumulateBatch(X, labels, SoftmaxCrossEntropy::lossGradBatch);
+  if (trainer.lastCorrect() != expected) {
+    std::cout << "[FAIL] ParallelTrainer counted " << trainer.lastCorrect()
+              << " correct predictions instead of " << expected << "\n";
+    return TestStatus::Error;
+  }
+
+  const auto csv =
+      std::filesystem::temp_directory_path() / "neural_net_test_metrics.csv";
+  {
+    MetricsReporter::Options options;
+    options.interval = std::chrono::hours(1);
+    options.console = false;
+    options.csv = csv;
+    std::ostream quiet(nullptr);
+    MetricsReporter reporter(options, quiet);
+    MetricsReporter::Counter &counter = reporter.counter();
+    std::thread producer([&] {
+      MetricsReporter::Counter &other = reporter.counter();
+      other.record(10, 5.0, 4);
+    });
+    producer.join();
+    counter.record(30, 3.0, 26);
+    reporter.flush();
+    counter.startEpoch(1);
+    counter.record(20, 4.0, 20);
+  }
+  std::ifstream in(csv);
+  std::string header, first, second, extra;
+  std::getline(in, header);
+  std::getline(in, first);
+  std::getline(in, second);
+  const bool more = bool(std::getline(in, extra));
+  std::filesystem::remove(csv);
+  // Seconds and samples/s vary; compare the epoch, samples, loss and
+  // accuracy columns.
+  const auto fixed = [](const std::string &row) {
+    std::vector<std::string> fields;
+    std::stringstream stream(row);
+    for (std::string field; std::getline(stream, field, ',');)
+      fields.push_back(field);
+    return fields.size() == 6 ? fields[1] + "," + fields[2] + "," +
+                                    fields[4] + "," + fields[5]
+                              : row;
+  };
+  if (more || fixed(first) != "1,40,0.2,75" ||
+      fixed(second) != "2,60,0.2,100") {
+    std::cout << "[FAIL] MetricsReporter wrote " << first << " / " << second
+              << "\n";
+    return TestStatus::Error;
+  }
+
+  // Metric files that cannot be fully written fail close().
+  if (std::filesystem::exists("/dev/full")) {
+    MetricsReporter::Options options;
+    options.console = false;
+    options.csv = "/dev/full";
+    std::ostream quiet(nullptr);
+    MetricsReporter reporter(options, quiet);
+    reporter.counter().record(1, 1.0, 1);
+    try {
+      reporter.close();
+      std::cout << "[FAIL] MetricsReporter::close missed a failed write\n";
+      return TestStatus::Error;
+    } catch (const std::runtime_error &) {
+    }
+  }
+  return TestStatus::OK;
+}
+
+TestStatus testProfiler() {
+  // The scopes are used directly so that this runs in every build; the
+  // macros only add or remove them.
+  profile::reset();
+  for (int i = 0; i < 2; ++i) {
+    profile::LayerScope layer(3);
+    profile::Scope scope(profile::Stage::Forward, 2e6, 1e6);
+  }
+  std::thread([] {
+    profile::Scope scope(profile::Stage::Reduce, 0, 0);
+  }).join();
+
+  std::ostringstream summary;
+  profile::printSummary(summary, "test");
+  std::istringstream lines(summary.str());
+  std::string line, title, forward, reduce;
+  std::getline(lines, title);
+  while (std::getline(lines, line)) {
+    std::istringstream fields(line);
+    std::string stage, layer, calls;
+    fields >> stage >> layer >> calls;
+    if (stage == "forward")
+      forward = layer + " " + calls;
+    else if (stage == "reduce")
+      reduce = layer + " " + calls;
+  }
+  if (title != "Profile: test" || forward != "3 2" || reduce != "- 1") {
+    std::cout << "[FAIL] Profiler summary:\n" << summary.str();
+    return TestStatus::Error;
+  }
+
+  const auto trace =
+      std::filesystem::temp_directory_path() / "neural_net_test_trace.json";
+  profile::writeChromeTrace(trace);
+  std::ifstream in(trace);
+  const std::string json((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+  in.close();
+  std::filesystem::remove(trace);
+  if (json.rfind("{\"displayTimeUnit\"", 0) != 0 ||
+      json.find("\"name\":\"forward/3\"") == std::string::npos ||
+      json.find("\"name\":\"reduce\"") == std::string::npos ||
+      json.find("\"ph\":\"X\"") == std::string::npos) {
+    std::cout << "[FAIL] Profiler trace is missing events\n";
+    return TestStatus::Error;
+  }
+  profile::reset();
+  return TestStatus::OK;
+}
+
+TestStatus testQuantizedModel() {
+  // 40 inputs and 37 units exercise the padded columns and the row tail
+  // of the int8 kernel.
+  Model model({40, 37, 10}, {ActivationFunction::Type::ReLU,
+                             ActivationFunction::Type::Identity});
+  const InferenceModel frozen = model.freeze();
+  Random rng(21);
+  const Matrix calibration = rng.uniformMatrix(40, 200, 0.0, 1.0);
+  const Matrix X = rng.uniformMatrix(40, 50, 0.0, 1.0);
+  const QuantizedModel quantized =
+      QuantizedModel::quantize(frozen, calibration);
+
+  InferenceModel::Workspace float_workspace = frozen.makeWorkspace(X.cols());
+  QuantizedModel::Workspace workspace = quantized.makeWorkspace(X.cols());
+  const Matrix expected = frozen.predict(X, float_workspace);
+  AllocationCounter counter;
+  const ConstMatrixRef out = quantized.predict(X, workspace);
+  const std::size_t allocations = counter.count();
+
+  // int8 rounding costs about 1% of the output range per layer.
+  const double range = expected.cwiseAbs().maxCoeff();
+  const double error = (out - expected).cwiseAbs().maxCoeff();
+  Index agree = 0;
+  for (Index j = 0; j < X.cols(); ++j) {
+    Index a, b;
+    out.col(j).maxCoeff(&a);
+    expected.col(j).maxCoeff(&b);
+    agree += a == b;
+  }
+  if (error > 0.05 * range || agree < 45) {
+    std::cout << "[FAIL] QuantizedModel error " << error << " of " << range
+              << ", " << agree << "/50 predictions agree\n";
+    return TestStatus::Error;
+  }
+  if (AllocationCounter::supported() && allocations != 0) {
+    std::cout << "[FAIL] QuantizedModel::predict allocated\n";
+    return TestStatus::Error;
+  }
+  if (quantized.parameterBytes() * 2 > frozen.parameterBytes()) {
+    std::cout << "[FAIL] QuantizedModel is not smaller than the float model\n";
+    return TestStatus::Error;
+  }
+
+  const auto file =
+      std::filesystem::temp_directory_path() / "neural_net_test_model.q8";
+  quantized.save(file);
+  double round_trip;
+  {
+    const QuantizedModel loaded = QuantizedModel::load(file);
+    QuantizedModel::Workspace loaded_workspace =
+        loaded.makeWorkspace(X.cols());
+    round_trip =
+        (loaded.predict(X, loaded_workspace) - out).cwiseAbs().maxCoeff();
+  }
+  // Make the second layer take 41 inputs from the first layer's 37.
+  bool rejected_file = false;
+  {
+    std::fstream patch(file, std::ios::in | std::ios::out | std::ios::binary);
+    const std::uint64_t cols = 41;
+    patch.seekp(24 + 56 + 8);
+    patch.write(reinterpret_cast<const char *>(&cols), sizeof(cols));
+  }
+  try {
+    QuantizedModel::load(file);
+  } catch (const std::runtime_error &) {
+    rejected_file = true;
+  }
+  std::filesystem::remove(file);
+  if (round_trip > kPrecision) {
+    std::cout << "[FAIL] QuantizedModel file round trip changed the output\n";
+    return TestStatus::Error;
+  }
+  if (!rejected_file) {
+    std::cout << "[FAIL] QuantizedModel loaded mismatched layer sizes\n";
+    return TestStatus::Error;
+  }
+  try {
+    quantized.predict(X.topRows(39), workspace);
+    std::cout << "[FAIL] QuantizedModel accepted a wrong input size\n";
+    return TestStatus::Error;
+  } catch (const std::runtime_error &) {
+  }
+  return TestStatus::OK;
+}
+
+TestStatus testStaticModel() {
+  using Type = ActivationFunction::Type;
+  // 24 rows take the blocked path, 7 and 5 the single-block one.
+  using Small = StaticModel<Dense<13, 24, Type::Tanh>,
+                            Dense<24, 7, Type::Sigmoid>,
+                            Dense<7, 5, Type::Softmax>>;
+  Model small({13, 24, 7, 5}, {Type::Tanh, Type::Sigmoid, Type::Softmax});
+  Model arch = makeArchitecture(3);
+  const Small small_static(small);
+  const static_architectures::Architecture3 arch_static(arch);
+
+  Random rng(23);
+  const Matrix X = rng.uniformMatrix(784, 8, 0.0, 1.0);
+  double error = 0.0;
+  std::size_t allocations = 0;
+  for (Index j = 0; j < X.cols(); ++j) {
+    const Vector x = X.col(j);
+    const Vector small_expected = small.forward(x.head(13));
+    const Vector arch_expected = arch.forward(x);
+    AllocationCounter counter;
+    const Small::Output small_out = small_static.predict(x.head<13>());
+    const auto arch_out = arch_static.predict(x);
+    allocations += counter.count();
+    error = std::max<double>(
+        {error, (small_out - small_expected).cwiseAbs().maxCoeff(),
+         (arch_out - arch_expected).cwiseAbs().maxCoeff()});
+  }
+  if (error > kPrecision) {
+    std::cout << "[FAIL] StaticModel::predict differs from Model by " << error
+              << "\n";
+    return TestStatus::Error;
+  }
+  if (AllocationCounter::supported() && allocations != 0) {
+    std::cout << "[FAIL] StaticModel::predict allocated\n";
+    return TestStatus::Error;
+  }
+
+  try {
+    const Small wrong(Model({13, 24, 7, 5}, {Type::ReLU, Type::Sigmoid,
+                                             Type::Softmax}));
+    std::cout << "[FAIL] StaticModel accepted a mismatched model\n";
+    return TestStatus::Error;
+  } catch (const std::runtime_error &) {
+  }
+  try {
+    small_static.predict(X.col(0).head(12));
+    std::cout << "[FAIL] StaticModel accepted a wrong input size\n";
+    return TestStatus::Error;
+  } catch (const std::runtime_error &) {
+  }
+  return TestStatus::OK;
+}
+
+TestStatus testMNISTLoader() {
+  const auto dir = std::filesystem::temp_directory_path();
+  const auto images = dir / "neural_net_test_images.idx3";
+  const auto labels = dir / "neural_net_test_labels.idx1";
+  {
+    // Three 2x2 images with pixel values 0..11 and labels 7, 8, 9.
+    std::ofstream img(images, std::ios::binary), lbl(labels, std::ios::binary);
+    for (std::uint32_t v : {2051u, 3u, 2u, 2u})
+      writeUint32BE(img, v);
+    for (char p = 0; p < 12; ++p)
+      img.put(p);
+    for (std::uint32_t v : {2049u, 3u})
+      writeUint32BE(lbl, v);
+    for (char l : {7, 8, 9})
+      lbl.put(l);
+  }
+
+  Dataset dataset;
+  const bool loaded = loadMNIST(images.string(), labels.string(), dataset);
+  std::filesystem::remove(images);
+  std::filesystem::remove(labels);
+
+  if (!loaded || dataset.size() != 3 || dataset.featureSize() != 4 ||
+      dataset.label(2) != 9 ||
+      std::abs(dataset.sample(1)[3] - 7.0 / 255.0) > kPrecision) {
+    std::cout << "[FAIL] loadMNIST produced a wrong dataset\n";
+    return TestStatus::Error;
+  }
+  if (dataset.batch(1, 2).data() != dataset.sample(1).data()) {
+    std::cout << "[FAIL] Dataset::batch is not a view of the samples\n";
+    return TestStatus::Error;
+  }
+
+  // Four 2^31 x 2^31 images, whose byte count wraps around to zero, are
+  // rejected rather than allocated.
+  {
+    std::ofstream img(images, std::ios::binary), lbl(labels, std::ios::binary);
+    for (std::uint32_t v : {2051u, 4u, 1u << 31, 1u << 31})
+      writeUint32BE(img, v);
+    for (std::uint32_t v : {2049u, 4u})
+      writeUint32BE(lbl, v);
+    for (char l : {1, 2, 3, 4})
+      lbl.put(l);
+  }
+  const bool loaded_wrapped =
+      loadMNIST(images.string(), labels.string(), dataset);
+  std::filesystem::remove(images);
+  std::filesystem::remove(labels);
+  if (loaded_wrapped) {
+    std::cout << "[FAIL] loadMNIST accepted a wrapping image count\n";
+    return TestStatus::Error;
+  }
+  return TestStatus::OK;
+}
+
+TestStatus testStreamingLoader() {
+  const auto dir = std::filesystem::temp_directory_path();
+  const auto images = dir / "neural_net_stream_images.idx3";
+  const auto labels = dir / "neural_net_stream_labels.idx1";
+  const int count = 50;
+  {
+    // 1x2 images whose pixels both equal the label, so pairs can be checked.
+    std::ofstream img(images, std::ios::binary), lbl(labels, std::ios::binary);
+    for (std::uint32_t v : {2051u, std::uint32_t(count), 1u, 2u})
+      writeUint32BE(img, v);
+    for (std::uint32_t v : {2049u, std::uint32_t(count)})
+      writeUint32BE(lbl, v);
+    for (int i = 0; i < count; ++i) {
+      img.put(char(i));
+      img.put(char(i));
+      lbl.put(char(i));
+    }
+  }
+
+  auto stream = [&](Index window, std::vector<int> &seen) {
+    StreamingOptions options;
+    options.batch_size = 8;
+    options.ring_size = 2;
+    options.shuffle_window = window;
+    options.read_chunk = 5;
+    StreamingLoader loader(images.string(), labels.string(), options);
+    while (const StreamingLoader::Batch *batch = loader.next()) {
+      for (Index j = 0; j < batch->size; ++j) {
+        const int label = batch->labels[size_t(j)];
+        if (std::abs(batch->view()(1, j) - label / 255.0) > kPrecision)
+          return false;
+        seen.push_back(label);
+      }
+    }
+    return loader.stats().batches == size_t((count + 7) / 8);
+  };
+
+  std::vector<int> in_order, shuffled;
+  bool ok = stream(1, in_order) && stream(16, shuffled);
+  // Images claimed larger than the file holds (1000 rows, big-endian) are
+  // rejected up front.
+  ok = ok && !loadsPatched(images, 8,
+                           std::array<unsigned char, 4>{0, 0, 3, 232}, [&] {
+                             StreamingLoader(images.string(), labels.string(),
+                                             StreamingOptions());
+                           });
+  std::filesystem::remove(images);
+  std::filesystem::remove(labels);
+
+  std::vector<int> expected(count);
+  std::iota(expected.begin(), expected.end(), 0);
+  if (!ok || in_order != expected || shuffled == expected) {
+    std::cout << "[FAIL] StreamingLoader produced wrong batches\n";
+    return TestStatus::Error;
+  }
+  std::sort(shuffled.begin(), shuffled.end());
+  if (shuffled != expected) {
+    std::cout << "[FAIL] StreamingLoader did not emit each sample once\n";
+    return TestStatus::Error;
+  }
+  return TestStatus::OK;
+}
+
+// A streamed run trains on every sample of the files each epoch, and one
+// resumed from a mid-epoch checkpoint ends exactly like the full run. Data
+// that does not fit the configured model is rejected.
+TestStatus testStreamedTraining() {
+  const auto dir =
+      std::filesystem::temp_directory_path() / "neural_net_test_streamed";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  // 2x3 images of random bytes with labels 0..classes-1.
+  const auto writeIdx = [&](const std::string &name, std::uint32_t count,
+                            std::uint32_t classes) {
+    std::ofstream img(dir / (name + ".idx3"), std::ios::binary);
+    std::ofstream lbl(dir / (name + ".idx1"), std::ios::binary);
+    for (std::uint32_t v : {2051u, count, 2u, 3u})
+      writeUint32BE(img, v);
+    for (std::uint32_t v : {2049u, count})
+      writeUint32BE(lbl, v);
+    std::mt19937 bytes(count);
+    for (std::uint32_t i = 0; i < count; ++i) {
+      for (int p = 0; p < 6; ++p)
+        img.put(char(bytes() & 0xFF));
+      lbl.put(char(i % classes));
+    }
+  };
+  writeIdx("train", 50, 3);
+  writeIdx("test", 20, 3);
+  writeIdx("four", 50, 4);
+
+  TrainingConfig config;
+  config.set("layers", "6,5,3");
+  config.set("activations", "tanh,identity");
+  config.set("loss", "softmax_cross_entropy");
+  config.set("stream", "true");
+  config.set("shuffle_window", "16");
+  config.train_images = dir / "train.idx3";
+  config.train_labels = dir / "train.idx1";
+  config.test_images = dir / "test.idx3";
+  config.test_labels = dir / "test.idx1";
+  config.epochs = 3;
+  config.batch_size = 4;
+  config.output_dir = dir;
+  config.progress = false;
+  config.checkpoint = dir / "run.ckpt";
+  config.checkpoint_epochs = 0;
+  // 13 optimizer steps per epoch: the checkpoint after step 30 falls
+  // after the fourth batch of the third epoch.
+  config.checkpoint_steps = 30;
+
+  std::ostream quiet(nullptr);
+  config.name = "full";
+  const TrainingResult full = runTraining(config, quiet);
+  const TrainingCheckpoint saved = readCheckpoint(config.checkpoint);
+  config.name = "resumed";
+  config.resume = config.checkpoint;
+  config.checkpoint.clear();
+  const TrainingResult resumed = runTraining(config, quiet);
+
+  const auto bytes = [&](const std::string &file) {
+    std::ifstream in(dir / file, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), {});
+  };
+  const bool same_model =
+      bytes("model_full.bin") == bytes("model_resumed.bin");
+
+  const auto rejects = [&](TrainingConfig bad) {
+    bad.resume.clear();
+    bad.epochs = 1;
+    try {
+      runTraining(bad, quiet);
+    } catch (const std::runtime_error &) {
+      return true;
+    }
+    return false;
+  };
+  TrainingConfig wide = config;
+  wide.set("layers", "7,5,3");
+  TrainingConfig few_classes = config;
+  few_classes.train_images = dir / "four.idx3";
+  few_classes.train_labels = dir / "four.idx1";
+  const bool rejected = rejects(wide) && rejects(few_classes);
+  std::filesystem::remove_all(dir);
+
+  if (!rejected) {
+    std::cout << "[FAIL] Streamed data that does not fit the model was "
+                 "accepted\n";
+    return TestStatus::Error;
+  }
+  if (full.history.size() != 3 || saved.epoch != 2 || saved.position != 16) {
+    std::cout << "[FAIL] Streamed run did not train on every sample\n";
+    return TestStatus::Error;
+  }
+  if (!same_model || resumed.history.size() != 3 ||
+      full.history[2].train_loss != resumed.history[2].train_loss) {
+    std::cout << "[FAIL] Resumed streamed run differs from the full one\n";
+    return TestStatus::Error;
+  }
+  return TestStatus::OK;
+}
+
+// Conv2D against a direct convolution, MaxPool against a direct maximum,
+// and both backward passes through their adjoint identities: for these
+// (piecewise) linear maps <g, f(x)> = <f'(g), x>, which exercises col2im
+// and the pooling scatter at the padded and dropped borders.
+TestStatus testConvolutionLayers() {
+  using AF = ActivationFunction;
+  Random rng(27);
+  const Index batch = 3;
+  auto dot = [](const ConstMatrixRef &a, const ConstMatrixRef &b) {
+    return double(a.cwiseProduct(b).sum());
+  };
+
+  const ImageShape in{7, 6, 3};
+  const Conv2D conv(in, 4, 3, AF::create(AF::Type::Identity), 2, 1);
+  const ImageShape out = conv.outputShape();
+  if (out.height != 4 || out.width != 3 || out.channels != 4) {
+    std::cout << "[FAIL] Conv2D output shape is wrong\n";
+    return TestStatus::Error;
+  }
+  const Matrix x = rng.uniformMatrix(in.size(), batch, -1.0, 1.0);
+  Conv2D::Scratch conv_scratch;
+  const Matrix y = conv.forwardBatch(x, conv_scratch);
+  const auto w = conv.weights();
+  const auto b = conv.biases();
+  double error = 0.0;
+  for (Index j = 0; j < batch; ++j) {
+    for (Index oy = 0; oy < out.height; ++oy) {
+      for (Index ox = 0; ox < out.width; ++ox) {
+        for (Index f = 0; f < out.channels; ++f) {
+          double sum = b[f];
+          for (Index ky = 0; ky < 3; ++ky) {
+            for (Index kx = 0; kx < 3; ++kx) {
+              const Index iy = oy * 2 - 1 + ky, ix = ox * 2 - 1 + kx;
+              if (iy < 0 || iy >= in.height || ix < 0 || ix >= in.width)
+                continue;
+              for (Index c = 0; c < in.channels; ++c)
+                sum += w(f, (ky * 3 + kx) * in.channels + c) *
+                       x((iy * in.width + ix) * in.channels + c, j);
+            }
+          }
+          error = std::max(
+              error,
+              std::abs(sum - y((oy * out.width + ox) * out.channels + f, j)));
+        }
+      }
+    }
+  }
+  const Matrix g = rng.uniformMatrix(out.size(), batch, -1.0, 1.0);
+  Matrix grad_w(w.rows(), w.cols());
+  Vector grad_b(b.size());
+  const Matrix grad_x =
+      conv.backwardBatch(g, conv_scratch, grad_w, grad_b, false, true);
+  const Matrix linear =
+      y.colwise() - Vector(b.replicate(out.height * out.width, 1));
+  const Vector bias_sum =
+      Eigen::Map<const Matrix>(g.data(), out.channels, g.size() / out.channels)
+          .rowwise()
+          .sum();
+  const double scale = std::abs(dot(g, linear)) + 1.0;
+  if (error > 10 * kPrecision ||
+      std::abs(dot(g, linear) - dot(grad_x, x)) > 10 * kPrecision * scale ||
+      std::abs(dot(g, linear) - dot(grad_w, w)) > 10 * kPrecision * scale ||
+      (grad_b - bias_sum).cwiseAbs().maxCoeff() > 10 * kPrecision) {
+    std::cout << "[FAIL] Conv2D disagrees with a direct convolution\n";
+    return TestStatus::Error;
+  }
+
+  // Batches of several tiles (a few 28 x 28 images each) agree with their
+  // samples one at a time, whether the patches stay sparse throughout or
+  // turn dense part of the way through, and in inference.
+  const Conv2D tiled({28, 28, 1}, 6, 5, AF::create(AF::Type::ReLU));
+  const Index images = 10;
+  Matrix digits = (rng.uniformMatrix(784, images, 0.0, 1.0).array() < 0.2)
+                      .select(rng.uniformMatrix(784, images, 0.0, 1.0), 0);
+  for (const Index dense_from : {images, Index(6)}) {
+    digits.rightCols(images - dense_from) =
+        rng.uniformMatrix(784, images - dense_from, 0.5, 1.0);
+    const Matrix tg =
+        rng.uniformMatrix(tiled.outputSize(), images, -1.0, 1.0);
+    Conv2D::Scratch batched, single;
+    const Matrix inferred = tiled.forwardBatch(digits, batched, false);
+    // Inference unrolls one tile at a time and leaves the patch buffer of
+    // a training batch unallocated.
+    if (batched.dense.input.size() != 0 ||
+        batched.patches.cols() >= images * tiled.outputSize() / 6) {
+      std::cout << "[FAIL] Conv2D inference sized the training patches\n";
+      return TestStatus::Error;
+    }
+    const Matrix trained = tiled.forwardBatch(digits, batched);
+    Matrix tiled_w(6, 25), single_w = Matrix::Zero(6, 25);
+    Vector tiled_b(6), single_b = Vector::Zero(6);
+    tiled.backwardBatch(tg, batched, tiled_w, tiled_b, false, false);
+    double tile_error = (inferred - trained).cwiseAbs().maxCoeff();
+    for (Index j = 0; j < images; ++j) {
+      const Matrix yj = tiled.forwardBatch(digits.col(j), single);
+      tiled.backwardBatch(tg.col(j), single, single_w, single_b, true, false);
+      tile_error = std::max<double>(
+          tile_error, (yj - trained.col(j)).cwiseAbs().maxCoeff());
+    }
+    const double tile_scale = 1.0 + single_w.cwiseAbs().maxCoeff() +
+                              single_b.cwiseAbs().maxCoeff();
+    if (tile_error > 10 * kPrecision ||
+        (tiled_w - single_w).cwiseAbs().maxCoeff() > kPrecision * tile_scale ||
+        (tiled_b - single_b).cwiseAbs().maxCoeff() > kPrecision * tile_scale) {
+      std::cout << "[FAIL] Conv2D tiles disagree with single samples\n";
+      return TestStatus::Error;
+    }
+  }
+
+  const ImageShape pooled{5, 5, 2};
+  const MaxPool pool(pooled, 2);
+  MaxPool::Scratch pool_scratch;
+  const Matrix px = rng.uniformMatrix(pooled.size(), batch, -1.0, 1.0);
+  const Matrix py = pool.forwardBatch(px, pool_scratch);
+  bool exact = pool.outputSize() == 8;
+  for (Index j = 0; exact && j < batch; ++j) {
+    for (Index i = 0; i < pool.outputSize(); ++i) {
+      const Index c = i % 2, ox = i / 2 % 2, oy = i / 4;
+      Scalar expected = px(((2 * oy) * 5 + 2 * ox) * 2 + c, j);
+      for (Index ky = 0; ky < 2; ++ky)
+        for (Index kx = 0; kx < 2; ++kx)
+          expected = std::max(
+              expected, px(((2 * oy + ky) * 5 + 2 * ox + kx) * 2 + c, j));
+      exact = exact && py(i, j) == expected;
+    }
+  }
+  const Matrix pg = rng.uniformMatrix(pool.outputSize(), batch, -1.0, 1.0);
+  const Matrix pgrad = pool.backwardBatch(pg, pool_scratch);
+  if (!exact ||
+      std::abs(dot(pg, py) - dot(pgrad, px)) > 10 * kPrecision) {
+    std::cout << "[FAIL] MaxPool disagrees with a direct maximum\n";
+    return TestStatus::Error;
+  }
+
+  // Inverted dropout: inference is the identity, training keeps 1 - rate
+  // of the inputs scaled up and draws a new mask every pass.
+  const Dropout dropout(50, 0.3);
+  Dropout::Scratch drop_scratch;
+  const Matrix dx = rng.uniformMatrix(50, 40, 0.5, 1.0);
+  if (dropout.forwardBatch(dx, drop_scratch, false).data() != dx.data()) {
+    std::cout << "[FAIL] Dropout changed its input in inference\n";
+    return TestStatus::Error;
+  }
+  const Matrix first = dropout.forwardBatch(dx, drop_scratch, true);
+  const Matrix second = dropout.forwardBatch(dx, drop_scratch, true);
+  const Matrix dgrad = dropout.backwardBatch(dx, drop_scratch);
+  const double kept = double((first.array() != 0).count()) / double(dx.size());
+  const bool scaled =
+      ((first.array() == 0) ||
+       ((first - dx / Scalar(0.7)).array().abs() < 10 * kPrecision))
+          .all();
+  if (kept < 0.6 || kept > 0.8 || !scaled || first == second ||
+      (dgrad - second).cwiseAbs().maxCoeff() > 10 * kPrecision) {
+    std::cout << "[FAIL] Dropout masks are wrong\n";
+    return TestStatus::Error;
+  }
+  return TestStatus::OK;
+}
+
+// A Model mixing every layer type: gradients of all parameters against
+// finite differences, the batch-norm running statistics (serial and
+// reduced across ParallelTrainer shards), the file round trip, and
+// allocation-free steady-state training.
+TestStatus testLayerGraph() {
+  using AF = ActivationFunction;
+  const auto af = [](AF::Type type) { return AF::create(type); };
+  const ImageShape image{6, 6, 2};
+  const Conv2D conv(image, 3, 3, af(AF::Type::Tanh), 1, 1);
+  const MaxPool pool(conv.outputShape(), 2);
+  const Model model({conv, BatchNorm(conv.outputShape()), pool,
+                     Layer(In(pool.outputSize()), Out(8), af(AF::Type::Tanh)),
+                     Dropout(8, 0.25),
+                     Layer(In(8), Out(4), af(AF::Type::Identity))});
+  try {
+    Model({conv, Layer(In(10), Out(4), af(AF::Type::Identity))});
+    std::cout << "[FAIL] Model accepted layers that do not chain\n";
+    return TestStatus::Error;
+  } catch (const std::runtime_error &) {
+  }
+
+  Random rng(28);
+  const Index batch = 5;
+  const Matrix X = rng.uniformMatrix(image.size(), batch, -1.0, 1.0);
+  const Matrix Y = rng.uniformMatrix(4, batch, -1.0, 1.0);
+
+  if constexpr (std::is_same_v<Scalar, double>) {
+    // Loss 0.5 * |out - Y|^2 of a training pass; a fresh scratch of the
+    // same stream repeats the dropout mask.
+    auto loss = [&](const Model &m) {
+      auto scratch = m.makeScratch();
+      return 0.5 * (m.forwardBatch(X, scratch) - Y).squaredNorm();
+    };
+    auto scratch = model.makeScratch();
+    const Matrix grad = model.forwardBatch(X, scratch) - Y;
+    model.backwardBatch(grad, scratch);
+
+    Model probe = model;
+    const Vector parameters = model.parameters();
+    const double h = 1e-6;
+    double error = 0.0;
+    for (Index i = 0; i < parameters.size(); ++i) {
+      Vector shifted = parameters;
+      shifted[i] += h;
+      probe.restore(shifted, {});
+      const double plus = loss(probe);
+      shifted[i] -= 2 * h;
+      probe.restore(shifted, {});
+      const double numeric = (plus - loss(probe)) / (2 * h);
+      error = std::max(error, std::abs(numeric - scratch.grads[i]) /
+                                  (1.0 + std::abs(numeric)));
+    }
+    if (error > 1e-6) {
+      std::cout << "[FAIL] Layer graph gradients disagree with finite "
+                   "differences ("
+                << error << ")\n";
+      return TestStatus::Error;
+    }
+  }
+
+  // One step moves the running statistics a tenth of the way to the
+  // batch's; the sums are reduced with the gradients across shards.
+  auto expected = model.makeScratch();
+  model.forwardBatch(X, expected);
+  const auto &batch_stats = std::get<BatchNorm::Scratch>(expected.layers[1]);
+  const Vector mean = Scalar(0.1) * batch_stats.mean;
+  const Vector variance =
+      (Scalar(0.9) + Scalar(0.1) * batch_stats.variance.array()).matrix();
+  const std::vector<int> labels{0, 1, 2, 3, 1};
+  const Labels y = Eigen::Map<const Eigen::VectorXi>(labels.data(), batch);
+  Optimizer opt = Optimizer::Adam(0.01);
+  Model serial = model, parallel = model;
+  serial.initOptimizerState(opt);
+  parallel.initOptimizerState(opt);
+  ParallelTrainer trainer(parallel, 2);
+  serial.trainBatch(X, y, SoftmaxCrossEntropy::lossGradBatch, opt);
+  trainer.trainBatch(X, y, SoftmaxCrossEntropy::lossGradBatch, opt);
+  for (const Model *m : {&serial, &parallel}) {
+    const auto *norm = m->layers()[1].get<BatchNorm>();
+    if (!norm ||
+        (norm->runningMean() - mean).cwiseAbs().maxCoeff() > kPrecision ||
+        (norm->runningVariance() - variance).cwiseAbs().maxCoeff() >
+            kPrecision) {
+      std::cout << "[FAIL] Batch-norm running statistics are wrong\n";
+      return TestStatus::Error;
+    }
+  }
+
+  const auto path =
+      std::filesystem::temp_directory_path() / "neural_net_test_graph.bin";
+  {
+    FileWriter out(path);
+    out << serial;
+  }
+  Model loaded({1, 1}, {AF::Type::Identity});
+  {
+    FileReader in(path);
+    in >> loaded;
+  }
+  // Only the batch-norm record (the second) has running statistics, and it
+  // must: moving its statistics_offset to the convolution or clearing it
+  // corrupts the file.
+  const auto read = [&path] {
+    Model patched({1, 1}, {AF::Type::Identity});
+    FileReader in(path);
+    in >> patched;
+  };
+  const auto statisticsField = [](std::streamoff layer) {
+    return recordField(layer,
+                       offsetof(model_format::LayerRecord, statistics_offset));
+  };
+  std::uint64_t statistics = 0;
+  {
+    std::ifstream in(path, std::ios::binary);
+    in.seekg(statisticsField(1));
+    in.read(reinterpret_cast<char *>(&statistics), sizeof(statistics));
+  }
+  if (statistics == 0 ||
+      loadsPatched(path, statisticsField(1), std::uint64_t(0), read) ||
+      loadsPatched(path, statisticsField(0), statistics, read)) {
+    std::cout << "[FAIL] A misplaced statistics_offset was accepted\n";
+    return TestStatus::Error;
+  }
+  std::filesystem::remove(path);
+  bool same = loaded.layers().size() == serial.layers().size() &&
+              loaded.parameters() == serial.parameters() &&
+              loaded.forwardBatch(X) == serial.forwardBatch(X);
+  for (size_t i = 0; same && i < serial.layers().size(); ++i)
+    same = loaded.layers()[i].kind() == serial.layers()[i].kind();
+  if (!same) {
+    std::cout << "[FAIL] Layer graph file round trip is not exact\n";
+    return TestStatus::Error;
+  }
+  try {
+    serial.freeze();
+    std::cout << "[FAIL] InferenceModel accepted a convolutional model\n";
+    return TestStatus::Error;
+  } catch (const std::runtime_error &) {
+  }
+
+  serial.trainBatch(X, y, SoftmaxCrossEntropy::lossGradBatch, opt);
+  AllocationCounter allocations;
+  serial.trainBatch(X, y, SoftmaxCrossEntropy::lossGradBatch, opt);
+  if (AllocationCounter::supported() && allocations.count() != 0) {
+    std::cout << "[FAIL] Layer graph training step allocated "
+              << allocations.count() << " times after warm-up\n";
+    return TestStatus::Error;
+  }
+  return TestStatus::OK;
+}
+
 } // anonymous namespace
 
 namespace neural_network {
@@ -104,12 +1867,64 @@ namespace test {
 void runAllTests() {
   if (testActivationFunction() == TestStatus::Error)
     return;
+  if (testFusedActivationKernels() == TestStatus::Error)
+    return;
+  if (testSoftmaxCrossEntropy() == TestStatus::Error)
+    return;
   if (testOptimizerSGD() == TestStatus::Error)
     return;
   if (testOptimizerAdam() == TestStatus::Error)
     return;
+  if (testOptimizerRulesAndSchedules() == TestStatus::Error)
+    return;
   if (testLayerForwardBackward() == TestStatus::Error)
     return;
+  if (testLayerForwardBatch() == TestStatus::Error)
+    return;
+  if (testOptimizerStateNoAllocations() == TestStatus::Error)
+    return;
+  if (testParameterArena() == TestStatus::Error)
+    return;
+  if (testParallelTrainer() == TestStatus::Error)
+    return;
+  if (testGradientAccumulation() == TestStatus::Error)
+    return;
+  if (testTrainingWorkspaceNoAllocations() == TestStatus::Error)
+    return;
+  if (testDenseKernels() == TestStatus::Error)
+    return;
+  if (testSparseInput() == TestStatus::Error)
+    return;
+  if (testInferenceModel() == TestStatus::Error)
+    return;
+  if (testGradientCheck() == TestStatus::Error)
+    return;
+  if (testModelFileRoundTrip() == TestStatus::Error)
+    return;
+  if (testTrainingConfig() == TestStatus::Error)
+    return;
+  if (testTrainingSweep() == TestStatus::Error)
+    return;
+  if (testCheckpointResume() == TestStatus::Error)
+    return;
+  if (testMetricsReporter() == TestStatus::Error)
+    return;
+  if (testProfiler() == TestStatus::Error)
+    return;
+  if (testQuantizedModel() == TestStatus::Error)
+    return;
+  if (testStaticModel() == TestStatus::Error)
+    return;
+  if (testMNISTLoader() == TestStatus::Error)
+    return;
+  if (testStreamingLoader() == TestStatus::Error)
+    return;
+  if (testStreamedTraining() == TestStatus::Error)
+    return;
+  if (testConvolutionLayers() == TestStatus::Error)
+    return;
+  if (testLayerGraph() == TestStatus::Error)
+    return;
 
   std::cout << "[OK] All tests passed!\n";
 }
@@ -0,0 +1,309 @@
+#include "Trainer/Checkpoint.h"
+#include "Utilities/FileReader.h"
+#include "Utilities/FileWriter.h"
+#include "Utilities/ModelFormat.h"
+
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace neural_network {
+
+namespace {
+
+// Checkpoint file layout (native little-endian, this build's Scalar):
+//
+//   Header
+//   uint64 layer sizes[layer_count + 1], input size first
+//   uint32 activations[layer_count]
+//   parameters[parameter_count], first moment[first_moment_size],
+//   second moment[second_moment_size]
+//   EpochResult history[history_count]
+//   shuffle generator state as text[rng_state_bytes]
+
+constexpr char kMagic[8] = {'N', 'N', 'C', 'K', 'P', 'T', '\0', '\0'};
+constexpr std::uint32_t kVersion = 3;
+
+struct Header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t scalar_type;
+  std::uint32_t optimizer;
+  std::uint32_t stream;
+  std::int64_t batch_size;
+  std::int64_t accumulation_steps;
+  std::uint64_t seed;
+  std::int64_t shuffle_window;
+  std::uint64_t threads;
+  std::uint64_t layer_count;
+  std::uint64_t parameter_count;
+  std::uint64_t first_moment_size;
+  std::uint64_t second_moment_size;
+  std::int64_t step;
+  double beta2_power;
+  std::int64_t epoch;
+  std::int64_t position;
+  std::int64_t micro_batch;
+  double running_loss;
+  std::uint64_t history_count;
+  std::uint64_t rng_state_bytes;
+};
+
+static_assert(std::is_trivially_copyable_v<Header> &&
+              std::is_trivially_copyable_v<EpochResult>);
+
+void writeScalars(FileWriter &w, const Scalar *data, Index count) {
+  w.write(data, sizeof(Scalar) * std::uint64_t(count));
+}
+
+void readScalars(FileReader &r, Scalar *data, Index count) {
+  r.read(data, sizeof(Scalar) * std::uint64_t(count));
+}
+
+} // namespace
+
+void TrainingCheckpoint::capture(const Model &model, Optimizer::Type type) {
+  const auto *state = std::any_cast<OptimizerCache>(&model.optimizerState());
+  if (!state) {
+    throw std::runtime_error("Checkpoint needs an initialized optimizer.");
+  }
+  const auto &model_layers = model.layers();
+  for (const auto &layer : model_layers) {
+    if (layer.kind() != AnyLayer::Kind::Dense) {
+      throw std::runtime_error("Checkpoints hold dense models only.");
+    }
+  }
+  layers.resize(model_layers.size() + 1);
+  activations.resize(model_layers.size());
+  layers[0] = size_t(model_layers.front().weights().cols());
+  for (size_t i = 0; i < model_layers.size(); ++i) {
+    layers[i + 1] = size_t(model_layers[i].weights().rows());
+    activations[i] = model_layers[i].activationType();
+  }
+  optimizer = type;
+  parameters = model.parameters();
+  optimizer_state = *state;
+}
+
+void TrainingCheckpoint::restore(Model &model) const {
+  const auto &model_layers = model.layers();
+  bool same = layers.size() == model_layers.size() + 1 &&
+              !model_layers.empty() &&
+              layers[0] == size_t(model_layers.front().weights().cols());
+  for (size_t i = 0; same && i < model_layers.size(); ++i) {
+    same = model_layers[i].kind() == AnyLayer::Kind::Dense &&
+           layers[i + 1] == size_t(model_layers[i].weights().rows()) &&
+           activations[i] == model_layers[i].activationType();
+  }
+  if (!same) {
+    throw std::runtime_error("Checkpoint was written for another model.");
+  }
+  model.restore(parameters, optimizer_state);
+}
+
+void writeCheckpoint(const std::filesystem::path &file,
+                     const TrainingCheckpoint &checkpoint) {
+  std::ostringstream rng_state;
+  rng_state << checkpoint.shuffle_rng;
+  const std::string rng_text = rng_state.str();
+
+  Header header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.scalar_type =
+      std::uint32_t(model_format::scalarTypeOf<Scalar>());
+  header.optimizer = std::uint32_t(checkpoint.optimizer);
+  header.stream = checkpoint.stream ? 1 : 0;
+  header.batch_size = checkpoint.batch_size;
+  header.accumulation_steps = checkpoint.accumulation_steps;
+  header.seed = checkpoint.seed;
+  header.shuffle_window = checkpoint.shuffle_window;
+  header.threads = checkpoint.threads;
+  header.layer_count = checkpoint.activations.size();
+  header.parameter_count = std::uint64_t(checkpoint.parameters.size());
+  header.first_moment_size = std::uint64_t(checkpoint.optimizer_state.m.size());
+  header.second_moment_size =
+      std::uint64_t(checkpoint.optimizer_state.v.size());
+  header.step = checkpoint.optimizer_state.t;
+  header.beta2_power = checkpoint.optimizer_state.beta2_power;
+  header.epoch = checkpoint.epoch;
+  header.position = checkpoint.position;
+  header.micro_batch = checkpoint.micro_batch;
+  header.running_loss = checkpoint.running_loss;
+  header.history_count = checkpoint.history.size();
+  header.rng_state_bytes = rng_text.size();
+
+  writeFileAtomically(file, [&](FileWriter &w) {
+    w << header;
+    for (size_t size : checkpoint.layers) {
+      w << std::uint64_t(size);
+    }
+    for (auto activation : checkpoint.activations) {
+      w << std::uint32_t(activation);
+    }
+    writeScalars(w, checkpoint.parameters.data(),
+                 checkpoint.parameters.size());
+    writeScalars(w, checkpoint.optimizer_state.m.data(),
+                 checkpoint.optimizer_state.m.size());
+    writeScalars(w, checkpoint.optimizer_state.v.data(),
+                 checkpoint.optimizer_state.v.size());
+    for (const auto &epoch : checkpoint.history) {
+      w << epoch;
+    }
+    w.write(rng_text.data(), rng_text.size());
+  });
+}
+
+TrainingCheckpoint readCheckpoint(const std::filesystem::path &file) {
+  FileReader r(file);
+  Header header;
+  r >> header;
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion) {
+    throw std::runtime_error(file.string() + " is not a checkpoint.");
+  }
+  if (header.scalar_type !=
+      std::uint32_t(model_format::scalarTypeOf<Scalar>())) {
+    throw std::runtime_error(file.string() +
+                             " was written with another scalar type.");
+  }
+  // Every section must fit in the bytes after the header; the counts are
+  // bounded by division so a corrupt one cannot wrap the total around.
+  std::uint64_t remaining = r.size() - sizeof(Header);
+  const auto take = [&remaining](std::uint64_t count, std::uint64_t size) {
+    if (count > remaining / size) {
+      return false;
+    }
+    remaining -= count * size;
+    return true;
+  };
+  if (!take(header.layer_count, sizeof(std::uint64_t)) ||
+      !take(1, sizeof(std::uint64_t)) ||
+      !take(header.layer_count, sizeof(std::uint32_t)) ||
+      !take(header.parameter_count, sizeof(Scalar)) ||
+      !take(header.first_moment_size, sizeof(Scalar)) ||
+      !take(header.second_moment_size, sizeof(Scalar)) ||
+      !take(header.history_count, sizeof(EpochResult)) ||
+      !take(header.rng_state_bytes, 1) || remaining != 0) {
+    throw std::runtime_error(file.string() + " is truncated or corrupt.");
+  }
+
+  TrainingCheckpoint checkpoint;
+  checkpoint.layers.resize(header.layer_count + 1);
+  for (auto &size : checkpoint.layers) {
+    std::uint64_t stored;
+    r >> stored;
+    size = size_t(stored);
+  }
+  checkpoint.activations.resize(header.layer_count);
+  for (auto &activation : checkpoint.activations) {
+    std::uint32_t stored;
+    r >> stored;
+    activation = ActivationFunction::Type(stored);
+  }
+  checkpoint.optimizer = Optimizer::Type(header.optimizer);
+  checkpoint.stream = header.stream != 0;
+  checkpoint.batch_size = Index(header.batch_size);
+  checkpoint.accumulation_steps = Index(header.accumulation_steps);
+  checkpoint.seed = header.seed;
+  checkpoint.shuffle_window = Index(header.shuffle_window);
+  checkpoint.threads = std::size_t(header.threads);
+
+  checkpoint.parameters.resize(Index(header.parameter_count));
+  readScalars(r, checkpoint.parameters.data(), checkpoint.parameters.size());
+  OptimizerCache &state = checkpoint.optimizer_state;
+  state.m.resize(header.first_moment_size ? Index(header.parameter_count) : 0,
+                 header.first_moment_size ? 1 : 0);
+  state.v.resize(header.second_moment_size ? Index(header.parameter_count) : 0,
+                 header.second_moment_size ? 1 : 0);
+  if (std::uint64_t(state.m.size()) != header.first_moment_size ||
+      std::uint64_t(state.v.size()) != header.second_moment_size) {
+    throw std::runtime_error(file.string() + " has inconsistent moments.");
+  }
+  readScalars(r, state.m.data(), state.m.size());
+  readScalars(r, state.v.data(), state.v.size());
+  state.t = Index(header.step);
+  state.beta2_power = header.beta2_power;
+
+  checkpoint.epoch = int(header.epoch);
+  checkpoint.position = Index(header.position);
+  checkpoint.micro_batch = Index(header.micro_batch);
+  checkpoint.running_loss = header.running_loss;
+  checkpoint.history.resize(header.history_count);
+  for (auto &epoch : checkpoint.history) {
+    r >> epoch;
+  }
+  std::string rng_text(header.rng_state_bytes, '\0');
+  r.read(rng_text.data(), rng_text.size());
+  std::istringstream rng_state(rng_text);
+  rng_state >> checkpoint.shuffle_rng;
+  if (!rng_state) {
+    throw std::runtime_error(file.string() + " has a corrupt shuffle state.");
+  }
+  return checkpoint;
+}
+
+CheckpointWriter::CheckpointWriter(std::filesystem::path file)
+    : file_(std::move(file)), thread_([this] { writerLoop(); }) {}
+
+CheckpointWriter::~CheckpointWriter() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [this] { return writing_ < 0 && queued_ < 0; });
+    stop_ = true;
+  }
+  wake_.notify_one();
+  thread_.join();
+}
+
+void CheckpointWriter::save(
+    const std::function<void(TrainingCheckpoint &)> &fill) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (error_) {
+    std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+  // Never the buffer being written; a queued one is simply replaced.
+  const int slot = writing_ == 0 ? 1 : 0;
+  fill(buffers_[slot]);
+  queued_ = slot;
+  lock.unlock();
+  wake_.notify_one();
+}
+
+void CheckpointWriter::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this] { return writing_ < 0 && queued_ < 0; });
+  if (error_) {
+    std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+}
+
+void CheckpointWriter::writerLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    wake_.wait(lock, [this] { return stop_ || queued_ >= 0; });
+    if (queued_ < 0) {
+      return;
+    }
+    writing_ = std::exchange(queued_, -1);
+    lock.unlock();
+    std::exception_ptr error;
+    try {
+      writeCheckpoint(file_, buffers_[writing_]);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    lock.lock();
+    if (error) {
+      error_ = error;
+    }
+    writing_ = -1;
+    idle_.notify_all();
+  }
+}
+
+} // namespace neural_network
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "ActivationFunctions/ActivationFunction.h"
+#include "Model/Model.h"
+#include "Optimizer/Optimizer.h"
+#include "Trainer/TrainingRun.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace neural_network {
+
+// Training state between two optimizer steps: enough to continue a run and
+// produce exactly the weights and logs of an uninterrupted one.
+struct TrainingCheckpoint {
+  // Model layout, checked against the config on resume.
+  std::vector<size_t> layers;
+  std::vector<ActivationFunction::Type> activations;
+  Optimizer::Type optimizer = Optimizer::Type::SGD;
+  // Settings that give position, micro_batch and shuffle_rng their
+  // meaning, and the thread count that fixes how gradients are summed; a
+  // run resumes only with the same values.
+  Index batch_size = 0;
+  Index accumulation_steps = 0;
+  std::uint64_t seed = 0;
+  bool stream = false;
+  Index shuffle_window = 0;
+  std::size_t threads = 0;
+
+  Vector parameters;
+  OptimizerCache optimizer_state;
+
+  // The epoch in progress, how many of its shuffled samples have been
+  // trained on, the micro-batches they formed and their summed loss.
+  int epoch = 0;
+  Index position = 0;
+  Index micro_batch = 0;
+  double running_loss = 0.0;
+  // Shuffle generator as it was before this epoch's shuffle, so that a
+  // resumed run redraws the same order.
+  std::default_random_engine shuffle_rng;
+  // Every finished epoch.
+  std::vector<EpochResult> history;
+
+  // Copies the layout, parameters and optimizer state of a model whose
+  // optimizer state is initialized, reusing this checkpoint's buffers.
+  // Only dense models are supported.
+  void capture(const Model &model, Optimizer::Type type);
+  // Puts the parameters and optimizer state back into a model of the same
+  // layout; throws if the layout differs.
+  void restore(Model &model) const;
+};
+
+// Writes `checkpoint` durably: to a temporary file that is synced and then
+// renamed over `file`, so a crash never leaves a half-written checkpoint.
+void writeCheckpoint(const std::filesystem::path &file,
+                     const TrainingCheckpoint &checkpoint);
+TrainingCheckpoint readCheckpoint(const std::filesystem::path &file);
+
+// Writes checkpoints on a background thread while training continues. The
+// trainer fills one of two buffers while the thread writes the other; if a
+// checkpoint is still queued when the next one arrives, the newer replaces
+// it. save() therefore only waits for a memory copy, never for the disk.
+class CheckpointWriter {
+public:
+  explicit CheckpointWriter(std::filesystem::path file);
+  // Finishes the queued writes.
+  ~CheckpointWriter();
+
+  CheckpointWriter(const CheckpointWriter &) = delete;
+  CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+  // Calls fill on a free buffer and queues it for writing. Rethrows the
+  // error of an earlier write, if any.
+  void save(const std::function<void(TrainingCheckpoint &)> &fill);
+  // Blocks until everything queued is on disk; rethrows write errors.
+  void wait();
+
+private:
+  void writerLoop();
+
+  std::filesystem::path file_;
+  TrainingCheckpoint buffers_[2];
+  // Buffer being written and buffer waiting to be, or -1.
+  int writing_ = -1;
+  int queued_ = -1;
+  bool stop_ = false;
+  std::exception_ptr error_;
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable idle_;
+  std::thread thread_;
+};
+
+} // namespace neural_network
@@ -0,0 +1,199 @@
+#include "Trainer/Metrics.h"
+#include "Utilities/Profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+
+namespace neural_network {
+
+namespace {
+
+// Single-writer update: no read-modify-write instruction is needed.
+template <typename T> void add(std::atomic<T> &value, T delta) {
+  value.store(value.load(std::memory_order_relaxed) + delta,
+              std::memory_order_relaxed);
+}
+
+} // namespace
+
+template <typename Update>
+void MetricsReporter::Counter::write(const Update &update) {
+  const auto sequence = sequence_.load(std::memory_order_relaxed);
+  sequence_.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  update();
+  sequence_.store(sequence + 2, std::memory_order_release);
+}
+
+void MetricsReporter::Counter::record(Index samples, double loss_sum,
+                                      Index correct) {
+  write([&] {
+    add(samples_, std::int64_t(samples));
+    add(correct_, std::int64_t(correct));
+    add(loss_, loss_sum);
+    add(epoch_samples_, std::int64_t(samples));
+    add(epoch_loss_, loss_sum);
+  });
+}
+
+void MetricsReporter::Counter::startEpoch(int epoch, Index samples,
+                                          double loss_sum) {
+  write([&] {
+    epoch_.store(epoch, std::memory_order_relaxed);
+    epoch_samples_.store(std::int64_t(samples), std::memory_order_relaxed);
+    epoch_loss_.store(loss_sum, std::memory_order_relaxed);
+  });
+}
+
+MetricsReporter::Counter::Values MetricsReporter::Counter::read() const {
+  Values values;
+  for (;;) {
+    const auto before = sequence_.load(std::memory_order_acquire);
+    values.epoch = epoch_.load(std::memory_order_relaxed);
+    values.samples = samples_.load(std::memory_order_relaxed);
+    values.correct = correct_.load(std::memory_order_relaxed);
+    values.loss = loss_.load(std::memory_order_relaxed);
+    values.epoch_samples = epoch_samples_.load(std::memory_order_relaxed);
+    values.epoch_loss = epoch_loss_.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if ((before & 1) == 0 &&
+        sequence_.load(std::memory_order_relaxed) == before) {
+      return values;
+    }
+    std::this_thread::yield();
+  }
+}
+
+MetricsReporter::MetricsReporter(Options options, std::ostream &console)
+    : options_(std::move(options)), console_(console),
+      start_(std::chrono::steady_clock::now()), last_time_(start_) {
+  if (!options_.csv.empty()) {
+    csv_.open(options_.csv);
+    if (!csv_) {
+      throw std::runtime_error("Could not open " + options_.csv.string());
+    }
+    csv_ << "Seconds,Epoch,Samples,SamplesPerSecond,Loss,Accuracy\n";
+  }
+  if (!options_.jsonl.empty()) {
+    jsonl_.open(options_.jsonl);
+    if (!jsonl_) {
+      throw std::runtime_error("Could not open " + options_.jsonl.string());
+    }
+  }
+  thread_ = std::thread([this] { reporterLoop(); });
+}
+
+MetricsReporter::~MetricsReporter() { stop(); }
+
+void MetricsReporter::stop() {
+  if (!thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_one();
+  thread_.join();
+  std::lock_guard<std::mutex> lock(mutex_);
+  reportLocked();
+}
+
+void MetricsReporter::close() {
+  stop();
+  // A headless run has nobody watching its metrics, so a file that cannot
+  // be fully written fails the run.
+  const auto closeFile = [](std::ofstream &out,
+                            const std::filesystem::path &file) {
+    if (!out.is_open()) {
+      return;
+    }
+    out.close();
+    if (!out) {
+      throw std::runtime_error("Could not write " + file.string());
+    }
+  };
+  closeFile(csv_, options_.csv);
+  closeFile(jsonl_, options_.jsonl);
+}
+
+MetricsReporter::Counter &MetricsReporter::counter() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return counters_.emplace_back();
+}
+
+void MetricsReporter::flush() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  reportLocked();
+}
+
+std::unique_lock<std::mutex> MetricsReporter::lockConsole() {
+  return std::unique_lock<std::mutex>(mutex_);
+}
+
+void MetricsReporter::reportLocked() {
+  Counter::Values now;
+  for (const auto &counter : counters_) {
+    const Counter::Values values = counter.read();
+    now.epoch = std::max(now.epoch, values.epoch);
+    now.samples += values.samples;
+    now.correct += values.correct;
+    now.loss += values.loss;
+    now.epoch_samples += values.epoch_samples;
+    now.epoch_loss += values.epoch_loss;
+  }
+  const std::int64_t samples = now.samples - last_.samples;
+  if (samples <= 0) {
+    return;
+  }
+  NN_PROFILE_SCOPE(Report, 0, 0);
+  const auto time = std::chrono::steady_clock::now();
+  const double seconds = std::chrono::duration<double>(time - start_).count();
+  const double rate =
+      double(samples) /
+      std::max(std::chrono::duration<double>(time - last_time_).count(), 1e-9);
+  const double loss = (now.loss - last_.loss) / double(samples);
+  const double accuracy =
+      100.0 * double(now.correct - last_.correct) / double(samples);
+  last_ = now;
+  last_time_ = time;
+
+  if (options_.console && options_.samples_per_epoch > 0) {
+    constexpr int kBarWidth = 30;
+    const double fraction =
+        std::min(1.0, double(now.epoch_samples) / options_.samples_per_epoch);
+    const int filled = int(kBarWidth * fraction);
+    console_ << "\r[";
+    for (int j = 0; j < kBarWidth; ++j) {
+      console_ << (j < filled ? '=' : ' ');
+    }
+    console_ << "] " << std::setw(3) << int(fraction * 100.0) << "% ("
+             << now.epoch_samples << "/" << options_.samples_per_epoch
+             << ") L:" << std::fixed << std::setprecision(4)
+             << now.epoch_loss / std::max<std::int64_t>(now.epoch_samples, 1)
+             << " A:" << std::setprecision(1) << accuracy << "% "
+             << std::setprecision(0) << rate << " samples/s"
+             << std::defaultfloat << std::flush;
+  }
+  if (csv_.is_open()) {
+    csv_ << seconds << "," << (now.epoch + 1) << "," << now.samples << ","
+         << rate << "," << loss << "," << accuracy << "\n";
+  }
+  if (jsonl_.is_open()) {
+    jsonl_ << "{\"seconds\":" << seconds << ",\"epoch\":" << (now.epoch + 1)
+           << ",\"samples\":" << now.samples
+           << ",\"samples_per_second\":" << rate << ",\"loss\":" << loss
+           << ",\"accuracy\":" << accuracy << "}\n";
+  }
+}
+
+void MetricsReporter::reporterLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!wake_.wait_for(lock, options_.interval, [this] { return stop_; })) {
+    reportLocked();
+  }
+}
+
+} // namespace neural_network
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Utilities/Utils.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iosfwd>
+#include <mutex>
+#include <thread>
+
+namespace neural_network {
+
+// Training metrics gathered on the hot path and written out by a reporter
+// thread. Every producing thread records into its own Counter: a handful of
+// relaxed atomic stores per batch, no locks, no formatting and no I/O. Every
+// `interval` the reporter sums the counters and writes one record with the
+// throughput, mean loss and accuracy since the previous record to each
+// enabled sink: a progress line on the console, a CSV file and a
+// JSON-lines file.
+class MetricsReporter {
+public:
+  struct Options {
+    std::chrono::duration<double> interval{1.0};
+    // Redraws a progress bar for the current epoch.
+    bool console = true;
+    Index samples_per_epoch = 0;
+    // Columns Seconds,Epoch,Samples,SamplesPerSecond,Loss,Accuracy.
+    std::filesystem::path csv;
+    // One object per record with the same fields in snake_case.
+    std::filesystem::path jsonl;
+  };
+
+  // Counters owned by one thread. Only that thread writes them; the
+  // reporter reads them under a sequence lock, so a record never mixes two
+  // batches.
+  class Counter {
+  public:
+    // Adds a batch: its size, its summed (not mean) loss and the number of
+    // correct predictions.
+    void record(Index samples, double loss_sum, Index correct);
+    // Starts counting epoch `epoch` (0-based) with `samples` of it already
+    // done at a summed loss of `loss_sum`, e.g. when resuming.
+    void startEpoch(int epoch, Index samples = 0, double loss_sum = 0.0);
+
+  private:
+    friend class MetricsReporter;
+
+    struct Values {
+      std::int64_t epoch = 0;
+      std::int64_t samples = 0;
+      std::int64_t correct = 0;
+      double loss = 0.0;
+      std::int64_t epoch_samples = 0;
+      double epoch_loss = 0.0;
+    };
+    template <typename Update> void write(const Update &update);
+    Values read() const;
+
+    alignas(64) std::atomic<std::uint64_t> sequence_{0};
+    std::atomic<std::int64_t> epoch_{0}, samples_{0}, correct_{0};
+    std::atomic<double> loss_{0.0};
+    std::atomic<std::int64_t> epoch_samples_{0};
+    std::atomic<double> epoch_loss_{0.0};
+  };
+
+  MetricsReporter(Options options, std::ostream &console);
+  // Writes a last record and stops the thread, if close() has not.
+  ~MetricsReporter();
+
+  MetricsReporter(const MetricsReporter &) = delete;
+  MetricsReporter &operator=(const MetricsReporter &) = delete;
+
+  // A new counter for the calling thread; fetch it once, outside the loop.
+  Counter &counter();
+  // Writes a record now, e.g. at the end of an epoch.
+  void flush();
+  // Holds the console so that other output does not interleave with the
+  // progress line.
+  std::unique_lock<std::mutex> lockConsole();
+  // Writes a last record, stops the thread and closes the metric files;
+  // throws if any of them could not be fully written.
+  void close();
+
+private:
+  void stop();
+  void reportLocked();
+  void reporterLoop();
+
+  Options options_;
+  std::ostream &console_;
+  std::ofstream csv_, jsonl_;
+  std::deque<Counter> counters_;
+
+  std::chrono::steady_clock::time_point start_, last_time_;
+  Counter::Values last_;
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+} // namespace neural_network
@@ -0,0 +1,150 @@
+#include "Trainer/ParallelTrainer.h"
+#include "Utilities/Profiler.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace neural_network {
+
+ParallelTrainer::ParallelTrainer(Model &model, std::size_t num_threads)
+    : model_(model), pool_(num_threads) {
+  scratch_.reserve(pool_.size());
+  for (std::size_t i = 0; i < pool_.size(); ++i) {
+    scratch_.push_back(model_.makeScratch(0, i));
+  }
+  loss_.resize(pool_.size());
+  correct_.resize(pool_.size());
+}
+
+std::size_t ParallelTrainer::numThreads() const { return pool_.size(); }
+
+Index ParallelTrainer::lastCorrect() const { return last_correct_; }
+
+void ParallelTrainer::trainBatch(const ConstMatrixRef &X,
+                                 const ConstMatrixRef &Y,
+                                 const Model::BatchLossGrad &lossGrad,
+                                 const Optimizer &optimizer) {
+  accumulateBatch(X, Y, lossGrad);
+  applyAccumulated(optimizer);
+}
+
+double ParallelTrainer::trainBatch(const ConstMatrixRef &X,
+                                   const ConstLabelsRef &labels,
+                                   const Model::LabelLossGrad &lossGrad,
+                                   const Optimizer &optimizer) {
+  const double loss = accumulateBatch(X, labels, lossGrad);
+  applyAccumulated(optimizer);
+  return loss;
+}
+
+// Splits the micro-batch into one contiguous shard per worker; each runs
+// forward, shardLoss and backward on its shard, adding to its gradients if
+// it already holds some since the last step.
+template <typename ShardLoss>
+double ParallelTrainer::accumulateShards(const ConstMatrixRef &X,
+                                         const ShardLoss &shardLoss) {
+  const Index batch_size = X.cols();
+  last_correct_ = 0;
+  if (batch_size == 0) {
+    return 0.0;
+  }
+  const std::size_t num_shards =
+      std::min<std::size_t>(pool_.size(), static_cast<std::size_t>(batch_size));
+  const std::size_t active_shards = active_shards_;
+
+  pool_.parallelFor(num_shards, [&](std::size_t shard) {
+    const Index begin = batch_size * Index(shard) / Index(num_shards);
+    const Index end = batch_size * Index(shard + 1) / Index(num_shards);
+    auto &scratch = scratch_[shard];
+
+    const ConstMatrixRef output =
+        model_.forwardBatch(X.middleCols(begin, end - begin), scratch);
+    auto grad = scratch.lossGrad(output.rows(), end - begin);
+    {
+      NN_PROFILE_SCOPE(Loss, 0, 2 * sizeof(Scalar) * output.size());
+      correct_[shard] = 0;
+      loss_[shard] = shardLoss(output, begin, grad, correct_[shard]);
+    }
+    model_.backwardBatch(grad, scratch, shard < active_shards);
+  });
+
+  active_shards_ = std::max(active_shards_, num_shards);
+  accumulated_samples_ += batch_size;
+
+  double loss = 0.0;
+  for (std::size_t shard = 0; shard < num_shards; ++shard) {
+    loss += loss_[shard];
+    last_correct_ += correct_[shard];
+  }
+  return loss / double(batch_size);
+}
+
+double ParallelTrainer::accumulateBatch(const ConstMatrixRef &X,
+                                        const ConstMatrixRef &Y,
+                                        const Model::BatchLossGrad &lossGrad,
+                                        const Model::BatchLoss &loss) {
+  assert(X.cols() == Y.cols());
+  return accumulateShards(X, [&](const ConstMatrixRef &output, Index begin,
+                                 Eigen::Ref<Matrix> grad, Index &correct) {
+    const auto targets = Y.middleCols(begin, output.cols());
+    for (Index j = 0; j < output.cols(); ++j) {
+      Index predicted, expected;
+      output.col(j).maxCoeff(&predicted);
+      targets.col(j).maxCoeff(&expected);
+      correct += predicted == expected;
+    }
+    const double sum =
+        loss ? loss(output, targets) * double(output.cols()) : 0.0;
+    lossGrad(output, targets, grad);
+    return sum;
+  });
+}
+
+double ParallelTrainer::accumulateBatch(const ConstMatrixRef &X,
+                                        const ConstLabelsRef &labels,
+                                        const Model::LabelLossGrad &lossGrad) {
+  assert(X.cols() == labels.size());
+  return accumulateShards(X, [&](const ConstMatrixRef &output, Index begin,
+                                 Eigen::Ref<Matrix> grad, Index &correct) {
+    const auto shard_labels = labels.segment(begin, output.cols());
+    for (Index j = 0; j < output.cols(); ++j) {
+      Index predicted;
+      output.col(j).maxCoeff(&predicted);
+      correct += predicted == shard_labels[j];
+    }
+    return lossGrad(output, shard_labels, grad) * double(output.cols());
+  });
+}
+
+void ParallelTrainer::applyAccumulated(const Optimizer &optimizer) {
+  if (accumulated_samples_ == 0) {
+    return;
+  }
+  reduceGradients(active_shards_);
+  model_.applyGradients(scratch_[0], accumulated_samples_, optimizer);
+  accumulated_samples_ = 0;
+  active_shards_ = 0;
+}
+
+// Pairwise tree reduction into shard 0: at every level shard i accumulates
+// shard i + stride. The pairs of one level are independent and run in
+// parallel; the summation order is fixed regardless of scheduling.
+void ParallelTrainer::reduceGradients(std::size_t num_shards) {
+  const double size = double(scratch_[0].grads.size());
+  NN_PROFILE_SCOPE(Reduce, (num_shards - 1) * size,
+                   3 * sizeof(Scalar) * (num_shards - 1) * size);
+  for (std::size_t stride = 1; stride < num_shards; stride *= 2) {
+    const std::size_t pairs =
+        (num_shards - stride + 2 * stride - 1) / (2 * stride);
+    pool_.parallelFor(pairs, [&](std::size_t pair) {
+      const std::size_t dst = pair * 2 * stride;
+      const std::size_t src = dst + stride;
+      if (src >= num_shards) {
+        return;
+      }
+      scratch_[dst].grads += scratch_[src].grads;
+    });
+  }
+}
+
+} // namespace neural_network
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Model/Model.h"
+#include "Utilities/ThreadPool.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace neural_network {
+
+// Data-parallel mini-batch trainer. Every batch is split into one
+// contiguous shard per worker; each worker runs forward/backward on its
+// shard with its own scratch, the per-shard gradients are tree-reduced and
+// the optimizer is applied once. Shard boundaries and the reduction order
+// depend only on the batch size and the thread count, so for a fixed seed
+// and thread count the results are deterministic.
+//
+// accumulateBatch()/applyAccumulated() split one large batch into
+// micro-batches: every shard keeps adding the gradients of its slice of each
+// micro-batch to its own buffer, and the buffers are reduced and applied
+// once, averaged over all accumulated samples.
+class ParallelTrainer {
+public:
+  ParallelTrainer(Model &model, std::size_t num_threads);
+
+  void trainBatch(const ConstMatrixRef &X, const ConstMatrixRef &Y,
+                  const Model::BatchLossGrad &lossGrad,
+                  const Optimizer &optimizer);
+  // Same with integer class labels; returns the mean loss of the batch.
+  double trainBatch(const ConstMatrixRef &X, const ConstLabelsRef &labels,
+                    const Model::LabelLossGrad &lossGrad,
+                    const Optimizer &optimizer);
+
+  // Returns the mean loss of the micro-batch if `loss` is given, else 0.
+  double accumulateBatch(const ConstMatrixRef &X, const ConstMatrixRef &Y,
+                         const Model::BatchLossGrad &lossGrad,
+                         const Model::BatchLoss &loss = nullptr);
+  // Returns the mean loss of the micro-batch.
+  double accumulateBatch(const ConstMatrixRef &X, const ConstLabelsRef &labels,
+                         const Model::LabelLossGrad &lossGrad);
+  void applyAccumulated(const Optimizer &optimizer);
+
+  // Samples of the last micro-batch whose largest output matched the label
+  // (the largest target with one-hot targets). Counted by every shard on
+  // the output of its forward pass, so it costs no extra inference.
+  Index lastCorrect() const;
+
+  std::size_t numThreads() const;
+
+private:
+  // The shard loop shared by both accumulateBatch() overloads. shardLoss
+  // gets a shard's output, its first column in the micro-batch, the
+  // gradient to write and the correct count to add to, and returns the
+  // shard's summed loss.
+  template <typename ShardLoss>
+  double accumulateShards(const ConstMatrixRef &X,
+                          const ShardLoss &shardLoss);
+  void reduceGradients(std::size_t num_shards);
+
+  Model &model_;
+  ThreadPool pool_;
+  std::vector<Model::Scratch> scratch_; // one per shard
+  std::vector<double> loss_;            // one per shard
+  std::vector<Index> correct_;          // one per shard
+  Index last_correct_ = 0;
+
+  // Samples accumulated since the last optimizer step. Shards
+  // [0, active_shards_) hold gradients; the others are stale and are
+  // overwritten rather than added to when they next take part.
+  Index accumulated_samples_ = 0;
+  std::size_t active_shards_ = 0;
+};
+
+} // namespace neural_network
@@ -0,0 +1,298 @@
+#include "Trainer/TrainingConfig.h"
+#include "Model/Architectures.h"
+#include "Utilities/Profiler.h"
+#include "Utilities/Settings.h"
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+namespace neural_network {
+
+namespace {
+
+std::string lower(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(),
+                 [](unsigned char c) { return char(std::tolower(c)); });
+  return text;
+}
+
+double parseDouble(const std::string &key, const std::string &value) {
+  std::size_t used = 0;
+  double result = 0.0;
+  try {
+    result = std::stod(value, &used);
+  } catch (const std::exception &) {
+    used = 0;
+  }
+  if (used == 0 || used != value.size()) {
+    throw std::runtime_error("Invalid number for " + key + ": " + value);
+  }
+  return result;
+}
+
+bool parseBool(const std::string &key, const std::string &value) {
+  const std::string v = lower(value);
+  if (v == "true" || v == "1" || v == "yes" || v == "on") {
+    return true;
+  }
+  if (v == "false" || v == "0" || v == "no" || v == "off") {
+    return false;
+  }
+  throw std::runtime_error("Invalid boolean for " + key + ": " + value);
+}
+
+ActivationFunction::Type parseActivation(const std::string &value) {
+  using Type = ActivationFunction::Type;
+  const std::string v = lower(value);
+  if (v == "relu")
+    return Type::ReLU;
+  if (v == "sigmoid")
+    return Type::Sigmoid;
+  if (v == "identity")
+    return Type::Identity;
+  if (v == "tanh")
+    return Type::Tanh;
+  if (v == "softmax")
+    return Type::Softmax;
+  throw std::runtime_error("Unknown activation: " + value);
+}
+
+TrainingConfig::Loss parseLoss(const std::string &value) {
+  using Loss = TrainingConfig::Loss;
+  const std::string v = lower(value);
+  if (v == "mse")
+    return Loss::MSE;
+  if (v == "cross_entropy")
+    return Loss::CrossEntropy;
+  if (v == "softmax_cross_entropy")
+    return Loss::SoftmaxCrossEntropy;
+  throw std::runtime_error("Unknown loss: " + value);
+}
+
+Optimizer::Type parseOptimizer(const std::string &value) {
+  using Type = Optimizer::Type;
+  const std::string v = lower(value);
+  if (v == "sgd")
+    return Type::SGD;
+  if (v == "momentum")
+    return Type::Momentum;
+  if (v == "nesterov")
+    return Type::Nesterov;
+  if (v == "rmsprop")
+    return Type::RMSProp;
+  if (v == "adam")
+    return Type::Adam;
+  if (v == "adamw")
+    return Type::AdamW;
+  if (v == "lamb")
+    return Type::LAMB;
+  throw std::runtime_error("Unknown optimizer: " + value);
+}
+
+TrainingConfig::Schedule parseSchedule(const std::string &value) {
+  using Schedule = TrainingConfig::Schedule;
+  const std::string v = lower(value);
+  if (v == "constant")
+    return Schedule::Constant;
+  if (v == "step")
+    return Schedule::Step;
+  if (v == "cosine")
+    return Schedule::Cosine;
+  if (v == "one_cycle" || v == "onecycle")
+    return Schedule::OneCycle;
+  throw std::runtime_error("Unknown schedule: " + value);
+}
+
+} // namespace
+
+void TrainingConfig::set(const std::string &raw_key, const std::string &raw) {
+  std::string key = trim(raw_key);
+  std::replace(key.begin(), key.end(), '-', '_');
+  const std::string value = trim(raw);
+
+  if (key == "architecture") {
+    const int choice = int(parseInteger(key, value, 1));
+    const Architecture a = architecture(choice);
+    layers = a.layer_sizes;
+    activations = a.activations;
+    loss = isClassifier(choice) ? Loss::SoftmaxCrossEntropy : Loss::MSE;
+  } else if (key == "layers") {
+    layers.clear();
+    for (const auto &item : split(value, ','))
+      layers.push_back(size_t(parseInteger(key, item, 1)));
+  } else if (key == "activations") {
+    activations.clear();
+    for (const auto &item : split(value, ','))
+      activations.push_back(parseActivation(item));
+  } else if (key == "loss") {
+    loss = parseLoss(value);
+  } else if (key == "optimizer") {
+    optimizer = parseOptimizer(value);
+  } else if (key == "learning_rate") {
+    learning_rate = parseDouble(key, value);
+  } else if (key == "momentum") {
+    momentum = parseDouble(key, value);
+  } else if (key == "beta2") {
+    beta2 = parseDouble(key, value);
+  } else if (key == "epsilon") {
+    epsilon = parseDouble(key, value);
+  } else if (key == "weight_decay") {
+    weight_decay = parseDouble(key, value);
+  } else if (key == "schedule") {
+    schedule = parseSchedule(value);
+  } else if (key == "step_epochs") {
+    step_epochs = int(parseInteger(key, value, 1));
+  } else if (key == "step_gamma") {
+    step_gamma = parseDouble(key, value);
+  } else if (key == "warmup_fraction") {
+    warmup_fraction = parseDouble(key, value);
+  } else if (key == "epochs") {
+    epochs = int(parseInteger(key, value, 0));
+  } else if (key == "batch_size") {
+    batch_size = Index(parseInteger(key, value, 1));
+  } else if (key == "accumulation_steps") {
+    accumulation_steps = Index(parseInteger(key, value, 1));
+  } else if (key == "threads") {
+    threads = std::size_t(parseInteger(key, value, 1));
+  } else if (key == "seed") {
+    seed = std::uint64_t(parseInteger(key, value, 0));
+  } else if (key == "train_images") {
+    train_images = value;
+  } else if (key == "train_labels") {
+    train_labels = value;
+  } else if (key == "test_images") {
+    test_images = value;
+  } else if (key == "test_labels") {
+    test_labels = value;
+  } else if (key == "stream") {
+    stream = parseBool(key, value);
+  } else if (key == "shuffle_window") {
+    shuffle_window = Index(parseInteger(key, value, 1));
+  } else if (key == "name") {
+    name = value;
+  } else if (key == "output_dir") {
+    output_dir = value;
+  } else if (key == "checkpoint") {
+    checkpoint = value;
+  } else if (key == "checkpoint_epochs") {
+    checkpoint_epochs = int(parseInteger(key, value, 0));
+  } else if (key == "checkpoint_steps") {
+    checkpoint_steps = int(parseInteger(key, value, 0));
+  } else if (key == "checkpoint_minutes") {
+    checkpoint_minutes = parseDouble(key, value);
+  } else if (key == "resume") {
+    resume = value;
+  } else if (key == "target_accuracy") {
+    target_accuracy = parseDouble(key, value);
+  } else if (key == "progress") {
+    progress = parseBool(key, value);
+  } else if (key == "metrics_interval") {
+    metrics_interval = parseDouble(key, value);
+  } else if (key == "metrics_csv") {
+    metrics_csv = value;
+  } else if (key == "metrics_jsonl") {
+    metrics_jsonl = value;
+  } else if (key == "profile_trace") {
+    profile_trace = value;
+  } else {
+    throw std::runtime_error("Unknown option: " + key);
+  }
+}
+
+void TrainingConfig::load(const std::filesystem::path &file) {
+  readSettings(file, "config",
+               [this](const std::string &key, const std::string &value) {
+                 set(key, value);
+               });
+}
+
+TrainingConfig TrainingConfig::fromArguments(int argc,
+                                             const char *const *argv) {
+  TrainingConfig config;
+  applyFlags(
+      argc, argv, "config",
+      [&config](const std::string &file) { config.load(file); },
+      [&config](const std::string &key, const std::string &value) {
+        config.set(key, value);
+      });
+  config.validate();
+  return config;
+}
+
+void TrainingConfig::validate() const {
+  if (layers.size() < 2 || activations.size() + 1 != layers.size()) {
+    throw std::runtime_error(
+        "Config needs at least two layer sizes and one activation per layer");
+  }
+  if (metrics_interval <= 0.0) {
+    throw std::runtime_error("metrics_interval must be positive");
+  }
+  if (!profile_trace.empty() && !profile::enabled()) {
+    throw std::runtime_error(
+        "profile_trace needs a build with -DNEURAL_NET_PROFILE=ON");
+  }
+  if (loss == Loss::SoftmaxCrossEntropy &&
+      activations.back() != ActivationFunction::Type::Identity) {
+    throw std::runtime_error(
+        "softmax_cross_entropy needs an identity output activation");
+  }
+  // Its gradient, output - target, is that of softmax and cross-entropy
+  // together.
+  if (loss == Loss::CrossEntropy &&
+      activations.back() != ActivationFunction::Type::Softmax) {
+    throw std::runtime_error("cross_entropy needs a softmax output activation");
+  }
+}
+
+Model TrainingConfig::makeModel() const {
+  validate();
+  return Model(layers, activations);
+}
+
+Optimizer TrainingConfig::makeOptimizer(Index steps_per_epoch) const {
+  Optimizer base = Optimizer::SGD(learning_rate);
+  switch (optimizer) {
+  case Optimizer::Type::SGD:
+    break;
+  case Optimizer::Type::Momentum:
+    base = Optimizer::Momentum(learning_rate, momentum);
+    break;
+  case Optimizer::Type::Nesterov:
+    base = Optimizer::Nesterov(learning_rate, momentum);
+    break;
+  case Optimizer::Type::RMSProp:
+    base = Optimizer::RMSProp(learning_rate, momentum, epsilon);
+    break;
+  case Optimizer::Type::Adam:
+    base = Optimizer::Adam(learning_rate, momentum, beta2, epsilon);
+    break;
+  case Optimizer::Type::AdamW:
+    base = Optimizer::AdamW(learning_rate, weight_decay, momentum, beta2,
+                            epsilon);
+    break;
+  case Optimizer::Type::LAMB:
+    base = Optimizer::LAMB(learning_rate, weight_decay, momentum, beta2,
+                           epsilon);
+    break;
+  }
+
+  const Index total = std::max<Index>(steps_per_epoch * epochs, 1);
+  const Index warmup = Index(double(total) * warmup_fraction);
+  switch (schedule) {
+  case Schedule::Constant:
+    return base;
+  case Schedule::Step:
+    return base.withSchedule(
+        LearningRateSchedule::Step(steps_per_epoch * step_epochs, step_gamma));
+  case Schedule::Cosine:
+    return base.withSchedule(
+        LearningRateSchedule::Cosine(std::max<Index>(total - warmup, 1))
+            .withWarmup(warmup));
+  case Schedule::OneCycle:
+    return base.withSchedule(LearningRateSchedule::OneCycle(total));
+  }
+  return base;
+}
+
+} // namespace neural_network
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "ActivationFunctions/ActivationFunction.h"
+#include "Model/Model.h"
+#include "Optimizer/Optimizer.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace neural_network {
+
+// Everything one training run needs. Every field can be set from a config
+// file of `key = value` lines ('#' starts a comment) and from command-line
+// flags `--key=value`; flags are applied after the file named by --config,
+// so they override it. Keys are the field names below (a '-' in a key is
+// read as '_'); lists are comma separated. `architecture = 1|2|3` is a
+// shorthand for the layers, activations and loss of the built-in networks.
+struct TrainingConfig {
+  enum class Loss { MSE, CrossEntropy, SoftmaxCrossEntropy };
+  enum class Schedule { Constant, Step, Cosine, OneCycle };
+
+  // Model: layer widths (input first) and one activation per layer.
+  std::vector<size_t> layers{784, 128, 10};
+  std::vector<ActivationFunction::Type> activations{
+      ActivationFunction::Type::ReLU, ActivationFunction::Type::Identity};
+  // MSE and CrossEntropy train on one-hot targets, CrossEntropy after a
+  // softmax output layer; SoftmaxCrossEntropy on integer labels, with the
+  // last layer producing raw logits.
+  Loss loss = Loss::MSE;
+
+  // Optimizer. `momentum` is the momentum of SGD with momentum/Nesterov,
+  // rho of RMSProp and beta1 of the Adam family.
+  Optimizer::Type optimizer = Optimizer::Type::Adam;
+  double learning_rate = 0.001;
+  double momentum = 0.9;
+  double beta2 = 0.999;
+  double epsilon = 1e-8;
+  double weight_decay = 0.01;
+
+  // Learning-rate schedule over the whole run. Step multiplies the rate by
+  // step_gamma every step_epochs epochs; Cosine warms up linearly over
+  // warmup_fraction of the steps.
+  Schedule schedule = Schedule::Constant;
+  int step_epochs = 1;
+  double step_gamma = 0.5;
+  double warmup_fraction = 0.05;
+
+  int epochs = 1;
+  Index batch_size = 64;
+  Index accumulation_steps = 1;
+  std::size_t threads = 1;
+  // Seeds the weight initialization and the per-epoch shuffling.
+  std::uint64_t seed = 42;
+
+  std::filesystem::path train_images = "../data/train-images.idx3-ubyte";
+  std::filesystem::path train_labels = "../data/train-labels.idx1-ubyte";
+  std::filesystem::path test_images = "../data/t10k-images.idx3-ubyte";
+  std::filesystem::path test_labels = "../data/t10k-labels.idx1-ubyte";
+  // With stream set, every epoch reads the training files in the background
+  // (see Loader/StreamingLoader.h) instead of loading them up front, so the
+  // training set need not fit in memory. Samples are then shuffled within a
+  // window of shuffle_window samples.
+  bool stream = false;
+  Index shuffle_window = 8192;
+
+  // Outputs: <output_dir>/loss_<name>_train.csv, loss_<name>_val.csv,
+  // accuracy_<name>.csv and the final model <output_dir>/model_<name>.bin.
+  std::string name = "model";
+  std::filesystem::path output_dir = ".";
+  // If checkpoint is set, the full training state (see Trainer/Checkpoint.h)
+  // is written there in the background at the end of every
+  // checkpoint_epochs-th epoch, after every checkpoint_steps optimizer steps
+  // and every checkpoint_minutes of training; 0 turns a trigger off.
+  // Training with resume set continues from such a file and ends exactly as
+  // the uninterrupted run would have.
+  std::filesystem::path checkpoint;
+  int checkpoint_epochs = 1;
+  int checkpoint_steps = 0;
+  double checkpoint_minutes = 0.0;
+  std::filesystem::path resume;
+
+  // Validation accuracy (percent) whose first epoch is reported.
+  double target_accuracy = 97.0;
+  // Training metrics are written every metrics_interval seconds: a
+  // progress line on the console (turn progress off for log files) and,
+  // when their paths are set, rows of a CSV and a JSON-lines file.
+  bool progress = true;
+  double metrics_interval = 1.0;
+  std::filesystem::path metrics_csv;
+  std::filesystem::path metrics_jsonl;
+  // Builds with NEURAL_NET_PROFILE print a per-stage profile after every
+  // epoch and, if this is set, write a Chrome trace of the run there.
+  std::filesystem::path profile_trace;
+
+  // Applies one key/value pair; throws std::runtime_error naming the key
+  // if it is unknown or the value does not parse.
+  void set(const std::string &key, const std::string &value);
+  void load(const std::filesystem::path &file);
+  // Reads --config=FILE first, then every other --key=value flag.
+  static TrainingConfig fromArguments(int argc, const char *const *argv);
+
+  // Throws if the fields are inconsistent (e.g. activation count).
+  void validate() const;
+
+  Model makeModel() const;
+  // The optimizer with its schedule for a run of `steps_per_epoch`
+  // optimizer steps per epoch.
+  Optimizer makeOptimizer(Index steps_per_epoch) const;
+};
+
+} // namespace neural_network
@@ -0,0 +1,481 @@
+#include "Trainer/TrainingRun.h"
+#include "Inference/InferenceModel.h"
+#include "Loader/MNISTLoader.h"
+#include "Loader/StreamingLoader.h"
+#include "LossFunctions/LossFunction.h"
+#include "LossFunctions/SoftmaxCrossEntropy.h"
+#include "Trainer/Checkpoint.h"
+#include "Trainer/Metrics.h"
+#include "Trainer/ParallelTrainer.h"
+#include "Utilities/FileWriter.h"
+#include "Utilities/MemoryUsage.h"
+#include "Utilities/Profiler.h"
+#include "Utilities/Random.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <ostream>
+#include <random>
+
+namespace neural_network {
+
+Dataset loadDataset(const std::filesystem::path &images,
+                    const std::filesystem::path &labels) {
+  Dataset dataset;
+  if (!loadMNIST(images.string(), labels.string(), dataset)) {
+    throw std::runtime_error("Failed to load " + images.string() + " / " +
+                             labels.string());
+  }
+  return dataset;
+}
+
+namespace {
+
+// Weight initialization draws from the process-wide generator, so reseeding
+// it and building the model must not interleave with another run's.
+Model makeSeededModel(const TrainingConfig &config) {
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+  Random::reseedGlobal(config.seed);
+  return config.makeModel();
+}
+
+void oneHot(const ConstLabelsRef &labels, Index num_classes, Matrix &out) {
+  out.setZero(num_classes, labels.size());
+  for (Index j = 0; j < labels.size(); ++j) {
+    out(labels[j], j) = Scalar(1);
+  }
+}
+
+// A checkpoint's position, micro-batch count and shuffle state only mean
+// the same thing under the settings that produced them; resuming with
+// others would silently train a different run. The shuffle window only
+// matters when streaming.
+void checkResumable(const TrainingCheckpoint &checkpoint,
+                    const TrainingConfig &config) {
+  if (checkpoint.optimizer != config.optimizer) {
+    throw std::runtime_error("Checkpoint was written with another "
+                             "optimizer.");
+  }
+  if (checkpoint.batch_size != config.batch_size ||
+      checkpoint.accumulation_steps != config.accumulation_steps) {
+    throw std::runtime_error("Checkpoint was written with another batch "
+                             "size or accumulation steps.");
+  }
+  if (checkpoint.seed != config.seed) {
+    throw std::runtime_error("Checkpoint was written with another seed.");
+  }
+  // The shard count shapes the gradient reduction, so other threads would
+  // round differently.
+  if (checkpoint.threads != config.threads) {
+    throw std::runtime_error("Checkpoint was written with another thread "
+                             "count.");
+  }
+  if (checkpoint.stream != config.stream ||
+      (config.stream && checkpoint.shuffle_window != config.shuffle_window)) {
+    throw std::runtime_error("Checkpoint was written with other streaming "
+                             "settings.");
+  }
+}
+
+// Per-run CSV logs: a headless run has nobody watching them, so a file
+// that cannot be opened or fully written fails the run.
+std::ofstream openLog(const std::filesystem::path &file) {
+  std::ofstream out(file);
+  if (!out) {
+    throw std::runtime_error("Could not open " + file.string());
+  }
+  return out;
+}
+
+void closeLog(std::ofstream &out, const std::filesystem::path &file) {
+  out.close();
+  if (!out) {
+    throw std::runtime_error("Could not write " + file.string());
+  }
+}
+
+// Labels index the model's outputs, so one outside [0, num_classes) would
+// be written out of bounds by the one-hot targets and the loss gradient.
+void checkLabels(const ConstLabelsRef &labels, Index num_classes) {
+  if (labels.size() > 0 &&
+      (labels.minCoeff() < 0 || labels.maxCoeff() >= num_classes)) {
+    throw std::runtime_error("Labels must lie in [0, " +
+                             std::to_string(num_classes) +
+                             ") for the configured model.");
+  }
+}
+
+void checkFeatures(Index feature_size, const TrainingConfig &config) {
+  if (feature_size != Index(config.layers.front())) {
+    throw std::runtime_error(
+        "Data has " + std::to_string(feature_size) +
+        " features but the model takes " +
+        std::to_string(config.layers.front()) + ".");
+  }
+}
+
+// One pass over the training files of a streamed run. The shuffle seed
+// depends only on the epoch, so a resumed run sees the same batches.
+std::unique_ptr<StreamingLoader> openStream(const TrainingConfig &config,
+                                            int epoch) {
+  StreamingOptions options;
+  options.batch_size = config.batch_size;
+  options.shuffle_window = config.shuffle_window;
+  options.seed = config.seed + std::uint64_t(epoch);
+  return std::make_unique<StreamingLoader>(
+      config.train_images.string(), config.train_labels.string(), options);
+}
+
+// Trains on `train_set`, or streams the training files if it is null.
+TrainingResult train(const TrainingConfig &config, const Dataset *train_set,
+                     const Dataset &test_set, std::ostream &log) {
+  using Loss = TrainingConfig::Loss;
+  const auto run_start = std::chrono::steady_clock::now();
+
+  Model model = makeSeededModel(config);
+  const Index num_classes = Index(config.layers.back());
+
+  // Softmax cross-entropy trains on the labels directly; the other losses
+  // compare against one-hot targets, built per batch so that runs sharing
+  // the datasets do not each hold an encoded copy.
+  const bool classifier = config.loss == Loss::SoftmaxCrossEntropy;
+  const auto batchLoss = config.loss == Loss::MSE
+                             ? LossFunction::mseBatch
+                             : LossFunction::crossEntropyBatch;
+  const auto batchLossGrad = config.loss == Loss::MSE
+                                 ? LossFunction::mseGradBatch
+                                 : LossFunction::crossEntropyGradBatch;
+
+  // A streamed run opens each epoch's pass when the epoch starts; the
+  // first one is opened here for the sample count.
+  std::unique_ptr<StreamingLoader> stream;
+  if (!train_set) {
+    stream = openStream(config, 0);
+  }
+  const Index batch_size = config.batch_size;
+  const Index accumulation_steps = config.accumulation_steps;
+  const Index num_train = stream ? stream->size() : train_set->size();
+  const Index feature_size =
+      stream ? stream->featureSize() : train_set->featureSize();
+  checkFeatures(feature_size, config);
+  checkFeatures(test_set.featureSize(), config);
+  if (train_set) {
+    checkLabels(train_set->labelBatch(0, num_train), num_classes);
+  }
+  checkLabels(test_set.labelBatch(0, test_set.size()), num_classes);
+  const Index micro_batches = (num_train + batch_size - 1) / batch_size;
+  const Index steps_per_epoch =
+      (micro_batches + accumulation_steps - 1) / accumulation_steps;
+
+  Optimizer opt = config.makeOptimizer(steps_per_epoch);
+  model.initOptimizerState(opt);
+  ParallelTrainer trainer(model, config.threads);
+
+  std::filesystem::create_directories(config.output_dir);
+  const auto output = [&](const std::string &file) {
+    return config.output_dir / file;
+  };
+  const std::filesystem::path train_loss_path =
+      output("loss_" + config.name + "_train.csv");
+  const std::filesystem::path val_loss_path =
+      output("loss_" + config.name + "_val.csv");
+  const std::filesystem::path acc_path =
+      output("accuracy_" + config.name + ".csv");
+  std::ofstream train_loss_file = openLog(train_loss_path);
+  std::ofstream val_loss_file = openLog(val_loss_path);
+  std::ofstream acc_file = openLog(acc_path);
+
+  train_loss_file << "Epoch,Loss\n";
+  val_loss_file << "Epoch,Loss\n";
+  acc_file << "Epoch,Accuracy\n";
+  const auto writeEpoch = [&](int epoch, const EpochResult &r) {
+    train_loss_file << epoch << "," << r.train_loss << "\n";
+    val_loss_file << epoch << "," << r.val_loss << "\n";
+    acc_file << epoch << "," << r.accuracy << "\n";
+  };
+
+  std::default_random_engine rng(config.seed);
+  TrainingResult result;
+
+  // A resumed run starts inside the saved epoch, with its shuffle order,
+  // partial loss and the logs of the epochs before it.
+  TrainingCheckpoint resumed;
+  if (!config.resume.empty()) {
+    resumed = readCheckpoint(config.resume);
+    checkResumable(resumed, config);
+    resumed.restore(model);
+    rng = resumed.shuffle_rng;
+    result.history = resumed.history;
+    for (size_t i = 0; i < result.history.size(); ++i) {
+      writeEpoch(int(i) + 1, result.history[i]);
+    }
+    log << "\nResuming from " << config.resume.string() << " at epoch "
+        << (resumed.epoch + 1) << ", sample " << resumed.position << "\n";
+  }
+
+  // Checkpoints are written in the background between optimizer steps, so
+  // they never hold partially accumulated gradients.
+  std::unique_ptr<CheckpointWriter> checkpoints;
+  if (!config.checkpoint.empty()) {
+    checkpoints = std::make_unique<CheckpointWriter>(config.checkpoint);
+  }
+  const auto checkpoint_interval =
+      std::chrono::duration<double>(60.0 * config.checkpoint_minutes);
+  auto last_checkpoint = std::chrono::steady_clock::now();
+  int steps_since_checkpoint = 0;
+  const auto saveCheckpoint = [&](int epoch, Index position,
+                                  Index micro_batch, double running_loss,
+                                  const std::default_random_engine &epoch_rng) {
+    checkpoints->save([&](TrainingCheckpoint &c) {
+      c.capture(model, config.optimizer);
+      c.batch_size = config.batch_size;
+      c.accumulation_steps = config.accumulation_steps;
+      c.seed = config.seed;
+      c.stream = config.stream;
+      c.shuffle_window = config.shuffle_window;
+      c.threads = config.threads;
+      c.epoch = epoch;
+      c.position = position;
+      c.micro_batch = micro_batch;
+      c.running_loss = running_loss;
+      c.shuffle_rng = epoch_rng;
+      c.history = result.history;
+    });
+    last_checkpoint = std::chrono::steady_clock::now();
+    steps_since_checkpoint = 0;
+  };
+
+  log << "\n=== Training " << config.name << " for " << config.epochs
+      << " epoch(s) ===\n";
+
+  // The step only records into its counter; the reporter thread formats
+  // and writes the progress line and metric files every interval.
+  MetricsReporter::Options metrics;
+  metrics.interval = std::chrono::duration<double>(config.metrics_interval);
+  metrics.console = config.progress;
+  metrics.samples_per_epoch = num_train;
+  metrics.csv = config.metrics_csv;
+  metrics.jsonl = config.metrics_jsonl;
+  auto reporter = std::make_unique<MetricsReporter>(metrics, log);
+  MetricsReporter::Counter &counter = reporter->counter();
+
+  for (int e = resumed.epoch; e < config.epochs; ++e) {
+    // Shuffle indices
+    const std::default_random_engine epoch_rng = rng;
+    std::vector<int> indices;
+    if (!stream) {
+      indices.resize(std::size_t(num_train));
+      std::iota(indices.begin(), indices.end(), 0);
+      std::shuffle(indices.begin(), indices.end(), rng);
+    } else if (e > 0) {
+      stream.reset();
+      stream = openStream(config, e);
+    }
+
+    Matrix X, Y;
+    Labels labels;
+
+    const bool resuming = e == resumed.epoch;
+    double running_loss = resuming ? resumed.running_loss : 0.0;
+    Index micro_batch = resuming ? resumed.micro_batch : 0;
+    const Index first = resuming ? resumed.position : 0;
+    // Checkpoints fall between whole batches, so a resumed stream skips
+    // to the saved position batch by batch.
+    for (Index skipped = 0; stream && skipped < first; skipped += batch_size) {
+      stream->next();
+    }
+    counter.startEpoch(e, first, running_loss);
+    const auto epoch_start = std::chrono::steady_clock::now();
+    for (Index start = first; start < num_train; start += batch_size) {
+      const Index count = std::min<Index>(batch_size, num_train - start);
+      const StreamingLoader::Batch *streamed = nullptr;
+      {
+        NN_PROFILE_SCOPE(Data, 0, 2 * sizeof(Scalar) * feature_size * count);
+        if (stream) {
+          streamed = stream->next();
+          if (!streamed || streamed->size != count) {
+            throw std::runtime_error("Training files ended while streaming.");
+          }
+        } else {
+          train_set->gather(indices, start, count, X, labels);
+        }
+      }
+      const ConstMatrixRef batch_x =
+          streamed ? ConstMatrixRef(streamed->view()) : ConstMatrixRef(X);
+      const ConstLabelsRef batch_labels =
+          streamed ? ConstLabelsRef(Eigen::Map<const Labels>(
+                         streamed->labels.data(), count))
+                   : ConstLabelsRef(labels);
+      if (streamed) {
+        checkLabels(batch_labels, num_classes);
+      }
+      if (!classifier) {
+        oneHot(batch_labels, num_classes, Y);
+      }
+      // The loss and accuracy come from the step's own forward pass, on
+      // the weights that produced the gradients.
+      const double batch_loss =
+          classifier
+              ? trainer.accumulateBatch(batch_x, batch_labels,
+                                        SoftmaxCrossEntropy::lossGradBatch)
+              : trainer.accumulateBatch(batch_x, Y, batchLossGrad, batchLoss);
+      running_loss += batch_loss * count;
+      counter.record(count, batch_loss * count, trainer.lastCorrect());
+      if (++micro_batch % accumulation_steps == 0 ||
+          start + count == num_train) {
+        trainer.applyAccumulated(opt);
+        ++steps_since_checkpoint;
+        if (checkpoints &&
+            ((config.checkpoint_steps > 0 &&
+              steps_since_checkpoint >= config.checkpoint_steps) ||
+             (config.checkpoint_minutes > 0 &&
+              std::chrono::steady_clock::now() - last_checkpoint >=
+                  checkpoint_interval))) {
+          saveCheckpoint(e, start + count, micro_batch, running_loss,
+                         epoch_rng);
+        }
+      }
+    }
+
+    const double train_seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                      epoch_start)
+            .count();
+
+    const Index trained = num_train - first;
+    double avg_train_loss = running_loss / num_train;
+
+    const Index val_batch = 256;
+    InferenceModel frozen = model.freeze();
+    InferenceModel::Workspace workspace = frozen.makeWorkspace(val_batch);
+
+    double val_loss = 0.0;
+    int correct = 0;
+    for (Index start = 0; start < test_set.size(); start += val_batch) {
+      const Index count = std::min(val_batch, test_set.size() - start);
+      NN_PROFILE_SCOPE(Evaluate, 0,
+                       sizeof(Scalar) * test_set.featureSize() * count);
+      Matrix out = frozen.predict(test_set.batch(start, count), workspace);
+      if (classifier)
+        val_loss += SoftmaxCrossEntropy::lossBatch(
+                        out, test_set.labelBatch(start, count)) *
+                    count;
+      else {
+        oneHot(test_set.labelBatch(start, count), num_classes, Y);
+        val_loss += batchLoss(out, Y) * count;
+      }
+
+      for (Index j = 0; j < count; ++j) {
+        Eigen::Index predIndex;
+        out.col(j).maxCoeff(&predIndex);
+        if (predIndex == test_set.label(start + j))
+          ++correct;
+      }
+    }
+
+    double avg_val_loss = val_loss / test_set.size();
+    double accuracy = 100.0 * double(correct) / test_set.size();
+
+    result.history.push_back(
+        {avg_train_loss, avg_val_loss, accuracy, train_seconds});
+    writeEpoch(e + 1, result.history.back());
+
+    reporter->flush();
+    const auto console = reporter->lockConsole();
+    log << std::fixed << std::setprecision(4) << (config.progress ? "\n" : "")
+        << "Epoch " << (e + 1) << " finished. Train Loss: " << avg_train_loss
+        << ", Val Loss: " << avg_val_loss << ", Accuracy: " << accuracy
+        << "%\n";
+    log << "Micro-batch " << batch_size << " x " << accumulation_steps
+        << " accumulation step(s): " << std::setprecision(0)
+        << (double(trained) / train_seconds) << " samples/s, peak RSS "
+        << (peakResidentBytes() >> 20) << " MiB\n"
+        << std::setprecision(4);
+    if (stream) {
+      const StreamingLoader::Stats stats = stream->stats();
+      log << "Streaming: waited " << std::setprecision(3)
+          << stats.stall_seconds << " s for " << stats.stalls << " of "
+          << stats.batches << " batches\n"
+          << std::setprecision(4);
+    }
+    if (profile::enabled()) {
+      profile::printSummary(log, "epoch " + std::to_string(e + 1));
+      profile::reset();
+    }
+
+    result.samples_per_second = double(trained) / train_seconds;
+
+    if (checkpoints && config.checkpoint_epochs > 0 &&
+        (e + 1) % config.checkpoint_epochs == 0) {
+      saveCheckpoint(e + 1, 0, 0, 0.0, rng);
+    }
+  }
+  reporter->close();
+  reporter.reset();
+  if (checkpoints) {
+    checkpoints->wait();
+  }
+  if (!config.profile_trace.empty()) {
+    profile::writeChromeTrace(config.profile_trace);
+  }
+
+  if (!result.history.empty()) {
+    result.train_loss = result.history.back().train_loss;
+    result.val_loss = result.history.back().val_loss;
+    result.accuracy = result.history.back().accuracy;
+  }
+  for (size_t i = 0; i < result.history.size(); ++i) {
+    if (result.history[i].accuracy >= config.target_accuracy) {
+      result.epochs_to_target = int(i) + 1;
+      break;
+    }
+  }
+
+  if (result.epochs_to_target > 0)
+    log << "Reached " << std::defaultfloat << config.target_accuracy
+        << "% accuracy after "
+        << result.epochs_to_target << " epoch(s)\n";
+  else
+    log << "Did not reach " << std::defaultfloat << config.target_accuracy
+        << "% accuracy\n";
+
+  closeLog(train_loss_file, train_loss_path);
+  closeLog(val_loss_file, val_loss_path);
+  closeLog(acc_file, acc_path);
+
+  FileWriter out(output("model_" + config.name + ".bin"));
+  out << model;
+  out.close();
+
+  result.wall_seconds = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - run_start)
+                            .count();
+
+  return result;
+}
+
+} // namespace
+
+TrainingResult runTraining(const TrainingConfig &config, std::ostream &log) {
+  const Dataset test_set = loadDataset(config.test_images, config.test_labels);
+  if (config.stream) {
+    return train(config, nullptr, test_set, log);
+  }
+  const Dataset train_set =
+      loadDataset(config.train_images, config.train_labels);
+  return train(config, &train_set, test_set, log);
+}
+
+TrainingResult runTraining(const TrainingConfig &config,
+                           const Dataset &train_set, const Dataset &test_set,
+                           std::ostream &log) {
+  return train(config, &train_set, test_set, log);
+}
+
+} // namespace neural_network
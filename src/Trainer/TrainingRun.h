@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Loader/Dataset.h"
+#include "Trainer/TrainingConfig.h"
+
+#include <iosfwd>
+#include <vector>
+
+namespace neural_network {
+
+// Losses and accuracy measured at the end of one epoch.
+struct EpochResult {
+  double train_loss = 0.0;
+  double val_loss = 0.0;
+  double accuracy = 0.0;
+  double seconds = 0.0;
+};
+
+// Outcome of a run, measured on the test set after the last epoch.
+struct TrainingResult {
+  double train_loss = 0.0;
+  double val_loss = 0.0;
+  double accuracy = 0.0;
+  // First epoch whose accuracy reached config.target_accuracy, or 0.
+  int epochs_to_target = 0;
+  double samples_per_second = 0.0;
+  // Whole run, including evaluation and writing the outputs.
+  double wall_seconds = 0.0;
+  // One entry per epoch, in order.
+  std::vector<EpochResult> history;
+};
+
+// Loads an IDX image/label pair; throws std::runtime_error on failure.
+Dataset loadDataset(const std::filesystem::path &images,
+                    const std::filesystem::path &labels);
+
+// Loads the data, trains config.makeModel() with the configured optimizer,
+// writes the CSV logs, checkpoints and final model, and reports progress to
+// `log`. With config.stream the training set is read from its files during
+// each epoch instead. Throws std::runtime_error if the data cannot be
+// loaded.
+TrainingResult runTraining(const TrainingConfig &config, std::ostream &log);
+
+// Same, on data that is already loaded; config's data paths and stream
+// are ignored.
+// The datasets are only read, so concurrent runs can share them.
+TrainingResult runTraining(const TrainingConfig &config,
+                           const Dataset &train_set, const Dataset &test_set,
+                           std::ostream &log);
+
+} // namespace neural_network
@@ -0,0 +1,188 @@
+#include "Trainer/TrainingSweep.h"
+#include "Utilities/Settings.h"
+#include "Utilities/ThreadPool.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+
+namespace neural_network {
+
+namespace {
+
+bool isDataKey(const std::string &key) {
+  return key == "train_images" || key == "train_labels" ||
+         key == "test_images" || key == "test_labels";
+}
+
+// Settings naming a run's own output, which concurrent runs would share.
+bool isRunKey(const std::string &key) {
+  return key == "name" || key == "checkpoint" || key == "resume" ||
+         key == "metrics_csv" || key == "metrics_jsonl" ||
+         key == "profile_trace";
+}
+
+// Settings of the streaming loader: runSweep preloads the datasets once
+// for all runs, so a sweep cannot stream them.
+bool isStreamKey(const std::string &key) {
+  return key == "stream" || key == "shuffle_window";
+}
+
+} // namespace
+
+void TrainingSweep::set(const std::string &raw_key, const std::string &values) {
+  std::string key = trim(raw_key);
+  std::replace(key.begin(), key.end(), '-', '_');
+
+  if (key == "jobs") {
+    jobs = std::size_t(parseInteger(key, trim(values), 1));
+    return;
+  }
+  if (key == "summary") {
+    summary = trim(values);
+    return;
+  }
+
+  std::vector<std::string> items = split(values, '|');
+  if (isDataKey(key) && items.size() > 1) {
+    throw std::runtime_error("The data paths cannot be swept: " + key);
+  }
+  if (isRunKey(key)) {
+    throw std::runtime_error("Per-run outputs cannot be set in a sweep: " +
+                             key);
+  }
+  if (isStreamKey(key)) {
+    throw std::runtime_error(
+        "A sweep shares preloaded datasets and cannot stream them: " + key);
+  }
+  // Parse every alternative now so that a typo fails before any training.
+  for (const auto &item : items) {
+    TrainingConfig probe;
+    probe.set(key, item);
+  }
+
+  const auto existing =
+      std::find_if(settings.begin(), settings.end(),
+                   [&](const auto &setting) { return setting.first == key; });
+  if (existing != settings.end()) {
+    existing->second = std::move(items);
+  } else {
+    settings.emplace_back(key, std::move(items));
+  }
+}
+
+void TrainingSweep::load(const std::filesystem::path &file) {
+  readSettings(file, "sweep",
+               [this](const std::string &key, const std::string &value) {
+                 set(key, value);
+               });
+}
+
+TrainingSweep TrainingSweep::fromArguments(int argc,
+                                           const char *const *argv) {
+  TrainingSweep sweep;
+  applyFlags(
+      argc, argv, "sweep",
+      [&sweep](const std::string &file) { sweep.load(file); },
+      [&sweep](const std::string &key, const std::string &value) {
+        sweep.set(key, value);
+      });
+  sweep.expand();
+  return sweep;
+}
+
+std::vector<TrainingConfig> TrainingSweep::expand() const {
+  std::size_t count = 1;
+  for (const auto &setting : settings) {
+    count *= setting.second.size();
+  }
+
+  std::vector<TrainingConfig> configs(count);
+  for (std::size_t index = 0; index < count; ++index) {
+    TrainingConfig &config = configs[index];
+    // The last setting varies fastest.
+    std::size_t stride = count;
+    for (const auto &[key, items] : settings) {
+      stride /= items.size();
+      config.set(key, items[(index / stride) % items.size()]);
+    }
+    config.name = "job" + std::to_string(index);
+    config.progress = false;
+    config.validate();
+  }
+  return configs;
+}
+
+std::string TrainingSweep::describe(std::size_t index) const {
+  std::size_t stride = 1;
+  for (const auto &setting : settings) {
+    stride *= setting.second.size();
+  }
+  std::string text;
+  for (const auto &[key, items] : settings) {
+    stride /= items.size();
+    if (items.size() > 1) {
+      text += (text.empty() ? "" : ";") + key + "=" +
+              items[(index / stride) % items.size()];
+    }
+  }
+  return text;
+}
+
+std::vector<TrainingResult> runSweep(const TrainingSweep &sweep,
+                                     std::ostream &log) {
+  const std::vector<TrainingConfig> configs = sweep.expand();
+  const TrainingConfig &first = configs.front();
+  const Dataset train_set = loadDataset(first.train_images, first.train_labels);
+  const Dataset test_set = loadDataset(first.test_images, first.test_labels);
+
+  log << "Sweeping " << configs.size() << " run(s), " << sweep.jobs
+      << " at a time\n";
+
+  std::vector<TrainingResult> results(configs.size());
+  std::mutex log_mutex;
+  std::size_t finished = 0;
+
+  ThreadPool pool(std::min(sweep.jobs, configs.size()));
+  pool.parallelFor(configs.size(), [&](std::size_t i) {
+    std::ostream quiet(nullptr);
+    results[i] = runTraining(configs[i], train_set, test_set, quiet);
+
+    std::lock_guard<std::mutex> lock(log_mutex);
+    log << "[" << ++finished << "/" << configs.size() << "] "
+        << configs[i].name << " " << sweep.describe(i) << ": accuracy "
+        << std::fixed << std::setprecision(2) << results[i].accuracy
+        << "% in " << results[i].wall_seconds << " s\n"
+        << std::defaultfloat;
+  });
+
+  if (sweep.summary.has_parent_path()) {
+    std::filesystem::create_directories(sweep.summary.parent_path());
+  }
+  std::ofstream out(sweep.summary);
+  if (!out) {
+    throw std::runtime_error("Could not write " + sweep.summary.string());
+  }
+  out << "Job,Settings,Epoch,TrainLoss,ValLoss,Accuracy,EpochSeconds,"
+         "WallSeconds\n";
+  for (std::size_t i = 0; i < configs.size(); ++i) {
+    for (std::size_t e = 0; e < results[i].history.size(); ++e) {
+      const EpochResult &epoch = results[i].history[e];
+      out << configs[i].name << ",\"" << sweep.describe(i) << "\"," << (e + 1)
+          << "," << epoch.train_loss << "," << epoch.val_loss << ","
+          << epoch.accuracy << "," << epoch.seconds << ","
+          << results[i].wall_seconds << "\n";
+    }
+  }
+  out.close();
+  if (!out) {
+    throw std::runtime_error("Could not write " + sweep.summary.string());
+  }
+  log << "Summary written to " << sweep.summary.string() << "\n";
+  return results;
+}
+
+} // namespace neural_network
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Trainer/TrainingConfig.h"
+#include "Trainer/TrainingRun.h"
+
+#include <cstddef>
+#include <filesystem>
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace neural_network {
+
+// A grid of training runs. Settings use the TrainingConfig keys; a value
+// may list alternatives separated by '|', and the sweep trains one model
+// for every combination, e.g.
+//   layers = 784,64,10 | 784,256,10
+//   optimizer = adam | lamb
+//   learning_rate = 0.001 | 0.003
+// is eight runs. The data paths cannot be swept: the datasets are loaded
+// once and shared read-only by all runs, which is also why stream and
+// shuffle_window are rejected. The settings of a single run's
+// files (name, checkpoint, resume, metrics_csv, metrics_jsonl and
+// profile_trace) are rejected, since concurrent runs would write them.
+struct TrainingSweep {
+  // Runs trained at the same time; each uses `threads` threads of its own.
+  std::size_t jobs = 1;
+  // CSV with one row per run and epoch.
+  std::filesystem::path summary = "sweep_summary.csv";
+  // Settings in the order given; setting a key again replaces it.
+  std::vector<std::pair<std::string, std::vector<std::string>>> settings;
+
+  void set(const std::string &key, const std::string &values);
+  void load(const std::filesystem::path &file);
+  // --sweep=FILE is read first, then --jobs, --summary and --key=value
+  // flags (which may also hold '|' alternatives).
+  static TrainingSweep fromArguments(int argc, const char *const *argv);
+
+  // One validated config per combination, named job0, job1, ... in
+  // row-major order over the settings, with the progress bar off.
+  std::vector<TrainingConfig> expand() const;
+  // "key=value;..." for the swept settings of run `index` of expand().
+  std::string describe(std::size_t index) const;
+};
+
+// Trains every run of the sweep, `sweep.jobs` at a time, writes the summary
+// and returns the results in expand() order. Each run's own CSVs and model
+// go to its output_dir as usual; `log` gets one line per finished run.
+std::vector<TrainingResult> runSweep(const TrainingSweep &sweep,
+                                     std::ostream &log);
+
+} // namespace neural_network
@@ -0,0 +1,60 @@
+#include "Utilities/AllocationCounter.h"
+
+#include <cstdlib>
+
+// The hooks replace malloc for the whole process, so they are only built
+// with -DNEURAL_NET_COUNT_ALLOCATIONS=ON. Sanitizers interpose malloc
+// themselves; leave the hooks out there too.
+#if defined(NEURAL_NET_COUNT_ALLOCATIONS) && defined(__GLIBC__) &&           \
+    !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+#define NEURAL_NETWORK_COUNT_ALLOCATIONS 1
+#endif
+
+namespace {
+
+thread_local std::size_t g_allocations = 0;
+
+} // namespace
+
+#if defined(NEURAL_NETWORK_COUNT_ALLOCATIONS)
+extern "C" {
+
+void *__libc_malloc(std::size_t size);
+void *__libc_calloc(std::size_t count, std::size_t size);
+void *__libc_realloc(void *ptr, std::size_t size);
+
+void *malloc(std::size_t size) noexcept {
+  ++g_allocations;
+  return __libc_malloc(size);
+}
+
+void *calloc(std::size_t count, std::size_t size) noexcept {
+  ++g_allocations;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, std::size_t size) noexcept {
+  ++g_allocations;
+  return __libc_realloc(ptr, size);
+}
+
+} // extern "C"
+#endif
+
+namespace neural_network {
+
+AllocationCounter::AllocationCounter() : start_(g_allocations) {}
+
+std::size_t AllocationCounter::count() const { return g_allocations - start_; }
+
+void AllocationCounter::reset() { start_ = g_allocations; }
+
+bool AllocationCounter::supported() {
+#if defined(NEURAL_NETWORK_COUNT_ALLOCATIONS)
+  return true;
+#else
+  return false;
+#endif
+}
+
+} // namespace neural_network
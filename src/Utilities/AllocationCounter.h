@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+
+namespace neural_network {
+
+// Counts heap allocations made by the calling thread since construction.
+// Built with -DNEURAL_NET_COUNT_ALLOCATIONS=ON on glibc, the counter hooks
+// malloc/calloc/realloc, so it sees both operator new and Eigen's own
+// aligned allocations. Otherwise (and under sanitizers) supported() is
+// false and the count stays at zero.
+class AllocationCounter {
+public:
+  AllocationCounter();
+
+  std::size_t count() const;
+  void reset();
+
+  static bool supported();
+
+private:
+  std::size_t start_;
+};
+
+} // namespace neural_network
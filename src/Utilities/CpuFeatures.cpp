@@ -0,0 +1,20 @@
+#include "Utilities/CpuFeatures.h"
+
+namespace neural_network {
+
+const CpuFeatures &cpuFeatures() {
+  static const CpuFeatures features = [] {
+    CpuFeatures detected;
+#if defined(NEURAL_NETWORK_X86_KERNELS)
+    // Also checks that the OS saves the wider registers (XGETBV).
+    __builtin_cpu_init();
+    detected.avx2 = __builtin_cpu_supports("avx2");
+    detected.fma = __builtin_cpu_supports("fma");
+    detected.avx512f = __builtin_cpu_supports("avx512f");
+#endif
+    return detected;
+  }();
+  return features;
+}
+
+} // namespace neural_network
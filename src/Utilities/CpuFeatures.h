@@ -0,0 +1,22 @@
+#pragma once
+
+// x86-64 builds with GCC or Clang compile kernels for wider instruction
+// sets per function (__attribute__((target(...)))) and pick them at run
+// time; SSE2 is the baseline every x86-64 CPU has.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define NEURAL_NETWORK_X86_KERNELS 1
+#endif
+
+namespace neural_network {
+
+// Instruction set extensions the CPU and the operating system support,
+// detected once. All false where NEURAL_NETWORK_X86_KERNELS is not defined.
+struct CpuFeatures {
+  bool avx2 = false;
+  bool fma = false;
+  bool avx512f = false;
+};
+
+const CpuFeatures &cpuFeatures();
+
+} // namespace neural_network
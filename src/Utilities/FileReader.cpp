@@ -1,55 +1,153 @@
 #include "Utilities/FileReader.h"
-#include "Layers/Layer.h"
+#include "Layers/AnyLayer.h"
 #include "Model/Model.h"
+#include "Utilities/ModelFormat.h"
 
 #include <stdexcept>
 
 namespace neural_network {
 
+namespace {
+
+// Reads count coefficients stored as `stored` into data, converting to
+// Scalar when the file was written with the other precision.
+void readScalars(FileReader &r, model_format::ScalarType stored, Scalar *data,
+                 std::uint64_t count) {
+  if (stored == model_format::scalarTypeOf<Scalar>()) {
+    r.read(data, sizeof(Scalar) * count);
+    return;
+  }
+  using Other =
+      std::conditional_t<std::is_same_v<Scalar, float>, double, float>;
+  std::vector<Other> buffer(count);
+  r.read(buffer.data(), sizeof(Other) * count);
+  for (std::uint64_t i = 0; i < count; ++i) {
+    data[i] = static_cast<Scalar>(buffer[i]);
+  }
+}
+
+} // namespace
+
 FileReader::FileReader(const std::filesystem::path &file) {
-  file_.open(file, std::ios::in);
+  file_.open(file, std::ios::in | std::ios::binary);
   if (!file_.is_open()) {
     throw std::runtime_error("Could not open file for reading.");
   }
+  size_ = std::filesystem::file_size(file);
 }
 
 FileReader::~FileReader() { file_.close(); }
 
+void FileReader::read(void *data, std::uint64_t bytes) {
+  file_.read(static_cast<char *>(data), static_cast<std::streamsize>(bytes));
+  if (!file_) {
+    throw std::runtime_error("Unexpected end of file.");
+  }
+}
+
+std::uint64_t FileReader::size() const { return size_; }
+
+void FileReader::seek(std::uint64_t position) {
+  file_.seekg(static_cast<std::streamoff>(position));
+}
+
 FileReader &operator>>(FileReader &r, Vector &v) {
-  Index size;
+  std::int64_t size;
   r >> size;
   v.resize(size);
-  for (Index i = 0; i < size; ++i)
-    r >> v[i];
+  r.read(v.data(), sizeof(Scalar) * v.size());
   return r;
 }
 
 FileReader &operator>>(FileReader &r, Matrix &m) {
-  Index rows, cols;
+  std::int64_t rows, cols;
   r >> rows >> cols;
   m.resize(rows, cols);
-  for (Index i = 0; i < rows; ++i)
-    for (Index j = 0; j < cols; ++j)
-      r >> m(i, j);
-  return r;
-}
-
-FileReader &operator>>(FileReader &r, Layer &l) {
-  r >> l.weights_ >> l.biases_;
-  int type;
-  r >> type;
-  l.activation_type_ = static_cast<ActivationFunction::Type>(type);
-  l.activation_ = ActivationFunction::create(l.activation_type_);
+  r.read(m.data(), sizeof(Scalar) * m.size());
   return r;
 }
 
 FileReader &operator>>(FileReader &r, Model &m) {
-  size_t n;
-  r >> n;
-  m.layers_.resize(n);
-  for (auto &layer : m.layers_) {
-    r >> layer;
+  namespace format = model_format;
+  using Kind = AnyLayer::Kind;
+
+  format::Header header;
+  r >> header;
+  format::checkHeader(header, r.size());
+  const auto stored = static_cast<format::ScalarType>(header.scalar_type);
+
+  std::vector<format::LayerRecord> records(header.layer_count);
+  for (auto &record : records) {
+    record = format::LayerRecord{};
+    r.read(&record, format::recordSize(header.version));
+    format::checkLayerRecord(header, record);
+    // Only batch normalization has running statistics; offset 0 (the
+    // header) means none.
+    if ((record.kind == std::uint32_t(Kind::BatchNorm)) !=
+        (record.statistics_offset != 0)) {
+      throw std::runtime_error("Corrupt layer record in model file.");
+    }
+  }
+
+  // The dense layer of a Dense or Conv2D record.
+  const auto readDense = [&](const format::LayerRecord &record) {
+    Layer layer;
+    layer.resize(Index(record.rows), Index(record.cols));
+    r.seek(record.weights_offset);
+    readScalars(r, stored, layer.weights_.data(), layer.weights_.size());
+    r.seek(record.biases_offset);
+    readScalars(r, stored, layer.biases_.data(), layer.biases_.size());
+    layer.activation_type_ =
+        static_cast<ActivationFunction::Type>(record.activation);
+    layer.activation_ = ActivationFunction::create(layer.activation_type_);
+    return layer;
+  };
+  const auto shapeOf = [](const format::LayerRecord &record) {
+    return ImageShape{Index(record.height), Index(record.width),
+                      Index(record.channels)};
+  };
+
+  std::vector<AnyLayer> layers;
+  layers.reserve(records.size());
+  for (const auto &record : records) {
+    switch (static_cast<Kind>(record.kind)) {
+    case Kind::Dense:
+      layers.emplace_back(readDense(record));
+      break;
+    case Kind::Dropout:
+      layers.emplace_back(Dropout(Index(record.inputs), record.rate));
+      break;
+    case Kind::BatchNorm: {
+      if (record.rows == 0 || record.cols != 1 ||
+          record.inputs % record.rows != 0) {
+        throw std::runtime_error("Corrupt layer record in model file.");
+      }
+      BatchNorm norm(Index(record.inputs), Index(record.rows));
+      r.seek(record.weights_offset);
+      readScalars(r, stored, norm.data_, record.rows);
+      r.seek(record.biases_offset);
+      readScalars(r, stored, norm.data_ + record.rows, record.rows);
+      r.seek(record.statistics_offset);
+      readScalars(r, stored, norm.running_mean_.data(), record.rows);
+      readScalars(r, stored, norm.running_variance_.data(), record.rows);
+      layers.emplace_back(std::move(norm));
+      break;
+    }
+    case Kind::Conv2D:
+      layers.emplace_back(Conv2D(shapeOf(record), Index(record.kernel),
+                                 Index(record.stride), Index(record.padding),
+                                 readDense(record)));
+      break;
+    case Kind::MaxPool:
+      layers.emplace_back(MaxPool(shapeOf(record), Index(record.kernel),
+                                  Index(record.stride)));
+      break;
+    default:
+      throw std::runtime_error("Unknown layer kind in model file.");
+    }
   }
+  // Also checks that the layers chain.
+  m = Model(std::move(layers));
   return r;
 }
 
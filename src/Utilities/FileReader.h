@@ -1,32 +1,41 @@
 #pragma once
 
 #include "Utilities/Utils.h"
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
+#include <type_traits>
 #include <vector>
 
 namespace neural_network {
 
 class Model;
-class Layer;
 
+// Binary input file, the counterpart of FileWriter. A Model file written
+// with another scalar type is converted on load.
 class FileReader {
 public:
   explicit FileReader(const std::filesystem::path &file);
   ~FileReader();
 
   template <typename T> FileReader &operator>>(T &x) {
-    file_ >> x;
+    static_assert(std::is_trivially_copyable_v<T>);
+    read(&x, sizeof(T));
     return *this;
   }
 
+  void read(void *data, std::uint64_t bytes);
+  void seek(std::uint64_t position);
+  // Bytes in the file, taken when it was opened.
+  std::uint64_t size() const;
+
 private:
   std::ifstream file_;
+  std::uint64_t size_ = 0;
 };
 
 FileReader &operator>>(FileReader &r, Vector &v);
 FileReader &operator>>(FileReader &r, Matrix &m);
-FileReader &operator>>(FileReader &r, Layer &l);
 FileReader &operator>>(FileReader &r, Model &m);
 
 } // namespace neural_network
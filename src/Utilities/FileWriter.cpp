@@ -1,46 +1,164 @@
 #include "Utilities/FileWriter.h"
-#include "Layers/Layer.h"
+#include "Layers/AnyLayer.h"
 #include "Model/Model.h"
+#include "Utilities/ModelFormat.h"
 
+#include <fcntl.h>
 #include <stdexcept>
+#include <unistd.h>
 
 namespace neural_network {
 
 FileWriter::FileWriter(const std::filesystem::path &file) {
-  file_.open(file, std::ios::out);
+  file_.open(file, std::ios::out | std::ios::binary | std::ios::trunc);
   if (!file_.is_open()) {
     throw std::runtime_error("Could not open file for writing.");
   }
 }
 
-FileWriter::~FileWriter() { file_.close(); }
+FileWriter::~FileWriter() {
+  if (file_.is_open()) {
+    file_.close();
+  }
+}
+
+void FileWriter::close() {
+  file_.close();
+  if (!file_) {
+    throw std::runtime_error("Could not write to file.");
+  }
+}
+
+void syncFile(const std::filesystem::path &file) {
+  // Directories can only be opened read-only; fsync accepts either.
+  const int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Could not open " + file.string() + " to sync.");
+  }
+  const bool synced = ::fsync(fd) == 0;
+  ::close(fd);
+  if (!synced) {
+    throw std::runtime_error("Could not sync " + file.string() + ".");
+  }
+}
+
+void FileWriter::write(const void *data, std::uint64_t bytes) {
+  file_.write(static_cast<const char *>(data),
+              static_cast<std::streamsize>(bytes));
+  if (!file_) {
+    throw std::runtime_error("Could not write to file.");
+  }
+}
+
+void FileWriter::pad(std::uint64_t alignment) {
+  static const char zeros[64] = {};
+  std::uint64_t remainder = position() % alignment;
+  std::uint64_t missing = remainder == 0 ? 0 : alignment - remainder;
+  while (missing > 0) {
+    const std::uint64_t chunk = std::min<std::uint64_t>(missing, sizeof(zeros));
+    write(zeros, chunk);
+    missing -= chunk;
+  }
+}
+
+std::uint64_t FileWriter::position() {
+  return static_cast<std::uint64_t>(file_.tellp());
+}
 
 FileWriter &operator<<(FileWriter &w, const Vector &v) {
-  w << v.size();
-  for (Index i = 0; i < v.size(); ++i)
-    w << v[i];
+  w << std::int64_t(v.size());
+  w.write(v.data(), sizeof(Scalar) * v.size());
   return w;
 }
 
 FileWriter &operator<<(FileWriter &w, const Matrix &m) {
-  w << m.rows() << m.cols();
-  for (Index i = 0; i < m.rows(); ++i)
-    for (Index j = 0; j < m.cols(); ++j)
-      w << m(i, j);
+  w << std::int64_t(m.rows()) << std::int64_t(m.cols());
+  w.write(m.data(), sizeof(Scalar) * m.size());
   return w;
 }
 
-FileWriter &operator<<(FileWriter &w, const Layer &l) {
-  w << l.weights_ << l.biases_;
-  w << static_cast<int>(l.activation_type_);
-  return w;
+namespace {
+
+// The record of a layer without its offsets.
+model_format::LayerRecord describe(const AnyLayer &layer) {
+  model_format::LayerRecord record{};
+  record.kind = static_cast<std::uint32_t>(layer.kind());
+  record.inputs = layer.inputSize();
+  record.rows = layer.weights().rows();
+  record.cols = layer.weights().cols();
+  record.activation = static_cast<std::uint32_t>(layer.activationType());
+  const auto setShape = [&](ImageShape shape) {
+    record.height = std::uint32_t(shape.height);
+    record.width = std::uint32_t(shape.width);
+    record.channels = std::uint32_t(shape.channels);
+  };
+  if (const auto *dropout = layer.get<Dropout>()) {
+    record.rate = dropout->rate();
+  } else if (const auto *norm = layer.get<BatchNorm>()) {
+    record.channels = std::uint32_t(norm->channels());
+  } else if (const auto *conv = layer.get<Conv2D>()) {
+    setShape(conv->inputShape());
+    record.kernel = std::uint32_t(conv->kernel());
+    record.stride = std::uint32_t(conv->stride());
+    record.padding = std::uint32_t(conv->padding());
+  } else if (const auto *pool = layer.get<MaxPool>()) {
+    setShape(pool->inputShape());
+    record.kernel = std::uint32_t(pool->window());
+    record.stride = std::uint32_t(pool->stride());
+  }
+  return record;
 }
 
+} // namespace
+
 FileWriter &operator<<(FileWriter &w, const Model &m) {
-  w << m.layers_.size();
-  for (const auto &layer : m.layers_) {
-    w << layer;
+  namespace format = model_format;
+
+  // Lay out the tensors first so the layer table can hold their offsets.
+  std::vector<format::LayerRecord> records;
+  std::uint64_t offset = format::alignUp(
+      sizeof(format::Header) + sizeof(format::LayerRecord) * m.layers().size());
+  for (const auto &layer : m.layers()) {
+    format::LayerRecord record = describe(layer);
+    if (layer.parameterCount() > 0) {
+      record.weights_offset = offset;
+      offset = format::alignUp(offset +
+                               sizeof(Scalar) * layer.weights().size());
+      record.biases_offset = offset;
+      offset = format::alignUp(offset + sizeof(Scalar) * layer.biases().size());
+    }
+    if (layer.statisticsCount() > 0) {
+      record.statistics_offset = offset;
+      offset =
+          format::alignUp(offset + sizeof(Scalar) * layer.statisticsCount());
+    }
+    records.push_back(record);
+  }
+
+  format::Header header = format::makeHeader(records.size());
+  header.file_size = offset;
+
+  w << header;
+  for (const auto &record : records) {
+    w << record;
+  }
+  for (const auto &layer : m.layers()) {
+    if (layer.parameterCount() > 0) {
+      w.pad(format::kAlignment);
+      w.write(layer.weights().data(),
+              sizeof(Scalar) * layer.weights().size());
+      w.pad(format::kAlignment);
+      w.write(layer.biases().data(), sizeof(Scalar) * layer.biases().size());
+    }
+    if (const auto *norm = layer.get<BatchNorm>()) {
+      w.pad(format::kAlignment);
+      w.write(norm->runningMean().data(),
+              sizeof(Scalar) * norm->runningMean().size());
+      w.write(norm->runningVariance().data(),
+              sizeof(Scalar) * norm->runningVariance().size());
+    }
   }
+  w.pad(format::kAlignment);
   return w;
 }
 
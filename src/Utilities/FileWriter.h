@@ -1,32 +1,65 @@
 #pragma once
 
 #include "Utilities/Utils.h"
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
+#include <type_traits>
 #include <vector>
 
 namespace neural_network {
 
 class Model;
-class Layer;
 
+// Binary output file. Plain values are written as raw bytes; a Model is
+// written in the aligned format described in Utilities/ModelFormat.h.
 class FileWriter {
 public:
   explicit FileWriter(const std::filesystem::path &file);
+  // Closes the file if close() was not called, ignoring errors.
   ~FileWriter();
 
   template <typename T> FileWriter &operator<<(const T &x) {
-    file_ << x << '\n';
+    static_assert(std::is_trivially_copyable_v<T>);
+    write(&x, sizeof(T));
     return *this;
   }
 
+  void write(const void *data, std::uint64_t bytes);
+  // Zero-fills up to the next multiple of alignment.
+  void pad(std::uint64_t alignment);
+  std::uint64_t position();
+  // Flushes and closes the file. Throws if any buffered data could not be
+  // written.
+  void close();
+
 private:
   std::ofstream file_;
 };
 
+// Raw tensors: shape followed by the column-major coefficients.
 FileWriter &operator<<(FileWriter &w, const Vector &v);
 FileWriter &operator<<(FileWriter &w, const Matrix &m);
-FileWriter &operator<<(FileWriter &w, const Layer &l);
 FileWriter &operator<<(FileWriter &w, const Model &m);
 
+// Forces a closed file's contents to stable storage. Throws on failure.
+void syncFile(const std::filesystem::path &file);
+// Writes what `write` puts into a FileWriter to `file` so that a crash at
+// any point leaves either the old or the new contents: the data goes to a
+// temporary next to it, is synced and then renamed over `file`.
+template <typename Write>
+void writeFileAtomically(const std::filesystem::path &file,
+                         const Write &write) {
+  std::filesystem::path temporary = file;
+  temporary += ".tmp";
+  {
+    FileWriter out(temporary);
+    write(out);
+    out.close();
+  }
+  syncFile(temporary);
+  std::filesystem::rename(temporary, file);
+  syncFile(file.has_parent_path() ? file.parent_path() : ".");
+}
+
 } // namespace neural_network
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+
+namespace neural_network {
+
+// Read-only memory mapping of a whole file. The mapping is released when
+// the object is destroyed.
+class MappedFile {
+public:
+  explicit MappedFile(const std::filesystem::path &file);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const std::byte *data() const;
+  std::size_t size() const;
+
+private:
+  const std::byte *data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+} // namespace neural_network
@@ -0,0 +1,20 @@
+#include "Utilities/MemoryUsage.h"
+
+#include <sys/resource.h>
+
+namespace neural_network {
+
+std::size_t peakResidentBytes() {
+  struct rusage usage {};
+  if (::getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#if defined(__APPLE__)
+  return static_cast<std::size_t>(usage.ru_maxrss);
+#else
+  // Linux reports kilobytes.
+  return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+} // namespace neural_network
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+
+namespace neural_network {
+
+// Peak resident set size of the process so far, in bytes (0 if the platform
+// does not report it). The value never decreases, so compare configurations
+// across separate runs.
+std::size_t peakResidentBytes();
+
+} // namespace neural_network
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "ActivationFunctions/ActivationFunction.h"
+#include "Utilities/Utils.h"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+namespace neural_network {
+namespace model_format {
+
+// Binary model file layout (version 2, native little-endian):
+//
+//   Header                        32 bytes
+//   LayerRecord[layer_count]      88 bytes each
+//   padding to kAlignment
+//   per layer with parameters: weights (rows x cols, column-major),
+//              padding, biases (rows), padding
+//   per batch-norm layer: running mean, running variance (rows each),
+//              padding
+//
+// All tensor data starts on a kAlignment boundary so that a memory-mapped
+// file can be wrapped with Eigen::Map without copying. Version 1 files
+// hold dense layers only, with the records cut after biases_offset.
+
+constexpr char kMagic[8] = {'N', 'N', 'M', 'O', 'D', 'E', 'L', '\0'};
+constexpr std::uint32_t kVersion = 2;
+constexpr std::uint64_t kAlignment = 64;
+
+enum class ScalarType : std::uint32_t { Float32 = 1, Float64 = 2 };
+
+struct Header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t scalar_type;
+  std::uint64_t layer_count;
+  std::uint64_t file_size;
+};
+
+// Fields a layer kind does not use are zero: dropout and pooling have no
+// tensors, and only convolutions and pooling have an image shape (kernel
+// is the pooling window).
+struct LayerRecord {
+  std::uint64_t rows;
+  std::uint64_t cols;
+  std::uint32_t activation;
+  std::uint32_t kind; // AnyLayer::Kind; zero (dense) in version 1
+  std::uint64_t weights_offset;
+  std::uint64_t biases_offset;
+  std::uint64_t inputs;
+  std::uint64_t statistics_offset;
+  std::uint32_t height;
+  std::uint32_t width;
+  std::uint32_t channels;
+  std::uint32_t kernel;
+  std::uint32_t stride;
+  std::uint32_t padding;
+  double rate;
+};
+
+static_assert(sizeof(Header) == 32 && std::is_trivially_copyable_v<Header>);
+static_assert(sizeof(LayerRecord) == 88 &&
+              std::is_trivially_copyable_v<LayerRecord>);
+
+// Bytes of a LayerRecord in a file of the given version.
+inline std::uint64_t recordSize(std::uint32_t version) {
+  return version == 1 ? 40 : sizeof(LayerRecord);
+}
+
+template <typename T> constexpr ScalarType scalarTypeOf() {
+  static_assert(std::is_same_v<T, float> || std::is_same_v<T, double>);
+  return std::is_same_v<T, float> ? ScalarType::Float32 : ScalarType::Float64;
+}
+
+inline std::uint64_t scalarSize(ScalarType type) {
+  return type == ScalarType::Float32 ? sizeof(float) : sizeof(double);
+}
+
+inline std::uint64_t alignUp(std::uint64_t offset) {
+  return (offset + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+inline Header makeHeader(std::uint64_t layer_count) {
+  Header header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.scalar_type = static_cast<std::uint32_t>(scalarTypeOf<Scalar>());
+  header.layer_count = layer_count;
+  return header;
+}
+
+// Checks a header read from a file of `actual_size` bytes. The layer
+// count is bounded by division so a corrupt value is rejected before
+// anything is sized from it.
+inline void checkHeader(const Header &header, std::uint64_t actual_size) {
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+    throw std::runtime_error("Not a model file.");
+  }
+  if (header.version < 1 || header.version > kVersion) {
+    throw std::runtime_error("Unsupported model file version.");
+  }
+  if (header.scalar_type != std::uint32_t(ScalarType::Float32) &&
+      header.scalar_type != std::uint32_t(ScalarType::Float64)) {
+    throw std::runtime_error("Unknown scalar type in model file.");
+  }
+  if (header.file_size > actual_size) {
+    throw std::runtime_error("Truncated model file.");
+  }
+  if (header.file_size < sizeof(Header) ||
+      header.layer_count > (header.file_size - sizeof(Header)) /
+                               recordSize(header.version)) {
+    throw std::runtime_error("Corrupt model file.");
+  }
+}
+
+// Whether a rows x cols tensor of `scalar`-byte values at `offset` lies
+// inside a file of `file_size` bytes, without overflowing on corrupt
+// values.
+inline bool fits(std::uint64_t offset, std::uint64_t rows, std::uint64_t cols,
+                 std::uint64_t scalar, std::uint64_t file_size) {
+  if (offset % kAlignment != 0 || offset > file_size) {
+    return false;
+  }
+  const std::uint64_t room = (file_size - offset) / scalar;
+  return rows == 0 || cols <= room / rows;
+}
+
+// Checks that a layer's tensors lie inside a file of the given size and
+// that its activation is known; a zero statistics_offset means the layer
+// has no running statistics.
+inline void checkLayerRecord(const Header &header, const LayerRecord &record) {
+  const std::uint64_t scalar =
+      scalarSize(static_cast<ScalarType>(header.scalar_type));
+  const std::uint64_t size = header.file_size;
+  if (!fits(record.weights_offset, record.rows, record.cols, scalar, size) ||
+      !fits(record.biases_offset, record.rows, 1, scalar, size) ||
+      (record.statistics_offset != 0 &&
+       !fits(record.statistics_offset, record.rows, 2, scalar, size)) ||
+      record.activation >= ActivationFunction::kTypeCount) {
+    throw std::runtime_error("Corrupt layer record in model file.");
+  }
+}
+
+} // namespace model_format
+} // namespace neural_network
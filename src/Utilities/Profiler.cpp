@@ -0,0 +1,250 @@
+#include "Utilities/Profiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace neural_network {
+namespace profile {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Per-thread cap on trace events (40 bytes each). The buffer is reserved
+// up front, so recording never allocates inside the code being measured;
+// its pages are only committed as events are written.
+constexpr std::size_t kMaxEvents = std::size_t(1) << 18;
+// Layers whose totals are preallocated; deeper models grow the table once.
+constexpr std::size_t kReservedLayers = 64;
+
+const Clock::time_point g_origin = Clock::now();
+
+struct Totals {
+  std::uint64_t calls = 0;
+  double seconds = 0.0;
+  double flops = 0.0;
+  double bytes = 0.0;
+  std::uint64_t allocations = 0;
+};
+
+struct Event {
+  std::int64_t start_ns;
+  std::int64_t duration_ns;
+  double flops;
+  double bytes;
+  std::int32_t layer;
+  Stage stage;
+};
+
+// Written by its own thread; the lock is only contended while a summary or
+// trace is being taken.
+struct ThreadData {
+  ThreadData() : totals((kReservedLayers + 1) * kStageCount) {
+    events.reserve(kMaxEvents);
+  }
+
+  std::mutex mutex;
+  int id = 0;
+  // Indexed by (layer + 1) * kStageCount + stage; layer -1 means none.
+  std::vector<Totals> totals;
+  std::vector<Event> events;
+  std::uint64_t dropped = 0;
+};
+
+struct Registry {
+  std::mutex mutex;
+  // Never shrinks, so the numbers of finished threads stay in the report.
+  std::vector<std::unique_ptr<ThreadData>> threads;
+};
+
+Registry &registry() {
+  static Registry instance;
+  return instance;
+}
+
+ThreadData &threadData() {
+  thread_local ThreadData *data = [] {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.threads.push_back(std::make_unique<ThreadData>());
+    r.threads.back()->id = int(r.threads.size());
+    return r.threads.back().get();
+  }();
+  return *data;
+}
+
+thread_local int g_layer = -1;
+
+std::string eventName(Stage stage, int layer) {
+  return layer < 0 ? stageName(stage)
+                   : std::string(stageName(stage)) + "/" +
+                         std::to_string(layer);
+}
+
+} // namespace
+
+const char *stageName(Stage stage) {
+  switch (stage) {
+  case Stage::Data:
+    return "data";
+  case Stage::Forward:
+    return "forward";
+  case Stage::Activation:
+    return "activation";
+  case Stage::Loss:
+    return "loss";
+  case Stage::Backward:
+    return "backward";
+  case Stage::Reduce:
+    return "reduce";
+  case Stage::Optimizer:
+    return "optimizer";
+  case Stage::Evaluate:
+    return "evaluate";
+  case Stage::Report:
+    return "report";
+  }
+  return "unknown";
+}
+
+Scope::Scope(Stage stage, double flops, double bytes)
+    : stage_(stage), layer_(g_layer), flops_(flops), bytes_(bytes),
+      start_(Clock::now()) {}
+
+Scope::~Scope() {
+  const auto end = Clock::now();
+  const std::size_t allocations = allocations_.count();
+  ThreadData &data = threadData();
+  std::lock_guard<std::mutex> lock(data.mutex);
+
+  const std::size_t slot =
+      std::size_t(layer_ + 1) * kStageCount + std::size_t(stage_);
+  if (slot >= data.totals.size()) {
+    data.totals.resize(slot + 1);
+  }
+  Totals &totals = data.totals[slot];
+  ++totals.calls;
+  totals.seconds += std::chrono::duration<double>(end - start_).count();
+  totals.flops += flops_;
+  totals.bytes += bytes_;
+  totals.allocations += allocations;
+
+  if (data.events.size() >= kMaxEvents) {
+    ++data.dropped;
+    return;
+  }
+  data.events.push_back(
+      {std::chrono::duration_cast<std::chrono::nanoseconds>(start_ - g_origin)
+           .count(),
+       std::chrono::duration_cast<std::chrono::nanoseconds>(end - start_)
+           .count(),
+       flops_, bytes_, std::int32_t(layer_), stage_});
+}
+
+LayerScope::LayerScope(int layer) : previous_(std::exchange(g_layer, layer)) {}
+
+LayerScope::~LayerScope() { g_layer = previous_; }
+
+void printSummary(std::ostream &out, const std::string &title) {
+  // (layer, stage) -> totals over all threads.
+  std::map<std::pair<int, int>, Totals> rows;
+  double total_seconds = 0.0;
+  {
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (const auto &thread : r.threads) {
+      std::lock_guard<std::mutex> thread_lock(thread->mutex);
+      for (std::size_t slot = 0; slot < thread->totals.size(); ++slot) {
+        const Totals &t = thread->totals[slot];
+        if (t.calls == 0) {
+          continue;
+        }
+        Totals &row = rows[{int(slot / kStageCount) - 1,
+                            int(slot % kStageCount)}];
+        row.calls += t.calls;
+        row.seconds += t.seconds;
+        row.flops += t.flops;
+        row.bytes += t.bytes;
+        row.allocations += t.allocations;
+        total_seconds += t.seconds;
+      }
+    }
+  }
+  if (rows.empty()) {
+    return;
+  }
+
+  // Times are summed over threads; a scope's time includes the scopes it
+  // encloses.
+  out << "Profile: " << title << "\n"
+      << std::left << std::setw(11) << "stage" << std::right << std::setw(6)
+      << "layer" << std::setw(10) << "calls" << std::setw(11) << "time ms"
+      << std::setw(8) << "share" << std::setw(10) << "GFLOP/s" << std::setw(9)
+      << "GB/s" << std::setw(9) << "allocs" << "\n";
+  for (const auto &[key, t] : rows) {
+    const auto rate = [&](double amount) {
+      return t.seconds > 0.0 ? amount / t.seconds * 1e-9 : 0.0;
+    };
+    out << std::left << std::setw(11) << stageName(Stage(key.second))
+        << std::right << std::setw(6)
+        << (key.first < 0 ? std::string("-") : std::to_string(key.first))
+        << std::setw(10) << t.calls << std::fixed << std::setprecision(2)
+        << std::setw(11) << t.seconds * 1e3 << std::setprecision(1)
+        << std::setw(7) << 100.0 * t.seconds / total_seconds << "%"
+        << std::setprecision(2) << std::setw(10) << rate(t.flops)
+        << std::setw(9) << rate(t.bytes) << std::setw(9) << t.allocations
+        << std::defaultfloat << "\n";
+  }
+}
+
+void reset() {
+  Registry &r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  for (const auto &thread : r.threads) {
+    std::lock_guard<std::mutex> thread_lock(thread->mutex);
+    thread->totals.assign(thread->totals.size(), Totals{});
+  }
+}
+
+void writeChromeTrace(const std::filesystem::path &file) {
+  std::ofstream out(file);
+  if (!out) {
+    throw std::runtime_error("Could not write " + file.string());
+  }
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first = true;
+  std::uint64_t dropped = 0;
+  Registry &r = registry();
+  std::lock_guard<std::mutex> lock(r.mutex);
+  for (const auto &thread : r.threads) {
+    std::lock_guard<std::mutex> thread_lock(thread->mutex);
+    dropped += thread->dropped;
+    for (const Event &e : thread->events) {
+      out << (first ? "\n" : ",\n") << "{\"name\":\""
+          << eventName(e.stage, e.layer) << "\",\"cat\":\""
+          << stageName(e.stage) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+          << thread->id << std::fixed << std::setprecision(3)
+          << ",\"ts\":" << double(e.start_ns) * 1e-3
+          << ",\"dur\":" << double(e.duration_ns) * 1e-3
+          << std::defaultfloat << ",\"args\":{\"flops\":" << e.flops
+          << ",\"bytes\":" << e.bytes << "}}";
+      first = false;
+    }
+  }
+  out << "\n],\"otherData\":{\"dropped_events\":" << dropped << "}}\n";
+  out.close();
+  if (!out) {
+    throw std::runtime_error("Could not write " + file.string());
+  }
+}
+
+} // namespace profile
+} // namespace neural_network
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "Utilities/AllocationCounter.h"
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iosfwd>
+#include <string>
+
+namespace neural_network {
+namespace profile {
+
+// Optional hot-path instrumentation, compiled in with
+// -DNEURAL_NET_PROFILE=ON. Instrumented code opens scopes with
+// NN_PROFILE_SCOPE(Stage, flops, bytes); each scope adds its time, its
+// nominal FLOPs and bytes moved and the heap allocations made inside it to
+// per-thread totals per stage and layer, and appends an event for the
+// Chrome trace. NN_PROFILE_LAYER(i) attributes the scopes that follow on
+// the same thread to layer i. Without the option both macros expand to
+// no-ops whose arguments are not evaluated, so the instrumentation costs
+// nothing in normal builds.
+enum class Stage {
+  Data,
+  Forward,
+  Activation,
+  Loss,
+  Backward,
+  Reduce,
+  Optimizer,
+  Evaluate,
+  Report,
+};
+constexpr int kStageCount = int(Stage::Report) + 1;
+
+const char *stageName(Stage stage);
+
+// True in builds with NEURAL_NET_PROFILE.
+constexpr bool enabled() {
+#if defined(NEURAL_NET_PROFILE)
+  return true;
+#else
+  return false;
+#endif
+}
+
+// Table of the totals of every stage and layer over all threads since the
+// last reset(), headed by `title`. Writes nothing when disabled.
+void printSummary(std::ostream &out, const std::string &title);
+void reset();
+// Every recorded scope as a complete ("X") event in the Chrome trace event
+// format, viewable in chrome://tracing or Perfetto. Each thread keeps at
+// most a fixed number of events; later ones are counted but dropped.
+void writeChromeTrace(const std::filesystem::path &file);
+
+class Scope {
+public:
+  Scope(Stage stage, double flops, double bytes);
+  ~Scope();
+
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+private:
+  Stage stage_;
+  int layer_;
+  double flops_, bytes_;
+  AllocationCounter allocations_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+class LayerScope {
+public:
+  explicit LayerScope(int layer);
+  ~LayerScope();
+
+  LayerScope(const LayerScope &) = delete;
+  LayerScope &operator=(const LayerScope &) = delete;
+
+private:
+  int previous_;
+};
+
+} // namespace profile
+} // namespace neural_network
+
+#define NN_PROFILE_CONCAT_(a, b) a##b
+#define NN_PROFILE_NAME_(line) NN_PROFILE_CONCAT_(nn_profile_scope_, line)
+
+#if defined(NEURAL_NET_PROFILE)
+#define NN_PROFILE_SCOPE(stage, flops, bytes)                                 \
+  ::neural_network::profile::Scope NN_PROFILE_NAME_(__LINE__){               \
+      ::neural_network::profile::Stage::stage, static_cast<double>(flops),    \
+      static_cast<double>(bytes)}
+#define NN_PROFILE_LAYER(index)                                               \
+  ::neural_network::profile::LayerScope NN_PROFILE_NAME_(__LINE__){          \
+      static_cast<int>(index)}
+#else
+// The arguments stay unevaluated, but count as used: locals computed only
+// for the profiler do not warn in builds without it.
+#define NN_PROFILE_SCOPE(stage, flops, bytes)                                 \
+  static_cast<void>(sizeof((flops) + (bytes)))
+#define NN_PROFILE_LAYER(index) static_cast<void>(sizeof(index))
+#endif
@@ -4,26 +4,33 @@ namespace neural_network {
 
 Random::Random(std::uint64_t seed) : generator_(seed) {}
 
-Matrix Random::uniformMatrix(Index rows, Index cols, double a, double b) {
+Matrix Random::uniformMatrix(Index rows, Index cols, Scalar a, Scalar b) {
   return Eigen::Rand::uniformReal<Matrix>(rows, cols, generator_, a, b);
 }
 
-Vector Random::uniformVector(Index size, double a, double b) {
+Vector Random::uniformVector(Index size, Scalar a, Scalar b) {
   return Eigen::Rand::uniformReal<Matrix>(size, 1, generator_, a, b);
 }
 
-Matrix Random::normalMatrix(Index rows, Index cols, double mean,
-                            double stddev) {
+Matrix Random::normalMatrix(Index rows, Index cols, Scalar mean,
+                            Scalar stddev) {
   return Eigen::Rand::normal<Matrix>(rows, cols, generator_, mean, stddev);
 }
 
-Vector Random::normalVector(Index size, double mean, double stddev) {
+Vector Random::normalVector(Index size, Scalar mean, Scalar stddev) {
   return Eigen::Rand::normal<Matrix>(size, 1, generator_, mean, stddev);
 }
 
-Random &Random::global() {
-  static Random instance(k_default_seed_);
+std::unique_ptr<Random> &Random::globalInstance() {
+  static std::unique_ptr<Random> instance =
+      std::make_unique<Random>(k_default_seed_);
   return instance;
 }
 
+Random &Random::global() { return *globalInstance(); }
+
+void Random::reseedGlobal(std::uint64_t seed) {
+  globalInstance() = std::make_unique<Random>(seed);
+}
+
 } // namespace neural_network
@@ -1,21 +1,28 @@
 #pragma once
 #include "Utilities/Utils.h"
 
+#include <memory>
+
 namespace neural_network {
 
 class Random {
 public:
   explicit Random(std::uint64_t seed);
 
-  Matrix uniformMatrix(Index rows, Index cols, double a, double b);
-  Vector uniformVector(Index size, double a, double b);
+  Matrix uniformMatrix(Index rows, Index cols, Scalar a, Scalar b);
+  Vector uniformVector(Index size, Scalar a, Scalar b);
 
-  Matrix normalMatrix(Index rows, Index cols, double mean, double stddev);
-  Vector normalVector(Index size, double mean, double stddev);
+  Matrix normalMatrix(Index rows, Index cols, Scalar mean, Scalar stddev);
+  Vector normalVector(Index size, Scalar mean, Scalar stddev);
 
+  // Generator used for weight initialization. reseedGlobal() restarts it
+  // from `seed`, making the initial weights of later models reproducible.
   static Random &global();
+  static void reseedGlobal(std::uint64_t seed);
 
 private:
+  static std::unique_ptr<Random> &globalInstance();
+
   static constexpr std::uint64_t k_default_seed_ = 42;
   Eigen::Rand::Vmt19937_64 generator_;
 };
@@ -0,0 +1,97 @@
+#include "Utilities/Settings.h"
+
+#include <fstream>
+#include <stdexcept>
+
+namespace neural_network {
+
+std::string trim(const std::string &text) {
+  const auto begin = text.find_first_not_of(" \t\r");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  const auto end = text.find_last_not_of(" \t\r");
+  return text.substr(begin, end - begin + 1);
+}
+
+std::vector<std::string> split(const std::string &text, char separator) {
+  std::vector<std::string> items;
+  std::size_t start = 0;
+  for (;;) {
+    const auto at = text.find(separator, start);
+    items.push_back(trim(text.substr(start, at - start)));
+    if (at == std::string::npos) {
+      return items;
+    }
+    start = at + 1;
+  }
+}
+
+long long parseInteger(const std::string &key, const std::string &value,
+                       long long min) {
+  std::size_t used = 0;
+  long long result = 0;
+  try {
+    result = std::stoll(value, &used);
+  } catch (const std::exception &) {
+    used = 0;
+  }
+  if (used == 0 || used != value.size() || result < min) {
+    throw std::runtime_error("Invalid value for " + key + ": " + value);
+  }
+  return result;
+}
+
+void readSettings(const std::filesystem::path &file, const std::string &kind,
+                  const SettingSetter &set) {
+  std::ifstream in(file);
+  if (!in) {
+    throw std::runtime_error("Could not open " + kind + " file " +
+                             file.string());
+  }
+  std::string line;
+  for (int number = 1; std::getline(in, line); ++number) {
+    line = trim(line.substr(0, line.find('#')));
+    if (line.empty()) {
+      continue;
+    }
+    const auto eq = line.find('=');
+    if (eq == std::string::npos) {
+      throw std::runtime_error(file.string() + ":" + std::to_string(number) +
+                               ": expected key = value");
+    }
+    set(line.substr(0, eq), line.substr(eq + 1));
+  }
+}
+
+std::vector<std::pair<std::string, std::string>>
+parseFlags(int argc, const char *const *argv) {
+  std::vector<std::pair<std::string, std::string>> flags;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const auto eq = arg.find('=');
+    if (arg.rfind("--", 0) != 0 || eq == std::string::npos) {
+      throw std::runtime_error("Expected --key=value, got " + arg);
+    }
+    flags.emplace_back(arg.substr(2, eq - 2), arg.substr(eq + 1));
+  }
+  return flags;
+}
+
+void applyFlags(int argc, const char *const *argv, const std::string &file_key,
+                const std::function<void(const std::string &)> &load,
+                const SettingSetter &set) {
+  const auto flags = parseFlags(argc, argv);
+  for (const auto &[key, value] : flags) {
+    if (key == file_key) {
+      load(value);
+    }
+  }
+  for (const auto &[key, value] : flags) {
+    if (key != file_key) {
+      set(key, value);
+    }
+  }
+}
+
+} // namespace neural_network
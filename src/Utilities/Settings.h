@@ -0,0 +1,43 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace neural_network {
+
+// Parsing shared by the command-line tools (TrainingConfig, TrainingSweep,
+// QuantizationJob), whose settings are key = value pairs read from files
+// and from --key=value flags. Malformed input throws std::runtime_error.
+
+using SettingSetter =
+    std::function<void(const std::string &key, const std::string &value)>;
+
+// `text` without leading and trailing blanks.
+std::string trim(const std::string &text);
+// The trimmed items of a list separated by `separator`.
+std::vector<std::string> split(const std::string &text, char separator);
+// The whole of `value` as an integer of at least `min`; `key` names the
+// setting in the error.
+long long parseInteger(const std::string &key, const std::string &value,
+                       long long min);
+
+// Calls set() for every "key = value" line of `file`. Text after '#' is a
+// comment and blank lines are skipped; `kind` ("config", "sweep") names
+// the file in errors.
+void readSettings(const std::filesystem::path &file, const std::string &kind,
+                  const SettingSetter &set);
+
+// The --key=value flags of a command line, in order.
+std::vector<std::pair<std::string, std::string>>
+parseFlags(int argc, const char *const *argv);
+// Applies the flags of a command line: the settings file of --`file_key`,
+// if given, through load() first, then every other flag through set(), so
+// that flags override the file.
+void applyFlags(int argc, const char *const *argv, const std::string &file_key,
+                const std::function<void(const std::string &)> &load,
+                const SettingSetter &set);
+
+} // namespace neural_network
@@ -0,0 +1,99 @@
+#include "Utilities/ThreadPool.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace neural_network {
+
+ThreadPool::ThreadPool(std::size_t num_threads) {
+  const std::size_t workers = std::max<std::size_t>(num_threads, 1) - 1;
+  workers_.reserve(workers);
+  for (std::size_t i = 0; i < workers; ++i) {
+    workers_.emplace_back([this] { workerLoop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+std::size_t ThreadPool::size() const { return workers_.size() + 1; }
+
+void ThreadPool::run(std::size_t count, Invoke invoke, const void *task) {
+  if (count == 0) {
+    return;
+  }
+  if (workers_.empty() || count == 1) {
+    for (std::size_t i = 0; i < count; ++i) {
+      invoke(task, i);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    invoke_ = invoke;
+    task_ = task;
+    count_ = count;
+    next_ = 0;
+    pending_ = count;
+    ++generation_;
+  }
+  wake_.notify_all();
+
+  runTasks();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this] { return pending_ == 0; });
+  task_ = nullptr;
+  if (error_) {
+    std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+}
+
+void ThreadPool::runTasks() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (task_ != nullptr && next_ < count_) {
+    const std::size_t index = next_++;
+    const Invoke invoke = invoke_;
+    const void *task = task_;
+    lock.unlock();
+    std::exception_ptr error;
+    try {
+      invoke(task, index);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    lock.lock();
+    if (error && !error_) {
+      error_ = error;
+    }
+    if (--pending_ == 0) {
+      done_.notify_all();
+    }
+  }
+}
+
+void ThreadPool::workerLoop() {
+  std::size_t seen_generation = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      wake_.wait(lock, [&] { return stop_ || generation_ != seen_generation; });
+      if (stop_) {
+        return;
+      }
+      seen_generation = generation_;
+    }
+    runTasks();
+  }
+}
+
+} // namespace neural_network
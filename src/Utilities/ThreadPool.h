@@ -0,0 +1,63 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace neural_network {
+
+// Fixed set of worker threads executing index-parallel loops. The calling
+// thread takes part in every loop, so a pool of N threads starts N - 1
+// workers.
+class ThreadPool {
+public:
+  explicit ThreadPool(std::size_t num_threads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Runs task(i) for every i in [0, count) and returns once all are done.
+  // Indices are handed out dynamically; which thread runs a given index is
+  // unspecified, so tasks must depend only on their index. The first
+  // exception thrown by a task is rethrown here. The task is called through
+  // a plain function pointer rather than a std::function, so a loop never
+  // allocates however much the task captures.
+  template <typename Task>
+  void parallelFor(std::size_t count, const Task &task) {
+    run(count,
+        [](const void *t, std::size_t i) {
+          (*static_cast<const Task *>(t))(i);
+        },
+        &task);
+  }
+
+  std::size_t size() const;
+
+private:
+  using Invoke = void (*)(const void *, std::size_t);
+
+  void run(std::size_t count, Invoke invoke, const void *task);
+  void workerLoop();
+  void runTasks();
+
+  std::vector<std::thread> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+
+  Invoke invoke_ = nullptr;
+  const void *task_ = nullptr;
+  std::size_t count_ = 0;
+  std::size_t next_ = 0;
+  std::size_t pending_ = 0;
+  std::size_t generation_ = 0;
+  bool stop_ = false;
+  std::exception_ptr error_;
+};
+
+} // namespace neural_network
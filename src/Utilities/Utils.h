@@ -4,10 +4,28 @@
 #include <EigenRand/EigenRand>
 
 namespace neural_network {
-using Matrix = Eigen::MatrixXd;
-using Vector = Eigen::VectorXd;
+
+// Scalar type of every tensor in the network. Single precision is the
+// production configuration; configure with -DNEURAL_NET_DOUBLE=ON to build
+// in double precision (e.g. for gradient checking).
+#if defined(NEURAL_NET_USE_DOUBLE)
+using Scalar = double;
+#else
+using Scalar = float;
+#endif
+
+using Matrix = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+using Vector = Eigen::Matrix<Scalar, Eigen::Dynamic, 1>;
 using Index = Eigen::Index;
 
+// Read-only view of a matrix or of a contiguous block of columns.
+using ConstMatrixRef = Eigen::Ref<const Matrix>;
+using ConstVectorRef = Eigen::Ref<const Vector>;
+
+// Integer class labels, one per sample.
+using Labels = Eigen::Matrix<int, Eigen::Dynamic, 1>;
+using ConstLabelsRef = Eigen::Ref<const Labels>;
+
 template <typename T, typename Tag> class StrongAlias {
 public:
   explicit StrongAlias(T value) : value_(value) {}
@@ -26,6 +44,18 @@ struct OutTag {};
 using In = StrongAlias<Index, InTag>;
 using Out = StrongAlias<Index, OutTag>;
 
+// Height, width and channels of an image-shaped sample. Images are stored
+// channels-last, one column per sample: entry (y, x, c) is at row
+// (y * width + x) * channels + c, so a grayscale image is its row-major
+// pixels, as in the MNIST files.
+struct ImageShape {
+  Index height = 0;
+  Index width = 0;
+  Index channels = 0;
+
+  Index size() const { return height * width * channels; }
+};
+
 template <typename T> Index size(const std::vector<T> &vec) {
   return static_cast<Index>(vec.size());
 }
@@ -1,161 +1,137 @@
-#include "Loader/MNISTLoader.h"
-#include "LossFunctions/LossFunction.h"
-#include "Model/Model.h"
-#include "Optimizer/Optimizer.h"
+#include "Inference/Quantization.h"
+#include "Model/Architectures.h"
 #include "Tests/Tests.h"
-#include "Utilities/FileWriter.h"
-#include "Utilities/Random.h"
-#include "Utilities/Utils.h"
+#include "Trainer/TrainingConfig.h"
+#include "Trainer/TrainingRun.h"
+#include "Trainer/TrainingSweep.h"
 
 #include <algorithm>
-#include <fstream>
-#include <iomanip>
 #include <iostream>
-#include <numeric>
-#include <random>
+#include <string>
 
 using namespace neural_network;
 
-int main() {
-  test::runAllTests();
+namespace {
 
-  std::vector<Vector> train_images, test_images;
-  std::vector<int> train_labels, test_labels;
-  if (!loadMNIST("../data/train-images.idx3-ubyte",
-                 "../data/train-labels.idx1-ubyte", train_images,
-                 train_labels) ||
-      !loadMNIST("../data/t10k-images.idx3-ubyte",
-                 "../data/t10k-labels.idx1-ubyte", test_images, test_labels)) {
-    std::cerr << "Failed to load MNIST data!\n";
-    return 1;
-  }
-
-  std::vector<Vector> train_targets, test_targets;
-  for (int lbl : train_labels) {
-    Vector y = Vector::Zero(10);
-    y[lbl] = 1.0;
-    train_targets.push_back(y);
-  }
-  for (int lbl : test_labels) {
-    Vector y = Vector::Zero(10);
-    y[lbl] = 1.0;
-    test_targets.push_back(y);
-  }
+// Builds the run from the interactive menu used when no flags are given.
+TrainingConfig promptConfig() {
+  TrainingConfig config;
 
   std::cout << "Select model architecture:\n";
   std::cout << "1. One hidden layer (ReLU + Identity)\n";
   std::cout << "2. Two hidden layers (ReLU + Sigmoid + Identity)\n";
-  std::cout << "3. Three hidden layers (ReLU + ReLU + ReLU + Softmax)\n";
-  int choice;
+  std::cout << "3. Three hidden layers (ReLU + ReLU + ReLU + Softmax "
+               "cross-entropy)\n";
+  int choice = 0;
   std::cout << "Enter choice (1/2/3): ";
   std::cin >> choice;
+  // Any other answer selects architecture 3.
+  choice = (choice == 1 || choice == 2) ? choice : 3;
+  config.set("architecture", std::to_string(choice));
+  config.name = "model" + std::to_string(choice);
 
-  int epochs;
   std::cout << "Enter number of training epochs: ";
-  std::cin >> epochs;
-
-  std::string model_name = "model" + std::to_string(choice);
-  Model model =
-      (choice == 1)
-          ? Model({784, 128, 10}, {ActivationFunction::Type::ReLU,
-                                   ActivationFunction::Type::Identity})
-      : (choice == 2)
-          ? Model({784, 128, 64, 10}, {ActivationFunction::Type::ReLU,
-                                       ActivationFunction::Type::Sigmoid,
-                                       ActivationFunction::Type::Identity})
-          : Model({784, 128, 64, 32, 10}, {ActivationFunction::Type::ReLU,
-                                           ActivationFunction::Type::ReLU,
-                                           ActivationFunction::Type::ReLU,
-                                           ActivationFunction::Type::Softmax});
-
-  Optimizer opt = Optimizer::Adam(0.001, 0.9, 0.999, 1e-8);
-
-  std::ofstream train_loss_file("loss_" + model_name + "_train.csv");
-  std::ofstream val_loss_file("loss_" + model_name + "_val.csv");
-  std::ofstream acc_file("accuracy_" + model_name + ".csv");
-
-  train_loss_file << "Epoch,Loss\n";
-  val_loss_file << "Epoch,Loss\n";
-  acc_file << "Epoch,Accuracy\n";
-
-  const int barWidth = 30;
-
-  std::cout << "\n=== Training " << model_name << " for " << epochs
-            << " epoch(s) ===\n";
-
-  std::default_random_engine rng(std::random_device{}());
-
-  for (int e = 0; e < epochs; ++e) {
-    // Shuffle indices
-    std::vector<int> indices(train_images.size());
-    std::iota(indices.begin(), indices.end(), 0);
-    std::shuffle(indices.begin(), indices.end(), rng);
-
-    double running_loss = 0.0;
-    for (int i = 0; i < int(train_images.size()); ++i) {
-      int idx = indices[i];
-
-      if (choice == 3) {
-        model.trainStep(train_images[idx], train_targets[idx],
-                        LossFunction::crossEntropyGrad, opt);
-        Vector out = model.forward(train_images[idx]);
-        running_loss += LossFunction::crossEntropy(out, train_targets[idx]);
-      } else {
-        model.trainStep(train_images[idx], train_targets[idx],
-                        LossFunction::mseGrad, opt);
-        Vector out = model.forward(train_images[idx]);
-        running_loss += LossFunction::mse(out, train_targets[idx]);
-      }
+  std::cin >> config.epochs;
+  config.epochs = std::max(config.epochs, 0);
+
+  std::cout << "Enter mini-batch size: ";
+  std::cin >> config.batch_size;
+  config.batch_size = std::max<Index>(config.batch_size, 1);
+
+  // Every optimizer step averages the gradients of this many mini-batches,
+  // for an effective batch of batch_size * accumulation_steps samples.
+  std::cout << "Enter gradient accumulation steps: ";
+  std::cin >> config.accumulation_steps;
+  config.accumulation_steps = std::max<Index>(config.accumulation_steps, 1);
+
+  int num_threads = 1;
+  std::cout << "Enter number of worker threads: ";
+  std::cin >> num_threads;
+  config.threads = std::size_t(std::max(num_threads, 1));
+
+  std::cout << "Select optimizer:\n";
+  std::cout << "1. SGD\n";
+  std::cout << "2. SGD + Nesterov momentum\n";
+  std::cout << "3. RMSProp\n";
+  std::cout << "4. Adam\n";
+  std::cout << "5. AdamW\n";
+  std::cout << "6. LAMB\n";
+  int optimizer_choice = 4;
+  std::cout << "Enter choice (1-6): ";
+  std::cin >> optimizer_choice;
+  switch (optimizer_choice) {
+  case 1:
+    config.optimizer = Optimizer::Type::SGD;
+    config.learning_rate = 0.05;
+    break;
+  case 2:
+    config.optimizer = Optimizer::Type::Nesterov;
+    config.learning_rate = 0.05;
+    break;
+  case 3:
+    config.optimizer = Optimizer::Type::RMSProp;
+    break;
+  case 5:
+    config.optimizer = Optimizer::Type::AdamW;
+    break;
+  case 6:
+    config.optimizer = Optimizer::Type::LAMB;
+    config.learning_rate = 0.005;
+    config.epsilon = 1e-6;
+    break;
+  default:
+    config.optimizer = Optimizer::Type::Adam;
+    break;
+  }
 
-      float fraction = float(i + 1) / train_images.size();
-      int pos = int(barWidth * fraction);
-      int percent = int(fraction * 100.0f);
+  std::cout << "Select learning-rate schedule:\n";
+  std::cout << "1. Constant\n";
+  std::cout << "2. Step (halved every epoch)\n";
+  std::cout << "3. Cosine with linear warmup\n";
+  std::cout << "4. One-cycle\n";
+  int schedule_choice = 1;
+  std::cout << "Enter choice (1-4): ";
+  std::cin >> schedule_choice;
+  config.schedule = (schedule_choice == 2)   ? TrainingConfig::Schedule::Step
+                    : (schedule_choice == 3) ? TrainingConfig::Schedule::Cosine
+                    : (schedule_choice == 4)
+                        ? TrainingConfig::Schedule::OneCycle
+                        : TrainingConfig::Schedule::Constant;
+  return config;
+}
 
-      std::cout << "\r[";
-      for (int j = 0; j < barWidth; ++j)
-        std::cout << (j < pos ? '=' : ' ');
-      std::cout << "] " << std::setw(3) << percent << "% "
-                << "(" << (i + 1) << "/" << train_images.size() << ") "
-                << "L:" << std::fixed << std::setprecision(4)
-                << (running_loss / (i + 1)) << std::flush;
+} // namespace
+
+// With flags (see Trainer/TrainingConfig.h) the run is fully headless, e.g.
+//   neural_net --config=run.cfg --seed=7 --output-dir=runs/7 --progress=off
+// --sweep=FILE trains a grid of runs instead (see Trainer/TrainingSweep.h)
+// and --quantize=MODEL converts a trained model to int8 (see
+// Inference/Quantization.h).
+// Without flags the unit tests run first and the settings are prompted for.
+int main(int argc, char **argv) {
+  try {
+    const auto hasFlag = [&](const std::string &flag) {
+      return std::any_of(argv + 1, argv + argc, [&](const char *arg) {
+        return std::string(arg).rfind(flag, 0) == 0;
+      });
+    };
+    if (hasFlag("--sweep=")) {
+      runSweep(TrainingSweep::fromArguments(argc, argv), std::cout);
+      return 0;
     }
-
-    double avg_train_loss = running_loss / train_images.size();
-    train_loss_file << (e + 1) << "," << avg_train_loss << "\n";
-
-    double val_loss = 0.0;
-    int correct = 0;
-    for (int i = 0; i < int(test_images.size()); ++i) {
-      Vector out = model.forward(test_images[i]);
-      if (choice == 3)
-        val_loss += LossFunction::crossEntropy(out, test_targets[i]);
-      else
-        val_loss += LossFunction::mse(out, test_targets[i]);
-
-      Eigen::Index predIndex;
-      out.maxCoeff(&predIndex);
-      if (predIndex == test_labels[i])
-        ++correct;
+    if (hasFlag("--quantize=")) {
+      runQuantization(QuantizationJob::fromArguments(argc, argv), std::cout);
+      return 0;
     }
-
-    double avg_val_loss = val_loss / test_images.size();
-    double accuracy = 100.0 * double(correct) / test_images.size();
-
-    val_loss_file << (e + 1) << "," << avg_val_loss << "\n";
-    acc_file << (e + 1) << "," << accuracy << "\n";
-
-    std::cout << "\nEpoch " << (e + 1)
-              << " finished. Train Loss: " << avg_train_loss
-              << ", Val Loss: " << avg_val_loss << ", Accuracy: " << accuracy
-              << "%\n";
+    if (argc > 1) {
+      runTraining(TrainingConfig::fromArguments(argc, argv), std::cout);
+      return 0;
+    }
+    test::runAllTests();
+    runTraining(promptConfig(), std::cout);
+  } catch (const std::exception &e) {
+    std::cerr << "neural_net: " << e.what() << "\n";
+    return 1;
   }
-
-  train_loss_file.close();
-  val_loss_file.close();
-  acc_file.close();
-
-  FileWriter out("model_" + model_name + ".bin");
-  out << model;
-
   return 0;
 }